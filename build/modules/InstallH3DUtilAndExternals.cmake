@@ -90,6 +90,11 @@ IF( H3DUTIL_INCLUDE_DIR AND EXTERNAL_ROOT )
                                "lib" "zlib"
                                "bin" "zlib1"
                                
+                               "#define HAVE_BZIP2"
+                               "include" "Bzip2"
+                               "lib" "libbz2"
+                               "bin" "libbz2"
+                               
                                "#define HAVE_FREEIMAGE"
                                "include" "FreeImage"
                                "lib" "FreeImage"
@@ -0,0 +1,185 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file BatchFileReader.h
+/// \brief Header file for BatchFileReader, which reads a list of files
+/// in the background ahead of their use.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __BATCHFILEREADER_H__
+#define __BATCHFILEREADER_H__
+
+#include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/Threads.h>
+
+#include <string>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// Hint the operating system that the given range of a file will be
+  /// read soon, so that it can start reading it into the page cache in
+  /// the background. Does nothing on platforms without such hints.
+  /// \param url The file.
+  /// \param offset The start of the range in bytes.
+  /// \param length The length of the range in bytes, 0 for the rest of
+  /// the file.
+  H3DUTIL_API void adviseFileRead( const std::string &url,
+                                   size_t offset = 0,
+                                   size_t length = 0 );
+
+  /// \class BatchFileReader
+  /// BatchFileReader reads the whole content of a list of files into memory
+  /// in the background, with many reads in flight at the same time, so
+  /// that the files are already read when they are used. This hides the
+  /// latency of the disk when many files, e.g. the slices of a DICOM
+  /// series, are decoded one after the other.
+  ///
+  /// On Linux the reads are submitted in batches through io_uring if the
+  /// kernel supports it, otherwise a few threads read the files. The files
+  /// are read in the order given, at most max_buffered_bytes ahead of the
+  /// files that have been released.
+  ///
+  /// \code
+  /// BatchFileReader reader;
+  /// reader.start( urls );
+  /// for( unsigned int i = 0; i < urls.size(); ++i ) {
+  ///   const unsigned char *data;
+  ///   size_t size;
+  ///   if( reader.waitForFile( i, data, size ) ) {
+  ///     // decode data
+  ///   }
+  ///   reader.releaseFile( i );
+  /// }
+  /// \endcode
+  class H3DUTIL_API BatchFileReader {
+  public:
+    /// Constructor.
+    /// \param max_buffered_bytes The number of bytes of files that have
+    /// been read but not released at which no more files are read ahead.
+    /// \param queue_depth The maximum number of reads in flight.
+    BatchFileReader( size_t max_buffered_bytes = 256 << 20,
+                     unsigned int queue_depth = 32 );
+
+    /// Destructor. Stops the reading and releases all files.
+    ~BatchFileReader();
+
+    /// Start reading the given files in the background. Any previous
+    /// batch is stopped and released first.
+    void start( const std::vector< std::string > &urls );
+
+    /// Stop reading and release all files.
+    void stop();
+
+    /// Wait until file i of the batch has been read. Files that are waited
+    /// for are read even if max_buffered_bytes is reached.
+    /// \param i The index of the file in the list given to start.
+    /// \param data Set to the content of the file, valid until the file is
+    /// released.
+    /// \param size Set to the size of the file.
+    /// \returns false if the file could not be read.
+    bool waitForFile( unsigned int i,
+                      const unsigned char *&data,
+                      size_t &size );
+
+    /// Release the content of file i, making room for more files to be
+    /// read ahead.
+    void releaseFile( unsigned int i );
+
+    /// Returns the number of files in the batch.
+    unsigned int nrFiles();
+
+    /// Returns true if the current batch is read with io_uring.
+    bool usesIoUring();
+
+  protected:
+    /// The state of a file of the batch.
+    enum FileState {
+      FILE_PENDING,
+      FILE_READ,
+      FILE_FAILED,
+      FILE_RELEASED
+    };
+
+    struct File {
+      std::string url;
+      unsigned char *data;
+      size_t size;
+      FileState state;
+    };
+
+    /// Returns true if file i may be read now. Must be called with lock
+    /// held.
+    bool canRead( unsigned int i );
+
+    /// Wait until file i may be read. Returns false if stopped.
+    bool waitToRead( unsigned int i );
+
+    /// Allocate the buffer for file i with the given size.
+    unsigned char *allocateFile( unsigned int i, size_t size );
+
+    /// Set the result of reading file i into its buffer.
+    /// \param size_read The number of bytes read if successful.
+    void fileDone( unsigned int i, bool success, size_t size_read = 0 );
+
+    /// Read file i with ordinary blocking reads.
+    void readFile( unsigned int i );
+
+    /// The function run in the reading thread.
+    static void *readThread( void *data );
+
+    /// parallelFor callback reading files with readFile.
+    static void readFiles( unsigned int begin, unsigned int end,
+                           void *data );
+
+#ifdef HAVE_IO_URING
+    /// Read all files with io_uring. Returns false if io_uring could not
+    /// be used or failed, in which case the files from first_unread on
+    /// have not been read and are left to readFile.
+    bool readWithIoUring( unsigned int &first_unread );
+#endif
+
+    std::vector< File > files;
+
+    /// The number of bytes of files that have been read and not released.
+    size_t buffered_bytes;
+
+    /// The highest index of a file that has been waited for.
+    unsigned int wanted;
+
+    bool stopped;
+    bool io_uring_used;
+
+    size_t max_buffered_bytes;
+    unsigned int queue_depth;
+
+    /// Lock for the state, broadcast when it changes.
+    ConditionLock lock;
+
+    /// The reading thread, deleted by stop.
+    SimpleThread *thread;
+  };
+}
+
+#endif
@@ -0,0 +1,394 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file BrickedVolumeFile.h
+/// \brief Header file for BrickedVolumeReader and BrickedVolumeWriter,
+/// reading and writing volumes divided into independently compressed
+/// bricks.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __BRICKEDVOLUMEFILE_H__
+#define __BRICKEDVOLUMEFILE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/Threads.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace H3DUtil {
+
+  /// \class BrickedVolumeFile
+  /// Base class for BrickedVolumeReader and BrickedVolumeWriter containing
+  /// the properties of a bricked volume file.
+  ///
+  /// A bricked volume file (.hvol) stores an image divided into bricks of
+  /// equal size, e.g. 64x64x64 voxels. The bricks at the upper edges of the
+  /// volume are cropped to the image. Each brick is compressed on its own
+  /// and the file starts with a header containing the image properties
+  /// followed by an index with the position and compressed size of each
+  /// brick. Any brick can therefore be read without reading the rest of
+  /// the file, and bricks can be compressed and decompressed in parallel.
+  ///
+  /// The bricks are numbered with x varying fastest, then y and then z, and
+  /// the voxels in each brick are stored in the same order as in an Image.
+  /// The file records the byte order of the machine that wrote it and
+  /// is converted when read on a machine with the other byte order.
+  class H3DUTIL_API BrickedVolumeFile {
+  public:
+    /// The encodings of the brick data that are supported.
+    typedef enum {
+      /// Uncompressed.
+      RAW,
+      /// Compressed with zlib.
+      ZLIB,
+      /// The bytes of each pixel component are grouped by significance,
+      /// which makes the data more compressible, and are then compressed
+      /// with the fastest zlib settings. Faster than ZLIB and usually
+      /// smaller for 16 bit data.
+      ZLIB_FAST
+    } Encoding;
+
+    /// Returns true if the given encoding is supported, i.e. H3DUtil
+    /// was built with the library needed for the compression.
+    static bool isEncodingSupported( Encoding e );
+
+    /// Destructor.
+    virtual ~BrickedVolumeFile() {}
+
+    /// Returns the width of the image in pixels.
+    inline unsigned int width() { return w; }
+
+    /// Returns the height of the image in pixels.
+    inline unsigned int height() { return h; }
+
+    /// Returns the depth of the image in pixels.
+    inline unsigned int depth() { return d; }
+
+    /// Returns the number of bits used for each pixel in the image.
+    inline unsigned int bitsPerPixel() { return bits_per_pixel; }
+
+    /// Returns the PixelType of the image.
+    inline Image::PixelType pixelType() { return pixel_type; }
+
+    /// Returns the PixelComponentType of the image.
+    inline Image::PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    inline const Vec3f &pixelSize() { return pixel_size; }
+
+    /// Returns the encoding of the bricks.
+    inline Encoding encoding() { return data_encoding; }
+
+    /// Returns the width of a brick in pixels.
+    inline unsigned int brickWidth() { return brick_w; }
+
+    /// Returns the height of a brick in pixels.
+    inline unsigned int brickHeight() { return brick_h; }
+
+    /// Returns the depth of a brick in pixels.
+    inline unsigned int brickDepth() { return brick_d; }
+
+    /// Returns the number of bricks along the x axis.
+    inline unsigned int nrBricksX() { return ( w + brick_w - 1 ) / brick_w; }
+
+    /// Returns the number of bricks along the y axis.
+    inline unsigned int nrBricksY() { return ( h + brick_h - 1 ) / brick_h; }
+
+    /// Returns the number of bricks along the z axis.
+    inline unsigned int nrBricksZ() { return ( d + brick_d - 1 ) / brick_d; }
+
+    /// Returns the total number of bricks.
+    inline unsigned int nrBricks() {
+      return nrBricksX() * nrBricksY() * nrBricksZ();
+    }
+
+    /// Returns the index of the brick with the given brick coordinates.
+    inline unsigned int brickIndex( unsigned int bx,
+                                    unsigned int by,
+                                    unsigned int bz ) {
+      return ( bz * nrBricksY() + by ) * nrBricksX() + bx;
+    }
+
+    /// Get the position of the first pixel of a brick and the size of the
+    /// brick in pixels, which is smaller than the brick size for bricks at
+    /// the upper edges of the volume.
+    void getBrickBox( unsigned int index,
+                      unsigned int &x, unsigned int &y, unsigned int &z,
+                      unsigned int &width,
+                      unsigned int &height,
+                      unsigned int &depth );
+
+    /// Returns the number of bytes in one pixel.
+    inline unsigned int bytesPerPixel() { return bits_per_pixel / 8; }
+
+    /// Set the number of threads to use when compressing or decompressing
+    /// bricks. 0 means one thread for each hardware thread.
+    inline void setNrThreads( unsigned int nr_threads ) {
+      nr_worker_threads = nr_threads;
+    }
+
+    /// Returns a message describing the last error.
+    inline const std::string &getError() { return error_message; }
+
+  protected:
+    /// Constructor.
+    BrickedVolumeFile();
+
+    /// Set the error message returned by getError().
+    void setError( const std::string &message );
+
+    /// The number of components in each pixel for the pixel type.
+    static unsigned int nrComponents( Image::PixelType type );
+
+    /// Dimensions of the image.
+    unsigned int w, h, d;
+
+    /// Number of bits per pixel.
+    unsigned int bits_per_pixel;
+
+    /// The pixel type.
+    Image::PixelType pixel_type;
+
+    /// The pixel component type.
+    Image::PixelComponentType pixel_component_type;
+
+    /// The size of a pixel in metres.
+    Vec3f pixel_size;
+
+    /// The dimensions of a brick.
+    unsigned int brick_w, brick_h, brick_d;
+
+    /// The encoding of the bricks.
+    Encoding data_encoding;
+
+    /// Number of threads to use, 0 for the number of hardware threads.
+    unsigned int nr_worker_threads;
+
+    /// The position in the file of each brick.
+    std::vector< H3DInt64 > brick_offsets;
+
+    /// The compressed size of each brick in bytes.
+    std::vector< H3DInt64 > brick_sizes;
+
+    /// The last error message.
+    std::string error_message;
+  };
+
+  /// \class BrickedVolumeReader
+  /// Reads bricked volume files, see BrickedVolumeFile. Single bricks,
+  /// regions of the volume or the whole volume can be read and only the
+  /// bricks that intersect the requested region are read from the file.
+  /// Bricks are decompressed in parallel.
+  ///
+  /// readBrick and readRegion can be called from several threads at the
+  /// same time.
+  class H3DUTIL_API BrickedVolumeReader: public BrickedVolumeFile {
+  public:
+    /// Constructor.
+    BrickedVolumeReader();
+
+    /// Read the header and brick index of the given file. Returns false if
+    /// the file could not be read, in which case getError() describes the
+    /// problem.
+    bool open( const std::string &url );
+
+    /// Read the header and brick index of a bricked volume file in memory.
+    /// The bricks are decompressed directly from the given buffer, which
+    /// must be valid until another file is opened or the reader is
+    /// destroyed.
+    /// \param data The content of the file.
+    /// \param size The number of bytes in data.
+    /// \param name The name used in error messages.
+    bool open( const void *data, size_t size,
+               const std::string &name = "<memory>" );
+
+    /// Read a bricked volume file from a stream. The rest of the stream is
+    /// read into memory and the file is then read from there.
+    bool open( std::istream &is, const std::string &name = "<stream>" );
+
+    /// Returns the name of the opened file.
+    inline const std::string &getFilename() { return filename; }
+
+    /// Returns the number of bytes of the uncompressed data of a brick.
+    H3DInt64 brickDataSize( unsigned int index );
+
+    /// Returns the number of bytes of the compressed data of a brick as
+    /// stored in the file.
+    inline H3DInt64 brickFileSize( unsigned int index ) {
+      return brick_sizes[index];
+    }
+
+    /// Read and decompress one brick into data, which must have room for
+    /// brickDataSize( index ) bytes. Returns true on success.
+    bool readBrick( unsigned int index, void *data );
+
+    /// Read the region of the volume starting at pixel (x, y, z) with the
+    /// given size into data, which must have room for
+    /// width * height * depth * bytesPerPixel() bytes. The bricks
+    /// intersecting the region are decompressed in parallel.
+    /// Returns true on success.
+    bool readRegion( unsigned int x, unsigned int y, unsigned int z,
+                     unsigned int width,
+                     unsigned int height,
+                     unsigned int depth,
+                     void *data );
+
+    /// Read the whole image. Returns a new PixelImage, NULL on failure.
+    Image *readImage();
+
+    /// Read a region of the volume as an image with the size of the
+    /// region. Returns a new PixelImage, NULL on failure.
+    Image *readRegionImage( unsigned int x, unsigned int y, unsigned int z,
+                            unsigned int width,
+                            unsigned int height,
+                            unsigned int depth );
+
+  protected:
+    /// Read the header and brick index from is. url is the name of the
+    /// file.
+    bool readHeader( std::istream &is, const std::string &url );
+
+    /// Callback for parallelFor reading a range of the bricks of the
+    /// current readRegion call.
+    static void readBrickRange( unsigned int begin,
+                                unsigned int end,
+                                void *data );
+
+    /// The name of the file.
+    std::string filename;
+
+    /// True if the file was written on a machine with another byte order.
+    bool swap_bytes;
+
+    /// The stream of the file. Only the reading of the compressed data is
+    /// done while holding file_lock, decompression is done without it.
+    std::ifstream file_stream;
+    MutexLock file_lock;
+
+    /// The file given to open() if it was given as a buffer or a stream,
+    /// NULL otherwise. stream_data holds the content of a stream.
+    const unsigned char *memory_data;
+    H3DInt64 memory_size;
+    std::vector< unsigned char > stream_data;
+  };
+
+  /// \class BrickedVolumeWriter
+  /// Writes bricked volume files, see BrickedVolumeFile. The data is given
+  /// slice by slice so large volumes can be written without creating the
+  /// whole image in memory. Only one layer of bricks is kept in memory and
+  /// the bricks of each layer are compressed in parallel.
+  class H3DUTIL_API BrickedVolumeWriter: public BrickedVolumeFile {
+  public:
+    /// Constructor.
+    BrickedVolumeWriter();
+
+    /// Destructor. Closes the file if open.
+    ~BrickedVolumeWriter();
+
+    /// Set the size of the bricks in pixels. Must be called before open().
+    /// Default is 64x64x64.
+    inline void setBrickSize( unsigned int width,
+                              unsigned int height,
+                              unsigned int depth ) {
+      brick_w = width;
+      brick_h = height;
+      brick_d = depth;
+    }
+
+    /// Set the zlib compression level, 1-9 or -1 for the default level.
+    /// Used by the ZLIB encoding, ZLIB_FAST always uses the fastest level.
+    /// Must be called before open().
+    inline void setCompressionLevel( int level ) {
+      compression_level = level;
+    }
+
+    /// Open the file and write the header.
+    /// \param url The file to write.
+    /// \param width, height, depth The dimensions of the image.
+    /// \param _bits_per_pixel The number of bits per pixel.
+    /// \param _pixel_type The pixel type.
+    /// \param _pixel_component_type The pixel component type.
+    /// \param _pixel_size The size of a pixel in metres.
+    /// \param encoding The encoding of the bricks.
+    /// \returns true on success.
+    bool open( const std::string &url,
+               unsigned int width,
+               unsigned int height,
+               unsigned int depth,
+               unsigned int _bits_per_pixel,
+               Image::PixelType _pixel_type,
+               Image::PixelComponentType _pixel_component_type,
+               const Vec3f &_pixel_size,
+               Encoding encoding = ZLIB );
+
+    /// Write the next nr_slices slices. data must contain
+    /// nr_slices * width * height * bytesPerPixel() bytes.
+    /// Returns true on success.
+    bool writeSlices( const void *data, unsigned int nr_slices );
+
+    /// Write the brick index and close the file. All slices must have been
+    /// written. Returns true on success.
+    bool close();
+
+    /// Write a whole image to a file. Returns true on success.
+    bool writeImage( const std::string &url,
+                     Image *image,
+                     Encoding encoding = ZLIB );
+
+  protected:
+    /// Compress and write the bricks of the layer in layer_data.
+    bool writeLayer();
+
+    /// Callback for parallelFor compressing a range of the bricks of the
+    /// current layer.
+    static void compressBrickRange( unsigned int begin,
+                                    unsigned int end,
+                                    void *data );
+
+    /// The compression level.
+    int compression_level;
+
+    /// The stream of the file.
+    std::ofstream file_stream;
+
+    /// The number of slices written so far.
+    unsigned int slices_written;
+
+    /// The slices of the current layer of bricks.
+    std::vector< unsigned char > layer_data;
+
+    /// The number of slices in layer_data.
+    unsigned int layer_slices;
+
+    /// The compressed bricks of the current layer.
+    std::vector< std::vector< unsigned char > > compressed_bricks;
+    bool compress_failed;
+  };
+}
+
+#endif
@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file DeltaPackedImage.h
+/// \brief Header file for DeltaPackedImage, a losslessly compressed in
+/// memory representation of 16 bit single component volumes.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __DELTAPACKEDIMAGE_H__
+#define __DELTAPACKEDIMAGE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/Exception.h>
+
+#include <vector>
+
+namespace H3DUtil {
+  /// \class DeltaPackedImage
+  /// DeltaPackedImage stores a 16 bit single component image, e.g. a CT
+  /// volume, losslessly compressed in memory. The volume is divided into
+  /// bricks of 8x8x8 voxels and each 8x8 slice of a brick is stored as its
+  /// minimum value followed by the differences to the minimum packed with
+  /// the number of bits needed for the largest difference. Smooth data
+  /// usually needs 4-8 bits per voxel instead of 16.
+  ///
+  /// Any voxel can be decoded on its own in constant time without locks,
+  /// so getElement, getPixel and getSample are fast and can be used from
+  /// several threads at the same time. Whole bricks are decoded with
+  /// unpacking loops specialized for each bit width.
+  ///
+  /// The data of the image is never in memory as a whole, so getImageData
+  /// returns NULL and functions that use it directly, e.g.
+  /// convertToNormalizedFloatData, cannot be used. Use getRegion or
+  /// createPixelImage to get the data as a dense array. The image is read
+  /// only, setElement does nothing.
+  class H3DUTIL_API DeltaPackedImage: public Image {
+  public:
+    /// Thrown if the image given to the constructor does not have a
+    /// single 16 bit integer component.
+    H3D_VALUE_EXCEPTION( std::string, UnsupportedPixelFormat );
+
+    /// The size of the bricks along each axis.
+    static const unsigned int brick_size = 8;
+
+    /// Returns true if the image can be stored as a DeltaPackedImage, i.e.
+    /// it has one 16 bit SIGNED or UNSIGNED component per pixel and its
+    /// data is not compressed.
+    static bool isSupported( Image *image );
+
+    /// Constructor. Compresses the given image in parallel.
+    /// \param image The image to compress. The data is read with
+    /// getImageData() if available and with getElement otherwise.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    DeltaPackedImage( Image *image, unsigned int nr_threads = 0 );
+
+    /// Returns the width of the image in pixels.
+    virtual unsigned int width() {
+      return w;
+    }
+
+    /// Returns the height of the image in pixels.
+    virtual unsigned int height() {
+      return h;
+    }
+
+    /// Returns the depth of the image in pixels.
+    virtual unsigned int depth() {
+      return d;
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    virtual Vec3f pixelSize() {
+      return pixel_size;
+    }
+
+    /// Returns the number of bits used for each pixel in the image.
+    virtual unsigned int bitsPerPixel() {
+      return 16;
+    }
+
+    /// Returns the PixelType of the image.
+    virtual PixelType pixelType() {
+      return pixel_type;
+    }
+
+    /// Returns the PixelComponentType of the image.
+    virtual PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns NULL since the data is not stored uncompressed.
+    virtual void *getImageData() {
+      return NULL;
+    }
+
+    /// Get the value of a pixel/voxel.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Does nothing, the image is read only.
+    virtual void setElement( void * /*value*/,
+                             int /*x*/ = 0, int /*y*/ = 0, int /*z*/ = 0 ) {}
+
+    /// Returns the number of bricks along the x, y and z axis.
+    inline unsigned int nrBricksX() { return bricks_x; }
+    inline unsigned int nrBricksY() { return bricks_y; }
+    inline unsigned int nrBricksZ() { return bricks_z; }
+
+    /// Returns the total number of bricks. Bricks are numbered with x
+    /// varying fastest, then y and then z.
+    inline unsigned int nrBricks() {
+      return bricks_x * bricks_y * bricks_z;
+    }
+
+    /// Decode a brick into data, which must have room for
+    /// brick_size^3 values. Voxels of bricks at the upper edges of the
+    /// image that are outside of the image get the value of the closest
+    /// voxel inside it.
+    void decodeBrick( unsigned int index, void *data );
+
+    /// Copy a region of the image into data, which must have room for
+    /// width * height * depth pixels. Returns false if the region is
+    /// outside of the image.
+    bool getRegion( unsigned int x, unsigned int y, unsigned int z,
+                    unsigned int width,
+                    unsigned int height,
+                    unsigned int depth,
+                    void *data );
+
+    /// Create a PixelImage with the same content. The bricks are decoded
+    /// in parallel.
+    Image *createPixelImage( unsigned int nr_threads = 0 );
+
+    /// Returns the number of bytes used to store the image.
+    H3DInt64 compressedSize();
+
+    /// Returns the ratio between the size of the uncompressed data and
+    /// compressedSize().
+    inline double compressionRatio() {
+      return (double) w * h * d * 2 / compressedSize();
+    }
+
+  protected:
+    /// The number of voxels in each group of values that share a base
+    /// value and a bit width, one slice of a brick.
+    static const unsigned int group_size = brick_size * brick_size;
+
+    /// Returns a pointer to the packed data of a group.
+    inline const unsigned char *groupData( unsigned int brick,
+                                           unsigned int group ) {
+      const unsigned char *data = &packed_data[0] + brick_offsets[brick];
+      const unsigned char *bits = &group_bits[ brick * brick_size ];
+      // each group uses bits * group_size / 8 bytes.
+      for( unsigned int g = 0; g < group; ++g ) data += bits[g] * 8;
+      return data;
+    }
+
+    /// Callback for parallelFor packing a range of bricks.
+    static void packBricks( unsigned int begin,
+                            unsigned int end,
+                            void *data );
+
+    /// Callback for parallelFor decoding a range of bricks into a dense
+    /// image.
+    static void unpackBricks( unsigned int begin,
+                              unsigned int end,
+                              void *data );
+
+    unsigned int w, h, d;
+    PixelType pixel_type;
+    PixelComponentType pixel_component_type;
+    Vec3f pixel_size;
+
+    /// The number of bricks along each axis.
+    unsigned int bricks_x, bricks_y, bricks_z;
+
+    /// The value that is xor:ed with the stored values, 0x8000 for signed
+    /// data to make the values ordered as unsigned values.
+    unsigned short sign_flip;
+
+    /// The position of the data of each brick in packed_data.
+    std::vector< size_t > brick_offsets;
+
+    /// The base value of each group, brick_size groups per brick.
+    std::vector< unsigned short > group_bases;
+
+    /// The number of bits per value of each group.
+    std::vector< unsigned char > group_bits;
+
+    /// The packed differences of all bricks.
+    std::vector< unsigned char > packed_data;
+
+    /// Image and packed bricks used during construction.
+    Image *source_image;
+    std::vector< std::vector< unsigned char > > *brick_data;
+  };
+}
+
+#endif
@@ -55,7 +55,44 @@ namespace H3DUtil {
     H3D_VALUE_EXCEPTION( std::string, CouldNotLoadDicomImage );
     /// Constructor. 
     /// \param url The url of the Dicom file.
-    DicomImage( const std::string &url );
+    /// \param _native_values If true the pixel values of monochrome images
+    /// are kept as they are stored in the file, without the modality
+    /// transformation and the rescaling to the output range that is done
+    /// by the DCMTK rendering pipeline. The pixel component type will be
+    /// SIGNED if the stored values are signed.
+    DicomImage( const std::string &url, bool _native_values = false );
+
+    /// Loads a single Dicom file in memory, the file is parsed directly
+    /// from the given buffer. Throws CouldNotLoadDicomImage on failure.
+    /// \param data The content of the Dicom file.
+    /// \param size The number of bytes in data.
+    /// \param native_values See the url constructor.
+    /// \param name The name of the file, used in error messages.
+    /// \returns A new image.
+    static DicomImage *fromMemory( const void *data,
+                                   size_t size,
+                                   bool native_values = false,
+                                   const std::string &name = "<memory>" );
+
+    /// Parse a Dicom file in memory into file_format. All values are
+    /// read since they cannot be loaded later on demand from memory.
+    /// \param file_format The object to read the file into.
+    /// \param data The content of the Dicom file.
+    /// \param size The number of bytes in data.
+    static OFCondition readFromMemory( DcmFileFormat &file_format,
+                                       const void *data,
+                                       size_t size );
+
+    /// Register the DCMTK decompression codecs. The codecs are only
+    /// registered the first time this function is called and are kept
+    /// until the program exits. Called automatically when an image is
+    /// loaded.
+    static void registerCodecs();
+
+    /// Returns true if the stored pixel values are used, see constructor.
+    inline bool nativeValues() {
+      return native_values;
+    }
 
     /// Get the DcmFileFormat (see DCMTK documentation) object for the 
     /// loaded file. This allows you to access the meta info and 
@@ -85,13 +122,24 @@ namespace H3DUtil {
     H3DFloat hounsfieldToPixelValue( H3DFloat v );
 
   protected:
+    /// Constructor for an empty image, used by fromMemory.
+    DicomImage();
+
     /// Load the image from the given url. The url can be a DIRFILE.
-    void loadImage( const std::string &url );
+    /// The frames of multi-frame files are decoded in parallel.
+    /// If from_memory is true the image is decoded from dicom_file_info,
+    /// which has been read from memory, and url is only used in error
+    /// messages.
+    void loadImage( const std::string &url, bool from_memory = false );
 
     /// Load the image from several urls where each url specifies
-    /// a Dicom file containing a 2D-slice.
+    /// a Dicom file containing a 2D-slice. The slices are decoded in
+    /// parallel.
     void loadImage( const std::vector< std::string > &urls );
 
+    /// If true the stored pixel values are used, see constructor.
+    bool native_values;
+
     /// The DcmFileFormat object for the currently loaded image.
     DcmFileFormat dicom_file_info;
     
@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file DicomSeriesIndex.h
+/// \brief Header file for DicomSeriesIndex, a persistent index of the
+/// DICOM files in a directory.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __DICOMSERIESINDEX_H__
+#define __DICOMSERIESINDEX_H__
+
+#include <H3DUtil/H3DUtil.h>
+#include <H3DUtil/LinAlgTypes.h>
+
+#ifdef HAVE_DCMTK
+
+#include <string>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \class DicomSeriesIndex
+  /// DicomSeriesIndex keeps track of the DICOM files in a directory tree
+  /// and the series they belong to. Only the header tags needed to compose
+  /// volumes are read from each file, parsing stops before the pixel data,
+  /// and the files are scanned in parallel.
+  ///
+  /// The result is stored in an index file in the scanned directory. When
+  /// the index is updated again the stored entries are reused for all files
+  /// whose modification time and size are unchanged, so only new and
+  /// modified files have to be parsed.
+  class H3DUTIL_API DicomSeriesIndex {
+  public:
+    /// The information stored for each file in the index.
+    struct Entry {
+      /// Constructor.
+      Entry():
+        mtime( 0 ),
+        file_size( 0 ),
+        is_dicom( false ),
+        has_position( false ),
+        rows( 0 ),
+        columns( 0 ),
+        nr_frames( 1 ),
+        bits_allocated( 0 ),
+        instance_number( 0 ) {}
+
+      /// The path of the file relative to the indexed directory.
+      std::string filename;
+      /// Modification time of the file when it was indexed.
+      double mtime;
+      /// Size of the file in bytes when it was indexed.
+      double file_size;
+      /// False if the file could not be parsed as a DICOM file.
+      bool is_dicom;
+      /// The SeriesInstanceUID of the file.
+      std::string series_instance_uid;
+      /// The SOPInstanceUID of the file.
+      std::string sop_instance_uid;
+      /// True if ImagePositionPatient and ImageOrientationPatient
+      /// were found.
+      bool has_position;
+      /// The ImagePositionPatient of the file.
+      Vec3d position;
+      /// The row direction cosines from ImageOrientationPatient.
+      Vec3d row_orientation;
+      /// The column direction cosines from ImageOrientationPatient.
+      Vec3d column_orientation;
+      /// Rows (height) of the image.
+      H3DInt32 rows;
+      /// Columns (width) of the image.
+      H3DInt32 columns;
+      /// NumberOfFrames of the image, 1 if not specified.
+      H3DInt32 nr_frames;
+      /// BitsAllocated for each pixel component.
+      H3DInt32 bits_allocated;
+      /// InstanceNumber of the image.
+      H3DInt32 instance_number;
+    };
+
+    /// Constructor.
+    /// \param _directory The directory to index.
+    /// \param _recursive If true sub directories are indexed as well.
+    /// \param _index_filename The name of the index file, relative to
+    /// directory. If empty no index file is read or written.
+    DicomSeriesIndex( const std::string &_directory,
+                      bool _recursive = true,
+                      const std::string &_index_filename =
+                      defaultIndexFilename() );
+
+    /// The default name of the index file that is stored in the indexed
+    /// directory.
+    static std::string defaultIndexFilename() {
+      return ".h3dutil_dicom_index";
+    }
+
+    /// Update the index. The stored index file is read if it has not been
+    /// read before, the directory is scanned and all files that are new or
+    /// have changed since they were indexed are parsed. If anything changed
+    /// and write_index is true the index file is written again.
+    /// \returns The number of files that were parsed.
+    unsigned int update( bool write_index = true );
+
+    /// Get all entries in the index, including non-DICOM files.
+    inline const std::vector< Entry > &getEntries() {
+      return entries;
+    }
+
+    /// Returns the SeriesInstanceUIDs of all series in the index.
+    std::vector< std::string > getSeriesUIDs();
+
+    /// Returns the entries of the series with the given SeriesInstanceUID.
+    /// The entries are sorted so that the slice with the highest position
+    /// along the slice normal comes first, which is the order used by
+    /// loadDicomFile. Files without position information are sorted on
+    /// InstanceNumber and filename.
+    std::vector< const Entry * > getSeries( const std::string &series_uid );
+
+    /// Returns the full paths of the files in the given series, in the
+    /// same order as getSeries().
+    std::vector< std::string > getSeriesFilenames(
+                                        const std::string &series_uid );
+
+    /// Find the entry for the given file. The filename can be an absolute
+    /// path or a path relative to the indexed directory. Returns NULL if no
+    /// such file is in the index.
+    const Entry *findEntry( const std::string &filename );
+
+    /// Returns the full path of the file of an entry.
+    inline std::string getFullPath( const Entry &entry ) {
+      return directory + "/" + entry.filename;
+    }
+
+    /// Returns the indexed directory.
+    inline const std::string &getDirectory() {
+      return directory;
+    }
+
+  protected:
+    /// Read the index file. Returns true on success.
+    bool readIndexFile();
+
+    /// Write the index file. Returns true on success.
+    bool writeIndexFile();
+
+    /// Add the files in the directory given by relative_path to the
+    /// entries vector with filename, mtime and file_size set.
+    void listFiles( const std::string &relative_path,
+                    std::vector< Entry > &files );
+
+    /// Parse the header of the file of the given entry and set the DICOM
+    /// fields of the entry.
+    void parseEntry( Entry &entry );
+
+    /// Callback for parallelFor that parses a range of entries.
+    static void parseEntries( unsigned int begin,
+                              unsigned int end,
+                              void *data );
+
+    /// The indexed directory.
+    std::string directory;
+
+    /// If true sub directories are indexed as well.
+    bool recursive;
+
+    /// The name of the index file relative to directory.
+    std::string index_filename;
+
+    /// True if the index file has been read.
+    bool index_file_read;
+
+    /// The entries in the index, sorted on filename.
+    std::vector< Entry > entries;
+
+    /// The entries that are being parsed by parseEntries.
+    std::vector< Entry * > entries_to_parse;
+  };
+}
+
+#endif // HAVE_DCMTK
+
+#endif
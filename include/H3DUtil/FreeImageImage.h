@@ -63,7 +63,8 @@ namespace H3DUtil {
       image_data( NULL ),
       w(0),
       h(0),
-      bits_per_pixel(8)
+      bits_per_pixel(8),
+      pitch(0)
       {
       byte_alignment = 4;
       updateImageProperties();
@@ -94,6 +95,12 @@ namespace H3DUtil {
         
     /// Returns a pointer to the raw image data. 
     virtual void *getImageData();
+
+    /// Returns the number of bytes between the starts of two rows in the
+    /// bitmap, which pads each row to a multiple of 4 bytes.
+    virtual size_t rowStride() {
+      return pitch;
+    }
     
     static FreeImageIO* getIStreamIO ();
 
@@ -106,6 +113,7 @@ namespace H3DUtil {
     unsigned char* image_data;
     unsigned int w,h;
     unsigned int bits_per_pixel;
+    unsigned int pitch;
     
 
     // when internal bitmap is updated, update all the image properties
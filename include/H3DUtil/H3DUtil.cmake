@@ -50,6 +50,10 @@
 /// Required for support for parsing zipped files.
 #cmakedefine HAVE_ZLIB
 
+/// Undef if you do not have bzip2(http://www.bzip.org/) installed.
+/// Required for support for bzip2 compressed Nrrd files.
+#cmakedefine HAVE_BZIP2
+
 /// Undef if you do not have FreeImage(freeimage.sourceforge.net) installed.
 /// Image files will not be possible to read (see ImageLoaderFunctions.h).
 #cmakedefine HAVE_FREEIMAGE
@@ -67,6 +71,10 @@
 /// Undef if you do not have OpenEXR
 #cmakedefine HAVE_OPENEXR
 
+/// Undef if the Linux io_uring header is not available. BatchFileReader
+/// then reads files with threads instead.
+#cmakedefine HAVE_IO_URING
+
 // note that _WIN32 is always defined when _WIN64 is defined.
 #if( defined( _WIN64 ) || defined(WIN64) )
 // set when on 64 bit Windows
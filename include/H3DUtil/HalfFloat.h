@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file HalfFloat.h
+/// \brief Functions for converting between 32 bit floats and 16 bit half
+/// floats, and between images with float and half float components.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __HALFFLOAT_H__
+#define __HALFFLOAT_H__
+
+#include <H3DUtil/Image.h>
+
+#include <cstddef>
+
+namespace H3DUtil {
+
+  /// Convert a float to the bits of an IEEE 754 half float. Values are
+  /// rounded to the nearest half float, values too large for a half
+  /// float become infinity.
+  H3DUTIL_API unsigned short floatToHalf( float value );
+
+  /// Convert the bits of an IEEE 754 half float to a float.
+  H3DUTIL_API float halfToFloat( unsigned short value );
+
+  /// Returns true if the CPU has instructions for converting between half
+  /// floats and floats (F16C), which are then used by convertHalfToFloat
+  /// and convertFloatToHalf.
+  H3DUTIL_API bool hasHalfFloatInstructions();
+
+  /// Convert an array of half floats to floats.
+  H3DUTIL_API void convertHalfToFloat( const unsigned short *half_data,
+                                       float *float_data,
+                                       size_t nr_values );
+
+  /// Convert an array of floats to half floats.
+  H3DUTIL_API void convertFloatToHalf( const float *float_data,
+                                       unsigned short *half_data,
+                                       size_t nr_values );
+
+  /// Create a PixelImage with the same content as the given image stored
+  /// as 16 bit RATIONAL components, i.e. half floats. Images with 32 bit
+  /// RATIONAL components are converted in parallel, other images are
+  /// converted pixel by pixel with getPixel. The returned image has the
+  /// same pixel type as the given image.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *createHalfFloatImage( Image *image,
+                                           unsigned int nr_threads = 0 );
+
+  /// Create a PixelImage with the same content as the given image stored
+  /// as 32 bit RATIONAL components. Images with 16 bit RATIONAL
+  /// components are converted in parallel, other images are converted
+  /// pixel by pixel with getPixel.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *createFloatImage( Image *image,
+                                       unsigned int nr_threads = 0 );
+}
+
+#endif
@@ -213,7 +213,8 @@ namespace H3DUtil {
       unsigned char *data = (unsigned char *) getImageData();
 
       memcpy( value, 
-              &data[ ( ( z * height() + y ) * width() + x ) * bytes_per_pixel ],
+              &data[ z * sliceStride() + y * rowStride() +
+                     x * bytes_per_pixel ],
               bytes_per_pixel );
     }
     
@@ -227,11 +228,48 @@ namespace H3DUtil {
         ++bytes_per_pixel;
 
       unsigned char *data = (unsigned char *)getImageData();
-      memcpy( &data[ ( ( z * height() + y ) * width() + x ) * bytes_per_pixel ],
+      memcpy( &data[ z * sliceStride() + y * rowStride() +
+                     x * bytes_per_pixel ],
               value, 
               bytes_per_pixel );
     }
 
+    /// Returns the number of bytes from the start of one row of pixels to
+    /// the start of the next in the data returned by getImageData(). By
+    /// default the rows follow each other directly. byteAlignment() does
+    /// not affect the layout of the data, subclasses with padded rows
+    /// override this function.
+    virtual size_t rowStride() {
+      return ( (size_t) width() * bitsPerPixel() + 7 ) / 8;
+    }
+
+    /// Returns the number of bytes from the start of one slice of pixels
+    /// to the start of the next in the data returned by getImageData(). By
+    /// default the slices follow each other directly.
+    virtual size_t sliceStride() {
+      return rowStride() * height();
+    }
+
+    /// Copy the pixels of a range of slices to data without any padding
+    /// between rows or slices. The data is read from getImageData() if it
+    /// is available and with getElement otherwise.
+    /// \param first_slice The first slice to copy.
+    /// \param nr_slices The number of slices to copy.
+    /// \param data Where to put the pixels, must have room for
+    /// width() * height() * nr_slices pixels.
+    void getPackedSlices( unsigned int first_slice,
+                          unsigned int nr_slices,
+                          void *data );
+
+    /// Returns true if the data returned by getImageData() has no padding
+    /// between rows or slices, i.e. it can be used as a plain array of
+    /// width * height * depth pixels.
+    inline bool hasPackedData() {
+      size_t row_size = ( (size_t) width() * bitsPerPixel() + 7 ) / 8;
+      return rowStride() == row_size &&
+        ( depth() <= 1 || sliceStride() == row_size * height() );
+    }
+
     /// Gets the byte alignment for the start of each pixel row in memory.
     /// Valid values are 1, 2, 4 and 8.
     virtual int byteAlignment() {
@@ -258,8 +296,10 @@ namespace H3DUtil {
     /// the lowest value that can be held by the data type used in the image maps
     /// to 0 and the highest to 1. 
     ///
-    /// This function only works on images with pixel component type SIGNED or
-    /// UNSIGNED.
+    /// This function works on images with pixel component type SIGNED or
+    /// UNSIGNED. For images with pixel component type RATIONAL the values
+    /// are returned without normalization, 16 bit components are treated as
+    /// half floats.
     /// 
     /// It is the responsibility of the caller to free the memory of the returned
     /// pointer when it is finished with it.
@@ -270,8 +310,10 @@ namespace H3DUtil {
     /// the lowest value that can be held by the data type used in the image maps
     /// to 0 and the highest to 1. 
     ///
-    /// This function only works on images with pixel component type SIGNED or
-    /// UNSIGNED.
+    /// This function works on images with pixel component type SIGNED or
+    /// UNSIGNED. For images with pixel component type RATIONAL the values
+    /// are returned without normalization, 16 bit components are treated as
+    /// half floats.
     /// 
     /// It is the responsibility of the caller to free the memory of the returned
     /// pointer when it is finished with it.
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageGeometry.h
+/// \brief Functions for flipping, rotating and reordering the axes of
+/// images and volumes.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGEGEOMETRY_H__
+#define __IMAGEGEOMETRY_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/Exception.h>
+
+namespace H3DUtil {
+
+  /// Thrown if an axis given to one of the geometry functions is not 0, 1
+  /// or 2, or if the axes given to reorientImage are not a permutation.
+  H3D_VALUE_EXCEPTION( unsigned int, InvalidImageAxis );
+
+  /// Flip the image in place along an axis, 0 for x, 1 for y and 2 for z.
+  /// Images with their data in memory are flipped in parallel, other
+  /// images pixel by pixel with getElement and setElement. Compressed
+  /// images are not supported.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API void flipImage( Image *image,
+                              unsigned int axis,
+                              unsigned int nr_threads = 0 );
+
+  /// Copy width * height * depth pixels without padding from src to dst,
+  /// flipped along an axis. src and dst may be the same to flip the data
+  /// in place, otherwise they must not overlap.
+  H3DUTIL_API void flipImageData( const void *src,
+                                  void *dst,
+                                  unsigned int width,
+                                  unsigned int height,
+                                  unsigned int depth,
+                                  unsigned int bytes_per_pixel,
+                                  unsigned int axis,
+                                  unsigned int nr_threads = 0 );
+
+  /// Create a PixelImage with the axes of the given image reordered and
+  /// optionally reversed. Axis i of the new image is axis axes[i] of the
+  /// given image, reversed if flip[i] is true. E.g. axes { 1, 2, 0 } turns
+  /// an axial volume into sagittal slices. The pixels are copied in
+  /// parallel in cache sized tiles, with SSE2 for 16 and 32 bit pixels.
+  /// Returns NULL if the image is compressed.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *reorientImage( Image *image,
+                                    const unsigned int axes[3],
+                                    const bool flip[3],
+                                    unsigned int nr_threads = 0 );
+
+  /// Create a PixelImage with the axes of the given image reordered,
+  /// where axis x, y and z of the new image are the given axes of the
+  /// image. See reorientImage.
+  H3DUTIL_API Image *permuteImageAxes( Image *image,
+                                       unsigned int x_axis,
+                                       unsigned int y_axis,
+                                       unsigned int z_axis,
+                                       unsigned int nr_threads = 0 );
+
+  /// Create a PixelImage with the x and y axis of the image swapped.
+  H3DUTIL_API Image *transposeImage( Image *image,
+                                     unsigned int nr_threads = 0 );
+
+  /// Create a PixelImage with the image rotated counter clockwise around
+  /// the z axis by nr_turns quarter turns. Negative values rotate
+  /// clockwise. A half turn can also be done in place by flipping the
+  /// image along x and y with flipImage.
+  H3DUTIL_API Image *rotateImage90( Image *image,
+                                    int nr_turns,
+                                    unsigned int nr_threads = 0 );
+}
+
+#endif
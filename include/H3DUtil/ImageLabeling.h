@@ -0,0 +1,172 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageLabeling.h
+/// \brief Functions for connected component labeling and region growing
+/// on volumes.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGELABELING_H__
+#define __IMAGELABELING_H__
+
+#include <H3DUtil/Image.h>
+
+#include <vector>
+
+namespace H3DUtil {
+
+  /// The voxels that are neighbours of a voxel when finding connected
+  /// voxels.
+  typedef enum {
+    /// Voxels sharing a face.
+    CONNECTIVITY_6,
+    /// Voxels sharing a face or an edge.
+    CONNECTIVITY_18,
+    /// Voxels sharing a face, an edge or a corner.
+    CONNECTIVITY_26
+  } Connectivity;
+
+  /// Decides from its value whether a voxel belongs to a component or
+  /// region. The values are those of MinMaxGrid, i.e. the stored component
+  /// values for images with integer or 32/64 bit floating point components
+  /// and the normalized values from getPixel for other images.
+  struct H3DUTIL_API IntensityPredicate {
+    /// The type of a user defined predicate, called with the value of a
+    /// voxel and the data pointer given with it. It may be called from
+    /// several threads at the same time.
+    typedef bool (*Function)( H3DFloat value, void *data );
+
+    /// Voxels with values in [_low, _high].
+    IntensityPredicate( H3DFloat _low, H3DFloat _high ):
+      low( _low ), high( _high ), function( NULL ), data( NULL ) {}
+
+    /// Voxels for which _function( value, _data ) is true.
+    IntensityPredicate( Function _function, void *_data = NULL ):
+      low( 0 ), high( 0 ), function( _function ), data( _data ) {}
+
+    /// Returns true if a voxel with the given value is included.
+    inline bool operator()( H3DFloat value ) const {
+      return function ? function( value, data ) :
+        value >= low && value <= high;
+    }
+
+    H3DFloat low, high;
+    Function function;
+    void *data;
+  };
+
+  /// Statistics of a connected component or region, in voxel coordinates.
+  struct H3DUTIL_API ComponentStatistics {
+    /// Constructor.
+    ComponentStatistics():
+      label( 0 ),
+      nr_voxels( 0 ),
+      min_value( 0 ),
+      max_value( 0 ),
+      mean_value( 0 ) {}
+
+    /// The label of the component in the label image.
+    unsigned int label;
+    /// The number of voxels in the component.
+    H3DInt64 nr_voxels;
+    /// The smallest and largest voxel coordinates in the component.
+    Vec3f bounding_box_min, bounding_box_max;
+    /// The mean of the voxel coordinates of the component.
+    Vec3f centroid;
+    /// The smallest, largest and mean value of the voxels.
+    H3DFloat min_value, max_value, mean_value;
+  };
+
+  /// Label the connected components of the voxels for which predicate is
+  /// true. The result is a LUMINANCE PixelImage of the same size with
+  /// label 0 for the voxels not included and labels 1 to N for the
+  /// components, numbered in the order of their first voxel in memory. It
+  /// has 8, 16 or 32 bits per pixel, the fewest that fit N.
+  ///
+  /// The volume is divided into slabs of rows that are labeled in
+  /// parallel with union-find, after which the components that cross the
+  /// boundaries between slabs are merged in parallel without locks. The
+  /// result does not depend on the number of threads.
+  ///
+  /// Returns NULL if the image has 2^32 - 1 voxels or more.
+  /// \param image The volume.
+  /// \param predicate The voxels to label.
+  /// \param connectivity The neighbours of a voxel.
+  /// \param statistics If not NULL, set to the statistics of the
+  /// components, with component i at index i - 1.
+  /// \param component The pixel component to use.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *labelConnectedComponents(
+    Image *image,
+    const IntensityPredicate &predicate,
+    Connectivity connectivity = CONNECTIVITY_6,
+    std::vector< ComponentStatistics > *statistics = NULL,
+    unsigned int component = 0,
+    unsigned int nr_threads = 0 );
+
+  /// Returns a mask of the largest connected component of the voxels for
+  /// which predicate is true, e.g. to remove noise from a segmentation.
+  /// The mask is an 8 bit LUMINANCE PixelImage with 1 for the voxels of
+  /// the component and 0 elsewhere. If several components are the
+  /// largest, the one with the lowest label is used. See
+  /// labelConnectedComponents for the parameters.
+  H3DUTIL_API Image *extractLargestComponent(
+    Image *image,
+    const IntensityPredicate &predicate,
+    Connectivity connectivity = CONNECTIVITY_6,
+    unsigned int component = 0,
+    unsigned int nr_threads = 0 );
+
+  /// Grow a region from seed voxels, adding neighbours for which predicate
+  /// is true until no more can be added. The result is an 8 bit LUMINANCE
+  /// PixelImage with 1 for the voxels of the region and 0 elsewhere.
+  ///
+  /// The region grows one layer of neighbours at a time, with the voxels
+  /// of each layer divided between the threads, and uses a queue instead
+  /// of recursion so any size of region can be grown. The result does not
+  /// depend on the number of threads.
+  ///
+  /// Returns NULL if the image has 2^32 - 1 voxels or more.
+  /// \param image The volume.
+  /// \param seeds The seed voxels in voxel coordinates, rounded to the
+  /// nearest voxel. Seeds outside of the volume or for which predicate is
+  /// false are ignored.
+  /// \param predicate The voxels that can be added to the region.
+  /// \param connectivity The neighbours of a voxel.
+  /// \param statistics If not NULL, set to the statistics of the region,
+  /// with label 1.
+  /// \param component The pixel component to use.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *growRegion( Image *image,
+                                 const std::vector< Vec3f > &seeds,
+                                 const IntensityPredicate &predicate,
+                                 Connectivity connectivity = CONNECTIVITY_6,
+                                 ComponentStatistics *statistics = NULL,
+                                 unsigned int component = 0,
+                                 unsigned int nr_threads = 0 );
+}
+
+#endif
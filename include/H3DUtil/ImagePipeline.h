@@ -0,0 +1,421 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImagePipeline.h
+/// \brief Header file for ImageNode and the nodes of lazily evaluated
+/// image processing pipelines.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGEPIPELINE_H__
+#define __IMAGEPIPELINE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/AutoRefVector.h>
+
+#include <vector>
+
+namespace H3DUtil {
+
+  /// A box shaped region of the voxels of an image.
+  struct H3DUTIL_API ImageRegion {
+    /// Constructor.
+    ImageRegion( unsigned int _x = 0,
+                 unsigned int _y = 0,
+                 unsigned int _z = 0,
+                 unsigned int _width = 0,
+                 unsigned int _height = 0,
+                 unsigned int _depth = 0 ):
+      x( _x ), y( _y ), z( _z ),
+      width( _width ), height( _height ), depth( _depth ) {}
+
+    /// Returns true if the region contains no voxels.
+    inline bool isEmpty() const {
+      return width == 0 || height == 0 || depth == 0;
+    }
+
+    /// Returns the part of the region inside an image of the given size.
+    ImageRegion clipped( unsigned int image_width,
+                         unsigned int image_height,
+                         unsigned int image_depth ) const;
+
+    /// Returns the region grown by margin voxels in all directions, clipped
+    /// to an image of the given size.
+    ImageRegion expanded( unsigned int margin,
+                          unsigned int image_width,
+                          unsigned int image_height,
+                          unsigned int image_depth ) const;
+
+    /// The first voxel of the region.
+    unsigned int x, y, z;
+    /// The size of the region in voxels.
+    unsigned int width, height, depth;
+  };
+
+  /// \class ImageNode
+  /// ImageNode is the base class for the nodes of an image processing
+  /// pipeline, a directed acyclic graph where each node computes an image
+  /// from the images of its input nodes and a set of parameters.
+  ///
+  /// The result of a node is computed when getImage is called and kept
+  /// until the node is invalidated, which happens when a parameter or an
+  /// input is changed and is propagated to the nodes that use the result.
+  /// Nodes that are not affected by a change keep their results.
+  ///
+  /// The result is divided into bricks. A node that can compute a region
+  /// of its result on its own, e.g. a filter, can be invalidated in a
+  /// region, in which case only the bricks intersecting the region are
+  /// recomputed, in parallel, and the region is mapped through the
+  /// following nodes so that they only recompute the bricks affected by
+  /// it. Other nodes recompute their whole result.
+  ///
+  /// A node references its inputs, so a pipeline is kept alive by its last
+  /// nodes. The results are also reference counted and can be kept after
+  /// the node has been changed or destroyed, but bricks are recomputed in
+  /// the existing result image, so it changes when the node is updated.
+  /// A pipeline must only be used from one thread at a time.
+  ///
+  /// \code
+  /// AutoRef< SourceImageNode > source( new SourceImageNode( image ) );
+  /// AutoRef< GaussianFilterNode > smooth( new GaussianFilterNode );
+  /// smooth->setInput( 0, source.get() );
+  /// AutoRef< GradientMagnitudeNode > gradient( new GradientMagnitudeNode );
+  /// gradient->setInput( 0, smooth.get() );
+  /// Image *result = gradient->getImage();
+  /// // change some voxels of image and update only what they affect
+  /// source->imageRegionChanged( ImageRegion( 10, 10, 10, 8, 8, 8 ) );
+  /// result = gradient->getImage();
+  /// \endcode
+  class H3DUTIL_API ImageNode: public RefCountedClass {
+  public:
+    /// Constructor.
+    /// \param nr_inputs The number of inputs of the node.
+    /// \param _brick_size The size of the bricks of the result that are
+    /// recomputed when a region of the node is invalidated.
+    ImageNode( unsigned int nr_inputs, unsigned int _brick_size = 32 );
+
+    /// Destructor.
+    virtual ~ImageNode();
+
+    /// Returns the number of inputs of the node.
+    inline unsigned int nrInputs() {
+      return (unsigned int) inputs.size();
+    }
+
+    /// Set input i of the node. Invalidates the node. The node must not
+    /// be one of the nodes that use the result of this node.
+    void setInput( unsigned int i, ImageNode *node );
+
+    /// Returns input i of the node, NULL if not set.
+    inline ImageNode *getInput( unsigned int i ) {
+      return i < inputs.size() ? inputs[i] : NULL;
+    }
+
+    /// Returns the result of the node, computing it and the results of
+    /// its inputs if they are not up to date. Returns NULL if the result
+    /// could not be computed, e.g. because an input is missing.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    Image *getImage( unsigned int nr_threads = 0 );
+
+    /// Mark the whole result as out of date, and the results of the nodes
+    /// that use it.
+    void invalidate();
+
+    /// Mark a region of the result as out of date, and the regions of the
+    /// results of the nodes that use it that are computed from it. The
+    /// whole result is invalidated if the node cannot compute regions.
+    void invalidateRegion( const ImageRegion &region );
+
+    /// Returns true if the result has been computed and is up to date.
+    bool isUpToDate();
+
+    /// Returns the size of the bricks of the result.
+    inline unsigned int brickSize() {
+      return brick_size;
+    }
+
+    /// Returns the number of times the whole result has been computed.
+    inline unsigned int nrEvaluations() {
+      return nr_evaluations;
+    }
+
+    /// Returns the number of bricks that have been recomputed after a
+    /// region was invalidated.
+    inline H3DInt64 nrBrickEvaluations() {
+      return nr_brick_evaluations;
+    }
+
+  protected:
+    /// Compute the whole result from the images of the inputs. Returns a
+    /// new image, or the current result if it can be reused, or NULL if
+    /// the result cannot be computed. The images of inputs that are not
+    /// set are NULL.
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads ) = 0;
+
+    /// Returns true if the node can compute regions of its result with
+    /// evaluateRegion.
+    virtual bool canEvaluateRegions() {
+      return false;
+    }
+
+    /// Compute a region of the result in place. Called from several
+    /// threads at the same time for different regions.
+    virtual void evaluateRegion(
+      const std::vector< Image * > & /*input_images*/,
+      Image * /*result*/,
+      const ImageRegion & /*region*/ ) {}
+
+    /// Returns the region of the result computed from a region of input
+    /// i. The default is the same region.
+    virtual ImageRegion affectedRegion( unsigned int /*input*/,
+                                        const ImageRegion &region ) {
+      return region;
+    }
+
+    /// Compute all bricks of result with evaluateRegion, in parallel. Used
+    /// by evaluate in nodes that compute their results by regions.
+    void evaluateAllRegions( const std::vector< Image * > &input_images,
+                             Image *result,
+                             unsigned int nr_threads );
+
+    /// Divide an image of the size of result into bricks, all up to date.
+    void setupBricks( Image *image );
+
+    /// Returns the region of brick i.
+    ImageRegion brickRegion( unsigned int i );
+
+    /// The input nodes.
+    AutoRefVector< ImageNode > inputs;
+
+    /// The nodes using the result of this node. Not referenced, since they
+    /// reference this node.
+    std::vector< ImageNode * > outputs;
+
+    /// The result, NULL if it has not been computed.
+    AutoRef< Image > result;
+
+    /// True if the whole result is out of date.
+    bool all_invalid;
+
+    /// The bricks of the result that are out of date, with bricks_x *
+    /// bricks_y * bricks_z bricks in x, y, z order.
+    std::vector< bool > invalid_bricks;
+    unsigned int nr_invalid_bricks;
+    unsigned int bricks_x, bricks_y, bricks_z;
+    unsigned int brick_size;
+
+    /// The size of the result the bricks were set up for.
+    unsigned int result_width, result_height, result_depth;
+
+    unsigned int nr_evaluations;
+    H3DInt64 nr_brick_evaluations;
+
+    /// The state of a parallel evaluation of bricks.
+    struct BrickEvaluation {
+      ImageNode *node;
+      const std::vector< Image * > *input_images;
+      Image *result;
+      const std::vector< unsigned int > *bricks;
+    };
+
+    /// parallelFor callback evaluating a range of bricks.
+    static void evaluateBricks( unsigned int begin, unsigned int end,
+                                void *data );
+  };
+
+  /// \class SourceImageNode
+  /// SourceImageNode brings an image into a pipeline. Its result is the
+  /// image itself. Call imageRegionChanged after changing voxels of the
+  /// image so that the nodes using it are updated.
+  class H3DUTIL_API SourceImageNode: public ImageNode {
+  public:
+    /// Constructor.
+    SourceImageNode( Image *_image = NULL );
+
+    /// Set the image. Invalidates the node.
+    void setImage( Image *_image );
+
+    /// Returns the image.
+    inline Image *getSourceImage() {
+      return image.get();
+    }
+
+    /// Call when the voxels of a region of the image have been changed.
+    inline void imageRegionChanged( const ImageRegion &region ) {
+      invalidateRegion( region );
+    }
+
+  protected:
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads );
+
+    virtual bool canEvaluateRegions() {
+      return true;
+    }
+
+    /// The image.
+    AutoRef< Image > image;
+  };
+
+  /// \class ConvertImageNode
+  /// ConvertImageNode converts one pixel component of its input to a 32
+  /// bit floating point LUMINANCE image, as value * scale + offset. The
+  /// values are read with VoxelValueReader, i.e. the stored component
+  /// values for images with integer or 32/64 bit floating point components
+  /// and the normalized values from getPixel for other images.
+  class H3DUTIL_API ConvertImageNode: public ImageNode {
+  public:
+    /// Constructor.
+    ConvertImageNode( unsigned int _component = 0,
+                      H3DFloat _scale = 1,
+                      H3DFloat _offset = 0 );
+
+    /// Set the pixel component to convert.
+    void setComponent( unsigned int _component );
+
+    /// Set the scale and offset of the values.
+    void setScaleOffset( H3DFloat _scale, H3DFloat _offset );
+
+  protected:
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads );
+
+    virtual bool canEvaluateRegions() {
+      return true;
+    }
+
+    virtual void evaluateRegion( const std::vector< Image * > &input_images,
+                                 Image *result,
+                                 const ImageRegion &region );
+
+    unsigned int component;
+    H3DFloat scale, offset;
+  };
+
+  /// \class GaussianFilterNode
+  /// GaussianFilterNode smooths one pixel component of its input with a
+  /// separable Gaussian filter, giving a 32 bit floating point LUMINANCE
+  /// image. The values are read as by ConvertImageNode and the volume is
+  /// extended by repeating its border voxels.
+  class H3DUTIL_API GaussianFilterNode: public ImageNode {
+  public:
+    /// Constructor.
+    /// \param _sigma The standard deviation of the filter in voxels. The
+    /// filter extends 3 standard deviations from the voxel.
+    /// \param _component The pixel component to filter.
+    GaussianFilterNode( H3DFloat _sigma = 1, unsigned int _component = 0 );
+
+    /// Set the standard deviation of the filter in voxels.
+    void setSigma( H3DFloat _sigma );
+
+    /// Set the pixel component to filter.
+    void setComponent( unsigned int _component );
+
+  protected:
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads );
+
+    virtual bool canEvaluateRegions() {
+      return true;
+    }
+
+    virtual void evaluateRegion( const std::vector< Image * > &input_images,
+                                 Image *result,
+                                 const ImageRegion &region );
+
+    virtual ImageRegion affectedRegion( unsigned int input,
+                                        const ImageRegion &region );
+
+    /// Compute the weights of the filter from sigma.
+    void updateKernel();
+
+    H3DFloat sigma;
+    unsigned int component;
+
+    /// The normalized weights of the filter, 2 * radius + 1 values.
+    std::vector< H3DFloat > kernel;
+    unsigned int radius;
+  };
+
+  /// \class GradientMagnitudeNode
+  /// GradientMagnitudeNode computes the length of the gradient of one
+  /// pixel component of its input, in value per metre using the pixel size
+  /// of the input with a size of 0 used as 1. The gradient is computed with
+  /// central differences inside the volume and one-sided differences on
+  /// its border. The result is a 32 bit floating point LUMINANCE image.
+  class H3DUTIL_API GradientMagnitudeNode: public ImageNode {
+  public:
+    /// Constructor.
+    GradientMagnitudeNode( unsigned int _component = 0 );
+
+    /// Set the pixel component to use.
+    void setComponent( unsigned int _component );
+
+  protected:
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads );
+
+    virtual bool canEvaluateRegions() {
+      return true;
+    }
+
+    virtual void evaluateRegion( const std::vector< Image * > &input_images,
+                                 Image *result,
+                                 const ImageRegion &region );
+
+    virtual ImageRegion affectedRegion( unsigned int input,
+                                        const ImageRegion &region );
+
+    unsigned int component;
+  };
+
+  /// \class ResampleImageNode
+  /// ResampleImageNode resamples its input to a new size with trilinear
+  /// interpolation, as the resampling constructor of PixelImage. The whole
+  /// result is recomputed when the input changes.
+  class H3DUTIL_API ResampleImageNode: public ImageNode {
+  public:
+    /// Constructor. A size of 0 keeps the size of the input along that
+    /// axis.
+    ResampleImageNode( unsigned int _width = 0,
+                       unsigned int _height = 0,
+                       unsigned int _depth = 0 );
+
+    /// Set the size of the result. A size of 0 keeps the size of the input
+    /// along that axis.
+    void setSize( unsigned int _width,
+                  unsigned int _height,
+                  unsigned int _depth );
+
+  protected:
+    virtual Image *evaluate( const std::vector< Image * > &input_images,
+                             unsigned int nr_threads );
+
+    unsigned int width, height, depth;
+  };
+}
+
+#endif
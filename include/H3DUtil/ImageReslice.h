@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageReslice.h
+/// \brief Functions for reslicing volumes along arbitrary planes
+/// (multi-planar reconstruction).
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IMAGERESLICE_H__
+#define __IMAGERESLICE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/LinAlgTypes.h>
+
+namespace H3DUtil {
+
+  /// How the pixels of a reslice are computed from the volume.
+  typedef enum {
+    /// The value of the nearest voxel.
+    RESLICE_NEAREST,
+    /// Trilinear interpolation of the voxels.
+    RESLICE_LINEAR,
+    /// The maximum of trilinearly interpolated samples through a slab
+    /// around the plane.
+    RESLICE_MIP,
+    /// The average of trilinearly interpolated samples through a slab
+    /// around the plane.
+    RESLICE_AVERAGE
+  } ResliceMode;
+
+  /// Create a 2D PixelImage by sampling a volume on a plane.
+  ///
+  /// The plane is the z = 0 plane of the coordinate system given by
+  /// plane_transform, an affine transform to the physical coordinates of
+  /// the volume, where voxel (i, j, k) is at
+  /// ( i, j, k ) * image->pixelSize(). Pixel (i, j) of the result is at
+  /// ( ( i - ( width - 1 ) / 2 ) * spacing.x,
+  ///   ( j - ( height - 1 ) / 2 ) * spacing.y, 0 )
+  /// in the plane coordinate system, i.e. the result is centered on the
+  /// origin of the plane. Pixels outside of the volume are 0.
+  ///
+  /// The positions are stepped incrementally in fixed point along each
+  /// row, only over the part of the row inside the volume, and the rows
+  /// are processed in parallel. The result has the same pixel format as
+  /// the volume. Returns NULL if the image is compressed.
+  ///
+  /// \param image The volume.
+  /// \param plane_transform The transform from the plane coordinate system
+  /// to the physical coordinates of the volume.
+  /// \param width, height The size of the result in pixels.
+  /// \param spacing The distance between the pixels of the result in the
+  /// plane coordinate system.
+  /// \param mode How the pixels are computed.
+  /// \param slab_thickness The thickness of the slab along the z axis of
+  /// the plane coordinate system for RESLICE_MIP and RESLICE_AVERAGE. The
+  /// slab is sampled about once per voxel.
+  /// \param nr_threads The number of threads to use, 0 for one thread
+  /// per hardware thread.
+  H3DUTIL_API Image *resliceImage( Image *image,
+                                   const Matrix4f &plane_transform,
+                                   unsigned int width,
+                                   unsigned int height,
+                                   const Vec2f &spacing,
+                                   ResliceMode mode = RESLICE_LINEAR,
+                                   H3DFloat slab_thickness = 0,
+                                   unsigned int nr_threads = 0 );
+
+  /// Sample a volume on a plane into an existing image, e.g. to reuse
+  /// the same image for every frame while browsing. The width and height
+  /// of the plane are those of output and only its first slice is
+  /// written. See the other resliceImage for the parameters.
+  /// \returns false if the image is compressed or if output does not have
+  /// its data in memory or does not have the same pixel format as the
+  /// image.
+  H3DUTIL_API bool resliceImage( Image *image,
+                                 const Matrix4f &plane_transform,
+                                 Image *output,
+                                 const Vec2f &spacing,
+                                 ResliceMode mode = RESLICE_LINEAR,
+                                 H3DFloat slab_thickness = 0,
+                                 unsigned int nr_threads = 0 );
+}
+
+#endif
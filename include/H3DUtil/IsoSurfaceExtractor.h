@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file IsoSurfaceExtractor.h
+/// \brief Header file for IsoSurfaceExtractor, which extracts iso-surfaces
+/// from volumes with marching cubes.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __ISOSURFACEEXTRACTOR_H__
+#define __ISOSURFACEEXTRACTOR_H__
+
+#include <H3DUtil/MinMaxGrid.h>
+
+#include <utility>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \class IsoSurfaceExtractor
+  /// IsoSurfaceExtractor extracts the iso-surface of a volume at a given
+  /// value as an indexed triangle mesh with marching cubes. The volume is
+  /// divided into slabs of slices that are processed in parallel and the
+  /// vertices on the boundaries between slabs are welded, so that the
+  /// resulting mesh is closed wherever the surface does not leave the
+  /// volume. The ambiguous faces of the cells are resolved in the same way
+  /// from both sides so there are no holes between cells.
+  ///
+  /// A MinMaxGrid of the volume is built once in the constructor and
+  /// blocks of the grid that cannot contain the iso-value are skipped, so
+  /// that extracting the surface again with another iso-value only visits
+  /// the blocks the surface passes through.
+  ///
+  /// The iso-value is in the same unit as the values of MinMaxGrid, i.e.
+  /// the stored component values for images with integer or 32/64 bit
+  /// floating point components and the normalized values from getPixel
+  /// for other images. Values greater than or equal to the iso-value are
+  /// inside the surface. The triangles are counter-clockwise and the
+  /// normals point out of the surface, towards lower values.
+  ///
+  /// \code
+  /// IsoSurfaceExtractor extractor( image );
+  /// std::vector< Vec3f > vertices, normals;
+  /// std::vector< unsigned int > indices;
+  /// extractor.extract( 300, vertices, normals, indices );
+  /// \endcode
+  class H3DUTIL_API IsoSurfaceExtractor {
+  public:
+    /// Constructor. Builds the MinMaxGrid of the image in parallel.
+    /// \param _image The volume. The image must stay valid as long as the
+    /// extractor is used.
+    /// \param _component The pixel component to use.
+    /// \param block_size The size of the blocks that are skipped if they
+    /// cannot contain the surface. Also the number of slices in a slab.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    IsoSurfaceExtractor( Image *_image,
+                         unsigned int _component = 0,
+                         unsigned int block_size = 8,
+                         unsigned int nr_threads = 0 );
+
+    /// Extract the iso-surface.
+    /// \param iso_value The value of the surface.
+    /// \param vertices Set to the vertices of the surface in physical
+    /// units, i.e. voxel coordinates scaled by the pixelSize of the image
+    /// with the center of voxel (0, 0, 0) at the origin. A pixel size of 0
+    /// along an axis is used as 1.
+    /// \param normals Set to the normal of each vertex, from the gradient
+    /// of the volume.
+    /// \param indices Set to three indices into vertices for each triangle.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    void extract( H3DFloat iso_value,
+                  std::vector< Vec3f > &vertices,
+                  std::vector< Vec3f > &normals,
+                  std::vector< unsigned int > &indices,
+                  unsigned int nr_threads = 0 );
+
+    /// Update the MinMaxGrid after a change of the voxels in the given
+    /// region of the image.
+    inline void update( unsigned int x, unsigned int y, unsigned int z,
+                        unsigned int width,
+                        unsigned int height,
+                        unsigned int depth,
+                        unsigned int nr_threads = 0 ) {
+      grid.update( x, y, z, width, height, depth, nr_threads );
+    }
+
+    /// Returns the MinMaxGrid used to skip empty blocks.
+    inline MinMaxGrid &getMinMaxGrid() {
+      return grid;
+    }
+
+  protected:
+    /// The part of the surface in one slab of slices, with indices into
+    /// the vertices of the slab.
+    struct Slab {
+      std::vector< Vec3f > vertices;
+      std::vector< Vec3f > normals;
+      std::vector< unsigned int > indices;
+      /// The vertices on the first and last slice of the slab, as pairs of
+      /// the edge they are on and the vertex index, sorted by edge.
+      std::vector< std::pair< size_t, unsigned int > > first_slice;
+      std::vector< std::pair< size_t, unsigned int > > last_slice;
+      /// The index of each vertex in the whole surface.
+      std::vector< unsigned int > global_index;
+      /// The index of the first vertex and the first index of the slab in
+      /// the whole surface.
+      unsigned int first_vertex;
+      size_t first_index;
+    };
+
+    /// Extract the part of the surface in a slab.
+    void extractSlab( unsigned int slab, H3DFloat iso_value, Slab &result );
+
+    /// Callback for parallelFor extracting a range of slabs.
+    static void extractSlabs( unsigned int begin, unsigned int end,
+                              void *data );
+
+    /// Callback for parallelFor copying a range of slabs to the output.
+    static void copySlabs( unsigned int begin, unsigned int end,
+                           void *data );
+
+    /// The image.
+    Image *image;
+
+    /// The pixel component to use.
+    unsigned int component;
+
+    /// The grid used to skip blocks that cannot contain the surface.
+    MinMaxGrid grid;
+  };
+}
+
+#endif
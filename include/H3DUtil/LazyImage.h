@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file LazyImage.h
+/// \brief Header file for LazyImage, an image that is loaded the first
+/// time its data is used.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __LAZYIMAGE_H__
+#define __LAZYIMAGE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/LoadImageFunctions.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Exception.h>
+
+namespace H3DUtil {
+  /// \class LazyImage
+  /// LazyImage is an Image that only reads the header of its file when it
+  /// is created, using probeImage, and loads the pixel data the first
+  /// time it is needed, i.e. when getImageData, getElement or setElement
+  /// is called. An application can therefore create images for all files
+  /// it might use and only pay for loading the ones that are used.
+  ///
+  /// The properties of the image are those given by probeImage until the
+  /// image has been loaded and those of the loaded image after that. They
+  /// are the same except in rare cases, e.g. DICOM files where the range
+  /// of the rendered values could not be found from the header.
+  ///
+  /// All functions can be called from several threads at the same time,
+  /// the file is only loaded once. If loading fails getImageData returns
+  /// NULL and getElement gives zero for all pixels.
+  class H3DUTIL_API LazyImage: public Image {
+  public:
+    /// Thrown if the file could neither be probed nor loaded.
+    H3D_VALUE_EXCEPTION( std::string, CouldNotLoadLazyImage );
+
+    /// The type of the function used to load the image.
+    typedef Image *(*LoadFunction)( const std::string &url );
+
+    /// Constructor. Reads the properties of the image with probeImage.
+    /// If the file cannot be probed it is loaded directly.
+    /// \param url The image file.
+    /// \param load_function The function used to load the image, NULL
+    /// for loadImage.
+    LazyImage( const std::string &url, LoadFunction load_function = NULL );
+
+    /// Constructor for an image with properties that are already known,
+    /// e.g. from an earlier call to probeImage. The file is not read
+    /// until the data is needed.
+    LazyImage( const std::string &url,
+               const ImageFileInfo &info,
+               LoadFunction load_function = NULL );
+
+    /// Returns the width of the image in pixels.
+    virtual unsigned int width();
+
+    /// Returns the height of the image in pixels.
+    virtual unsigned int height();
+
+    /// Returns the depth of the image in pixels.
+    virtual unsigned int depth();
+
+    /// Returns the number of bits used for each pixel in the image.
+    virtual unsigned int bitsPerPixel();
+
+    /// Returns the PixelType of the image.
+    virtual PixelType pixelType();
+
+    /// Returns the PixelComponentType of the image.
+    virtual PixelComponentType pixelComponentType();
+
+    /// Returns the compression type of the image data.
+    virtual CompressionType compressionType();
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    virtual Vec3f pixelSize();
+
+    /// Returns a pointer to the data of the loaded image, loading it if
+    /// needed. NULL if the image could not be loaded.
+    virtual void *getImageData();
+
+    /// Get the value of a pixel/voxel, loading the image if needed.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Set the value of a pixel/voxel, loading the image if needed.
+    virtual void setElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Returns the row stride of the loaded image, loading it if needed.
+    virtual size_t rowStride();
+
+    /// Returns the slice stride of the loaded image, loading it if needed.
+    virtual size_t sliceStride();
+
+    /// Returns the byte alignment of the loaded image, loading it if
+    /// needed.
+    virtual int byteAlignment();
+
+    /// Returns the url of the image file.
+    inline const std::string &getURL() {
+      return url;
+    }
+
+    /// Returns true if the image has been loaded, or an attempt to load it
+    /// has failed.
+    bool isLoaded();
+
+    /// Load the image if it has not been loaded already and return it.
+    /// NULL if the image could not be loaded.
+    Image *getLoadedImage();
+
+  protected:
+    /// The url of the image file.
+    std::string url;
+
+    /// The function used to load the image.
+    LoadFunction load_function;
+
+    /// The properties of the image given by probeImage.
+    ImageFileInfo info;
+
+    /// The loaded image, NULL until it has been loaded. It is set before
+    /// loaded and never changed after that, so it can be read without a
+    /// lock once loaded is set.
+    AutoRef< Image > image;
+
+    /// Non-zero when the image has been loaded or loading has failed. Set
+    /// with release and read with acquire semantics.
+    volatile long loaded;
+
+    /// Lock held while loading the image, so that it is only loaded once
+    /// while the properties can still be read.
+    MutexLock load_lock;
+
+    /// Returns the loaded image without loading it, NULL if it has not
+    /// been loaded.
+    Image *currentImage();
+  };
+}
+
+#endif
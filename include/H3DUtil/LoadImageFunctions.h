@@ -30,6 +30,9 @@
 #define __LOADIMAGEFUNCTIONS_H__
 
 #include <H3DUtil/Image.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/NrrdFile.h>
+#include <H3DUtil/BrickedVolumeFile.h>
 
 namespace H3DUtil {
 
@@ -48,31 +51,155 @@ namespace H3DUtil {
   H3DUTIL_API Image *loadFreeImage( std::istream &is );
 
   /// \ingroup ImageLoaderFunctions
-  /// Saves an image as a PNG file using FreeImage.
+  /// Loads an image in memory using FreeImage. The data is read directly
+  /// from the given buffer.
+  /// \param data The content of the image file.
+  /// \param size The number of bytes in data.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadFreeImage( const void *data, size_t size );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Saves an image as a PNG file using FreeImage. Images with 8 or 16 bit
+  /// unsigned components are saved with their own bit depth and are copied
+  /// a row at a time. Other images are converted to 8 bits per component.
   /// \param url The filename to save to.
   /// \param image The image to save.
-  /// \returns 0 on success.
+  /// \param compression_level The zlib compression level, 0 for no
+  /// compression up to 9 for best compression. -1 gives the FreeImage
+  /// default.
+  /// \returns true on success.
   H3DUTIL_API bool saveFreeImagePNG( const std::string &url,
-                                     Image& image );
+                                     Image& image,
+                                     int compression_level = -1 );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Saves an image as a PNG file in a background thread. The image is
+  /// copied before the function returns and can be changed directly. If
+  /// the images waiting to be saved use more memory than the limit set with
+  /// setFreeImagePNGSaveQueueSize the call waits until earlier images have
+  /// been saved. Images still waiting when the program exits are saved
+  /// before it exits.
+  /// \param url The filename to save to.
+  /// \param image The image to save.
+  /// \param compression_level See saveFreeImagePNG.
+  /// \returns false if the image could not be converted to PNG. Errors
+  /// when saving are reported by waitForFreeImagePNGSaves.
+  H3DUTIL_API bool saveFreeImagePNGAsync( const std::string &url,
+                                          Image& image,
+                                          int compression_level = -1 );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Wait until all images queued with saveFreeImagePNGAsync have been
+  /// saved. 
+  /// \returns The number of images that could not be saved since the
+  /// last call.
+  H3DUTIL_API unsigned int waitForFreeImagePNGSaves();
+
+  /// \ingroup ImageLoaderFunctions
+  /// Set the maximum number of bytes of image data that can wait to be
+  /// saved by saveFreeImagePNGAsync. Default is 256 MB.
+  H3DUTIL_API void setFreeImagePNGSaveQueueSize( size_t max_bytes );
 #endif
 
-#ifdef HAVE_TEEM
   /// \ingroup ImageLoaderFunctions
-  /// Loads a file in the Nrrd file format as an image.
+  /// Loads a file in the Nrrd file format as an image. Files with raw,
+  /// gzip or bzip2 encoding and detached headers are read by NrrdReader.
+  /// Other files are read with teem if H3DUtil is built with teem.
   /// \param url The url of the image to load.
-  /// \param spacingsVec a pointer to The spacing ( voxel size of the model )
   /// \returns A pointer to and Image class containing the data
   /// of the loaded url. NULL if unsuccessful.
   H3DUTIL_API Image *loadNrrdFile( const std::string &url);
 
   /// \ingroup ImageLoaderFunctions
-  /// Saves an image in the Nrrd file format.
+  /// Loads a Nrrd file in memory with NrrdReader. Compressed data is
+  /// decompressed directly from the given buffer. Files that need teem
+  /// cannot be loaded from memory.
+  /// \param data The content of the file.
+  /// \param size The number of bytes in data.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadNrrdFile( const void *data, size_t size );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a Nrrd file from a stream with NrrdReader. The rest of the
+  /// stream is read into memory first.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadNrrdFile( std::istream &is );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads the slices [first_slice, first_slice + nr_slices) of a file
+  /// in the Nrrd file format as an image with depth nr_slices. Only the
+  /// part of the file that is needed is read, see NrrdReader.
+  /// \param url The url of the image to load.
+  /// \param first_slice The first slice to load.
+  /// \param nr_slices The number of slices to load.
+  /// \returns A pointer to and Image class containing the data
+  /// of the loaded slices. NULL if unsuccessful.
+  H3DUTIL_API Image *loadNrrdFileSlices( const std::string &url,
+                                         unsigned int first_slice,
+                                         unsigned int nr_slices );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Saves an image in the Nrrd file format using NrrdWriter. A detached
+  /// header is written if the url ends with .nhdr.
   /// \param url The filename to save to.
   /// \param image The image to save.
+  /// \param encoding The encoding of the data.
   /// \returns 0 on success.
   H3DUTIL_API int saveImageAsNrrdFile( const std::string &url,
-                                       Image *image );
-#endif
+                                       Image *image,
+                                       NrrdFile::Encoding encoding =
+                                       NrrdFile::RAW );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a bricked volume file (.hvol) as an image, see
+  /// BrickedVolumeFile.
+  /// \param url The url of the image to load.
+  /// \returns A pointer to and Image class containing the data
+  /// of the loaded url. NULL if unsuccessful.
+  H3DUTIL_API Image *loadBrickedVolumeFile( const std::string &url );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a bricked volume file in memory. The bricks are decompressed
+  /// directly from the given buffer.
+  /// \param data The content of the file.
+  /// \param size The number of bytes in data.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadBrickedVolumeFile( const void *data, size_t size );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a bricked volume file from a stream. The rest of the stream is
+  /// read into memory first.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadBrickedVolumeFile( std::istream &is );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a region of a bricked volume file (.hvol) as an image with the
+  /// size of the region. Only the bricks intersecting the region are read.
+  /// \param url The url of the image to load.
+  /// \param x, y, z The first pixel of the region.
+  /// \param width, height, depth The size of the region.
+  /// \returns A pointer to and Image class containing the data
+  /// of the region. NULL if unsuccessful.
+  H3DUTIL_API Image *loadBrickedVolumeFileRegion( const std::string &url,
+                                                  unsigned int x,
+                                                  unsigned int y,
+                                                  unsigned int z,
+                                                  unsigned int width,
+                                                  unsigned int height,
+                                                  unsigned int depth );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Saves an image as a bricked volume file (.hvol) using
+  /// BrickedVolumeWriter.
+  /// \param url The filename to save to.
+  /// \param image The image to save.
+  /// \param encoding The encoding of the bricks.
+  /// \returns 0 on success.
+  H3DUTIL_API int saveImageAsBrickedVolumeFile( const std::string &url,
+                                                Image *image,
+                                                BrickedVolumeFile::Encoding
+                                                encoding =
+                                                BrickedVolumeFile::ZLIB );
 
 #ifdef HAVE_DCMTK
   /// \ingroup ImageLoaderFunctions
@@ -120,10 +247,40 @@ namespace H3DUtil {
   /// file url specifies. If false, it will look in the same directory
   /// for files of the same image set, and compose them to a 3d image
   /// if they are found.
+  /// \param use_series_index Only used if load_single_file is false. If
+  /// true a DicomSeriesIndex of the directory is used to find the files
+  /// of the same series instead of parsing every file with the same
+  /// prefix. The index is stored in the directory so that later loads only
+  /// have to parse files that are new or have changed. The slices are
+  /// ordered on their position along the slice normal.
+  /// \param native_values If true the pixel values are kept as they are
+  /// stored in the files instead of being rescaled to the output range
+  /// of the DCMTK rendering pipeline, see DicomImage.
   /// \returns A pointer to and Image class containing the data
   /// of the loaded url. NULL if unsuccessful.
   H3DUTIL_API Image *loadDicomFile( const std::string &url, 
-                                    bool load_single_file = true );
+                                    bool load_single_file = true,
+                                    bool use_series_index = false,
+                                    bool native_values = false );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a single DICOM file in memory, as loadDicomFile does with
+  /// load_single_file true. The file is parsed directly from the given
+  /// buffer.
+  /// \param data The content of the file.
+  /// \param size The number of bytes in data.
+  /// \param native_values See loadDicomFile.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadDicomFileFromMemory( const void *data,
+                                              size_t size,
+                                              bool native_values = false );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Loads a single DICOM file from a stream. The rest of the stream is
+  /// read into memory first.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadDicomFile( std::istream &is,
+                                    bool native_values = false );
 #endif
 
   /// Contains information needed by the loadRawImage function
@@ -175,6 +332,50 @@ namespace H3DUtil {
   H3DUTIL_API Image *loadRawImage( const std::string &url,
                                    RawImageInfo &raw_image_info );
 
+  /// \ingroup ImageLoaderFunctions
+  /// Read raw image data from a stream, see loadRawImage. If the stream
+  /// ends before the size of the image the data is assumed to be
+  /// compressed with zlib or gzip.
+  H3DUTIL_API Image *loadRawImage( std::istream &is,
+                                   RawImageInfo &raw_image_info );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Create a PixelImage with a copy of raw image data in memory, see
+  /// loadRawImage. Data smaller than the size of the image is assumed to
+  /// be compressed with zlib or gzip and is decompressed directly from
+  /// the given buffer. Use wrapRawImage to use the data without copying.
+  /// \param data The raw data.
+  /// \param size The number of bytes in data.
+  H3DUTIL_API Image *loadRawImage( const void *data, size_t size,
+                                   RawImageInfo &raw_image_info );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Create a PixelImage that uses raw image data in memory directly,
+  /// without copying it. By default the data is not released by the
+  /// image and must be valid as long as the image is used, a deleter can
+  /// be given to let the image release the data when it is destroyed.
+  /// \param data The raw data.
+  /// \param size The number of bytes in data. NULL is returned if it is
+  /// smaller than the size of the image given by raw_image_info.
+  /// \param deleter The function releasing the data, see PixelImage.
+  /// \param deleter_data The data given to deleter.
+  H3DUTIL_API Image *wrapRawImage( void *data, size_t size,
+                                   RawImageInfo &raw_image_info,
+                                   PixelImage::DataDeleter deleter =
+                                   PixelImage::keepData,
+                                   void *deleter_data = NULL );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Map the raw file pointed to by the parameter url into memory and
+  /// create a PixelImage that uses the mapped data directly instead of
+  /// reading the file. Pages are read from the file when first used, and
+  /// changes to the image data are not written to the file. Compressed
+  /// files cannot be mapped and are loaded with loadRawImage.
+  /// \param offset The position in the file of the first pixel.
+  H3DUTIL_API Image *mapRawImage( const std::string &url,
+                                  RawImageInfo &raw_image_info,
+                                  H3DInt64 offset = 0 );
+
 #ifdef HAVE_OPENEXR
   /// \ingroup ImageLoaderFunctions
   /// Save the specified image as an OpenEXR file with the filename url.
@@ -183,9 +384,38 @@ namespace H3DUtil {
                                      Image& image ); 
 
   /// \ingroup ImageLoaderFunctions
-  /// Read the data from the OpenEXR file pointed to by the parameter url
+  /// Read the data from the OpenEXR file pointed to by the parameter url.
+  /// If the application has not set the global thread count of OpenEXR it
+  /// is set to the number of hardware threads, so that the file is decoded
+  /// in parallel.
   /// \return A new PixelImage containing this data or NULL on error.
   H3DUTIL_API Image* loadOpenEXRImage ( const std::string &url );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Read a region of the OpenEXR file pointed to by the parameter url.
+  /// Only the rows of the file that are part of the region are decoded,
+  /// which makes it possible to load parts of very large images.
+  /// \param url The url of the image to load.
+  /// \param x, y The position of the region in pixels from the bottom
+  /// left corner of the image.
+  /// \param width, height The size of the region in pixels.
+  /// \return A new PixelImage containing the region or NULL on error.
+  H3DUTIL_API Image* loadOpenEXRImage ( const std::string &url,
+                                        int x, int y,
+                                        int width, int height );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Read an OpenEXR file in memory. OpenEXR reads the file directly from
+  /// the given buffer.
+  /// \param data The content of the file.
+  /// \param size The number of bytes in data.
+  /// \return A new PixelImage containing this data or NULL on error.
+  H3DUTIL_API Image* loadOpenEXRImage( const void *data, size_t size );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Read an OpenEXR file from a stream. The stream must support seeking.
+  /// \return A new PixelImage containing this data or NULL on error.
+  H3DUTIL_API Image* loadOpenEXRImage( std::istream &is );
 #endif
 
   /// \ingroup ImageLoaderFunctions
@@ -207,6 +437,104 @@ namespace H3DUtil {
   /// Load a DDS image from the specified input stream. The url parameter is used
   /// only to make error output more identifiable.
   H3DUTIL_API Image *loadDDSImage( std::istream &is, const std::string& url = "<unnamed stream>" );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Load a DDS image in memory. The data is read directly from the given
+  /// buffer.
+  H3DUTIL_API Image *loadDDSImage( const void *data, size_t size );
+
+  /// The properties of an image file found by probeImage without reading
+  /// the pixel data. They are the properties of the Image that loadImage
+  /// returns for the file.
+  struct H3DUTIL_API ImageFileInfo {
+    /// The file formats recognized by probeImage.
+    typedef enum {
+      /// The file could not be probed.
+      UNKNOWN_FORMAT,
+      /// A format read by FreeImage, loaded with loadFreeImage.
+      FREEIMAGE_FORMAT,
+      /// A Nrrd file, loaded with loadNrrdFile.
+      NRRD_FORMAT,
+      /// A bricked volume file, loaded with loadBrickedVolumeFile.
+      BRICKED_VOLUME_FORMAT,
+      /// A DICOM file, loaded with loadDicomFile.
+      DICOM_FORMAT,
+      /// An OpenEXR file, loaded with loadOpenEXRImage.
+      OPENEXR_FORMAT,
+      /// A DDS file, loaded with loadDDSImage.
+      DDS_FORMAT
+    } Format;
+
+    /// Constructor.
+    ImageFileInfo():
+      format( UNKNOWN_FORMAT ),
+      width( 0 ),
+      height( 0 ),
+      depth( 0 ),
+      bits_per_pixel( 0 ),
+      pixel_type( Image::LUMINANCE ),
+      pixel_component_type( Image::UNSIGNED ),
+      compression_type( Image::NO_COMPRESSION ),
+      pixel_size( 1, 1, 1 ) {}
+
+    /// The format of the file.
+    Format format;
+
+    /// Dimensions of the image.
+    unsigned int width, height, depth;
+
+    /// The number of bits per pixel.
+    unsigned int bits_per_pixel;
+
+    /// The pixel type.
+    Image::PixelType pixel_type;
+
+    /// The pixel component type.
+    Image::PixelComponentType pixel_component_type;
+
+    /// The compression of the pixel data.
+    Image::CompressionType compression_type;
+
+    /// The size of the pixel in x, y and z direction in metres.
+    Vec3f pixel_size;
+  };
+
+  /// \ingroup ImageLoaderFunctions
+  /// Get the properties of an image file by reading only its header. The
+  /// format is found from the content of the file. Files in FreeImage
+  /// formats for which FreeImage cannot read the header without the pixels
+  /// are loaded completely to get their properties. Nrrd files are probed
+  /// with NrrdReader, or with teem for files NrrdReader does not support. For DICOM files the
+  /// number of bits per pixel is computed from the header in the same way
+  /// as DCMTK does for the rendered values given by loadDicomFile.
+  /// \param url The url of the image to probe.
+  /// \returns The properties of the image. The format is UNKNOWN_FORMAT
+  /// if the file could not be probed.
+  H3DUTIL_API ImageFileInfo probeImage( const std::string &url );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Load an image with the loader for the format of the file, which is
+  /// found from its content in the same way as by probeImage. The default
+  /// arguments of the loader are used.
+  /// \param url The url of the image to load.
+  /// \returns A pointer to and Image class containing the data
+  /// of the loaded url. NULL if unsuccessful.
+  H3DUTIL_API Image *loadImage( const std::string &url );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Load an image file in memory with the loader for its format, which
+  /// is found from its content. The loaders read the data directly from
+  /// the given buffer.
+  /// \param data The content of the image file.
+  /// \param size The number of bytes in data.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadImage( const void *data, size_t size );
+
+  /// \ingroup ImageLoaderFunctions
+  /// Load an image file from a stream with the loader for its format. The
+  /// rest of the stream is read into memory first.
+  /// \returns A new image, NULL if unsuccessful.
+  H3DUTIL_API Image *loadImage( std::istream &is );
 }
 
 #endif
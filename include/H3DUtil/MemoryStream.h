@@ -0,0 +1,116 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MemoryStream.h
+/// \brief Header file for MemoryInputStream, an input stream reading
+/// from a memory buffer without copying it.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __MEMORYSTREAM_H__
+#define __MEMORYSTREAM_H__
+
+#include <istream>
+#include <streambuf>
+#include <vector>
+#include <cstddef>
+
+namespace H3DUtil {
+
+  /// \class MemoryStreamBuffer
+  /// A read only stream buffer using a memory buffer as its get area. The
+  /// data is not copied and must be valid as long as the stream buffer is
+  /// used. Seeking is supported.
+  class MemoryStreamBuffer: public std::streambuf {
+  public:
+    /// Constructor.
+    /// \param data The data to read.
+    /// \param size The number of bytes in data.
+    MemoryStreamBuffer( const void *data, size_t size ) {
+      char *begin = static_cast< char * >( const_cast< void * >( data ) );
+      setg( begin, begin, begin + size );
+    }
+
+  protected:
+    virtual pos_type seekoff( off_type off,
+                              std::ios_base::seekdir dir,
+                              std::ios_base::openmode which =
+                              std::ios_base::in ) {
+      char *pos;
+      if( dir == std::ios_base::beg ) pos = eback() + off;
+      else if( dir == std::ios_base::cur ) pos = gptr() + off;
+      else pos = egptr() + off;
+      if( !( which & std::ios_base::in ) ||
+          pos < eback() || pos > egptr() ) {
+        return pos_type( off_type( -1 ) );
+      }
+      setg( eback(), pos, egptr() );
+      return pos_type( off_type( pos - eback() ) );
+    }
+
+    virtual pos_type seekpos( pos_type pos,
+                              std::ios_base::openmode which =
+                              std::ios_base::in ) {
+      return seekoff( off_type( pos ), std::ios_base::beg, which );
+    }
+  };
+
+  /// \class MemoryInputStream
+  /// An input stream reading from a memory buffer without copying it, e.g.
+  /// to give image data from an archive or a network cache to the image
+  /// loaders that read from a std::istream. The data must be valid as long
+  /// as the stream is used.
+  class MemoryInputStream: public std::istream {
+  public:
+    /// Constructor.
+    /// \param data The data to read.
+    /// \param size The number of bytes in data.
+    MemoryInputStream( const void *data, size_t size ) :
+      std::istream( NULL ),
+      buffer( data, size ) {
+      rdbuf( &buffer );
+    }
+
+  protected:
+    MemoryStreamBuffer buffer;
+  };
+
+  /// Read the rest of the given stream into data. Used by functions that
+  /// need the whole content of a stream in memory.
+  /// \returns false if nothing could be read.
+  inline bool readWholeStream( std::istream &is,
+                               std::vector< unsigned char > &data ) {
+    data.clear();
+    const size_t chunk_size = 1 << 20;
+    size_t size = 0;
+    while( is.good() ) {
+      data.resize( size + chunk_size );
+      is.read( (char *)&data[size], chunk_size );
+      size += (size_t) is.gcount();
+    }
+    data.resize( size );
+    return size > 0;
+  }
+}
+
+#endif
@@ -0,0 +1,329 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MinMaxGrid.h
+/// \brief Header file for MinMaxGrid, a hierarchical grid of the minimum
+/// and maximum values of blocks of a volume.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __MINMAXGRID_H__
+#define __MINMAXGRID_H__
+
+#include <H3DUtil/Image.h>
+
+#include <vector>
+
+namespace H3DUtil {
+  /// \class VoxelValueReader
+  /// VoxelValueReader reads the values of one pixel component of an image
+  /// as MinMaxGrid does: the stored component values for images in memory
+  /// with integer or 32/64 bit floating point components, and the
+  /// normalized values from getPixel for other images. Code that uses a
+  /// MinMaxGrid reads the volume with it so that the values agree with
+  /// the grid.
+  class H3DUTIL_API VoxelValueReader {
+  public:
+    /// The type of the stored values that are read directly from the
+    /// image data.
+    typedef enum {
+      /// The values are read with getPixel.
+      PIXEL_VALUE,
+      UNSIGNED_8,
+      UNSIGNED_16,
+      UNSIGNED_32,
+      SIGNED_8,
+      SIGNED_16,
+      SIGNED_32,
+      FLOAT_32,
+      FLOAT_64
+    } ValueType;
+
+    /// Constructor.
+    /// \param _image The image to read. Its data must not be changed to
+    /// another buffer while the reader is used.
+    /// \param _component The pixel component to read.
+    VoxelValueReader( Image *_image, unsigned int _component );
+
+    /// Returns the value of voxel (x, y, z).
+    inline H3DFloat operator()( unsigned int x,
+                                unsigned int y,
+                                unsigned int z ) const {
+      return value_func( *this, x, y, z );
+    }
+
+    /// Read the values of n voxels along the x axis, starting at voxel
+    /// (x, y, z), into values.
+    inline void row( unsigned int x, unsigned int y, unsigned int z,
+                     unsigned int n, H3DFloat *values ) const {
+      row_func( *this, x, y, z, n, values );
+    }
+
+    /// Returns the type of the values read from the image data.
+    inline ValueType valueType() const {
+      return value_type;
+    }
+
+    /// Returns the stored value of voxel (x, y, z). T must be the type
+    /// given by valueType(), which must not be PIXEL_VALUE. Lets templated
+    /// code read the values without a function call per voxel.
+    template< class T >
+    inline T storedValue( int x, int y, int z ) const {
+      return *(const T *)( data + z * slice_stride + y * row_stride +
+                           x * pixel_stride );
+    }
+
+  protected:
+    typedef H3DFloat (*ValueFunc)( const VoxelValueReader &reader,
+                                   unsigned int x,
+                                   unsigned int y,
+                                   unsigned int z );
+    typedef void (*RowFunc)( const VoxelValueReader &reader,
+                             unsigned int x,
+                             unsigned int y,
+                             unsigned int z,
+                             unsigned int n,
+                             H3DFloat *values );
+
+    /// Use the stored values of type T.
+    template< class T >
+    void useStoredValues( ValueType type );
+
+    template< class T >
+    static H3DFloat storedValueFunc( const VoxelValueReader &reader,
+                                     unsigned int x,
+                                     unsigned int y,
+                                     unsigned int z );
+
+    template< class T >
+    static void storedRowFunc( const VoxelValueReader &reader,
+                               unsigned int x,
+                               unsigned int y,
+                               unsigned int z,
+                               unsigned int n,
+                               H3DFloat *values );
+
+    static H3DFloat pixelValueFunc( const VoxelValueReader &reader,
+                                    unsigned int x,
+                                    unsigned int y,
+                                    unsigned int z );
+
+    static void pixelRowFunc( const VoxelValueReader &reader,
+                              unsigned int x,
+                              unsigned int y,
+                              unsigned int z,
+                              unsigned int n,
+                              H3DFloat *values );
+
+    Image *image;
+    unsigned int component;
+    ValueType value_type;
+
+    /// The component of the first voxel and the strides of the data when
+    /// the stored values are used.
+    const unsigned char *data;
+    size_t pixel_stride, row_stride, slice_stride;
+
+    ValueFunc value_func;
+    RowFunc row_func;
+  };
+
+  /// \class MinMaxGrid
+  /// MinMaxGrid stores the minimum and maximum value of one pixel
+  /// component for blocks of a volume, e.g. 8x8x8 voxels, and for a
+  /// hierarchy of coarser levels where each block contains 2x2x2 blocks
+  /// of the level below. It is used to skip the parts of a volume that
+  /// cannot contain values of interest when ray casting or searching for
+  /// surfaces.
+  ///
+  /// Positions are given in voxel coordinates where voxel (i, j, k) is at
+  /// position (i, j, k), i.e. texture coordinate t corresponds to
+  /// t * ( width, height, depth ) - 0.5. The range of a block includes the
+  /// voxels on its upper border so that the range also bounds linearly
+  /// interpolated values anywhere inside the block.
+  ///
+  /// The values are read with VoxelValueReader, i.e. they are the stored
+  /// component values for images with integer or 32/64 bit floating point
+  /// components, and the normalized values from getPixel for other images.
+  class H3DUTIL_API MinMaxGrid {
+  public:
+    /// Constructor. Builds the grid in parallel.
+    /// \param _image The image to build the grid for. The image must stay
+    /// valid as long as update is used.
+    /// \param _block_size The size of the finest blocks in voxels.
+    /// \param _component The pixel component to use.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    MinMaxGrid( Image *_image,
+                unsigned int _block_size = 8,
+                unsigned int _component = 0,
+                unsigned int nr_threads = 0 );
+
+    /// Recompute the blocks affected by a change of the voxels in the
+    /// given region and the levels above them.
+    void update( unsigned int x, unsigned int y, unsigned int z,
+                 unsigned int width,
+                 unsigned int height,
+                 unsigned int depth,
+                 unsigned int nr_threads = 0 );
+
+    /// Get the minimum and maximum value of all voxels in a box. The
+    /// result is conservative, i.e. the range of all blocks touching the
+    /// box. Returns false if the box is outside of the volume.
+    /// \param box_min, box_max The corners of the box in voxel coordinates.
+    bool getRange( const Vec3f &box_min, const Vec3f &box_max,
+                   H3DFloat &min_value, H3DFloat &max_value );
+
+    /// Returns true if a box may contain values in the range
+    /// [low, high]. Returns false only if it is certain that no voxel or
+    /// interpolated value in the box is in the range.
+    /// \param box_min, box_max The corners of the box in voxel coordinates.
+    bool mayContain( const Vec3f &box_min, const Vec3f &box_max,
+                     H3DFloat low, H3DFloat high );
+
+    /// Find the next interval along a ray that may contain values in the
+    /// range [low, high].
+    /// \param origin The origin of the ray in voxel coordinates.
+    /// \param direction The direction of the ray in voxel coordinates.
+    /// \param t_start, t_end The part of the ray to search, the ray is
+    /// origin + t * direction.
+    /// \param low, high The range of values to look for.
+    /// \param t0, t1 Set to the start and end of the interval. Between
+    /// t_start and t0 the ray only passes blocks that cannot contain the
+    /// values. The interval ends where the ray enters a block that cannot
+    /// contain the values or at t_end.
+    /// \returns false if no part of the ray may contain the values.
+    bool nextInterval( const Vec3f &origin, const Vec3f &direction,
+                       H3DFloat t_start, H3DFloat t_end,
+                       H3DFloat low, H3DFloat high,
+                       H3DFloat &t0, H3DFloat &t1 );
+
+    /// Returns the number of levels in the hierarchy. Level 0 has the
+    /// finest blocks and the highest level has a single block.
+    inline unsigned int nrLevels() {
+      return (unsigned int) levels.size();
+    }
+
+    /// Returns the number of blocks along each axis on a level.
+    inline void getLevelSize( unsigned int level, unsigned int &x,
+                              unsigned int &y, unsigned int &z ) {
+      x = levels[level].nx;
+      y = levels[level].ny;
+      z = levels[level].nz;
+    }
+
+    /// Get the range of a block.
+    inline void getBlockRange( unsigned int level, unsigned int x,
+                               unsigned int y, unsigned int z,
+                               H3DFloat &min_value, H3DFloat &max_value ) {
+      Level &l = levels[level];
+      unsigned int i = ( z * l.ny + y ) * l.nx + x;
+      min_value = l.min_values[i];
+      max_value = l.max_values[i];
+    }
+
+    /// Returns the size in voxels of the blocks on level 0.
+    inline unsigned int blockSize() {
+      return block_size;
+    }
+
+    /// Returns the size in voxels of the blocks on the given level.
+    inline unsigned int blockSize( unsigned int level ) {
+      return block_size << level;
+    }
+
+  protected:
+    /// The blocks of one level of the hierarchy.
+    struct Level {
+      /// The number of blocks along each axis.
+      unsigned int nx, ny, nz;
+      /// The minimum and maximum value of each block, with x varying
+      /// fastest.
+      std::vector< H3DFloat > min_values;
+      std::vector< H3DFloat > max_values;
+    };
+
+    /// Set up the levels for the size of the image.
+    void initLevels();
+
+    /// Compute the range of a level 0 block from the image.
+    void computeBlock( unsigned int x, unsigned int y, unsigned int z );
+
+    /// Compute the range of a block from the blocks of the level below.
+    void combineBlock( unsigned int level,
+                       unsigned int x, unsigned int y, unsigned int z );
+
+    /// Compute the blocks of a level in the given block range.
+    void computeBlocks( unsigned int level,
+                        unsigned int x0, unsigned int y0, unsigned int z0,
+                        unsigned int x1, unsigned int y1, unsigned int z1,
+                        unsigned int nr_threads );
+
+    /// Callback for parallelFor computing a range of rows of blocks.
+    static void computeBlockRows( unsigned int begin,
+                                  unsigned int end,
+                                  void *data );
+
+    /// Extend min_value and max_value with the range of the parts of
+    /// the given block that are inside the level 0 block range [b0, b1].
+    void rangeInBlocks( unsigned int level,
+                        unsigned int x, unsigned int y, unsigned int z,
+                        const unsigned int *b0, const unsigned int *b1,
+                        H3DFloat &min_value, H3DFloat &max_value );
+
+    /// Returns true if the parts of the given block that are inside the
+    /// level 0 block range [b0, b1] may contain values in [low, high].
+    bool blocksMayContain( unsigned int level,
+                           unsigned int x, unsigned int y, unsigned int z,
+                           const unsigned int *b0, const unsigned int *b1,
+                           H3DFloat low, H3DFloat high );
+
+    /// Get the level 0 block range of a box in voxel coordinates. Returns
+    /// false if the box is outside of the volume.
+    bool boxToBlocks( const Vec3f &box_min, const Vec3f &box_max,
+                      unsigned int *b0, unsigned int *b1 );
+
+    /// Returns true if the block may contain values in [low, high].
+    inline bool blockMayContain( unsigned int level, unsigned int x,
+                                 unsigned int y, unsigned int z,
+                                 H3DFloat low, H3DFloat high ) {
+      Level &l = levels[level];
+      unsigned int i = ( z * l.ny + y ) * l.nx + x;
+      return l.max_values[i] >= low && l.min_values[i] <= high;
+    }
+
+    /// The image.
+    Image *image;
+
+    /// The size of the blocks on level 0.
+    unsigned int block_size;
+
+    /// The pixel component to use.
+    unsigned int component;
+
+    /// The levels, from the finest to the coarsest.
+    std::vector< Level > levels;
+  };
+}
+
+#endif
@@ -0,0 +1,462 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file NrrdFile.h
+/// \brief Header file for NrrdReader and NrrdWriter, streaming readers and
+/// writers for the Nrrd file format.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __NRRDFILE_H__
+#define __NRRDFILE_H__
+
+#include <H3DUtil/Image.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace H3DUtil {
+
+  /// \class NrrdFile
+  /// Base class for NrrdReader and NrrdWriter containing the properties
+  /// of a Nrrd file that can be represented as an Image.
+  ///
+  /// The data of a Nrrd file is always handled as a sequence of slices
+  /// along the last (depth) axis. Compressed data can be divided into
+  /// blocks that are compressed independently of each other and stored as
+  /// concatenated gzip members or bzip2 streams. The compressed size of
+  /// each block is stored in the header as the key/value pair
+  /// "H3DUtil_block_sizes", which allows the blocks to be decompressed in
+  /// parallel and single slices to be read without decompressing the whole
+  /// file. Files without this key are decompressed as one stream.
+  class H3DUTIL_API NrrdFile {
+  public:
+    /// The encodings of the data that are supported.
+    typedef enum {
+      RAW,
+      GZIP,
+      BZIP2
+    } Encoding;
+
+    /// Returns true if the given encoding is supported, i.e. H3DUtil
+    /// was built with the library needed for the compression.
+    static bool isEncodingSupported( Encoding e );
+
+    /// Destructor.
+    virtual ~NrrdFile() {}
+
+    /// Returns the width of the image in pixels.
+    inline unsigned int width() { return w; }
+
+    /// Returns the height of the image in pixels.
+    inline unsigned int height() { return h; }
+
+    /// Returns the depth of the image in pixels.
+    inline unsigned int depth() { return d; }
+
+    /// Returns the number of bits used for each pixel in the image.
+    inline unsigned int bitsPerPixel() { return bits_per_pixel; }
+
+    /// Returns the PixelType of the image.
+    inline Image::PixelType pixelType() { return pixel_type; }
+
+    /// Returns the PixelComponentType of the image.
+    inline Image::PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    inline const Vec3f &pixelSize() { return pixel_size; }
+
+    /// Returns the encoding of the data.
+    inline Encoding encoding() { return data_encoding; }
+
+    /// Returns the number of bytes in one slice of the image.
+    inline H3DInt64 sliceSize() {
+      return (H3DInt64) w * h * ( bits_per_pixel / 8 );
+    }
+
+    /// Set the number of threads to use when compressing or decompressing
+    /// blocks. 0 means one thread for each hardware thread.
+    inline void setNrThreads( unsigned int nr_threads ) {
+      nr_worker_threads = nr_threads;
+    }
+
+    /// Returns a message describing the last error.
+    inline const std::string &getError() { return error_message; }
+
+  protected:
+    /// Constructor.
+    NrrdFile();
+
+    /// Set the error message returned by getError().
+    void setError( const std::string &message );
+
+    /// The name of the encoding as written in a Nrrd header.
+    static std::string encodingName( Encoding e );
+
+    /// The number of components in each pixel for the pixel type.
+    static unsigned int nrComponents( Image::PixelType type );
+
+    /// Dimensions of the image.
+    unsigned int w, h, d;
+
+    /// Number of bits per pixel.
+    unsigned int bits_per_pixel;
+
+    /// The pixel type.
+    Image::PixelType pixel_type;
+
+    /// The pixel component type.
+    Image::PixelComponentType pixel_component_type;
+
+    /// The size of a pixel in metres.
+    Vec3f pixel_size;
+
+    /// The encoding of the data.
+    Encoding data_encoding;
+
+    /// Number of threads to use, 0 for the number of hardware threads.
+    unsigned int nr_worker_threads;
+
+    /// The uncompressed size of each block in bytes, 0 if the data is not
+    /// divided into blocks.
+    H3DInt64 block_size;
+
+    /// The compressed size of each block in bytes.
+    std::vector< H3DInt64 > block_sizes;
+
+    /// The last error message.
+    std::string error_message;
+  };
+
+  /// \class NrrdReader
+  /// Reads the Nrrd file format without depending on teem. Raw, gzip and
+  /// bzip2 encoded data is supported, both with attached headers and with
+  /// detached headers (.nhdr) that refer to a single data file.
+  ///
+  /// The header is read by open() and the data can then be read slice
+  /// by slice into memory allocated by the caller, without intermediate
+  /// copies of the whole data. Data in other byte order than the native
+  /// one is converted. Compressed files divided into blocks (see NrrdFile)
+  /// are decompressed in parallel.
+  ///
+  /// A Nrrd file is interpreted as an image in the same way as by
+  /// loadNrrdFile. A four dimensional file has the pixel components on the
+  /// first axis, otherwise the axes are width, height and depth.
+  class H3DUTIL_API NrrdReader: public NrrdFile {
+  public:
+    /// Function called by readSlices each time more of the requested
+    /// slices have been read.
+    /// \param reader The reader.
+    /// \param nr_slices The number of slices from the first requested
+    /// slice that are now completely read into the destination.
+    /// \param data The data given to setProgressCallback.
+    /// \returns false to cancel the read, readSlices then returns false.
+    typedef bool (*ProgressCallback)( NrrdReader *reader,
+                                      unsigned int nr_slices,
+                                      void *data );
+
+    /// Constructor.
+    NrrdReader();
+
+    /// Read the header of the given file. Returns false if the file could
+    /// not be read or uses features that are not supported, in which case
+    /// getError() describes the problem.
+    bool open( const std::string &url );
+
+    /// Read the header of a Nrrd file in memory. The data is read directly
+    /// from the given buffer, which must be valid until another file is
+    /// opened or the reader is destroyed. A detached header is supported
+    /// if the data file it refers to exists.
+    /// \param data The content of the file.
+    /// \param size The number of bytes in data.
+    /// \param name The name used in error messages and to find detached
+    /// data files relative to.
+    bool open( const void *data, size_t size,
+               const std::string &name = "<memory>" );
+
+    /// Read a Nrrd file from a stream. The rest of the stream is read into
+    /// memory and the file is then read from there as by the open function
+    /// taking a buffer.
+    bool open( std::istream &is, const std::string &name = "<stream>" );
+
+    /// Returns true if the last call to open failed because the file uses
+    /// Nrrd features that NrrdReader does not support, e.g. ascii or hex
+    /// encodings, block types or data divided into several files.
+    inline bool hasUnsupportedFeature() { return unsupported_feature; }
+
+    /// Returns the path of the file containing the data.
+    inline const std::string &getDataFilename() { return data_filename; }
+
+    /// Set a function to call during readSlices as the slices are read.
+    /// Uncompressed data and data divided into blocks are then read in
+    /// chunks of a few MB or one block per thread, data compressed as one
+    /// stream reports progress as it is decompressed. NULL removes the
+    /// callback.
+    inline void setProgressCallback( ProgressCallback callback,
+                                     void *data = NULL ) {
+      progress_callback = callback;
+      progress_data = data;
+    }
+
+    /// Read nr_slices slices starting with first_slice into data, which
+    /// must have room for nr_slices * sliceSize() bytes.
+    /// Returns true on success.
+    bool readSlices( unsigned int first_slice,
+                     unsigned int nr_slices,
+                     void *data );
+
+    /// Read the whole image. Returns a new PixelImage, NULL on failure.
+    Image *readImage();
+
+    /// Read the slices [first_slice, first_slice + nr_slices) as an image
+    /// of depth nr_slices. Returns a new PixelImage, NULL on failure.
+    Image *readSlab( unsigned int first_slice, unsigned int nr_slices );
+
+  protected:
+    /// Reset the state from any previously opened file.
+    void resetHeader();
+
+    /// Read the header from is and find the data. url is the name of the
+    /// file the header is read from.
+    bool readHeader( std::istream &is, const std::string &url );
+
+    /// Open a stream for reading the data, from memory_data if the data is
+    /// in memory and from data_filename otherwise.
+    std::istream *openDataStream();
+
+    /// Parse one field of the header. Returns false on errors.
+    bool parseField( const std::string &field, const std::string &value,
+                     const std::string &url );
+
+    /// Parse one key/value pair of the header.
+    void parseKeyValue( const std::string &key, const std::string &value );
+
+    /// Set up the image properties after the header has been read.
+    bool setupImage( const std::string &url );
+
+    /// Read uncompressed data.
+    bool readRaw( H3DInt64 offset, H3DInt64 size, unsigned char *data );
+
+    /// Decompress data without using blocks.
+    bool readStream( H3DInt64 offset, H3DInt64 size, unsigned char *data );
+
+    /// Decompress data divided into blocks in parallel.
+    bool readBlocks( H3DInt64 offset, H3DInt64 size, unsigned char *data );
+
+    /// Callback for parallelFor decompressing a range of blocks.
+    static void readBlockRange( unsigned int begin,
+                                unsigned int end,
+                                void *data );
+
+    /// Returns read_failed, locking failed_lock.
+    bool readFailed();
+
+    /// Set read_failed, locking failed_lock.
+    void setReadFailed();
+
+    /// Called when the first size bytes of the destination data of the
+    /// current read have been read. Converts the byte order of the
+    /// slices completed since the last call and calls the progress
+    /// callback. Returns false if the read was cancelled.
+    bool reportProgress( unsigned char *data, H3DInt64 size );
+
+    /// The file containing the data.
+    std::string data_filename;
+
+    /// The file given to open() if it was given as a buffer or a stream,
+    /// NULL otherwise. stream_data holds the content of a stream.
+    const unsigned char *memory_data;
+    H3DInt64 memory_size;
+    std::vector< unsigned char > stream_data;
+
+    /// True if the data is attached to a header in memory_data.
+    bool data_in_memory;
+
+    /// Offset of the (possibly compressed) data in data_filename.
+    H3DInt64 data_offset;
+
+    /// Number of lines and bytes to skip in the data file.
+    H3DInt64 line_skip, byte_skip;
+
+    /// True if the data has another byte order than the native one.
+    bool swap_bytes;
+
+    /// True if the last open failed because of an unsupported feature.
+    bool unsupported_feature;
+
+    /// Values of the header fields needed to set up the image.
+    std::string type_string;
+    unsigned int dimension;
+    std::vector< H3DInt64 > sizes;
+    std::vector< double > spacings;
+    std::vector< double > direction_lengths;
+    std::vector< std::string > space_units;
+    bool has_encoding;
+
+    /// Offsets in the data file of each compressed block.
+    std::vector< H3DInt64 > block_offsets;
+
+    /// Offset of the first byte of the current read in the data and the
+    /// destination of the read, used by readBlockRange.
+    H3DInt64 read_offset;
+    H3DInt64 read_size;
+    unsigned char *read_data;
+
+    /// True if a block of the current read failed. Shared by the threads
+    /// of readBlocks and only accessed with failed_lock locked.
+    bool read_failed;
+    MutexLock failed_lock;
+
+    /// The progress callback and its data.
+    ProgressCallback progress_callback;
+    void *progress_data;
+
+    /// The number of slices of the current read that have been reported
+    /// to the progress callback.
+    unsigned int progress_slices;
+  };
+
+  /// \class NrrdWriter
+  /// Writes the Nrrd file format without depending on teem. The data can
+  /// be written with raw, gzip or bzip2 encoding and is given slice by
+  /// slice, so large volumes can be written without first creating the
+  /// whole image in memory. Compressed data is divided into blocks that
+  /// are compressed in parallel, see NrrdFile.
+  ///
+  /// If the filename ends with .nhdr a detached header is written and the
+  /// data is written to a file with the same name with the extension
+  /// .raw, .raw.gz or .raw.bz2 depending on the encoding.
+  class H3DUTIL_API NrrdWriter: public NrrdFile {
+  public:
+    /// Constructor.
+    NrrdWriter();
+
+    /// Destructor. Closes the file if open.
+    ~NrrdWriter();
+
+    /// Set the uncompressed size in bytes of each independently
+    /// compressed block. Must be called before open(). If 0 the data is
+    /// compressed as one stream, which gives slightly smaller files and
+    /// maximum compatibility with other readers but no parallel
+    /// compression or decompression. Default is 4 MB.
+    inline void setBlockSize( H3DInt64 size ) {
+      block_size = size;
+    }
+
+    /// Set the compression level, 1-9 or -1 for the default level of the
+    /// compression library. Must be called before open().
+    inline void setCompressionLevel( int level ) {
+      compression_level = level;
+    }
+
+    /// Open the file and write the header.
+    /// \param url The file to write. A detached header is written if the
+    /// name ends with .nhdr.
+    /// \param width, height, depth The dimensions of the image.
+    /// \param _bits_per_pixel The number of bits per pixel.
+    /// \param _pixel_type The pixel type.
+    /// \param _pixel_component_type The pixel component type.
+    /// \param _pixel_size The size of a pixel in metres.
+    /// \param encoding The encoding of the data.
+    /// \returns true on success.
+    bool open( const std::string &url,
+               unsigned int width,
+               unsigned int height,
+               unsigned int depth,
+               unsigned int _bits_per_pixel,
+               Image::PixelType _pixel_type,
+               Image::PixelComponentType _pixel_component_type,
+               const Vec3f &_pixel_size,
+               Encoding encoding = RAW );
+
+    /// Write the next nr_slices slices. data must contain
+    /// nr_slices * sliceSize() bytes. Returns true on success.
+    bool writeSlices( const void *data, unsigned int nr_slices );
+
+    /// Write the rest of the data and close the file. All slices must
+    /// have been written. Returns true on success.
+    bool close();
+
+  protected:
+    /// Compress and write nr_blocks full blocks from data in parallel.
+    bool writeBlocks( const unsigned char *data, unsigned int nr_blocks );
+
+    /// Compress and write data as one block.
+    bool writeBlock( const unsigned char *data, H3DInt64 size );
+
+    /// Callback for parallelFor compressing a range of blocks.
+    static void compressBlockRange( unsigned int begin,
+                                    unsigned int end,
+                                    void *data );
+
+    /// Write the header to os. If block_sizes_pos is not NULL it is
+    /// set to the position of the block sizes in the stream.
+    bool writeHeader( std::ostream &os,
+                      const std::string &data_file,
+                      std::streamoff *block_sizes_pos );
+
+    /// The compression level.
+    int compression_level;
+
+    /// The stream of the header file.
+    std::ofstream header_stream;
+
+    /// The stream of the data file if a detached header is written.
+    std::ofstream data_stream;
+
+    /// The stream the data is written to, either header_stream or
+    /// data_stream.
+    inline std::ofstream &dataStream() {
+      return detached_header ? data_stream : header_stream;
+    }
+
+    /// True if the header and data are in separate files.
+    bool detached_header;
+
+    /// Position in header_stream of the block sizes.
+    std::streamoff block_sizes_pos;
+
+    /// Number of bytes of data written so far.
+    H3DInt64 bytes_written;
+
+    /// Data of an incomplete block waiting for more data.
+    std::vector< unsigned char > pending_data;
+
+    /// Compression state used when the data is compressed as one stream.
+    void *stream_codec;
+
+    /// Input and output of the blocks compressed by compressBlockRange.
+    const unsigned char *compress_input;
+    std::vector< std::vector< unsigned char > > compressed_blocks;
+
+    /// True if a block failed to compress. Shared by the threads of
+    /// writeBlocks and only accessed with failed_lock locked.
+    bool compress_failed;
+    MutexLock failed_lock;
+  };
+}
+
+#endif
@@ -0,0 +1,259 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file PagedImage.h
+/// \brief Header file for PagedImage, an Image that keeps only part of a
+/// bricked volume file in memory.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __PAGEDIMAGE_H__
+#define __PAGEDIMAGE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/BrickedVolumeFile.h>
+#include <H3DUtil/Exception.h>
+
+#include <list>
+
+namespace H3DUtil {
+  /// \class PagedImage
+  /// PagedImage is an Image that reads its data from a bricked volume
+  /// file (see BrickedVolumeFile) when it is needed. Bricks are read when a
+  /// voxel in them is accessed and are kept in a cache of bounded size
+  /// where the least recently used brick is removed first. This makes it
+  /// possible to use volumes that are larger than the available memory.
+  ///
+  /// getElement, and thereby getPixel and getSample, can be called from
+  /// several threads at the same time. If several threads need the same
+  /// brick it is only read once. Bricks can also be read in advance with
+  /// the prefetch functions, by a background thread shared by all
+  /// PagedImage instances.
+  ///
+  /// The data of the image is never in memory as a whole, so getImageData
+  /// returns NULL and functions that use it directly, e.g.
+  /// convertToNormalizedFloatData, cannot be used. The image is read only,
+  /// setElement does nothing.
+  class H3DUTIL_API PagedImage: public Image {
+  public:
+    /// Thrown when the bricked volume file could not be opened.
+    H3D_VALUE_EXCEPTION( std::string, CouldNotOpenPagedImage );
+
+    /// Statistics about the use of the brick cache.
+    struct CacheStatistics {
+      /// Constructor.
+      CacheStatistics():
+        hits( 0 ),
+        misses( 0 ),
+        prefetched_bricks( 0 ),
+        evicted_bricks( 0 ),
+        bytes_paged( 0 ),
+        bytes_read( 0 ) {}
+
+      /// The fraction of the brick accesses that were found in the cache.
+      inline double hitRate() const {
+        return hits + misses > 0 ? (double)hits / ( hits + misses ) : 0;
+      }
+
+      /// The number of accesses to bricks that were in the cache.
+      H3DInt64 hits;
+      /// The number of accesses to bricks that had to be read.
+      H3DInt64 misses;
+      /// The number of bricks read by the prefetch thread.
+      H3DInt64 prefetched_bricks;
+      /// The number of bricks removed from the cache to make room.
+      H3DInt64 evicted_bricks;
+      /// The number of bytes of uncompressed brick data read.
+      H3DInt64 bytes_paged;
+      /// The number of bytes read from the file.
+      H3DInt64 bytes_read;
+    };
+
+    /// Constructor.
+    /// \param url The bricked volume file to use.
+    /// \param _cache_size The maximum number of bytes of brick data to
+    /// keep in memory. At least one brick is always kept.
+    PagedImage( const std::string &url,
+                H3DInt64 _cache_size = H3DInt64( 512 ) << 20 );
+
+    /// Destructor.
+    virtual ~PagedImage();
+
+    /// Returns the width of the image in pixels.
+    virtual unsigned int width() {
+      return reader.width();
+    }
+
+    /// Returns the height of the image in pixels.
+    virtual unsigned int height() {
+      return reader.height();
+    }
+
+    /// Returns the depth of the image in pixels.
+    virtual unsigned int depth() {
+      return reader.depth();
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    virtual Vec3f pixelSize() {
+      return reader.pixelSize();
+    }
+
+    /// Returns the number of bits used for each pixel in the image.
+    virtual unsigned int bitsPerPixel() {
+      return reader.bitsPerPixel();
+    }
+
+    /// Returns the PixelType of the image.
+    virtual PixelType pixelType() {
+      return reader.pixelType();
+    }
+
+    /// Returns the PixelComponentType of the image.
+    virtual PixelComponentType pixelComponentType() {
+      return reader.pixelComponentType();
+    }
+
+    /// Returns NULL since the data is not in memory.
+    virtual void *getImageData() {
+      return NULL;
+    }
+
+    /// Get the value of a pixel/voxel, reading the brick containing it
+    /// if it is not in the cache.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Does nothing, the image is read only.
+    virtual void setElement( void * /*value*/,
+                             int /*x*/ = 0, int /*y*/ = 0, int /*z*/ = 0 ) {}
+
+    /// Copy a region of the image into data, which must have room for
+    /// width * height * depth pixels. The bricks are read through the cache.
+    /// Returns false if a brick could not be read.
+    bool getRegion( unsigned int x, unsigned int y, unsigned int z,
+                    unsigned int width,
+                    unsigned int height,
+                    unsigned int depth,
+                    void *data );
+
+    /// Read the bricks intersecting the given region in the background.
+    /// Replaces the prefetch requests that have not been started yet.
+    void prefetchRegion( unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int width,
+                         unsigned int height,
+                         unsigned int depth );
+
+    /// Read the bricks that will be visited when moving from the given
+    /// position in the given direction in the background, e.g. when
+    /// stepping through slices or following a ray.
+    /// Replaces the prefetch requests that have not been started yet.
+    /// \param position The start position in pixels.
+    /// \param direction The direction of the traversal in pixels.
+    /// \param nr_bricks The maximum number of bricks to read.
+    void prefetchDirection( const Vec3f &position,
+                            const Vec3f &direction,
+                            unsigned int nr_bricks = 4 );
+
+    /// Returns the maximum number of bytes of brick data in the cache.
+    inline H3DInt64 cacheSize() {
+      return cache_size;
+    }
+
+    /// Set the maximum number of bytes of brick data in the cache.
+    void setCacheSize( H3DInt64 size );
+
+    /// Returns the number of bytes of brick data currently in the cache.
+    H3DInt64 cachedBytes();
+
+    /// Remove all bricks from the cache.
+    void clearCache();
+
+    /// Returns the statistics of the cache.
+    CacheStatistics getCacheStatistics();
+
+    /// Reset the statistics of the cache.
+    void resetCacheStatistics();
+
+    /// Returns the reader of the bricked volume file.
+    inline BrickedVolumeReader &getReader() {
+      return reader;
+    }
+
+    /// Read a brick into the cache if it is not already there. Used by the
+    /// prefetch thread.
+    void prefetchBrick( unsigned int index );
+
+  protected:
+    /// A brick in the cache.
+    struct CacheEntry {
+      /// Constructor.
+      CacheEntry(): loading( false ) {}
+
+      /// The brick data, empty if the brick is not in the cache.
+      std::vector< unsigned char > data;
+      /// True while the brick is being read.
+      bool loading;
+      /// The position of the brick in lru_list, if in the cache.
+      std::list< unsigned int >::iterator lru_position;
+    };
+
+    /// Returns the data of the given brick, reading it if it is not in
+    /// the cache. Must be called with cache_lock locked and the returned
+    /// data is only valid until it is unlocked. Returns NULL if the
+    /// brick could not be read.
+    /// \param prefetch True if called by the prefetch thread, in which case
+    /// the access is not counted as a hit or miss.
+    unsigned char *getBrick( unsigned int index, bool prefetch = false );
+
+    /// Remove least recently used bricks until the cache size is within
+    /// the limit. The brick keep is never removed.
+    void evictBricks( unsigned int keep );
+
+    /// Limit the number of bricks to what fits in half of the cache and
+    /// give them to the prefetch thread.
+    void setPrefetchBricks( std::vector< unsigned int > &bricks );
+
+    /// The reader of the file.
+    BrickedVolumeReader reader;
+
+    /// The maximum number of bytes of brick data in the cache.
+    H3DInt64 cache_size;
+
+    /// The number of bytes of brick data in the cache.
+    H3DInt64 cached_bytes;
+
+    /// Protects the cache and the statistics.
+    ConditionLock cache_lock;
+
+    /// One entry for each brick in the file.
+    std::vector< CacheEntry > cache;
+
+    /// The bricks in the cache, the most recently used first.
+    std::list< unsigned int > lru_list;
+
+    /// The cache statistics.
+    CacheStatistics statistics;
+  };
+}
+
+#endif
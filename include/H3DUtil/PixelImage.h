@@ -39,6 +39,22 @@ namespace H3DUtil {
   /// width * height * depth and the values for the pixels must be supplied.
   class H3DUTIL_API PixelImage: public Image {
   public:
+    /// Function used to release image data that the PixelImage has taken
+    /// ownership of. It is called with the data pointer and the
+    /// deleter_data pointer given together with the data.
+    typedef void (*DataDeleter)( unsigned char *data, void *deleter_data );
+
+    /// DataDeleter for data allocated with new[]. This is what is used
+    /// when no deleter is given.
+    static void deleteArrayData( unsigned char *data, void *deleter_data );
+
+    /// DataDeleter for data allocated with malloc.
+    static void freeData( unsigned char *data, void *deleter_data );
+
+    /// DataDeleter that does nothing. Used to wrap data owned by someone
+    /// else, which must then stay valid as long as the PixelImage uses it.
+    static void keepData( unsigned char *data, void *deleter_data );
+
     /// Constructor. 
     ///
     PixelImage( unsigned int _width,
@@ -52,6 +68,22 @@ namespace H3DUtil {
                 const Vec3f &_pixel_size = Vec3f( 0, 0, 0 ),
                 CompressionType _compression_type = NO_COMPRESSION );
 
+    /// Constructor. The image takes ownership of data and calls
+    /// deleter( data, deleter_data ) when the data is no longer used,
+    /// which makes it possible to use data allocated by other libraries or
+    /// memory mapped files without copying it.
+    PixelImage( unsigned int _width,
+                unsigned int _height,
+                unsigned int _depth,
+                unsigned int _bits_per_pixel,
+                PixelType _pixel_type,
+                PixelComponentType _pixel_component_type,
+                unsigned char *data,
+                DataDeleter deleter,
+                void *deleter_data = NULL,
+                const Vec3f &_pixel_size = Vec3f( 0, 0, 0 ),
+                CompressionType _compression_type = NO_COMPRESSION );
+
     /// Constructor. 
     /// An image of the size given will be created. The data will be 
     /// undefined until set by the user using e.g. setPixel methods.
@@ -74,8 +106,7 @@ namespace H3DUtil {
                 unsigned int new_depth );
 
     ~PixelImage() {
-      if( image_data )
-        delete[] image_data;
+      deleteImageData();
     }
 
     /// Returns the width of the image in pixels.
@@ -159,11 +190,37 @@ namespace H3DUtil {
       pixel_component_type = pct;
     }
         
-    /// Set a pointer to the raw image data. 
+    /// Returns the number of bytes between the starts of two rows in the
+    /// image data, as set with setStrides.
+    virtual size_t rowStride() {
+      return row_stride ? row_stride : Image::rowStride();
+    }
+
+    /// Returns the number of bytes between the starts of two slices in
+    /// the image data, as set with setStrides.
+    virtual size_t sliceStride() {
+      return slice_stride ? slice_stride : rowStride() * h;
+    }
+
+    /// Set the layout of the image data, e.g. to use a buffer with padded
+    /// rows without repacking it. A value of 0 gives the default layout,
+    /// rows and slices following each other without padding.
+    /// \param _row_stride The number of bytes from the start of one row to
+    /// the next.
+    /// \param _slice_stride The number of bytes from the start of one slice
+    /// to the next.
+    inline void setStrides( size_t _row_stride, size_t _slice_stride = 0 ) {
+      row_stride = _row_stride;
+      slice_stride = _slice_stride;
+    }
+
+    /// Set a pointer to the raw image data. If copy_data is false the
+    /// image takes ownership of the data, which must have been allocated
+    /// with new[].
     virtual void setImageData( unsigned char * data, bool copy_data = false ) {
-      if( image_data ) delete[] image_data;
+      deleteImageData();
       if( copy_data ) {
-        unsigned int size = (w * h * d * bits_per_pixel)/8;
+        size_t size = sliceStride() * d;
         image_data = new unsigned char[ size ];
         memcpy( image_data, data, size );
       } else {
@@ -171,7 +228,47 @@ namespace H3DUtil {
       }
     }
 
+    /// Set a pointer to the raw image data. The image takes ownership of
+    /// the data and calls deleter( data, deleter_data ) when the data is
+    /// no longer used.
+    void setImageData( unsigned char *data,
+                       DataDeleter deleter,
+                       void *deleter_data = NULL ) {
+      deleteImageData();
+      image_data = data;
+      data_deleter = deleter;
+      data_deleter_data = deleter_data;
+    }
+
+    /// Give the image data back to the caller, who becomes responsible
+    /// for releasing it. The image is left without data.
+    /// \param deleter If not NULL, set to the function that releases the
+    /// data, NULL if it was allocated with new[].
+    /// \param deleter_data If not NULL, set to the data for deleter.
+    /// \returns The image data.
+    inline unsigned char *releaseImageData( DataDeleter *deleter = NULL,
+                                            void **deleter_data = NULL ) {
+      unsigned char *data = image_data;
+      if( deleter ) *deleter = data_deleter;
+      if( deleter_data ) *deleter_data = data_deleter_data;
+      image_data = NULL;
+      data_deleter = NULL;
+      data_deleter_data = NULL;
+      return data;
+    }
+
   protected:
+    /// Release the image data with its deleter.
+    inline void deleteImageData() {
+      if( image_data ) {
+        if( data_deleter ) data_deleter( image_data, data_deleter_data );
+        else delete[] image_data;
+        image_data = NULL;
+      }
+      data_deleter = NULL;
+      data_deleter_data = NULL;
+    }
+
     unsigned int w, h, d;
     unsigned int bits_per_pixel;
     PixelType pixel_type;
@@ -179,6 +276,14 @@ namespace H3DUtil {
     Vec3f pixel_size;
     CompressionType compression_type;
     unsigned char *image_data;
+
+    /// The layout of image_data, 0 for the default layout.
+    size_t row_stride;
+    size_t slice_stride;
+
+    /// The function used to release image_data, NULL for delete[].
+    DataDeleter data_deleter;
+    void *data_deleter_data;
   };
 
     
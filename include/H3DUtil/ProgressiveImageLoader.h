@@ -0,0 +1,230 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ProgressiveImageLoader.h
+/// \brief Header file for ProgressiveImageLoader, which loads volumes
+/// slice by slice in a background thread.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __PROGRESSIVEIMAGELOADER_H__
+#define __PROGRESSIVEIMAGELOADER_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Threads.h>
+
+#include <string>
+#include <vector>
+
+namespace H3DUtil {
+
+  class NrrdReader;
+  class BrickedVolumeReader;
+
+  /// \class ProgressiveImageLoader
+  /// ProgressiveImageLoader loads a volume in a background thread into a
+  /// PixelImage that is allocated with its final size before any data is
+  /// read. The slices are filled in order starting with slice 0 and the
+  /// number of slices that have been completely loaded is published as
+  /// the loading progresses, so that the image can be rendered and used
+  /// before the whole volume has been read. Slices that have not been
+  /// loaded yet contain zeros.
+  ///
+  /// Nrrd files that can be read by NrrdReader, bricked volume files and
+  /// DICOM series are loaded progressively. Other files are loaded with
+  /// H3DUtil::loadImage and become available all at once, getImage()
+  /// returns NULL until then.
+  ///
+  /// \code
+  /// ProgressiveImageLoader loader;
+  /// if( loader.load( "volume.nrrd" ) ) {
+  ///   Image *image = loader.getImage();
+  ///   // slices [0, loader.nrSlicesLoaded()) can be used
+  /// }
+  /// \endcode
+  class H3DUTIL_API ProgressiveImageLoader {
+  public:
+    /// Function called from the loading thread each time more slices have
+    /// been loaded and once when the loading has ended, with isDone()
+    /// true.
+    /// \param loader The loader.
+    /// \param nr_slices The number of slices loaded so far.
+    /// \param data The data given to setProgressCallback.
+    typedef void (*ProgressCallback)( ProgressiveImageLoader *loader,
+                                      unsigned int nr_slices,
+                                      void *data );
+
+    /// Constructor.
+    ProgressiveImageLoader();
+
+    /// Destructor. Cancels the loading and waits for the loading thread
+    /// to end. The image stays valid as long as it is referenced.
+    ~ProgressiveImageLoader();
+
+    /// Set the function to call as slices are loaded. Must be set before
+    /// load is called to be used for that load.
+    void setProgressCallback( ProgressCallback callback, void *data = NULL );
+
+    /// Start loading the given file in a background thread. Any previous
+    /// load is cancelled first. For formats that are loaded progressively
+    /// the header is read and the image allocated before the function
+    /// returns.
+    /// \returns false if the file could not be opened, in which case
+    /// getError() describes the problem.
+    bool load( const std::string &url );
+
+#ifdef HAVE_DCMTK
+    /// Start loading the series of DICOM files that the given file belongs
+    /// to in a background thread. The files of the series are found and
+    /// ordered with a DicomSeriesIndex of the directory of the file and
+    /// are stacked in the same way as by loadDicomFile. The first file is
+    /// read before the function returns.
+    /// \param url A file in the series.
+    /// \param native_values If true the pixel values are kept as stored in
+    /// the files, see DicomImage.
+    /// \returns false if the file could not be loaded.
+    bool loadDicomSeries( const std::string &url,
+                          bool native_values = false );
+#endif
+
+    /// Returns the image being loaded. NULL if no load has been started,
+    /// if the load failed before the image could be allocated or until a
+    /// file that is not loaded progressively has been loaded.
+    Image *getImage();
+
+    /// Returns the number of slices of the volume, 0 if not known yet.
+    unsigned int nrSlices();
+
+    /// Returns the number of slices from slice 0 that have been loaded.
+    unsigned int nrSlicesLoaded();
+
+    /// Wait until at least nr_slices slices have been loaded or the
+    /// loading has ended, including the last progress callback. Returns
+    /// true if the slices are loaded.
+    bool waitForSlices( unsigned int nr_slices );
+
+    /// Wait until the loading has ended and the last progress callback
+    /// has returned. Returns true if the whole volume was loaded.
+    bool wait();
+
+    /// Returns true if the loading has ended, successfully or not.
+    bool isDone();
+
+    /// Returns true if the loading failed or was cancelled.
+    bool hasFailed();
+
+    /// Returns a message describing why the loading failed.
+    std::string getError();
+
+    /// Stop the loading and wait for the loading thread to end. The slices
+    /// loaded so far stay in the image. Must not be called from the
+    /// progress callback.
+    void cancel();
+
+  protected:
+    /// The formats that are loaded progressively.
+    enum Source {
+      NRRD_SOURCE,
+      BRICKED_VOLUME_SOURCE,
+      DICOM_SOURCE,
+      IMAGE_FILE_SOURCE
+    };
+
+    /// Reset the state and allocate the image for a new load.
+    void startLoad( const std::string &url, Source source,
+                    Image *_image, unsigned int nr_slices );
+
+    /// Set the state for a load of url that failed before the loading
+    /// thread was started.
+    void loadFailed( const std::string &_url, const std::string &message );
+
+    /// Start the loading thread.
+    void startThread();
+
+    /// Called from the loading thread when more slices have been loaded.
+    /// Returns false if the loading has been cancelled.
+    bool publishSlices( unsigned int nr_slices );
+
+    /// Called from the loading thread when the loading has ended.
+    void finish( bool success, const std::string &message = "" );
+
+    /// The function run in the loading thread.
+    static void *loadThread( void *data );
+
+    /// Progress callback for NrrdReader.
+    static bool nrrdProgress( NrrdReader *reader,
+                              unsigned int nr_slices,
+                              void *data );
+
+    /// Functions loading the data in the loading thread.
+    void loadNrrdData();
+    void loadBrickedVolumeData();
+    void loadImageFileData();
+#ifdef HAVE_DCMTK
+    void loadDicomData();
+#endif
+
+    /// The url being loaded.
+    std::string url;
+
+    /// The format of the current load.
+    Source source;
+
+    /// The image being loaded.
+    AutoRef< Image > image;
+
+    /// The number of slices of the image and the number loaded so far.
+    unsigned int nr_slices;
+    unsigned int nr_slices_loaded;
+
+    /// State of the loading. finished is set when the loading thread
+    /// has made its last progress callback.
+    bool done;
+    bool finished;
+    bool failed;
+    bool cancelled;
+    std::string error_message;
+
+    /// Lock for the state, broadcast when the state changes.
+    ConditionLock lock;
+
+    /// The progress callback and its data.
+    ProgressCallback progress_callback;
+    void *progress_data;
+
+    /// The readers used for the current load, deleted by cancel.
+    NrrdReader *nrrd_reader;
+    BrickedVolumeReader *bricked_reader;
+
+    /// The DICOM files of the series being loaded, in slice order, and
+    /// whether native values are used.
+    std::vector< std::string > dicom_files;
+    bool dicom_native_values;
+
+    /// The loading thread, deleted by cancel.
+    SimpleThread *thread;
+  };
+}
+
+#endif
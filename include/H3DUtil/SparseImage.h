@@ -0,0 +1,270 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file SparseImage.h
+/// \brief Header file for SparseImage, an Image that only stores the
+/// parts of a volume that are not uniform.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __SPARSEIMAGE_H__
+#define __SPARSEIMAGE_H__
+
+#include <H3DUtil/Image.h>
+
+#include <vector>
+
+namespace H3DUtil {
+  /// \class SparseImage
+  /// SparseImage divides the image into bricks of equal size and only
+  /// stores the pixel data of bricks where the pixels have different
+  /// values. A brick where all pixels have the same value is stored as that
+  /// value only. Label maps and masked volumes where most of the volume
+  /// is zero therefore need a fraction of the memory of a PixelImage.
+  ///
+  /// All pixel access goes through getElement and setElement, which can be
+  /// used to read the image from several threads at the same time.
+  /// setElement on a uniform brick with another value allocates the data
+  /// of the brick. Call compact() to release bricks that have become
+  /// uniform.
+  ///
+  /// The data of the image is never in memory as a whole, so getImageData
+  /// returns NULL and functions that use it directly, e.g.
+  /// convertToNormalizedFloatData, cannot be used. Use getRegion or
+  /// createPixelImage to get the data as a dense array.
+  class H3DUTIL_API SparseImage: public Image {
+  public:
+    /// Constructor. Creates an image where all pixels have the same value.
+    /// \param _width, _height, _depth The dimensions of the image.
+    /// \param _bits_per_pixel The number of bits per pixel, must be a
+    /// multiple of 8.
+    /// \param _pixel_type The pixel type.
+    /// \param _pixel_component_type The pixel component type.
+    /// \param _pixel_size The size of a pixel in metres.
+    /// \param value The value of all pixels, bitsPerPixel() / 8 bytes. If
+    /// NULL all bytes are 0.
+    /// \param _brick_size The size of the bricks in pixels along each axis.
+    SparseImage( unsigned int _width,
+                 unsigned int _height,
+                 unsigned int _depth,
+                 unsigned int _bits_per_pixel,
+                 PixelType _pixel_type,
+                 PixelComponentType _pixel_component_type,
+                 const Vec3f &_pixel_size = Vec3f( 1, 1, 1 ),
+                 const void *value = NULL,
+                 unsigned int _brick_size = 32 );
+
+    /// Constructor. Creates a copy of another image. The bricks are
+    /// converted in parallel. The data is read with getImageData() if the
+    /// image has its data in memory and with getElement otherwise.
+    /// \param image The image to copy.
+    /// \param _brick_size The size of the bricks in pixels along each axis.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    SparseImage( Image *image,
+                 unsigned int _brick_size = 32,
+                 unsigned int nr_threads = 0 );
+
+    /// Destructor.
+    virtual ~SparseImage();
+
+    /// Returns the width of the image in pixels.
+    virtual unsigned int width() {
+      return w;
+    }
+
+    /// Returns the height of the image in pixels.
+    virtual unsigned int height() {
+      return h;
+    }
+
+    /// Returns the depth of the image in pixels.
+    virtual unsigned int depth() {
+      return d;
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    virtual Vec3f pixelSize() {
+      return pixel_size;
+    }
+
+    /// Returns the number of bits used for each pixel in the image.
+    virtual unsigned int bitsPerPixel() {
+      return bits_per_pixel;
+    }
+
+    /// Returns the PixelType of the image.
+    virtual PixelType pixelType() {
+      return pixel_type;
+    }
+
+    /// Returns the PixelComponentType of the image.
+    virtual PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns NULL since the data is not stored as a dense array.
+    virtual void *getImageData() {
+      return NULL;
+    }
+
+    /// Get the value of a pixel/voxel.
+    virtual void getElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Set the value of a pixel/voxel. Allocates the brick if it is uniform
+    /// with another value.
+    virtual void setElement( void *value, int x = 0, int y = 0, int z = 0 );
+
+    /// Copy a region of the image into data, which must have room for
+    /// width * height * depth pixels. Returns false if the region is
+    /// outside of the image.
+    bool getRegion( unsigned int x, unsigned int y, unsigned int z,
+                    unsigned int width,
+                    unsigned int height,
+                    unsigned int depth,
+                    void *data );
+
+    /// Create a PixelImage with the same content.
+    Image *createPixelImage();
+
+    /// Release the data of bricks where all pixels have the same value.
+    /// The bricks are checked in parallel.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    void compact( unsigned int nr_threads = 0 );
+
+    /// Returns the size of the bricks in pixels along each axis.
+    inline unsigned int brickSize() {
+      return brick_size;
+    }
+
+    /// Returns the number of bricks along the x, y and z axis.
+    inline unsigned int nrBricksX() { return bricks_x; }
+    inline unsigned int nrBricksY() { return bricks_y; }
+    inline unsigned int nrBricksZ() { return bricks_z; }
+
+    /// Returns the total number of bricks. Bricks are numbered with x
+    /// varying fastest, then y and then z.
+    inline unsigned int nrBricks() {
+      return (unsigned int) bricks.size();
+    }
+
+    /// Get the position of the first pixel of a brick and the size of the
+    /// brick in pixels, which is smaller than brickSize() for bricks at the
+    /// upper edges of the image.
+    void getBrickBox( unsigned int index,
+                      unsigned int &x, unsigned int &y, unsigned int &z,
+                      unsigned int &width,
+                      unsigned int &height,
+                      unsigned int &depth );
+
+    /// Returns true if all pixels in the brick have the same value.
+    inline bool isBrickUniform( unsigned int index ) {
+      return bricks[index] == NULL;
+    }
+
+    /// Returns true if the brick is uniform and all bytes of its value
+    /// are 0.
+    bool isBrickEmpty( unsigned int index );
+
+    /// Returns the value of a uniform brick, bitsPerPixel() / 8 bytes.
+    inline const unsigned char *getBrickValue( unsigned int index ) {
+      return &uniform_values[ index * bytes_per_pixel ];
+    }
+
+    /// Returns the pixel data of a brick that is not uniform, NULL for
+    /// uniform bricks. The data has brickSize() pixels along each axis,
+    /// also for bricks at the edges of the image where only the part
+    /// given by getBrickBox is used.
+    inline unsigned char *getBrickData( unsigned int index ) {
+      return bricks[index];
+    }
+
+    /// Returns the indices of all bricks that contain pixels with values
+    /// where not all bytes are 0, in increasing order.
+    std::vector< unsigned int > getOccupiedBricks();
+
+    /// Returns the number of bricks that store pixel data.
+    unsigned int nrAllocatedBricks();
+
+    /// Returns the number of bytes used for pixel data.
+    H3DInt64 memoryUsage();
+
+  protected:
+    /// Set up the brick tables for the current dimensions.
+    void initBricks();
+
+    /// Allocate the data of a uniform brick and fill it with its value.
+    void allocateBrick( unsigned int index );
+
+    /// Returns the byte offset of pixel (x, y, z) in the data of its brick
+    /// and the index of the brick.
+    inline size_t pixelOffset( unsigned int x, unsigned int y,
+                               unsigned int z, unsigned int &index ) {
+      unsigned int bx = x / brick_size, by = y / brick_size,
+        bz = z / brick_size;
+      index = ( bz * bricks_y + by ) * bricks_x + bx;
+      return ( ( (size_t)( z - bz * brick_size ) * brick_size +
+                 ( y - by * brick_size ) ) * brick_size +
+               ( x - bx * brick_size ) ) * bytes_per_pixel;
+    }
+
+    /// Callback for parallelFor converting a range of bricks from the
+    /// image given in the constructor.
+    static void convertBricks( unsigned int begin,
+                               unsigned int end,
+                               void *data );
+
+    /// Callback for parallelFor releasing uniform bricks.
+    static void compactBricks( unsigned int begin,
+                               unsigned int end,
+                               void *data );
+
+    /// Releases the brick data if all its pixels have the same value.
+    void compactBrick( unsigned int index );
+
+    unsigned int w, h, d;
+    unsigned int bits_per_pixel;
+    unsigned int bytes_per_pixel;
+    PixelType pixel_type;
+    PixelComponentType pixel_component_type;
+    Vec3f pixel_size;
+
+    /// The size of the bricks along each axis.
+    unsigned int brick_size;
+
+    /// The number of bricks along each axis.
+    unsigned int bricks_x, bricks_y, bricks_z;
+
+    /// The data of each brick, NULL for uniform bricks.
+    std::vector< unsigned char * > bricks;
+
+    /// The value of each uniform brick, bytes_per_pixel bytes per brick.
+    std::vector< unsigned char > uniform_values;
+
+    /// The image being converted by convertBricks.
+    Image *source_image;
+  };
+}
+
+#endif
@@ -397,8 +397,12 @@ struct hash_pthread
     /// Returns 0 on success.
     int join();
 
-    /// Destructor.
+    /// Destructor. Cancels the thread unless it has been joined.
     virtual ~SimpleThread();
+
+  protected:
+    /// True if the thread has been joined.
+    bool joined;
   }; 
 
   /// The PeriodicThread class is used to create new threads and provides an interface
@@ -559,6 +563,38 @@ struct hash_pthread
       PeriodicThread( thread_priority, thread_frequency ) {
     }
   };
+
+  /// Function type used by parallelFor. The function is called with a
+  /// half-open range [begin, end) of indices to process and the data
+  /// pointer given to parallelFor.
+  typedef void (*ParallelForFunc)( unsigned int begin,
+                                   unsigned int end,
+                                   void *data );
+
+  /// Returns the number of hardware threads available on the system.
+  /// At least 1 is always returned.
+  H3DUTIL_API unsigned int getNrHardwareThreads();
+
+  /// Process the index range [begin, end) using several threads. The range
+  /// is divided into chunks of chunk_size indices and each worker thread
+  /// repeatedly takes the next unprocessed chunk and calls func on it,
+  /// until all chunks are done. func is called once per chunk also when
+  /// only one thread is used. The function returns when the whole range
+  /// has been processed. The calling thread takes part in the work.
+  /// func must be safe to call concurrently from several threads.
+  /// \param begin The first index in the range.
+  /// \param end One past the last index in the range.
+  /// \param func The function to call for each chunk.
+  /// \param data User data that is given as argument to func.
+  /// \param chunk_size The number of indices in each chunk.
+  /// \param nr_threads The maximum number of threads to use. 0 means
+  /// getNrHardwareThreads().
+  H3DUTIL_API void parallelFor( unsigned int begin,
+                                unsigned int end,
+                                ParallelForFunc func,
+                                void *data,
+                                unsigned int chunk_size = 1,
+                                unsigned int nr_threads = 0 );
 }
 
 #endif
@@ -0,0 +1,315 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file TimeSeriesImage.h
+/// \brief Header file for TimeSeriesImage, a 4D image made of a sequence
+/// of 3D frames.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __TIMESERIESIMAGE_H__
+#define __TIMESERIESIMAGE_H__
+
+#include <H3DUtil/Image.h>
+#include <H3DUtil/AutoRef.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Exception.h>
+
+#include <string>
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \class TimeSeriesImage
+  /// TimeSeriesImage is a 4D image, e.g. dynamic CT, 4D MRI or an
+  /// ultrasound cine loop, made of a sequence of 3D frames that all have
+  /// the same size, pixel format and pixel size.
+  ///
+  /// The frames can be views into one volume where the frames are stacked
+  /// along the z axis, e.g. a mapped raw file, in which case no frame
+  /// data is copied or allocated. They can also be existing images, or
+  /// files that are loaded when needed into a cache of a bounded number of
+  /// frames. A background thread loads the frames following the playback
+  /// position given with setPlaybackPosition, wrapping around to the first
+  /// frame as for looping playback, and the least recently used frames
+  /// are removed from the cache first.
+  ///
+  /// A frame is used by acquiring it, which keeps it in the cache until it
+  /// is released. tryAcquireFrame and setPlaybackPosition never block, so
+  /// a playback loop does not stall while frames are loaded:
+  ///
+  /// \code
+  /// series.setPlaybackPosition( frame );
+  /// Image *image = series.tryAcquireFrame( frame );
+  /// if( image ) {
+  ///   // render image, keep showing the previous frame otherwise
+  ///   series.releaseFrame( frame );
+  /// }
+  /// \endcode
+  class H3DUTIL_API TimeSeriesImage {
+  public:
+    /// Thrown when the frames given to a constructor do not form a valid
+    /// time series.
+    H3D_VALUE_EXCEPTION( std::string, InvalidTimeSeries );
+
+    /// The type of the function used to load the frame files.
+    typedef Image *(*LoadFunction)( const std::string &url );
+
+    /// Constructor for frames stacked along the z axis of one volume. Each
+    /// frame is a PixelImage using the data of the volume directly, with
+    /// the strides of the volume.
+    /// \param volume The volume. It must have its data in memory, not be
+    /// compressed and have a depth that is a multiple of nr_frames.
+    /// \param nr_frames The number of frames.
+    /// \param _frame_duration The time between frames in seconds.
+    TimeSeriesImage( Image *volume,
+                     unsigned int nr_frames,
+                     H3DTime _frame_duration = 0 );
+
+    /// Constructor for frames that are already in memory. The images must
+    /// all have the same size and pixel format.
+    /// \param frames The frames, which are referenced by the time series.
+    /// \param _frame_duration The time between frames in seconds.
+    TimeSeriesImage( const std::vector< Image * > &frames,
+                     H3DTime _frame_duration = 0 );
+
+    /// Constructor for frames read from files when they are needed. The
+    /// properties of the frames are those of the first file, found with
+    /// probeImage. Frames that turn out to have other properties are
+    /// reported as errors and cannot be acquired.
+    /// \param _urls The frame files.
+    /// \param _max_cached_frames The maximum number of frames kept in
+    /// memory, apart from frames that are acquired. At least 2.
+    /// \param _load_function The function used to load the frames, NULL
+    /// for loadImage.
+    /// \param _frame_duration The time between frames in seconds.
+    TimeSeriesImage( const std::vector< std::string > &_urls,
+                     unsigned int _max_cached_frames = 8,
+                     LoadFunction _load_function = NULL,
+                     H3DTime _frame_duration = 0 );
+
+    /// Destructor. Stops the prefetch thread and releases all frames.
+    ~TimeSeriesImage();
+
+    /// Returns the number of frames.
+    inline unsigned int nrFrames() {
+      return (unsigned int) frames.size();
+    }
+
+    /// Returns the width of the frames in pixels.
+    inline unsigned int width() {
+      return w;
+    }
+
+    /// Returns the height of the frames in pixels.
+    inline unsigned int height() {
+      return h;
+    }
+
+    /// Returns the depth of the frames in pixels.
+    inline unsigned int depth() {
+      return d;
+    }
+
+    /// Returns the number of bits used for each pixel in the frames.
+    inline unsigned int bitsPerPixel() {
+      return bits_per_pixel;
+    }
+
+    /// Returns the PixelType of the frames.
+    inline Image::PixelType pixelType() {
+      return pixel_type;
+    }
+
+    /// Returns the PixelComponentType of the frames.
+    inline Image::PixelComponentType pixelComponentType() {
+      return pixel_component_type;
+    }
+
+    /// Returns the size of the pixel in x, y and z direction in metres.
+    inline Vec3f pixelSize() {
+      return pixel_size;
+    }
+
+    /// Returns the time between frames in seconds.
+    inline H3DTime frameDuration() {
+      return frame_duration;
+    }
+
+    /// Set the time between frames in seconds.
+    inline void setFrameDuration( H3DTime duration ) {
+      frame_duration = duration;
+    }
+
+    /// Returns the frame shown at the given time from the start of a
+    /// looping playback, 0 if the frame duration is 0.
+    unsigned int frameAtTime( H3DTime time );
+
+    /// Returns frame i if it is in memory, without locking or waiting,
+    /// and keeps it in memory until releaseFrame( i ) is called. Returns
+    /// NULL if the frame has not been loaded. The frame must not be
+    /// modified, it is shared by all users of the time series.
+    Image *tryAcquireFrame( unsigned int i );
+
+    /// Returns frame i, loading it in the calling thread or waiting for
+    /// the prefetch thread to load it if it is not in memory, and keeps
+    /// it in memory until releaseFrame( i ) is called. Returns NULL if the
+    /// frame could not be loaded.
+    Image *acquireFrame( unsigned int i );
+
+    /// Release a frame acquired with tryAcquireFrame or acquireFrame.
+    void releaseFrame( unsigned int i );
+
+    /// Set the frame that is played and the direction of playback, so
+    /// that the prefetch thread loads the frames that follow it. Never
+    /// waits for the prefetch thread.
+    /// \param i The current frame.
+    /// \param direction 1 for forward and -1 for backward playback.
+    void setPlaybackPosition( unsigned int i, int direction = 1 );
+
+    /// Returns true if frame i is in memory.
+    bool isFrameLoaded( unsigned int i );
+
+    /// Returns the number of frames that are in memory.
+    unsigned int nrLoadedFrames();
+
+    /// Returns the maximum number of frames kept in memory for time series
+    /// read from files.
+    inline unsigned int maxCachedFrames() {
+      return max_cached_frames;
+    }
+
+    /// Returns the number of frames following the playback position that
+    /// are loaded in advance.
+    inline unsigned int nrPrefetchFrames() {
+      return prefetch_frames;
+    }
+
+    /// Set the number of frames following the playback position that are
+    /// loaded in advance, at most maxCachedFrames() - 1. Default is
+    /// half of maxCachedFrames().
+    void setNrPrefetchFrames( unsigned int nr_frames );
+
+    /// Returns the url of frame i, empty if the frames are not read from
+    /// files.
+    inline std::string getURL( unsigned int i ) {
+      return i < urls.size() ? urls[i] : std::string();
+    }
+
+  protected:
+    /// The state of a frame. image, pins and last_used are accessed
+    /// atomically so that frames can be acquired without locking, the
+    /// other members are protected by lock.
+    struct Frame {
+      /// Constructor.
+      Frame(): image( NULL ), pins( 0 ), last_used( 0 ),
+               loading( false ), failed( false ) {}
+
+      /// The frame, NULL if it is not in memory. Holds a reference.
+      Image *volatile image;
+      /// The number of times the frame is acquired and not released.
+      volatile long pins;
+      /// The value of use_counter when the frame was last acquired.
+      volatile long last_used;
+      /// True while the frame is being loaded.
+      bool loading;
+      /// True if the frame could not be loaded.
+      bool failed;
+    };
+
+    /// Set the properties of the frames from an image.
+    void setProperties( Image *image );
+
+    /// Returns true if the image has the properties of the frames.
+    bool hasProperties( Image *image );
+
+    /// Load frame i, which must be marked as loading, and make it
+    /// available. Must be called without lock held.
+    /// \param pin If true the frame is acquired before it can be removed.
+    /// \returns The frame, NULL if it could not be loaded.
+    Image *loadFrame( unsigned int i, bool pin );
+
+    /// Returns the next frame the prefetch thread should load, or
+    /// nrFrames() if all frames in the prefetch window are loaded. Must
+    /// be called with lock held.
+    unsigned int nextPrefetchFrame();
+
+    /// Returns true if frame i is among the frames following the playback
+    /// position that are loaded in advance.
+    bool inPrefetchWindow( unsigned int i );
+
+    /// Remove least recently used frames that are not acquired until at
+    /// most max_cached_frames frames are loaded. Frames in the prefetch
+    /// window are only removed if there are no others, and frame keep is
+    /// never removed. Must be called with lock held.
+    void evictFrames( unsigned int keep );
+
+    /// The function run in the prefetch thread.
+    static void *prefetchThread( void *data );
+
+    /// The frames.
+    std::vector< Frame > frames;
+
+    /// The frame files, empty if the frames are not read from files.
+    std::vector< std::string > urls;
+
+    /// The function used to load the frame files.
+    LoadFunction load_function;
+
+    /// The volume the frames are views into, if any.
+    AutoRef< Image > volume;
+
+    /// The properties of the frames.
+    unsigned int w, h, d;
+    unsigned int bits_per_pixel;
+    Image::PixelType pixel_type;
+    Image::PixelComponentType pixel_component_type;
+    Vec3f pixel_size;
+
+    H3DTime frame_duration;
+    unsigned int max_cached_frames;
+    unsigned int prefetch_frames;
+
+    /// The number of frames in memory. Protected by lock.
+    unsigned int loaded_frames;
+
+    /// The playback position as frame * 2, plus 1 for backward playback.
+    /// Accessed atomically.
+    volatile long playback_position;
+
+    /// Incremented for every acquired frame to order the frames by use.
+    volatile long use_counter;
+
+    /// True when the prefetch thread should stop. Protected by lock.
+    bool stopped;
+
+    /// Lock for the frame states, broadcast when a frame has been loaded
+    /// and signalled when the playback position changes.
+    ConditionLock lock;
+
+    /// The prefetch thread, only used for frames read from files.
+    SimpleThread *thread;
+  };
+}
+
+#endif
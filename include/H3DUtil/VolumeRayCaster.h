@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file VolumeRayCaster.h
+/// \brief Header file for VolumeRayCaster, a CPU volume renderer.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __VOLUMERAYCASTER_H__
+#define __VOLUMERAYCASTER_H__
+
+#include <H3DUtil/MinMaxGrid.h>
+#include <H3DUtil/LinAlgTypes.h>
+
+#include <vector>
+
+namespace H3DUtil {
+
+  /// \class VolumeRayCaster
+  /// VolumeRayCaster renders a volume with ray casting on the CPU, e.g. to
+  /// make reference renderings on machines without a GPU. The result is
+  /// an 8 bit RGBA PixelImage that can be saved with the image writers.
+  ///
+  /// The image is divided into tiles that are rendered in parallel. Each
+  /// ray skips the blocks of a MinMaxGrid of the volume that cannot change
+  /// the result, i.e. blocks where the transfer function is transparent,
+  /// blocks below the iso-value or blocks below the current maximum, and
+  /// composite rays stop when they are almost opaque.
+  ///
+  /// The volume is in physical coordinates where voxel (i, j, k) is at
+  /// ( i, j, k ) * image->pixelSize(), with a pixel size of 0 used as 1,
+  /// and extends between the centers of its outer voxels. The values are
+  /// those of MinMaxGrid, i.e. the stored component values for images with
+  /// integer or 32/64 bit floating point components and the normalized
+  /// values from getPixel for other images, trilinearly interpolated.
+  ///
+  /// \code
+  /// VolumeRayCaster caster( image );
+  /// caster.setRenderMode( VolumeRayCaster::COMPOSITE );
+  /// caster.setTransferFunction( lut, 0, 4095 );
+  /// AutoRef< Image > result( caster.render( camera, 512, 512 ) );
+  /// \endcode
+  class H3DUTIL_API VolumeRayCaster {
+  public:
+    /// How the samples along a ray are combined.
+    typedef enum {
+      /// The transfer function of the maximum value along the ray.
+      MAXIMUM_INTENSITY,
+      /// Front to back compositing of the transfer function of the
+      /// samples. The alpha of the transfer function is the opacity of
+      /// one voxel of distance.
+      COMPOSITE,
+      /// The first point where the value reaches the iso-value, colored
+      /// by the transfer function at the iso-value and lit by a light at
+      /// the camera.
+      ISO_SURFACE
+    } RenderMode;
+
+    /// Constructor. Builds the MinMaxGrid of the image in parallel.
+    /// \param _image The volume. The image must stay valid as long as the
+    /// ray caster is used.
+    /// \param _component The pixel component to render.
+    /// \param block_size The size of the blocks used to skip empty space.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    VolumeRayCaster( Image *_image,
+                     unsigned int _component = 0,
+                     unsigned int block_size = 8,
+                     unsigned int nr_threads = 0 );
+
+    /// Set how the samples along a ray are combined. Default is COMPOSITE.
+    inline void setRenderMode( RenderMode _mode ) {
+      mode = _mode;
+    }
+
+    /// Set the transfer function as a lookup table that is linearly
+    /// interpolated, where the first entry is the color of min_value and
+    /// the last the color of max_value. Values outside of the range get
+    /// the color of the closest end. If no transfer function is set a
+    /// ramp from transparent black to opaque white over the range of the
+    /// volume is used.
+    void setTransferFunction( const std::vector< RGBA > &_lut,
+                              H3DFloat min_value,
+                              H3DFloat max_value );
+
+    /// Set the iso-value used by ISO_SURFACE.
+    inline void setIsoValue( H3DFloat value ) {
+      iso_value = value;
+    }
+
+    /// Set the distance between the samples along a ray in voxels.
+    /// Default is 0.5.
+    inline void setStepSize( H3DFloat step ) {
+      step_size = step;
+    }
+
+    /// Set the opacity at which COMPOSITE rays stop. Default is 0.99, 1
+    /// composites all samples.
+    inline void setTerminationOpacity( H3DFloat opacity ) {
+      termination_opacity = opacity;
+    }
+
+    /// Set the color behind the volume. Default is transparent black.
+    inline void setBackground( const RGBA &color ) {
+      background = color;
+    }
+
+    /// Use a perspective projection with the given field of view in
+    /// radians for the smaller of the width and height of the image. This
+    /// is the default, with a field of view of pi / 4.
+    inline void setPerspective( H3DFloat _field_of_view ) {
+      field_of_view = _field_of_view;
+      orthographic = false;
+    }
+
+    /// Use an orthographic projection where the smaller of the width and
+    /// height of the image covers the given size in physical units.
+    inline void setOrthographic( H3DFloat view_size ) {
+      orthographic_size = view_size;
+      orthographic = true;
+    }
+
+    /// Render the volume.
+    /// \param camera_transform The transform from the camera coordinate
+    /// system to the physical coordinates of the volume. The camera is at
+    /// the origin looking along the negative z axis with the y axis up.
+    /// \param width, height The size of the image. Row 0 is the bottom
+    /// of the view.
+    /// \param nr_threads The number of threads to use, 0 for one thread
+    /// per hardware thread.
+    /// \returns A new 8 bit RGBA PixelImage with straight alpha.
+    Image *render( const Matrix4f &camera_transform,
+                   unsigned int width,
+                   unsigned int height,
+                   unsigned int nr_threads = 0 );
+
+    /// Update the MinMaxGrid after a change of the voxels in the given
+    /// region of the image.
+    inline void update( unsigned int x, unsigned int y, unsigned int z,
+                        unsigned int width,
+                        unsigned int height,
+                        unsigned int depth,
+                        unsigned int nr_threads = 0 ) {
+      grid.update( x, y, z, width, height, depth, nr_threads );
+    }
+
+    /// Returns the MinMaxGrid used to skip empty space.
+    inline MinMaxGrid &getMinMaxGrid() {
+      return grid;
+    }
+
+  protected:
+    /// The image.
+    Image *image;
+
+    /// The pixel component to render.
+    unsigned int component;
+
+    /// The grid used to skip empty space.
+    MinMaxGrid grid;
+
+    /// The transfer function and the values of its first and last entry.
+    std::vector< RGBA > lut;
+    H3DFloat lut_min, lut_max;
+
+    RenderMode mode;
+    H3DFloat iso_value;
+    H3DFloat step_size;
+    H3DFloat termination_opacity;
+    RGBA background;
+
+    bool orthographic;
+    H3DFloat field_of_view;
+    H3DFloat orthographic_size;
+  };
+}
+
+#endif
@@ -0,0 +1,549 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file BatchFileReader.cpp
+/// \brief CPP file for BatchFileReader.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/BatchFileReader.h>
+#include <H3DUtil/H3DBasicTypes.h>
+#include <H3DUtil/H3DMath.h>
+
+#include <fstream>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+// the system call numbers are the same on all architectures that have
+// io_uring but may be missing from older C library headers.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#endif
+
+using namespace H3DUtil;
+using namespace std;
+
+namespace BatchFileReaderInternals {
+  // The largest number of bytes read with one read call.
+  const size_t max_read_size = 1 << 30;
+
+  // The maximum number of threads used to read files when io_uring is not
+  // used.
+  const unsigned int max_read_threads = 16;
+
+#ifdef HAVE_IO_URING
+  // A minimal io_uring submission and completion queue pair used through
+  // the system calls directly, so that no extra library is needed.
+  class IoUring {
+  public:
+    IoUring() :
+      fd( -1 ),
+      sq_ring( MAP_FAILED ),
+      cq_ring( MAP_FAILED ),
+      sqes( (io_uring_sqe *) MAP_FAILED ),
+      sq_tail( 0 ),
+      to_submit( 0 ) {}
+
+    ~IoUring() {
+      if( sqes != MAP_FAILED ) munmap( sqes, sqes_size );
+      if( cq_ring != MAP_FAILED && cq_ring != sq_ring ) {
+        munmap( cq_ring, cq_ring_size );
+      }
+      if( sq_ring != MAP_FAILED ) munmap( sq_ring, sq_ring_size );
+      if( fd >= 0 ) close( fd );
+    }
+
+    // Create the queues. Returns false if io_uring is not available.
+    bool init( unsigned int entries ) {
+      io_uring_params params;
+      memset( &params, 0, sizeof( params ) );
+      fd = (int) syscall( __NR_io_uring_setup, entries, &params );
+      if( fd < 0 ) return false;
+
+      sq_ring_size = params.sq_off.array +
+        params.sq_entries * sizeof( unsigned int );
+      cq_ring_size = params.cq_off.cqes +
+        params.cq_entries * sizeof( io_uring_cqe );
+      bool single_mmap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+      if( single_mmap ) {
+        sq_ring_size = cq_ring_size = H3DMax( sq_ring_size, cq_ring_size );
+      }
+      sq_ring = mmap( NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+      if( sq_ring == MAP_FAILED ) return false;
+      if( single_mmap ) {
+        cq_ring = sq_ring;
+      } else {
+        cq_ring = mmap( NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+        if( cq_ring == MAP_FAILED ) return false;
+      }
+      sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+      sqes = (io_uring_sqe *) mmap( NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd,
+                                    IORING_OFF_SQES );
+      if( sqes == MAP_FAILED ) return false;
+
+      char *sq = (char *) sq_ring;
+      sq_head_ptr = (unsigned int *)( sq + params.sq_off.head );
+      sq_tail_ptr = (unsigned int *)( sq + params.sq_off.tail );
+      sq_mask = *(unsigned int *)( sq + params.sq_off.ring_mask );
+      sq_array = (unsigned int *)( sq + params.sq_off.array );
+      sq_entries = params.sq_entries;
+      sq_tail = *sq_tail_ptr;
+
+      char *cq = (char *) cq_ring;
+      cq_head_ptr = (unsigned int *)( cq + params.cq_off.head );
+      cq_tail_ptr = (unsigned int *)( cq + params.cq_off.tail );
+      cq_mask = *(unsigned int *)( cq + params.cq_off.ring_mask );
+      cqes = (io_uring_cqe *)( cq + params.cq_off.cqes );
+      return true;
+    }
+
+    // Queue a read at offset of the file file_fd into the buffer of iov.
+    // Returns false if the submission queue is full.
+    bool queueRead( int file_fd, iovec *iov, H3DInt64 offset,
+                    unsigned long long user_data ) {
+      unsigned int head = __atomic_load_n( sq_head_ptr, __ATOMIC_ACQUIRE );
+      if( sq_tail - head >= sq_entries ) {
+        // entries that the kernel has not consumed yet, submit them.
+        if( !submitAndWait( 0 ) ) return false;
+        head = __atomic_load_n( sq_head_ptr, __ATOMIC_ACQUIRE );
+        if( sq_tail - head >= sq_entries ) return false;
+      }
+      unsigned int index = sq_tail & sq_mask;
+      io_uring_sqe *sqe = &sqes[ index ];
+      memset( sqe, 0, sizeof( io_uring_sqe ) );
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = file_fd;
+      sqe->off = (unsigned long long) offset;
+      sqe->addr = (unsigned long long)(size_t) iov;
+      sqe->len = 1;
+      sqe->user_data = user_data;
+      sq_array[ index ] = index;
+      ++sq_tail;
+      ++to_submit;
+      return true;
+    }
+
+    // Submit the queued reads and wait for at least min_complete
+    // completions. Returns false on failure.
+    bool submitAndWait( unsigned int min_complete ) {
+      __atomic_store_n( sq_tail_ptr, sq_tail, __ATOMIC_RELEASE );
+      while( true ) {
+        long res = syscall( __NR_io_uring_enter, fd, to_submit, min_complete,
+                            min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                            NULL, 0 );
+        if( res >= 0 ) {
+          to_submit -= (unsigned int) res;
+          return true;
+        }
+        if( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+          return false;
+        }
+      }
+    }
+
+    // Get the next completion. Returns false if there is none.
+    bool nextCompletion( io_uring_cqe &cqe ) {
+      unsigned int head = *cq_head_ptr;
+      if( head == __atomic_load_n( cq_tail_ptr, __ATOMIC_ACQUIRE ) ) {
+        return false;
+      }
+      cqe = cqes[ head & cq_mask ];
+      __atomic_store_n( cq_head_ptr, head + 1, __ATOMIC_RELEASE );
+      return true;
+    }
+
+  protected:
+    int fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    io_uring_sqe *sqes;
+    unsigned int *sq_head_ptr, *sq_tail_ptr, *sq_array;
+    unsigned int sq_mask, sq_entries;
+    unsigned int sq_tail, to_submit;
+    unsigned int *cq_head_ptr, *cq_tail_ptr;
+    unsigned int cq_mask;
+    io_uring_cqe *cqes;
+  };
+
+  // A file being read with io_uring.
+  struct RingRead {
+    int fd;
+    size_t done;
+    iovec iov;
+  };
+#endif
+}
+
+using namespace BatchFileReaderInternals;
+
+void H3DUtil::adviseFileRead( const string &url,
+                              size_t offset,
+                              size_t length ) {
+#ifdef POSIX_FADV_WILLNEED
+  int fd = open( url.c_str(), O_RDONLY );
+  if( fd < 0 ) return;
+  posix_fadvise( fd, (off_t) offset, (off_t) length, POSIX_FADV_WILLNEED );
+  close( fd );
+#endif
+}
+
+BatchFileReader::BatchFileReader( size_t _max_buffered_bytes,
+                                  unsigned int _queue_depth ) :
+  buffered_bytes( 0 ),
+  wanted( 0 ),
+  stopped( true ),
+  io_uring_used( false ),
+  max_buffered_bytes( _max_buffered_bytes ),
+  queue_depth( _queue_depth == 0 ? 1 : _queue_depth ),
+  thread( NULL ) {
+}
+
+BatchFileReader::~BatchFileReader() {
+  stop();
+}
+
+void BatchFileReader::start( const vector< string > &urls ) {
+  stop();
+  files.resize( urls.size() );
+  for( unsigned int i = 0; i < urls.size(); ++i ) {
+    files[i].url = urls[i];
+    files[i].data = NULL;
+    files[i].size = 0;
+    files[i].state = FILE_PENDING;
+  }
+  buffered_bytes = 0;
+  wanted = 0;
+  stopped = false;
+  io_uring_used = false;
+  if( !files.empty() ) {
+    thread = new SimpleThread( readThread, this );
+  }
+}
+
+void BatchFileReader::stop() {
+  lock.lock();
+  stopped = true;
+  lock.broadcast();
+  lock.unlock();
+  if( thread ) {
+    thread->join();
+    delete thread;
+    thread = NULL;
+  }
+  for( unsigned int i = 0; i < files.size(); ++i ) {
+    delete [] files[i].data;
+  }
+  files.clear();
+  buffered_bytes = 0;
+}
+
+bool BatchFileReader::waitForFile( unsigned int i,
+                                   const unsigned char *&data,
+                                   size_t &size ) {
+  lock.lock();
+  if( i >= files.size() ) {
+    lock.unlock();
+    return false;
+  }
+  if( i > wanted ) {
+    wanted = i;
+    lock.broadcast();
+  }
+  while( files[i].state == FILE_PENDING && !stopped ) {
+    lock.wait();
+  }
+  bool success = files[i].state == FILE_READ;
+  data = files[i].data;
+  size = files[i].size;
+  lock.unlock();
+  return success;
+}
+
+void BatchFileReader::releaseFile( unsigned int i ) {
+  lock.lock();
+  if( i < files.size() && files[i].state != FILE_PENDING ) {
+    buffered_bytes -= files[i].size;
+    delete [] files[i].data;
+    files[i].data = NULL;
+    files[i].size = 0;
+    files[i].state = FILE_RELEASED;
+    lock.broadcast();
+  }
+  lock.unlock();
+}
+
+unsigned int BatchFileReader::nrFiles() {
+  return (unsigned int) files.size();
+}
+
+bool BatchFileReader::usesIoUring() {
+  lock.lock();
+  bool result = io_uring_used;
+  lock.unlock();
+  return result;
+}
+
+bool BatchFileReader::canRead( unsigned int i ) {
+  return i <= wanted || buffered_bytes < max_buffered_bytes;
+}
+
+bool BatchFileReader::waitToRead( unsigned int i ) {
+  lock.lock();
+  while( !stopped && !canRead( i ) ) {
+    lock.wait();
+  }
+  bool result = !stopped;
+  lock.unlock();
+  return result;
+}
+
+unsigned char *BatchFileReader::allocateFile( unsigned int i, size_t size ) {
+  unsigned char *data = new unsigned char[ size > 0 ? size : 1 ];
+  lock.lock();
+  files[i].data = data;
+  files[i].size = size;
+  buffered_bytes += size;
+  lock.unlock();
+  return data;
+}
+
+void BatchFileReader::fileDone( unsigned int i, bool success,
+                                size_t size_read ) {
+  lock.lock();
+  File &file = files[i];
+  if( success ) {
+    // the file may have become shorter since its size was read.
+    buffered_bytes -= file.size - size_read;
+    file.size = size_read;
+    file.state = FILE_READ;
+  } else {
+    buffered_bytes -= file.size;
+    delete [] file.data;
+    file.data = NULL;
+    file.size = 0;
+    file.state = FILE_FAILED;
+  }
+  lock.broadcast();
+  lock.unlock();
+}
+
+void BatchFileReader::readFile( unsigned int i ) {
+  const string &url = files[i].url;
+#ifdef WIN32
+  ifstream is( url.c_str(), ios::in | ios::binary );
+  if( !is ) {
+    fileDone( i, false );
+    return;
+  }
+  is.seekg( 0, ios::end );
+  size_t size = (size_t) is.tellg();
+  is.seekg( 0, ios::beg );
+  unsigned char *data = allocateFile( i, size );
+  is.read( (char *) data, size );
+  fileDone( i, !is.bad(), (size_t) is.gcount() );
+#else
+  int fd = open( url.c_str(), O_RDONLY );
+  struct stat file_stat;
+  if( fd < 0 || fstat( fd, &file_stat ) != 0 ) {
+    if( fd >= 0 ) close( fd );
+    fileDone( i, false );
+    return;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+  size_t size = (size_t) file_stat.st_size;
+  unsigned char *data = allocateFile( i, size );
+  size_t done = 0;
+  bool success = true;
+  while( done < size ) {
+    ssize_t res = read( fd, data + done, H3DMin( size - done, max_read_size ) );
+    if( res < 0 ) {
+      if( errno == EINTR ) continue;
+      success = false;
+      break;
+    }
+    if( res == 0 ) break;
+    done += (size_t) res;
+  }
+  close( fd );
+  fileDone( i, success, done );
+#endif
+}
+
+void BatchFileReader::readFiles( unsigned int begin, unsigned int end,
+                                 void *data ) {
+  BatchFileReader *reader = static_cast< BatchFileReader * >( data );
+  for( unsigned int i = begin; i < end; ++i ) {
+    if( !reader->waitToRead( i ) ) return;
+    reader->readFile( i );
+  }
+}
+
+void *BatchFileReader::readThread( void *data ) {
+  BatchFileReader *reader = static_cast< BatchFileReader * >( data );
+  unsigned int first_unread = 0;
+#ifdef HAVE_IO_URING
+  if( reader->readWithIoUring( first_unread ) ) return NULL;
+#endif
+  // the threads mostly wait for the disk so the number of threads is
+  // given by the number of reads to keep in flight.
+  parallelFor( first_unread, reader->nrFiles(), readFiles, reader, 1,
+               H3DMin( reader->queue_depth, max_read_threads ) );
+  return NULL;
+}
+
+#ifdef HAVE_IO_URING
+bool BatchFileReader::readWithIoUring( unsigned int &first_unread ) {
+  first_unread = 0;
+  IoUring ring;
+  if( !ring.init( queue_depth ) ) return false;
+  lock.lock();
+  io_uring_used = true;
+  lock.unlock();
+
+  unsigned int nr_files = nrFiles();
+  vector< RingRead > reads( nr_files );
+  unsigned int next = 0;
+  unsigned int in_flight = 0;
+
+  while( true ) {
+    // open and queue reads of the files that may be read now.
+    while( next < nr_files && in_flight < queue_depth ) {
+      lock.lock();
+      bool read_next = !stopped && canRead( next );
+      lock.unlock();
+      if( !read_next ) break;
+
+      unsigned int i = next++;
+      RingRead &r = reads[i];
+      r.fd = open( files[i].url.c_str(), O_RDONLY );
+      struct stat file_stat;
+      if( r.fd < 0 || fstat( r.fd, &file_stat ) != 0 ) {
+        if( r.fd >= 0 ) close( r.fd );
+        fileDone( i, false );
+        continue;
+      }
+      posix_fadvise( r.fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+      size_t size = (size_t) file_stat.st_size;
+      r.done = 0;
+      r.iov.iov_base = allocateFile( i, size );
+      r.iov.iov_len = H3DMin( size, max_read_size );
+      if( size == 0 || !ring.queueRead( r.fd, &r.iov, 0, i ) ) {
+        close( r.fd );
+        fileDone( i, size == 0, 0 );
+        continue;
+      }
+      ++in_flight;
+    }
+
+    if( in_flight == 0 ) {
+      if( next >= nr_files ) break;
+      // wait until more files may be read.
+      lock.lock();
+      while( !stopped && !canRead( next ) ) {
+        lock.wait();
+      }
+      bool stop_reading = stopped;
+      lock.unlock();
+      if( stop_reading ) break;
+      continue;
+    }
+
+    if( !ring.submitAndWait( 1 ) ) {
+      // fail the files that have not been completed. Their buffers are
+      // not freed since reads of them may still be in flight. The files
+      // not yet queued are left to the caller to read without io_uring.
+      for( unsigned int i = 0; i < next; ++i ) {
+        lock.lock();
+        bool pending = files[i].state == FILE_PENDING;
+        if( pending ) files[i].data = NULL;
+        lock.unlock();
+        if( pending ) {
+          close( reads[i].fd );
+          fileDone( i, false );
+        }
+      }
+      first_unread = next;
+      return false;
+    }
+
+    io_uring_cqe cqe;
+    while( ring.nextCompletion( cqe ) ) {
+      unsigned int i = (unsigned int) cqe.user_data;
+      RingRead &r = reads[i];
+      lock.lock();
+      size_t size = files[i].size;
+      bool stop_reading = stopped;
+      lock.unlock();
+
+      bool success = true;
+      bool complete = true;
+      if( cqe.res == -EINTR || cqe.res == -EAGAIN ) {
+        complete = stop_reading;
+        success = false;
+      } else if( cqe.res < 0 ) {
+        success = false;
+      } else if( cqe.res > 0 ) {
+        r.done += (size_t) cqe.res;
+        // a read can return fewer bytes than requested, continue with the
+        // rest of the file.
+        complete = r.done >= size || stop_reading;
+        success = r.done >= size;
+      }
+      // a read of 0 bytes means that the file has become shorter.
+
+      if( !complete ) {
+        r.iov.iov_base = files[i].data + r.done;
+        r.iov.iov_len = H3DMin( size - r.done, max_read_size );
+        complete = !ring.queueRead( r.fd, &r.iov, (H3DInt64) r.done, i );
+      }
+      if( complete ) {
+        close( r.fd );
+        fileDone( i, success || cqe.res == 0, r.done );
+        --in_flight;
+      }
+    }
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,789 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file BrickedVolumeFile.cpp
+/// \brief CPP file for BrickedVolumeReader and BrickedVolumeWriter.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/BrickedVolumeFile.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/MemoryStream.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <cstring>
+
+using namespace H3DUtil;
+
+namespace BrickedVolumeFileInternals {
+  // The first bytes of a bricked volume file.
+  const char magic[8] = { 'H', '3', 'D', 'B', 'V', 'O', 'L', '\n' };
+
+  // Written in the byte order of the machine writing the file.
+  const H3DUInt32 byte_order_mark = 0x01020304;
+
+  const H3DUInt32 file_version = 1;
+
+  // The size of the header, the brick index follows directly after it.
+  const unsigned int header_size = 80;
+
+  // The size of each entry of the brick index, the offset and size of the
+  // brick as 64 bit integers.
+  const unsigned int index_entry_size = 16;
+
+  // Reverse the byte order of each element of bytes_per_element bytes.
+  void swapBytes( unsigned char *data, size_t size,
+                  unsigned int bytes_per_element ) {
+    if( bytes_per_element < 2 ) return;
+    for( size_t i = 0; i + bytes_per_element <= size;
+         i += bytes_per_element ) {
+      for( unsigned int j = 0; j < bytes_per_element / 2; ++j ) {
+        unsigned char tmp = data[i + j];
+        data[i + j] = data[i + bytes_per_element - 1 - j];
+        data[i + bytes_per_element - 1 - j] = tmp;
+      }
+    }
+  }
+
+  template< class T >
+  void putValue( unsigned char *buffer, unsigned int pos, T value ) {
+    memcpy( buffer + pos, &value, sizeof( T ) );
+  }
+
+  template< class T >
+  T getValue( const unsigned char *buffer, unsigned int pos, bool swap ) {
+    unsigned char tmp[ sizeof( T ) ];
+    memcpy( tmp, buffer + pos, sizeof( T ) );
+    if( swap ) swapBytes( tmp, sizeof( T ), sizeof( T ) );
+    T value;
+    memcpy( &value, tmp, sizeof( T ) );
+    return value;
+  }
+
+  // Group the bytes of elements of bytes_per_element bytes so that all
+  // first bytes come first, then all second bytes and so on.
+  void shuffle( const unsigned char *data, size_t size,
+                unsigned int bytes_per_element, unsigned char *output ) {
+    size_t n = size / bytes_per_element;
+    for( unsigned int b = 0; b < bytes_per_element; ++b ) {
+      unsigned char *out = output + b * n;
+      const unsigned char *in = data + b;
+      for( size_t i = 0; i < n; ++i, in += bytes_per_element ) {
+        out[i] = *in;
+      }
+    }
+  }
+
+  // Reverse the grouping done by shuffle.
+  void unshuffle( const unsigned char *data, size_t size,
+                  unsigned int bytes_per_element, unsigned char *output ) {
+    size_t n = size / bytes_per_element;
+    for( unsigned int b = 0; b < bytes_per_element; ++b ) {
+      const unsigned char *in = data + b * n;
+      unsigned char *out = output + b;
+      for( size_t i = 0; i < n; ++i, out += bytes_per_element ) {
+        *out = in[i];
+      }
+    }
+  }
+
+  // Compress the data of a brick.
+  bool compressBrick( BrickedVolumeFile::Encoding encoding, int level,
+                      unsigned int bytes_per_component,
+                      const unsigned char *data, size_t size,
+                      std::vector< unsigned char > &output ) {
+    if( encoding == BrickedVolumeFile::RAW ) {
+      output.assign( data, data + size );
+      return true;
+    }
+#ifdef HAVE_ZLIB
+    std::vector< unsigned char > shuffled;
+    if( encoding == BrickedVolumeFile::ZLIB_FAST ) {
+      level = Z_BEST_SPEED;
+      if( bytes_per_component > 1 ) {
+        shuffled.resize( size );
+        shuffle( data, size, bytes_per_component, &shuffled[0] );
+        data = &shuffled[0];
+      }
+    }
+    uLongf output_size = compressBound( (uLong) size );
+    output.resize( output_size );
+    if( compress2( &output[0], &output_size, data, (uLong) size,
+                   level ) != Z_OK ) {
+      return false;
+    }
+    output.resize( output_size );
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Decompress the data of a brick into output, which has room for the
+  // uncompressed size of the brick.
+  bool decompressBrick( BrickedVolumeFile::Encoding encoding,
+                        unsigned int bytes_per_component,
+                        const unsigned char *data, size_t size,
+                        unsigned char *output, size_t output_size ) {
+    if( encoding == BrickedVolumeFile::RAW ) {
+      if( size != output_size ) return false;
+      memcpy( output, data, size );
+      return true;
+    }
+#ifdef HAVE_ZLIB
+    bool shuffled =
+      encoding == BrickedVolumeFile::ZLIB_FAST && bytes_per_component > 1;
+    std::vector< unsigned char > tmp;
+    unsigned char *dest = output;
+    if( shuffled ) {
+      tmp.resize( output_size );
+      dest = &tmp[0];
+    }
+    uLongf dest_size = (uLongf) output_size;
+    if( uncompress( dest, &dest_size, data, (uLong) size ) != Z_OK ||
+        dest_size != output_size ) {
+      return false;
+    }
+    if( shuffled ) unshuffle( dest, output_size, bytes_per_component, output );
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Copy a box of size width x height x depth pixels from position
+  // (sx, sy, sz) in src, a volume of src_w x src_h pixels per slice, to
+  // position (dx, dy, dz) in dst.
+  void copyBox( const unsigned char *src,
+                unsigned int src_w, unsigned int src_h,
+                unsigned int sx, unsigned int sy, unsigned int sz,
+                unsigned char *dst,
+                unsigned int dst_w, unsigned int dst_h,
+                unsigned int dx, unsigned int dy, unsigned int dz,
+                unsigned int width, unsigned int height, unsigned int depth,
+                unsigned int bytes_per_pixel ) {
+    size_t row_size = (size_t) width * bytes_per_pixel;
+    for( unsigned int z = 0; z < depth; ++z ) {
+      for( unsigned int y = 0; y < height; ++y ) {
+        memcpy( dst + ( ( (size_t)( dz + z ) * dst_h + dy + y ) * dst_w + dx ) *
+                bytes_per_pixel,
+                src + ( ( (size_t)( sz + z ) * src_h + sy + y ) * src_w + sx ) *
+                bytes_per_pixel,
+                row_size );
+      }
+    }
+  }
+
+  // The state of a BrickedVolumeReader::readRegion call.
+  struct RegionRead {
+    BrickedVolumeReader *reader;
+    std::vector< unsigned int > bricks;
+    unsigned int x, y, z, width, height, depth;
+    unsigned char *data;
+    bool failed;
+  };
+
+  // The state of a BrickedVolumeWriter::writeLayer call.
+  struct LayerWrite {
+    BrickedVolumeWriter *writer;
+    unsigned int first_brick;
+  };
+}
+
+using namespace BrickedVolumeFileInternals;
+
+BrickedVolumeFile::BrickedVolumeFile() :
+  w( 0 ), h( 0 ), d( 0 ),
+  bits_per_pixel( 0 ),
+  pixel_type( Image::LUMINANCE ),
+  pixel_component_type( Image::UNSIGNED ),
+  pixel_size( 0, 0, 0 ),
+  brick_w( 64 ), brick_h( 64 ), brick_d( 64 ),
+  data_encoding( RAW ),
+  nr_worker_threads( 0 ) {
+}
+
+bool BrickedVolumeFile::isEncodingSupported( Encoding e ) {
+  if( e == RAW ) return true;
+#ifdef HAVE_ZLIB
+  if( e == ZLIB || e == ZLIB_FAST ) return true;
+#endif
+  return false;
+}
+
+void BrickedVolumeFile::setError( const std::string &message ) {
+  error_message = message;
+}
+
+unsigned int BrickedVolumeFile::nrComponents( Image::PixelType type ) {
+  switch( type ) {
+  case Image::LUMINANCE:
+  case Image::R:
+    return 1;
+  case Image::LUMINANCE_ALPHA:
+  case Image::RG:
+    return 2;
+  case Image::RGB:
+  case Image::BGR:
+  case Image::VEC3:
+    return 3;
+  case Image::RGBA:
+  case Image::BGRA:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+void BrickedVolumeFile::getBrickBox( unsigned int index,
+                                     unsigned int &x,
+                                     unsigned int &y,
+                                     unsigned int &z,
+                                     unsigned int &width,
+                                     unsigned int &height,
+                                     unsigned int &depth ) {
+  unsigned int nr_x = nrBricksX();
+  unsigned int nr_y = nrBricksY();
+  x = ( index % nr_x ) * brick_w;
+  y = ( ( index / nr_x ) % nr_y ) * brick_h;
+  z = ( index / ( nr_x * nr_y ) ) * brick_d;
+  width = H3DMin( brick_w, w - x );
+  height = H3DMin( brick_h, h - y );
+  depth = H3DMin( brick_d, d - z );
+}
+
+BrickedVolumeReader::BrickedVolumeReader() :
+  swap_bytes( false ),
+  memory_data( NULL ),
+  memory_size( 0 ) {
+}
+
+bool BrickedVolumeReader::open( const std::string &url ) {
+  error_message = "";
+  filename = "";
+  memory_data = NULL;
+  memory_size = 0;
+  stream_data.clear();
+  file_lock.lock();
+  if( file_stream.is_open() ) file_stream.close();
+  file_stream.clear();
+  file_stream.open( url.c_str(), std::ios::in | std::ios::binary );
+  file_lock.unlock();
+  if( !file_stream.is_open() ) {
+    setError( "Could not open file \"" + url + "\"." );
+    return false;
+  }
+  return readHeader( file_stream, url );
+}
+
+bool BrickedVolumeReader::open( const void *data, size_t size,
+                                const std::string &name ) {
+  error_message = "";
+  filename = "";
+  file_lock.lock();
+  if( file_stream.is_open() ) file_stream.close();
+  file_lock.unlock();
+  stream_data.clear();
+  memory_data = static_cast< const unsigned char * >( data );
+  memory_size = (H3DInt64) size;
+  MemoryInputStream is( data, size );
+  return readHeader( is, name );
+}
+
+bool BrickedVolumeReader::open( std::istream &is, const std::string &name ) {
+  std::vector< unsigned char > buffer;
+  readWholeStream( is, buffer );
+  if( !open( buffer.empty() ? NULL : &buffer[0], buffer.size(), name ) ) {
+    return false;
+  }
+  // memory_data stays valid when the vector is swapped.
+  stream_data.swap( buffer );
+  return true;
+}
+
+bool BrickedVolumeReader::readHeader( std::istream &is,
+                                      const std::string &url ) {
+  unsigned char header[ header_size ];
+  is.read( (char *)header, header_size );
+  if( is.gcount() != header_size ||
+      memcmp( header, magic, sizeof( magic ) ) != 0 ) {
+    setError( "\"" + url + "\" is not a bricked volume file." );
+    return false;
+  }
+
+  swap_bytes = false;
+  H3DUInt32 bom = getValue< H3DUInt32 >( header, 8, false );
+  if( bom != byte_order_mark ) {
+    swap_bytes = true;
+    bom = getValue< H3DUInt32 >( header, 8, true );
+    if( bom != byte_order_mark ) {
+      setError( "Invalid byte order in \"" + url + "\"." );
+      return false;
+    }
+  }
+
+  if( getValue< H3DUInt32 >( header, 12, swap_bytes ) > file_version ) {
+    setError( "\"" + url + "\" was written by a newer version of H3DUtil." );
+    return false;
+  }
+
+  w = getValue< H3DUInt32 >( header, 16, swap_bytes );
+  h = getValue< H3DUInt32 >( header, 20, swap_bytes );
+  d = getValue< H3DUInt32 >( header, 24, swap_bytes );
+  bits_per_pixel = getValue< H3DUInt32 >( header, 28, swap_bytes );
+  pixel_type =
+    (Image::PixelType) getValue< H3DUInt32 >( header, 32, swap_bytes );
+  pixel_component_type = (Image::PixelComponentType)
+    getValue< H3DUInt32 >( header, 36, swap_bytes );
+  pixel_size = Vec3f( getValue< H3DFloat >( header, 40, swap_bytes ),
+                      getValue< H3DFloat >( header, 44, swap_bytes ),
+                      getValue< H3DFloat >( header, 48, swap_bytes ) );
+  brick_w = getValue< H3DUInt32 >( header, 52, swap_bytes );
+  brick_h = getValue< H3DUInt32 >( header, 56, swap_bytes );
+  brick_d = getValue< H3DUInt32 >( header, 60, swap_bytes );
+  data_encoding = (Encoding) getValue< H3DUInt32 >( header, 64, swap_bytes );
+  H3DUInt32 nr_bricks = getValue< H3DUInt32 >( header, 68, swap_bytes );
+  H3DInt64 index_offset = getValue< H3DInt64 >( header, 72, swap_bytes );
+
+  unsigned int nr_components = nrComponents( pixel_type );
+  if( w == 0 || h == 0 || d == 0 ||
+      brick_w == 0 || brick_h == 0 || brick_d == 0 ||
+      nr_components == 0 || bits_per_pixel == 0 ||
+      bits_per_pixel % ( 8 * nr_components ) != 0 ||
+      nr_bricks != nrBricks() ) {
+    setError( "Invalid header in \"" + url + "\"." );
+    return false;
+  }
+  if( !isEncodingSupported( data_encoding ) ) {
+    setError( "The encoding of \"" + url +
+              "\" is not supported by this build." );
+    return false;
+  }
+
+  std::vector< unsigned char > index( nr_bricks * index_entry_size );
+  is.seekg( index_offset );
+  is.read( (char *)&index[0], index.size() );
+  if( is.gcount() != (std::streamsize) index.size() ) {
+    setError( "Could not read brick index of \"" + url + "\"." );
+    return false;
+  }
+  brick_offsets.resize( nr_bricks );
+  brick_sizes.resize( nr_bricks );
+  for( unsigned int i = 0; i < nr_bricks; ++i ) {
+    brick_offsets[i] =
+      getValue< H3DInt64 >( &index[0], i * index_entry_size, swap_bytes );
+    brick_sizes[i] =
+      getValue< H3DInt64 >( &index[0], i * index_entry_size + 8, swap_bytes );
+  }
+
+  filename = url;
+  return true;
+}
+
+H3DInt64 BrickedVolumeReader::brickDataSize( unsigned int index ) {
+  unsigned int x, y, z, width, height, depth;
+  getBrickBox( index, x, y, z, width, height, depth );
+  return (H3DInt64) width * height * depth * bytesPerPixel();
+}
+
+bool BrickedVolumeReader::readBrick( unsigned int index, void *data ) {
+  if( filename.empty() || index >= brick_sizes.size() ) return false;
+
+  // bricks in memory are decompressed directly from their buffer.
+  const unsigned char *brick_data = NULL;
+  size_t brick_data_size = (size_t) brick_sizes[index];
+  std::vector< unsigned char > input;
+  if( memory_data ) {
+    if( brick_offsets[index] < 0 ||
+        brick_offsets[index] + brick_sizes[index] > memory_size ) {
+      return false;
+    }
+    brick_data = memory_data + brick_offsets[index];
+  } else {
+    input.resize( brick_data_size );
+    file_lock.lock();
+    file_stream.clear();
+    file_stream.seekg( brick_offsets[index] );
+    if( !input.empty() ) file_stream.read( (char *)&input[0], input.size() );
+    bool read_ok = file_stream.gcount() == (std::streamsize) input.size();
+    file_lock.unlock();
+    if( !read_ok ) return false;
+    if( !input.empty() ) brick_data = &input[0];
+  }
+
+  unsigned int bytes_per_component =
+    bits_per_pixel / ( 8 * nrComponents( pixel_type ) );
+  size_t size = (size_t) brickDataSize( index );
+  if( !decompressBrick( data_encoding, bytes_per_component,
+                        brick_data, brick_data_size,
+                        (unsigned char *)data, size ) ) {
+    return false;
+  }
+  if( swap_bytes ) {
+    swapBytes( (unsigned char *)data, size, bytes_per_component );
+  }
+  return true;
+}
+
+bool BrickedVolumeReader::readRegion( unsigned int x,
+                                      unsigned int y,
+                                      unsigned int z,
+                                      unsigned int width,
+                                      unsigned int height,
+                                      unsigned int depth,
+                                      void *data ) {
+  if( filename.empty() ) {
+    setError( "No bricked volume file open." );
+    return false;
+  }
+  if( x + width > w || y + height > h || z + depth > d ||
+      x + width < x || y + height < y || z + depth < z ) {
+    setError( "Region outside of image in \"" + filename + "\"." );
+    return false;
+  }
+  if( width == 0 || height == 0 || depth == 0 ) return true;
+
+  RegionRead read;
+  read.reader = this;
+  read.x = x;
+  read.y = y;
+  read.z = z;
+  read.width = width;
+  read.height = height;
+  read.depth = depth;
+  read.data = (unsigned char *)data;
+  read.failed = false;
+  for( unsigned int bz = z / brick_d; bz <= ( z + depth - 1 ) / brick_d; ++bz ) {
+    for( unsigned int by = y / brick_h; by <= ( y + height - 1 ) / brick_h;
+         ++by ) {
+      for( unsigned int bx = x / brick_w; bx <= ( x + width - 1 ) / brick_w;
+           ++bx ) {
+        read.bricks.push_back( brickIndex( bx, by, bz ) );
+      }
+    }
+  }
+
+  parallelFor( 0, (unsigned int) read.bricks.size(), readBrickRange,
+               &read, 1, nr_worker_threads );
+  if( read.failed ) {
+    setError( "Could not read bricks of \"" + filename + "\"." );
+    return false;
+  }
+  return true;
+}
+
+void BrickedVolumeReader::readBrickRange( unsigned int begin,
+                                          unsigned int end,
+                                          void *data ) {
+  RegionRead *read = static_cast< RegionRead * >( data );
+  BrickedVolumeReader *reader = read->reader;
+  unsigned int bytes_per_pixel = reader->bytesPerPixel();
+  std::vector< unsigned char > brick;
+
+  for( unsigned int i = begin; i < end && !read->failed; ++i ) {
+    unsigned int index = read->bricks[i];
+    unsigned int bx, by, bz, bw, bh, bd;
+    reader->getBrickBox( index, bx, by, bz, bw, bh, bd );
+    brick.resize( (size_t) reader->brickDataSize( index ) );
+    if( !reader->readBrick( index, &brick[0] ) ) {
+      read->failed = true;
+      return;
+    }
+
+    // the intersection of the brick and the region.
+    unsigned int x0 = H3DMax( bx, read->x );
+    unsigned int y0 = H3DMax( by, read->y );
+    unsigned int z0 = H3DMax( bz, read->z );
+    unsigned int x1 = H3DMin( bx + bw, read->x + read->width );
+    unsigned int y1 = H3DMin( by + bh, read->y + read->height );
+    unsigned int z1 = H3DMin( bz + bd, read->z + read->depth );
+    copyBox( &brick[0], bw, bh, x0 - bx, y0 - by, z0 - bz,
+             read->data, read->width, read->height,
+             x0 - read->x, y0 - read->y, z0 - read->z,
+             x1 - x0, y1 - y0, z1 - z0, bytes_per_pixel );
+  }
+}
+
+Image *BrickedVolumeReader::readImage() {
+  return readRegionImage( 0, 0, 0, w, h, d );
+}
+
+Image *BrickedVolumeReader::readRegionImage( unsigned int x,
+                                             unsigned int y,
+                                             unsigned int z,
+                                             unsigned int width,
+                                             unsigned int height,
+                                             unsigned int depth ) {
+  unsigned char *data =
+    new unsigned char[ (size_t) width * height * depth * bytesPerPixel() ];
+  if( !readRegion( x, y, z, width, height, depth, data ) ) {
+    delete [] data;
+    return NULL;
+  }
+  return new PixelImage( width, height, depth, bits_per_pixel,
+                         pixel_type, pixel_component_type,
+                         data, false, pixel_size );
+}
+
+BrickedVolumeWriter::BrickedVolumeWriter() :
+  compression_level( -1 ),
+  slices_written( 0 ),
+  layer_slices( 0 ),
+  compress_failed( false ) {
+}
+
+BrickedVolumeWriter::~BrickedVolumeWriter() {
+  if( file_stream.is_open() ) close();
+}
+
+bool BrickedVolumeWriter::open( const std::string &url,
+                                unsigned int width,
+                                unsigned int height,
+                                unsigned int depth,
+                                unsigned int _bits_per_pixel,
+                                Image::PixelType _pixel_type,
+                                Image::PixelComponentType _pixel_component_type,
+                                const Vec3f &_pixel_size,
+                                Encoding encoding ) {
+  if( file_stream.is_open() ) close();
+  error_message = "";
+
+  unsigned int nr_components = nrComponents( _pixel_type );
+  if( nr_components == 0 || _bits_per_pixel == 0 ||
+      _bits_per_pixel % ( 8 * nr_components ) != 0 ) {
+    setError( "Unsupported pixel format for bricked volume file \"" +
+              url + "\"." );
+    return false;
+  }
+  if( width == 0 || height == 0 || depth == 0 ||
+      brick_w == 0 || brick_h == 0 || brick_d == 0 ) {
+    setError( "Invalid dimensions for bricked volume file \"" + url + "\"." );
+    return false;
+  }
+  if( !isEncodingSupported( encoding ) ) {
+    setError( "The encoding is not supported by this build." );
+    return false;
+  }
+
+  w = width;
+  h = height;
+  d = depth;
+  bits_per_pixel = _bits_per_pixel;
+  pixel_type = _pixel_type;
+  pixel_component_type = _pixel_component_type;
+  pixel_size = _pixel_size;
+  data_encoding = encoding;
+  slices_written = 0;
+  layer_slices = 0;
+  brick_offsets.assign( nrBricks(), 0 );
+  brick_sizes.assign( nrBricks(), 0 );
+
+  file_stream.clear();
+  file_stream.open( url.c_str(), std::ios::out | std::ios::binary );
+  if( !file_stream.is_open() ) {
+    setError( "Could not open file \"" + url + "\" for writing." );
+    return false;
+  }
+
+  unsigned char header[ header_size ];
+  memset( header, 0, header_size );
+  memcpy( header, magic, sizeof( magic ) );
+  putValue< H3DUInt32 >( header, 8, byte_order_mark );
+  putValue< H3DUInt32 >( header, 12, file_version );
+  putValue< H3DUInt32 >( header, 16, w );
+  putValue< H3DUInt32 >( header, 20, h );
+  putValue< H3DUInt32 >( header, 24, d );
+  putValue< H3DUInt32 >( header, 28, bits_per_pixel );
+  putValue< H3DUInt32 >( header, 32, pixel_type );
+  putValue< H3DUInt32 >( header, 36, pixel_component_type );
+  putValue< H3DFloat >( header, 40, pixel_size.x );
+  putValue< H3DFloat >( header, 44, pixel_size.y );
+  putValue< H3DFloat >( header, 48, pixel_size.z );
+  putValue< H3DUInt32 >( header, 52, brick_w );
+  putValue< H3DUInt32 >( header, 56, brick_h );
+  putValue< H3DUInt32 >( header, 60, brick_d );
+  putValue< H3DUInt32 >( header, 64, data_encoding );
+  putValue< H3DUInt32 >( header, 68, nrBricks() );
+  putValue< H3DInt64 >( header, 72, header_size );
+  file_stream.write( (const char *)header, header_size );
+
+  // reserve room for the index, it is written by close().
+  std::vector< unsigned char > index( nrBricks() * index_entry_size, 0 );
+  file_stream.write( (const char *)&index[0], index.size() );
+
+  layer_data.resize( (size_t) w * h * brick_d * bytesPerPixel() );
+  if( !file_stream.good() ) {
+    setError( "Could not write to file \"" + url + "\"." );
+    file_stream.close();
+    return false;
+  }
+  return true;
+}
+
+bool BrickedVolumeWriter::writeSlices( const void *data,
+                                       unsigned int nr_slices ) {
+  if( !file_stream.is_open() ) {
+    setError( "No bricked volume file open." );
+    return false;
+  }
+  if( slices_written + layer_slices + nr_slices > d ) {
+    setError( "Too many slices written to bricked volume file." );
+    return false;
+  }
+
+  size_t slice_size = (size_t) w * h * bytesPerPixel();
+  const unsigned char *src = (const unsigned char *)data;
+  while( nr_slices > 0 ) {
+    unsigned int n = H3DMin( nr_slices, brick_d - layer_slices );
+    memcpy( &layer_data[0] + layer_slices * slice_size, src, n * slice_size );
+    layer_slices += n;
+    src += n * slice_size;
+    nr_slices -= n;
+    if( layer_slices == brick_d || slices_written + layer_slices == d ) {
+      if( !writeLayer() ) return false;
+    }
+  }
+  return true;
+}
+
+bool BrickedVolumeWriter::writeLayer() {
+  unsigned int bricks_per_layer = nrBricksX() * nrBricksY();
+  LayerWrite layer;
+  layer.writer = this;
+  layer.first_brick = ( slices_written / brick_d ) * bricks_per_layer;
+  compressed_bricks.resize( bricks_per_layer );
+  compress_failed = false;
+  parallelFor( 0, bricks_per_layer, compressBrickRange, &layer,
+               1, nr_worker_threads );
+  if( compress_failed ) {
+    setError( "Could not compress bricks." );
+    return false;
+  }
+
+  for( unsigned int i = 0; i < bricks_per_layer; ++i ) {
+    std::vector< unsigned char > &brick = compressed_bricks[i];
+    brick_offsets[ layer.first_brick + i ] = file_stream.tellp();
+    brick_sizes[ layer.first_brick + i ] = brick.size();
+    if( !brick.empty() ) {
+      file_stream.write( (const char *)&brick[0], brick.size() );
+    }
+    std::vector< unsigned char >().swap( brick );
+  }
+
+  slices_written += layer_slices;
+  layer_slices = 0;
+  if( !file_stream.good() ) {
+    setError( "Could not write to bricked volume file." );
+    return false;
+  }
+  return true;
+}
+
+void BrickedVolumeWriter::compressBrickRange( unsigned int begin,
+                                              unsigned int end,
+                                              void *data ) {
+  LayerWrite *layer = static_cast< LayerWrite * >( data );
+  BrickedVolumeWriter *writer = layer->writer;
+  unsigned int bytes_per_pixel = writer->bytesPerPixel();
+  unsigned int bytes_per_component =
+    writer->bits_per_pixel / ( 8 * nrComponents( writer->pixel_type ) );
+  std::vector< unsigned char > brick;
+
+  for( unsigned int i = begin; i < end && !writer->compress_failed; ++i ) {
+    unsigned int bx, by, bz, bw, bh, bd;
+    writer->getBrickBox( layer->first_brick + i, bx, by, bz, bw, bh, bd );
+    brick.resize( (size_t) bw * bh * bd * bytes_per_pixel );
+    copyBox( &writer->layer_data[0], writer->w, writer->h, bx, by, 0,
+             &brick[0], bw, bh, 0, 0, 0,
+             bw, bh, bd, bytes_per_pixel );
+    if( !compressBrick( writer->data_encoding, writer->compression_level,
+                        bytes_per_component, &brick[0], brick.size(),
+                        writer->compressed_bricks[i] ) ) {
+      writer->compress_failed = true;
+      return;
+    }
+  }
+}
+
+bool BrickedVolumeWriter::close() {
+  if( !file_stream.is_open() ) return false;
+  bool success = error_message.empty();
+  if( success && slices_written != d ) {
+    setError( "Not all slices were written to bricked volume file." );
+    success = false;
+  }
+
+  if( success ) {
+    std::vector< unsigned char > index( nrBricks() * index_entry_size );
+    for( unsigned int i = 0; i < nrBricks(); ++i ) {
+      putValue< H3DInt64 >( &index[0], i * index_entry_size,
+                            brick_offsets[i] );
+      putValue< H3DInt64 >( &index[0], i * index_entry_size + 8,
+                            brick_sizes[i] );
+    }
+    file_stream.seekp( header_size );
+    file_stream.write( (const char *)&index[0], index.size() );
+    success = file_stream.good();
+    if( !success ) setError( "Could not write to bricked volume file." );
+  }
+
+  file_stream.close();
+  std::vector< unsigned char >().swap( layer_data );
+  return success;
+}
+
+bool BrickedVolumeWriter::writeImage( const std::string &url,
+                                      Image *image,
+                                      Encoding encoding ) {
+  if( !image || image->compressionType() != Image::NO_COMPRESSION ) {
+    setError( "Cannot write compressed image as bricked volume file." );
+    return false;
+  }
+  if( !open( url, image->width(), image->height(), image->depth(),
+             image->bitsPerPixel(), image->pixelType(),
+             image->pixelComponentType(), image->pixelSize(), encoding ) ) {
+    return false;
+  }
+  bool success = true;
+  void *data = image->getImageData();
+  if( data && image->hasPackedData() ) {
+    success = writeSlices( data, image->depth() );
+  } else {
+    // remove the row padding or read the pixels one slice at a time.
+    std::vector< unsigned char > slice( (size_t) image->width() *
+                                        image->height() *
+                                        image->bitsPerPixel() / 8 );
+    for( unsigned int z = 0; success && z < image->depth(); ++z ) {
+      image->getPackedSlices( z, 1, &slice[0] );
+      success = writeSlices( &slice[0], 1 );
+    }
+  }
+  if( !success ) {
+    file_stream.close();
+    return false;
+  }
+  return close();
+}
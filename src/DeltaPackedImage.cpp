@@ -0,0 +1,342 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file DeltaPackedImage.cpp
+/// \brief CPP file for DeltaPackedImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/DeltaPackedImage.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+
+using namespace H3DUtil;
+
+namespace DeltaPackedImageInternals {
+  const unsigned int brick_size = DeltaPackedImage::brick_size;
+  const unsigned int group_size = brick_size * brick_size;
+  const unsigned int brick_voxels = group_size * brick_size;
+
+  // Extra bytes after the packed data so that a value can always be read
+  // with a three byte load.
+  const unsigned int padding_bytes = 4;
+
+  // Read the value with the given number of bits at a bit position in
+  // packed data. The values are stored least significant bit first.
+  inline unsigned int readBits( const unsigned char *data,
+                                unsigned int bit,
+                                unsigned int bits ) {
+    const unsigned char *p = data + ( bit >> 3 );
+    unsigned int v = p[0] | ( p[1] << 8 ) | ( p[2] << 16 );
+    return ( v >> ( bit & 7 ) ) & ( ( 1u << bits ) - 1 );
+  }
+
+  // Unpack a group of values packed with B bits each. B is a template
+  // argument so that the loop is unrolled with constant offsets and
+  // shifts, which the compiler turns into vector code.
+  template< unsigned int B >
+  void unpackGroup( const unsigned char *data,
+                    unsigned short base,
+                    unsigned short sign_flip,
+                    unsigned short *values ) {
+    const unsigned int mask = ( 1u << B ) - 1;
+    for( unsigned int i = 0; i < group_size; ++i ) {
+      const unsigned int bit = i * B;
+      const unsigned char *p = data + ( bit >> 3 );
+      unsigned int v = p[0] | ( p[1] << 8 ) | ( p[2] << 16 );
+      values[i] = (unsigned short)
+        ( ( base + ( ( v >> ( bit & 7 ) ) & mask ) ) ^ sign_flip );
+    }
+  }
+
+  typedef void (*UnpackGroupFunc)( const unsigned char *data,
+                                   unsigned short base,
+                                   unsigned short sign_flip,
+                                   unsigned short *values );
+
+  // The unpack function for each number of bits.
+  const UnpackGroupFunc unpack_group_funcs[17] = {
+    unpackGroup< 0 >, unpackGroup< 1 >, unpackGroup< 2 >, unpackGroup< 3 >,
+    unpackGroup< 4 >, unpackGroup< 5 >, unpackGroup< 6 >, unpackGroup< 7 >,
+    unpackGroup< 8 >, unpackGroup< 9 >, unpackGroup< 10 >,
+    unpackGroup< 11 >, unpackGroup< 12 >, unpackGroup< 13 >,
+    unpackGroup< 14 >, unpackGroup< 15 >, unpackGroup< 16 > };
+
+  // Returns the number of bits needed to store value.
+  inline unsigned char bitsNeeded( unsigned int value ) {
+    unsigned char bits = 0;
+    while( value >> bits ) ++bits;
+    return bits;
+  }
+
+  // State for DeltaPackedImage::unpackBricks.
+  struct UnpackBricksState {
+    DeltaPackedImage *image;
+    unsigned short *data;
+  };
+
+  // Copy the part of a decoded brick that is inside the region
+  // [x, x + width) x [y, y + height) x [z, z + depth) to the region data.
+  // x0, y0, z0 is the position of the first voxel of the brick.
+  void copyBrickToRegion( const unsigned short *brick,
+                          unsigned int x0, unsigned int y0, unsigned int z0,
+                          unsigned int x, unsigned int y, unsigned int z,
+                          unsigned int width,
+                          unsigned int height,
+                          unsigned int depth,
+                          unsigned short *data ) {
+    unsigned int sx = H3DMax( x0, x );
+    unsigned int ex = H3DMin( x0 + brick_size, x + width );
+    unsigned int sy = H3DMax( y0, y );
+    unsigned int ey = H3DMin( y0 + brick_size, y + height );
+    unsigned int sz = H3DMax( z0, z );
+    unsigned int ez = H3DMin( z0 + brick_size, z + depth );
+    for( unsigned int pz = sz; pz < ez; ++pz ) {
+      for( unsigned int py = sy; py < ey; ++py ) {
+        memcpy( data +
+                ( ( (size_t)( pz - z ) * height + ( py - y ) ) * width +
+                  ( sx - x ) ),
+                brick + ( ( pz - z0 ) * brick_size + ( py - y0 ) ) *
+                brick_size + ( sx - x0 ),
+                ( ex - sx ) * sizeof( unsigned short ) );
+      }
+    }
+  }
+}
+
+using namespace DeltaPackedImageInternals;
+
+bool DeltaPackedImage::isSupported( Image *image ) {
+  Image::PixelComponentType t = image->pixelComponentType();
+  return image->nrPixelComponents() == 1 &&
+    image->bitsPerPixel() == 16 &&
+    ( t == Image::SIGNED || t == Image::UNSIGNED ) &&
+    image->compressionType() == Image::NO_COMPRESSION;
+}
+
+DeltaPackedImage::DeltaPackedImage( Image *image, unsigned int nr_threads ) :
+  w( image->width() ),
+  h( image->height() ),
+  d( image->depth() ),
+  pixel_type( image->pixelType() ),
+  pixel_component_type( image->pixelComponentType() ),
+  pixel_size( image->pixelSize() ),
+  sign_flip( image->pixelComponentType() == Image::SIGNED ? 0x8000 : 0 ),
+  source_image( image ),
+  brick_data( NULL ) {
+  if( !isSupported( image ) ) {
+    throw UnsupportedPixelFormat( "", "DeltaPackedImage only supports "
+                                  "images with one 16 bit integer "
+                                  "component.",
+                                  H3D_FULL_LOCATION );
+  }
+
+  bricks_x = ( w + brick_size - 1 ) / brick_size;
+  bricks_y = ( h + brick_size - 1 ) / brick_size;
+  bricks_z = ( d + brick_size - 1 ) / brick_size;
+  unsigned int nr_bricks = nrBricks();
+  brick_offsets.resize( nr_bricks );
+  group_bases.resize( nr_bricks * brick_size );
+  group_bits.resize( nr_bricks * brick_size );
+
+  // pack each brick into its own buffer in parallel and then put them
+  // after each other.
+  std::vector< std::vector< unsigned char > > packed_bricks( nr_bricks );
+  brick_data = &packed_bricks;
+  parallelFor( 0, nr_bricks, packBricks, this, 1, nr_threads );
+  brick_data = NULL;
+  source_image = NULL;
+
+  size_t total_size = 0;
+  for( unsigned int i = 0; i < nr_bricks; ++i ) {
+    brick_offsets[i] = total_size;
+    total_size += packed_bricks[i].size();
+  }
+  packed_data.resize( total_size + padding_bytes, 0 );
+  for( unsigned int i = 0; i < nr_bricks; ++i ) {
+    if( !packed_bricks[i].empty() ) {
+      memcpy( &packed_data[ brick_offsets[i] ], &packed_bricks[i][0],
+              packed_bricks[i].size() );
+    }
+  }
+}
+
+void DeltaPackedImage::packBricks( unsigned int begin,
+                                   unsigned int end,
+                                   void *data ) {
+  DeltaPackedImage *packed = static_cast< DeltaPackedImage * >( data );
+  Image *image = packed->source_image;
+  unsigned int w = packed->w, h = packed->h;
+  const unsigned char *image_data =
+    (const unsigned char *) image->getImageData();
+  size_t row_stride = image->rowStride();
+  size_t slice_stride = image->sliceStride();
+  unsigned short values[ brick_voxels ];
+
+  for( unsigned int i = begin; i < end; ++i ) {
+    unsigned int x0 = ( i % packed->bricks_x ) * brick_size;
+    unsigned int y0 = ( ( i / packed->bricks_x ) % packed->bricks_y ) *
+      brick_size;
+    unsigned int z0 = ( i / ( packed->bricks_x * packed->bricks_y ) ) *
+      brick_size;
+
+    // read the brick. Voxels outside of the image get the value of the
+    // closest voxel inside so that they do not widen the group ranges.
+    for( unsigned int z = 0; z < brick_size; ++z ) {
+      unsigned int pz = H3DMin( z0 + z, packed->d - 1 );
+      for( unsigned int y = 0; y < brick_size; ++y ) {
+        unsigned int py = H3DMin( y0 + y, h - 1 );
+        for( unsigned int x = 0; x < brick_size; ++x ) {
+          unsigned int px = H3DMin( x0 + x, w - 1 );
+          unsigned short *v = &values[ ( z * brick_size + y ) * brick_size + x ];
+          if( image_data ) {
+            memcpy( v, image_data + pz * slice_stride + py * row_stride +
+                    px * 2, 2 );
+          } else {
+            image->getElement( v, px, py, pz );
+          }
+          *v ^= packed->sign_flip;
+        }
+      }
+    }
+
+    // pack each group with its minimum as base.
+    std::vector< unsigned char > &brick = (*packed->brick_data)[i];
+    for( unsigned int g = 0; g < brick_size; ++g ) {
+      const unsigned short *group = &values[ g * group_size ];
+      unsigned short min_value = group[0], max_value = group[0];
+      for( unsigned int j = 1; j < group_size; ++j ) {
+        if( group[j] < min_value ) min_value = group[j];
+        if( group[j] > max_value ) max_value = group[j];
+      }
+      unsigned char bits = bitsNeeded( max_value - min_value );
+      packed->group_bases[ i * brick_size + g ] = min_value;
+      packed->group_bits[ i * brick_size + g ] = bits;
+      if( bits == 0 ) continue;
+
+      size_t start = brick.size();
+      // group_size values of bits bits each.
+      brick.resize( start + bits * group_size / 8 + 2, 0 );
+      unsigned char *dst = &brick[ start ];
+      for( unsigned int j = 0; j < group_size; ++j ) {
+        unsigned int bit = j * bits;
+        unsigned int v = (unsigned int)( group[j] - min_value ) << ( bit & 7 );
+        unsigned char *p = dst + ( bit >> 3 );
+        p[0] |= (unsigned char)( v );
+        p[1] |= (unsigned char)( v >> 8 );
+        p[2] |= (unsigned char)( v >> 16 );
+      }
+      // the last value never reaches the two extra bytes.
+      brick.resize( start + bits * group_size / 8 );
+    }
+  }
+}
+
+void DeltaPackedImage::getElement( void *value, int x, int y, int z ) {
+  unsigned int brick = ( ( z / brick_size ) * bricks_y + y / brick_size ) *
+    bricks_x + x / brick_size;
+  unsigned int group = z % brick_size;
+  unsigned int g = brick * brick_size + group;
+  unsigned int i = ( y % brick_size ) * brick_size + x % brick_size;
+  unsigned int bits = group_bits[g];
+  unsigned short v = (unsigned short)
+    ( ( group_bases[g] +
+        readBits( groupData( brick, group ), i * bits, bits ) ) ^ sign_flip );
+  memcpy( value, &v, 2 );
+}
+
+void DeltaPackedImage::decodeBrick( unsigned int index, void *data ) {
+  unsigned short *values = static_cast< unsigned short * >( data );
+  const unsigned char *src = &packed_data[0] + brick_offsets[index];
+  for( unsigned int g = 0; g < brick_size; ++g ) {
+    unsigned int bits = group_bits[ index * brick_size + g ];
+    unpack_group_funcs[bits]( src, group_bases[ index * brick_size + g ],
+                              sign_flip, values + g * group_size );
+    src += bits * group_size / 8;
+  }
+}
+
+bool DeltaPackedImage::getRegion( unsigned int x,
+                                  unsigned int y,
+                                  unsigned int z,
+                                  unsigned int width,
+                                  unsigned int height,
+                                  unsigned int depth,
+                                  void *data ) {
+  if( x + width > w || y + height > h || z + depth > d ) return false;
+  if( width == 0 || height == 0 || depth == 0 ) return true;
+
+  unsigned short brick[ brick_voxels ];
+  for( unsigned int bz = z / brick_size;
+       bz <= ( z + depth - 1 ) / brick_size; ++bz ) {
+    for( unsigned int by = y / brick_size;
+         by <= ( y + height - 1 ) / brick_size; ++by ) {
+      for( unsigned int bx = x / brick_size;
+           bx <= ( x + width - 1 ) / brick_size; ++bx ) {
+        decodeBrick( ( bz * bricks_y + by ) * bricks_x + bx, brick );
+        copyBrickToRegion( brick,
+                           bx * brick_size, by * brick_size, bz * brick_size,
+                           x, y, z, width, height, depth,
+                           static_cast< unsigned short * >( data ) );
+      }
+    }
+  }
+  return true;
+}
+
+void DeltaPackedImage::unpackBricks( unsigned int begin,
+                                     unsigned int end,
+                                     void *data ) {
+  UnpackBricksState *state = static_cast< UnpackBricksState * >( data );
+  DeltaPackedImage *image = state->image;
+  unsigned short brick[ brick_voxels ];
+  for( unsigned int i = begin; i < end; ++i ) {
+    image->decodeBrick( i, brick );
+    copyBrickToRegion( brick,
+                       ( i % image->bricks_x ) * brick_size,
+                       ( ( i / image->bricks_x ) % image->bricks_y ) *
+                       brick_size,
+                       ( i / ( image->bricks_x * image->bricks_y ) ) *
+                       brick_size,
+                       0, 0, 0, image->w, image->h, image->d,
+                       state->data );
+  }
+}
+
+Image *DeltaPackedImage::createPixelImage( unsigned int nr_threads ) {
+  unsigned char *data = new unsigned char[ (size_t) w * h * d * 2 ];
+  UnpackBricksState state;
+  state.image = this;
+  state.data = (unsigned short *) data;
+  parallelFor( 0, nrBricks(), unpackBricks, &state, 1, nr_threads );
+  return new PixelImage( w, h, d, 16,
+                         pixel_type, pixel_component_type,
+                         data, false, pixel_size );
+}
+
+H3DInt64 DeltaPackedImage::compressedSize() {
+  return (H3DInt64) packed_data.size() +
+    brick_offsets.size() * sizeof( size_t ) +
+    group_bases.size() * sizeof( unsigned short ) +
+    group_bits.size();
+}
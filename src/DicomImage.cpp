@@ -31,10 +31,9 @@
 
 #ifdef HAVE_DCMTK 
 
-//#define USE_INTERNAL_DICOM_DATA
-
 // DCMTK includes
 #include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcistrmb.h>
 #include <dcmtk/dcmdata/dcmetinf.h>
 #include <dcmtk/dcmdata/dcuid.h>
 #include <dcmtk/dcmdata/dcsequen.h>
@@ -43,11 +42,188 @@
 #include <dcmtk/dcmjpeg/djdecode.h>
 
 #include <H3DUtil/LinAlgTypes.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Console.h>
+
+
+// Partial access to the pixel data makes it possible to decode a range of
+// frames of a multi-frame file without decoding the other frames.
+#if OFFIS_DCMTK_VERSION_NUMBER >= 360
+#define DICOMIMAGE_USE_PARTIAL_ACCESS
+#endif
 
 using namespace H3DUtil;
 
-H3DUtil::DicomImage::DicomImage( const std::string &url ):
-  PixelImage( 0,0,0,0,RGB, UNSIGNED, NULL ) {
+namespace DicomImageInternals {
+  MutexLock codec_lock;
+  bool codecs_registered = false;
+
+  // Unregisters the codecs when the program exits if they were registered.
+  struct CodecCleanup {
+    ~CodecCleanup() {
+      if( codecs_registered ) {
+        DJDecoderRegistration::cleanup();
+        codecs_registered = false;
+      }
+    }
+  };
+  CodecCleanup codec_cleanup;
+
+  // Get the bits per pixel and component type of the stored values of
+  // a monochrome image. Returns false if image has no such data.
+  bool getNativeFormat( ::DicomImage &image,
+                        unsigned int &bits_per_pixel,
+                        Image::PixelComponentType &component_type ) {
+    // the internal data of color images is stored as one plane per
+    // channel and cannot be copied as pixels.
+    if( !image.isMonochrome() ) return false;
+    const DiPixel *inter_data = image.getInterData();
+    if( !inter_data ) return false;
+    switch( inter_data->getRepresentation() ) {
+    case EPR_Uint8:
+      bits_per_pixel = 8;
+      component_type = Image::UNSIGNED; 
+      break;
+    case EPR_Uint16:
+      bits_per_pixel = 16;
+      component_type = Image::UNSIGNED; 
+      break;
+    case EPR_Uint32: 
+      bits_per_pixel = 32;
+      component_type = Image::UNSIGNED; 
+      break;
+    case EPR_Sint8: 
+      bits_per_pixel = 8;
+      component_type = Image::SIGNED; 
+      break;
+    case EPR_Sint16:
+      bits_per_pixel = 16;
+      component_type = Image::SIGNED; 
+      break;
+    case EPR_Sint32:
+      bits_per_pixel = 32;
+      component_type = Image::SIGNED; 
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  // Copy the given frame of image into dest. If native_values is true
+  // the stored values are copied, otherwise the output of the rendering
+  // pipeline with bits_per_sample bits per sample is used.
+  bool copyFrame( ::DicomImage &image,
+                  unsigned long frame,
+                  unsigned char *dest,
+                  unsigned int frame_size,
+                  unsigned int bits_per_sample,
+                  bool native_values ) {
+    if( native_values ) {
+      if( !image.isMonochrome() ) return false;
+      const DiPixel *inter_data = image.getInterData();
+      if( !inter_data || !inter_data->getData() ) return false;
+      memcpy( dest,
+              (const unsigned char *)inter_data->getData() + 
+              frame * frame_size,
+              frame_size );
+      return true;
+    } 
+    return image.getOutputData( dest, frame_size, 
+                                bits_per_sample, frame ) != 0;
+  }
+
+  // Data shared by the threads decoding the frames of a file or the
+  // slices of a DIRFILE.
+  struct DecodeData {
+    // Used when decoding the frames of a single file.
+    std::string url;
+    // Used when decoding one slice from each file.
+    const std::vector< std::string > *urls;
+    // Flags to use when creating each ::DicomImage.
+    unsigned long flags;
+    // Destination of the decoded frames.
+    unsigned char *image_data;
+    // Expected properties of the frames.
+    unsigned int width, height;
+    unsigned int frame_size;
+    unsigned int bits_per_sample;
+    bool native_values;
+    // The first error that occured, if any.
+    MutexLock error_lock;
+    std::string error_url;
+    std::string error;
+
+    void setError( const std::string &_url, const std::string &_error ) {
+      error_lock.lock();
+      if( error.empty() ) {
+        error_url = _url;
+        error = _error;
+      }
+      error_lock.unlock();
+    }
+  };
+
+#ifdef DICOMIMAGE_USE_PARTIAL_ACCESS
+  // parallelFor callback that decodes the frames [begin, end) of 
+  // DecodeData::url directly into their place in the image data.
+  void decodeFrames( unsigned int begin, unsigned int end, void *data ) {
+    DecodeData *d = static_cast< DecodeData * >( data );
+    ::DicomImage image( d->url.c_str(), 
+                        d->flags | CIF_UsePartialAccessToPixelData,
+                        begin, end - begin );
+    if( image.getStatus() != EIS_Normal ) {
+      d->setError( d->url, ::DicomImage::getString( image.getStatus() ) );
+      return;
+    }
+    if( image.getFrameCount() < end - begin ) {
+      d->setError( d->url, "Could not decode all frames." );
+      return;
+    }
+    for( unsigned int i = begin; i < end; ++i ) {
+      if( !copyFrame( image, i - begin, 
+                      d->image_data + (size_t)i * d->frame_size,
+                      d->frame_size, d->bits_per_sample,
+                      d->native_values ) ) {
+        d->setError( d->url, "Could not get pixel data of frame." );
+        return;
+      }
+    }
+  }
+#endif
+
+  // parallelFor callback that decodes the first frame of the files
+  // [begin, end) in DecodeData::urls directly into their place in the
+  // image data.
+  void decodeSlices( unsigned int begin, unsigned int end, void *data ) {
+    DecodeData *d = static_cast< DecodeData * >( data );
+    for( unsigned int i = begin; i < end; ++i ) {
+      const std::string &url = (*d->urls)[i];
+      ::DicomImage image( url.c_str(), d->flags );
+      if( image.getStatus() != EIS_Normal ) {
+        d->setError( url, ::DicomImage::getString( image.getStatus() ) );
+        return;
+      }
+      if( image.getWidth() != d->width || image.getHeight() != d->height ||
+          image.getFrameCount() != 1 ) {
+        d->setError( url, "Slice dimensions do not match first slice." );
+        return;
+      }
+      if( !copyFrame( image, 0, 
+                      d->image_data + (size_t)i * d->frame_size,
+                      d->frame_size, d->bits_per_sample,
+                      d->native_values ) ) {
+        d->setError( url, "Could not get pixel data of slice." );
+        return;
+      }
+    }
+  }
+}
+
+H3DUtil::DicomImage::DicomImage( const std::string &url,
+                                 bool _native_values ):
+  PixelImage( 0,0,0,0,RGB, UNSIGNED, NULL ),
+  native_values( _native_values ) {
 
   dir_file_info.clear();
   dicom_file_info.loadFile( url.c_str() );
@@ -94,21 +270,97 @@ H3DUtil::DicomImage::DicomImage( const std::string &url ):
   }
 }
 
-void H3DUtil::DicomImage::loadImage( const std::string &url ) {
-  DJDecoderRegistration::registerCodecs();
+void H3DUtil::DicomImage::registerCodecs() {
+  using namespace DicomImageInternals;
+  codec_lock.lock();
+  if( !codecs_registered ) {
+    DJDecoderRegistration::registerCodecs();
+    codecs_registered = true;
+  }
+  codec_lock.unlock();
+}
+
+H3DUtil::DicomImage::DicomImage():
+  PixelImage( 0,0,0,0,RGB, UNSIGNED, NULL ),
+  native_values( false ) {
+}
+
+H3DUtil::DicomImage *H3DUtil::DicomImage::fromMemory(
+  const void *data,
+  size_t size,
+  bool native_values,
+  const std::string &name ) {
+  DicomImage *image = new DicomImage;
+  image->native_values = native_values;
+  OFCondition result = readFromMemory( image->dicom_file_info, data, size );
+  if( result.bad() ) {
+    delete image;
+    throw CouldNotLoadDicomImage( name, result.text(), H3D_FULL_LOCATION );
+  }
+  try {
+    image->loadImage( name, true );
+  } catch( ... ) {
+    delete image;
+    throw;
+  }
+  return image;
+}
 
-  ::DicomImage *image = new ::DicomImage( url.c_str() );
+OFCondition H3DUtil::DicomImage::readFromMemory( DcmFileFormat &file_format,
+                                                 const void *data,
+                                                 size_t size ) {
+  DcmInputBufferStream stream;
+  stream.setBuffer( data, (offile_off_t) size );
+  stream.setEos();
+  file_format.transferInit();
+  OFCondition result = file_format.read( stream );
+  file_format.transferEnd();
+  return result;
+}
+
+void H3DUtil::DicomImage::loadImage( const std::string &url,
+                                     bool from_memory ) {
+  using namespace DicomImageInternals;
+  registerCodecs();
+
+  unsigned long flags = 
+    native_values ? CIF_IgnoreModalityTransformation : 0;
+
+  // the number of frames decoded here, the rest of the frames are
+  // decoded in parallel below. The frames of a file in memory are all
+  // decoded from dicom_file_info, which cannot be shared between threads.
+  unsigned int nr_serial_frames;
+  ::DicomImage *image;
+  if( from_memory ) {
+    image = new ::DicomImage( &dicom_file_info,
+                              dicom_file_info.getDataset()->getOriginalXfer(),
+                              flags );
+    nr_serial_frames = image->getFrameCount();
+  } else {
+#ifdef DICOMIMAGE_USE_PARTIAL_ACCESS
+    image = new ::DicomImage( url.c_str(), 
+                              flags | CIF_UsePartialAccessToPixelData, 0, 1 );
+    nr_serial_frames = 1;
+#else
+    image = new ::DicomImage( url.c_str(), flags );
+    nr_serial_frames = image->getFrameCount();
+#endif
+  }
   if (image->getStatus() != EIS_Normal) {
     std::string error_string( ::DicomImage::getString(image->getStatus()) );
     delete image;
-    DJDecoderRegistration::cleanup();
     throw CouldNotLoadDicomImage( url,
                                   error_string,
                                   H3D_FULL_LOCATION );
   }
   w = image->getWidth();
   h = image->getHeight();
+#ifdef DICOMIMAGE_USE_PARTIAL_ACCESS
+  d = image->getNumberOfFrames();
+#else
   d = image->getFrameCount();
+#endif
+  if( nr_serial_frames > d ) nr_serial_frames = d;
 
   DcmDataset *dataset = dicom_file_info.getDataset();
   double size_x, size_y, size_z;
@@ -122,91 +374,101 @@ void H3DUtil::DicomImage::loadImage( const std::string &url ) {
                       (H3DFloat) size_y,
                       (H3DFloat) size_z ) * 0.001;
 
-  // use the internal representation since that contains the original
-  // pixel data. The getOutputData function provides some other representation
-  // "after rendering" that contains overlays and such things. Have not 
-  // figured out the format for this though. In a 16 bit signed dataset 0
-  // will be mapped to 32767
+  // The internal representation contains the stored pixel values when
+  // the modality transformation is ignored. The getOutputData function
+  // provides the values "after rendering" which are rescaled to the
+  // output range, e.g. in a 16 bit signed dataset 0 will be mapped to 32767.
+  // The internal representation is only available for monochrome images.
   pixel_component_type = UNSIGNED;
-#ifndef USE_INTERNAL_DICOM_DATA
-  bits_per_pixel = image->getDepth();
-  if( !isPowerOfTwo( bits_per_pixel ) ) {
-    bits_per_pixel = nextPowerOfTwo( bits_per_pixel );
+  bool use_native_values = 
+    native_values &&
+    getNativeFormat( *image, bits_per_pixel, pixel_component_type );
+  if( native_values && !use_native_values ) {
+    Console(LogLevel::Warning) << "Warning: Stored pixel values not "
+                               << "available for \"" << url 
+                               << "\". Using rendered values." << std::endl;
   }
-  unsigned int frame_size = image->getOutputDataSize();
-  image_data = new unsigned char[ frame_size * d ];
-  for( unsigned int i = 0; i < d; ++i ) {
-    
-    
-    image->getOutputData( &image_data[ i * frame_size ], 
-                          frame_size, 
-                          bits_per_pixel, i );
-    
-    
+
+  unsigned int frame_size;
+  if( use_native_values ) {
+    frame_size = w * h * bits_per_pixel / 8;
+  } else {
+    bits_per_pixel = image->getDepth();
+    if( !isPowerOfTwo( bits_per_pixel ) ) {
+      bits_per_pixel = nextPowerOfTwo( bits_per_pixel );
+    }
+    frame_size = image->getOutputDataSize( bits_per_pixel );
   }
-#else
-  // geOutputDataSize cannot be used since it produces different values
-  // for bitsPerSample if rescaleSlope and rescaleIntercept is defined
-  // in the dicom file.
-  switch (image->getInterData()->getRepresentation()) {
-  case EPR_Uint8:
-    bits_per_pixel = 8;
-    pixel_component_type = UNSIGNED; 
-    break;
-  case EPR_Uint16:
-    bits_per_pixel = 16;
-    pixel_component_type = UNSIGNED; 
-    break;
-  case EPR_Uint32: 
-    bits_per_pixel = 32;
-    pixel_component_type = UNSIGNED; 
-    break;
-  case EPR_Sint8: 
-    bits_per_pixel = 8;
-    pixel_component_type = SIGNED; 
-    break;
-  case EPR_Sint16:
-    bits_per_pixel = 16;
-    pixel_component_type = SIGNED; 
-    break;
-  case EPR_Sint32:
-    bits_per_pixel = 32;
-    pixel_component_type = SIGNED; 
-    break;
+  unsigned int bits_per_sample = bits_per_pixel;
+
+  image_data = new unsigned char[ (size_t)frame_size * d ];
+
+  for( unsigned int i = 0; i < nr_serial_frames; ++i ) {
+    if( !copyFrame( *image, i, 
+                    (unsigned char *)image_data + (size_t)i * frame_size, 
+                    frame_size, bits_per_sample, use_native_values ) ) {
+      delete image;
+      throw CouldNotLoadDicomImage( url,
+                                    "Could not get pixel data of frame.",
+                                    H3D_FULL_LOCATION );
+    }
+  }
+  bool monochrome = image->isMonochrome();
+  delete image;
+
+#ifdef DICOMIMAGE_USE_PARTIAL_ACCESS
+  if( d > nr_serial_frames ) {
+    DecodeData data;
+    data.url = url;
+    data.urls = NULL;
+    data.flags = flags;
+    data.image_data = (unsigned char *) image_data;
+    data.width = w;
+    data.height = h;
+    data.frame_size = frame_size;
+    data.bits_per_sample = bits_per_sample;
+    data.native_values = use_native_values;
+
+    // each chunk of frames opens the file once, so use a few chunks per 
+    // thread to balance the load without parsing the file too often.
+    unsigned int chunk_size = d / ( 4 * getNrHardwareThreads() );
+    if( chunk_size == 0 ) chunk_size = 1;
+    parallelFor( nr_serial_frames, d, decodeFrames, &data, chunk_size );
+    if( !data.error.empty() ) {
+      throw CouldNotLoadDicomImage( data.error_url,
+                                    data.error,
+                                    H3D_FULL_LOCATION );
+    }
   }
-  unsigned int frame_size = w * h * d * bits_per_pixel / 8;
-  image_data = new unsigned char[ frame_size * d ];
-  
-  memcpy(image_data,
-         image->getInterData()->getData(),
-         frame_size * d );
 #endif
  
-  if( image->isMonochrome() )
-    pixel_type = LUMINANCE;
-  else {
+  if( !monochrome ) {
     bits_per_pixel = bits_per_pixel * 3; // RGB image
     pixel_type = RGB; 
+  } else {
+    pixel_type = LUMINANCE;
   }
-
-  delete image;
-  DJDecoderRegistration::cleanup();
 }
 
 void H3DUtil::DicomImage::loadImage( const std::vector< std::string > &urls ) {
+  using namespace DicomImageInternals;
   if( urls.size() > 0 ) {
-    ::DicomImage *image = new ::DicomImage( urls[0].c_str() );
-    if (image->getStatus() != EIS_Normal)
+    registerCodecs();
+
+    unsigned long flags = 
+      native_values ? CIF_IgnoreModalityTransformation : 0;
+
+    ::DicomImage *image = new ::DicomImage( urls[0].c_str(), flags );
+    if (image->getStatus() != EIS_Normal) {
+      std::string error_string( ::DicomImage::getString(image->getStatus()) );
+      delete image;
       throw CouldNotLoadDicomImage( urls[0],
-                                    ::DicomImage::getString(image->getStatus()),
+                                    error_string,
                                     H3D_FULL_LOCATION );
+    }
     w = image->getWidth();
     h = image->getHeight();
     d = (unsigned int) urls.size();
-    bits_per_pixel = image->getDepth();
-    if( !isPowerOfTwo( bits_per_pixel ) ) {
-      bits_per_pixel = nextPowerOfTwo( bits_per_pixel );
-    }
     
     DcmDataset *dataset = dir_file_info[0].getDataset();
     double size_x, size_y, size_z;
@@ -220,6 +482,27 @@ void H3DUtil::DicomImage::loadImage( const std::vector< std::string > &urls ) {
                         (H3DFloat) size_y,
                         (H3DFloat) size_z ) * 0.001;
 
+    pixel_component_type = UNSIGNED;
+    bool use_native_values = 
+      native_values &&
+      getNativeFormat( *image, bits_per_pixel, pixel_component_type );
+    if( native_values && !use_native_values ) {
+      Console(LogLevel::Warning) << "Warning: Stored pixel values not "
+                                 << "available for \"" << urls[0] 
+                                 << "\". Using rendered values." << std::endl;
+    }
+
+    unsigned int frame_size;
+    if( use_native_values ) {
+      frame_size = w * h * bits_per_pixel / 8;
+    } else {
+      bits_per_pixel = image->getDepth();
+      if( !isPowerOfTwo( bits_per_pixel ) ) {
+        bits_per_pixel = nextPowerOfTwo( bits_per_pixel );
+      }
+      frame_size = image->getOutputDataSize( bits_per_pixel );
+    }
+
     unsigned int bits_per_component = bits_per_pixel;
     if( image->isMonochrome() )
       pixel_type = LUMINANCE;
@@ -228,28 +511,33 @@ void H3DUtil::DicomImage::loadImage( const std::vector< std::string > &urls ) {
       pixel_type = RGB; 
     }
     
-    pixel_component_type = UNSIGNED;
-    
-    unsigned int frame_size = image->getOutputDataSize();
-    image_data = new unsigned char[ frame_size * d ];
+    image_data = new unsigned char[ (size_t)frame_size * d ];
 
-    image->getOutputData( &image_data[ 0 ], 
-                          frame_size, 
-                          bits_per_component, 0 ); 
+    bool copied = copyFrame( *image, 0, image_data, frame_size, 
+                             bits_per_component, use_native_values );
     delete image;
-    for( unsigned int i = 1; i < urls.size(); ++i ) {
-      image = new ::DicomImage( urls[i].c_str() );
-      if (image->getStatus() != EIS_Normal) 
-        throw CouldNotLoadDicomImage( urls[i],
-                                      ::DicomImage::getString(image->getStatus()),
+    if( !copied ) {
+      throw CouldNotLoadDicomImage( urls[0],
+                                    "Could not get pixel data of slice.",
+                                    H3D_FULL_LOCATION );
+    }
+
+    if( urls.size() > 1 ) {
+      DecodeData data;
+      data.urls = &urls;
+      data.flags = flags;
+      data.image_data = (unsigned char *) image_data;
+      data.width = w;
+      data.height = h;
+      data.frame_size = frame_size;
+      data.bits_per_sample = bits_per_component;
+      data.native_values = use_native_values;
+      parallelFor( 1, (unsigned int) urls.size(), decodeSlices, &data );
+      if( !data.error.empty() ) {
+        throw CouldNotLoadDicomImage( data.error_url,
+                                      data.error,
                                       H3D_FULL_LOCATION );
-      assert( w == image->getWidth() && 
-              h == image->getHeight() && 
-              image->getFrameCount() == 1 );
-      image->getOutputData( &image_data[ i * frame_size ], 
-                            frame_size, 
-                            bits_per_component, 0 ); 
-      delete image;
+      }
     }
   }
 }
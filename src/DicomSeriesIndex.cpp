@@ -0,0 +1,496 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file DicomSeriesIndex.cpp
+/// \brief .cpp file for DicomSeriesIndex.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/DicomSeriesIndex.h>
+
+#ifdef HAVE_DCMTK
+
+#ifndef WIN32
+// for Unix platforms this has to be defined before including anything
+// from dcmtk
+#define HAVE_CONFIG_H
+#endif
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcdatset.h>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcuid.h>
+
+#include <H3DUtil/ReadWriteH3DTypes.h>
+#include <H3DUtil/BatchFileReader.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Console.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <dirent.h>
+#endif
+#include <fstream>
+#include <algorithm>
+#include <set>
+
+using namespace H3DUtil;
+using namespace std;
+
+namespace DicomSeriesIndexInternals {
+  // Identifies the index file format. Increase index_version if the
+  // layout of the stored entries changes.
+  const string index_magic = "H3DDICOMINDEX";
+  const H3DInt32 index_version = 1;
+
+  // Maximum length of element values to read when parsing headers. Larger
+  // values are skipped, the values needed for the index are all small.
+  const Uint32 max_read_length = 1024;
+
+  // The number of bytes at the start of each file that the operating
+  // system is asked to read ahead before the headers are parsed.
+  const size_t header_read_ahead = 64 * 1024;
+
+  bool entryFilenameLess( const DicomSeriesIndex::Entry &a,
+                          const DicomSeriesIndex::Entry &b ) {
+    return a.filename < b.filename;
+  }
+
+  // Comparison used to order the slices in a series. position_along_normal
+  // is precomputed for each entry.
+  struct SliceOrder {
+    const DicomSeriesIndex::Entry *entry;
+    double position_along_normal;
+
+    bool operator<( const SliceOrder &o ) const {
+      if( entry->has_position && o.entry->has_position &&
+          position_along_normal != o.position_along_normal ) {
+        // highest position first
+        return position_along_normal > o.position_along_normal;
+      }
+      if( entry->instance_number != o.entry->instance_number )
+        return entry->instance_number < o.entry->instance_number;
+      return entry->filename < o.entry->filename;
+    }
+  };
+}
+
+DicomSeriesIndex::DicomSeriesIndex( const string &_directory,
+                                    bool _recursive,
+                                    const string &_index_filename ):
+  directory( _directory ),
+  recursive( _recursive ),
+  index_filename( _index_filename ),
+  index_file_read( false ) {
+  // remove trailing separators so that paths can be joined with "/".
+  while( directory.size() > 1 &&
+         ( directory[ directory.size() - 1 ] == '/' ||
+           directory[ directory.size() - 1 ] == '\\' ) ) {
+    directory.erase( directory.size() - 1 );
+  }
+  if( directory.empty() ) directory = ".";
+}
+
+unsigned int DicomSeriesIndex::update( bool write_index ) {
+  using namespace DicomSeriesIndexInternals;
+
+  if( !index_file_read ) {
+    index_file_read = true;
+    readIndexFile();
+  }
+
+  vector< Entry > files;
+  listFiles( "", files );
+  std::sort( files.begin(), files.end(), entryFilenameLess );
+
+  // Merge the directory listing with the current entries. Both are sorted
+  // on filename. Entries for unchanged files are kept as is.
+  bool changed = false;
+  vector< Entry > new_entries;
+  vector< size_t > new_file_indices;
+  new_entries.reserve( files.size() );
+  vector< Entry >::iterator old_entry = entries.begin();
+  for( vector< Entry >::iterator i = files.begin(); i != files.end(); ++i ) {
+    while( old_entry != entries.end() &&
+           old_entry->filename < i->filename ) {
+      // the file has been removed.
+      changed = true;
+      ++old_entry;
+    }
+    if( old_entry != entries.end() &&
+        old_entry->filename == i->filename &&
+        old_entry->mtime == i->mtime &&
+        old_entry->file_size == i->file_size ) {
+      new_entries.push_back( *old_entry );
+    } else {
+      new_file_indices.push_back( new_entries.size() );
+      new_entries.push_back( *i );
+      changed = true;
+    }
+    if( old_entry != entries.end() && old_entry->filename == i->filename )
+      ++old_entry;
+  }
+  if( old_entry != entries.end() ) changed = true;
+  entries.swap( new_entries );
+
+  // parse the new and modified files.
+  entries_to_parse.clear();
+  for( vector< size_t >::iterator i = new_file_indices.begin();
+       i != new_file_indices.end(); ++i ) {
+    entries_to_parse.push_back( &entries[*i] );
+  }
+
+  unsigned int nr_parsed = (unsigned int)entries_to_parse.size();
+  if( nr_parsed > 0 ) {
+    // Parsing is mostly disk bound so more threads than cores helps to
+    // keep the disk busy.
+    parallelFor( 0, nr_parsed, parseEntries, this, 16,
+                 2 * getNrHardwareThreads() );
+  }
+  entries_to_parse.clear();
+
+  if( changed && write_index && !index_filename.empty() ) {
+    if( !writeIndexFile() ) {
+      Console(LogLevel::Debug) << "DicomSeriesIndex: Could not write index "
+                               << "file in " << directory << endl;
+    }
+  }
+  return nr_parsed;
+}
+
+void DicomSeriesIndex::parseEntries( unsigned int begin,
+                                     unsigned int end,
+                                     void *data ) {
+  using namespace DicomSeriesIndexInternals;
+  DicomSeriesIndex *index = static_cast< DicomSeriesIndex * >( data );
+  // let the disk read the headers of the whole chunk while the first ones
+  // are parsed.
+  for( unsigned int i = begin; i < end; ++i ) {
+    adviseFileRead( index->getFullPath( *index->entries_to_parse[i] ), 0,
+                    header_read_ahead );
+  }
+  for( unsigned int i = begin; i < end; ++i ) {
+    index->parseEntry( *index->entries_to_parse[i] );
+  }
+}
+
+void DicomSeriesIndex::parseEntry( Entry &entry ) {
+  using namespace DicomSeriesIndexInternals;
+
+  string path = getFullPath( entry );
+  DcmFileFormat fileformat;
+#if OFFIS_DCMTK_VERSION_NUMBER >= 361
+  // stop parsing when the pixel data is reached.
+  OFCondition res = fileformat.loadFileUntilTag( path.c_str(),
+                                                 EXS_Unknown,
+                                                 EGL_noChange,
+                                                 max_read_length,
+                                                 ERM_autoDetect,
+                                                 DCM_PixelData );
+#else
+  // the pixel data will be skipped since it is larger than
+  // max_read_length.
+  OFCondition res = fileformat.loadFile( path.c_str(),
+                                         EXS_Unknown,
+                                         EGL_noChange,
+                                         max_read_length,
+                                         ERM_autoDetect );
+#endif
+  entry.is_dicom = res.good();
+  if( !entry.is_dicom ) return;
+
+  DcmDataset *dataset = fileformat.getDataset();
+
+  OFString value;
+  if( dataset->findAndGetOFString( DCM_SeriesInstanceUID, value ).good() )
+    entry.series_instance_uid = value.c_str();
+  if( dataset->findAndGetOFString( DCM_SOPInstanceUID, value ).good() )
+    entry.sop_instance_uid = value.c_str();
+
+  Uint16 v16;
+  if( dataset->findAndGetUint16( DCM_Rows, v16 ).good() )
+    entry.rows = v16;
+  if( dataset->findAndGetUint16( DCM_Columns, v16 ).good() )
+    entry.columns = v16;
+  if( dataset->findAndGetUint16( DCM_BitsAllocated, v16 ).good() )
+    entry.bits_allocated = v16;
+
+  Sint32 v32;
+  if( dataset->findAndGetSint32( DCM_NumberOfFrames, v32 ).good() )
+    entry.nr_frames = v32;
+  if( dataset->findAndGetSint32( DCM_InstanceNumber, v32 ).good() )
+    entry.instance_number = v32;
+
+  // findAndGetFloat64 on decimal strings is independent of the locale
+  // so no decimal separator handling is needed.
+  Float64 pos[3], orn[6];
+  bool pos_ok = true;
+  for( unsigned int j = 0; j < 3 && pos_ok; ++j )
+    pos_ok = dataset->findAndGetFloat64( DCM_ImagePositionPatient,
+                                         pos[j], j ).good();
+  bool orn_ok = true;
+  for( unsigned int j = 0; j < 6 && orn_ok; ++j )
+    orn_ok = dataset->findAndGetFloat64( DCM_ImageOrientationPatient,
+                                         orn[j], j ).good();
+  if( pos_ok ) {
+    entry.has_position = true;
+    entry.position = Vec3d( pos[0], pos[1], pos[2] );
+    if( orn_ok ) {
+      entry.row_orientation = Vec3d( orn[0], orn[1], orn[2] );
+      entry.column_orientation = Vec3d( orn[3], orn[4], orn[5] );
+    } else {
+      entry.row_orientation = Vec3d( 1, 0, 0 );
+      entry.column_orientation = Vec3d( 0, 1, 0 );
+    }
+  }
+}
+
+void DicomSeriesIndex::listFiles( const string &relative_path,
+                                  vector< Entry > &files ) {
+  string path = relative_path.empty() ?
+    directory : directory + "/" + relative_path;
+  string prefix = relative_path.empty() ? "" : relative_path + "/";
+
+  vector< string > names;
+#ifdef WIN32
+  WIN32_FIND_DATA find_data;
+  HANDLE handle = FindFirstFile( ( path + "/*" ).c_str(), &find_data );
+  if( handle != INVALID_HANDLE_VALUE ) {
+    do {
+      names.push_back( find_data.cFileName );
+    } while( FindNextFile( handle, &find_data ) );
+    FindClose( handle );
+  }
+#else
+  DIR *dp = opendir( path.c_str() );
+  if( dp ) {
+    struct dirent *dirp;
+    while( ( dirp = readdir( dp ) ) != NULL ) {
+      names.push_back( dirp->d_name );
+    }
+    closedir( dp );
+  }
+#endif
+
+  for( vector< string >::iterator i = names.begin(); i != names.end(); ++i ) {
+    const string &name = *i;
+    if( name == "." || name == ".." ) continue;
+    if( relative_path.empty() &&
+        ( name == index_filename || name == index_filename + ".tmp" ) )
+      continue;
+
+    struct stat file_info;
+    if( stat( ( path + "/" + name ).c_str(), &file_info ) != 0 ) continue;
+
+    if( file_info.st_mode & S_IFDIR ) {
+      if( recursive ) listFiles( prefix + name, files );
+    } else {
+      Entry entry;
+      entry.filename = prefix + name;
+      entry.mtime = (double)file_info.st_mtime;
+      entry.file_size = (double)file_info.st_size;
+      files.push_back( entry );
+    }
+  }
+}
+
+bool DicomSeriesIndex::readIndexFile() {
+  using namespace DicomSeriesIndexInternals;
+  if( index_filename.empty() ) return false;
+
+  ifstream is( ( directory + "/" + index_filename ).c_str(),
+               ios::in | ios::binary );
+  if( !is.good() ) return false;
+
+  string magic;
+  H3DInt32 version = 0, nr_entries = 0;
+  readH3DType( is, magic );
+  readH3DType( is, version );
+  readH3DType( is, nr_entries );
+  if( !is.good() || magic != index_magic || version != index_version ||
+      nr_entries < 0 ) {
+    Console(LogLevel::Debug) << "DicomSeriesIndex: Ignoring invalid index "
+                             << "file in " << directory << endl;
+    return false;
+  }
+
+  vector< Entry > read_entries( nr_entries );
+  for( H3DInt32 i = 0; i < nr_entries && is.good(); ++i ) {
+    Entry &e = read_entries[i];
+    H3DInt32 flags = 0;
+    readH3DType( is, e.filename );
+    readH3DType( is, e.mtime );
+    readH3DType( is, e.file_size );
+    readH3DType( is, flags );
+    e.is_dicom = ( flags & 1 ) != 0;
+    e.has_position = ( flags & 2 ) != 0;
+    if( e.is_dicom ) {
+      readH3DType( is, e.series_instance_uid );
+      readH3DType( is, e.sop_instance_uid );
+      readH3DType( is, e.position );
+      readH3DType( is, e.row_orientation );
+      readH3DType( is, e.column_orientation );
+      readH3DType( is, e.rows );
+      readH3DType( is, e.columns );
+      readH3DType( is, e.nr_frames );
+      readH3DType( is, e.bits_allocated );
+      readH3DType( is, e.instance_number );
+    }
+  }
+
+  if( !is.good() ) {
+    Console(LogLevel::Debug) << "DicomSeriesIndex: Ignoring truncated index "
+                             << "file in " << directory << endl;
+    return false;
+  }
+
+  std::sort( read_entries.begin(), read_entries.end(), entryFilenameLess );
+  entries.swap( read_entries );
+  return true;
+}
+
+bool DicomSeriesIndex::writeIndexFile() {
+  using namespace DicomSeriesIndexInternals;
+  if( index_filename.empty() ) return false;
+
+  // write to a temporary file and rename it so that a reader never sees
+  // a partially written index.
+  string filename = directory + "/" + index_filename;
+  string tmp_filename = filename + ".tmp";
+  {
+    ofstream os( tmp_filename.c_str(), ios::out | ios::binary );
+    if( !os.good() ) return false;
+
+    writeH3DType( os, index_magic );
+    writeH3DType( os, index_version );
+    writeH3DType( os, (H3DInt32)entries.size() );
+    for( vector< Entry >::iterator i = entries.begin();
+         i != entries.end(); ++i ) {
+      const Entry &e = *i;
+      H3DInt32 flags = ( e.is_dicom ? 1 : 0 ) | ( e.has_position ? 2 : 0 );
+      writeH3DType( os, e.filename );
+      writeH3DType( os, e.mtime );
+      writeH3DType( os, e.file_size );
+      writeH3DType( os, flags );
+      if( e.is_dicom ) {
+        writeH3DType( os, e.series_instance_uid );
+        writeH3DType( os, e.sop_instance_uid );
+        writeH3DType( os, e.position );
+        writeH3DType( os, e.row_orientation );
+        writeH3DType( os, e.column_orientation );
+        writeH3DType( os, e.rows );
+        writeH3DType( os, e.columns );
+        writeH3DType( os, e.nr_frames );
+        writeH3DType( os, e.bits_allocated );
+        writeH3DType( os, e.instance_number );
+      }
+    }
+    if( !os.good() ) {
+      os.close();
+      remove( tmp_filename.c_str() );
+      return false;
+    }
+  }
+
+#ifdef WIN32
+  // rename does not replace existing files on Windows.
+  remove( filename.c_str() );
+#endif
+  if( rename( tmp_filename.c_str(), filename.c_str() ) != 0 ) {
+    remove( tmp_filename.c_str() );
+    return false;
+  }
+  return true;
+}
+
+vector< string > DicomSeriesIndex::getSeriesUIDs() {
+  std::set< string > uids;
+  for( vector< Entry >::iterator i = entries.begin();
+       i != entries.end(); ++i ) {
+    if( i->is_dicom && !i->series_instance_uid.empty() )
+      uids.insert( i->series_instance_uid );
+  }
+  return vector< string >( uids.begin(), uids.end() );
+}
+
+vector< const DicomSeriesIndex::Entry * >
+DicomSeriesIndex::getSeries( const string &series_uid ) {
+  using namespace DicomSeriesIndexInternals;
+
+  vector< SliceOrder > slices;
+  for( vector< Entry >::iterator i = entries.begin();
+       i != entries.end(); ++i ) {
+    if( i->is_dicom && i->series_instance_uid == series_uid ) {
+      SliceOrder s;
+      s.entry = &(*i);
+      // project the position on the slice normal. For the default
+      // orientation this is the z-value of ImagePositionPatient.
+      Vec3d normal = i->row_orientation % i->column_orientation;
+      s.position_along_normal = i->has_position ? i->position * normal : 0;
+      slices.push_back( s );
+    }
+  }
+  std::sort( slices.begin(), slices.end() );
+
+  vector< const Entry * > series;
+  series.reserve( slices.size() );
+  for( vector< SliceOrder >::iterator i = slices.begin();
+       i != slices.end(); ++i ) {
+    series.push_back( i->entry );
+  }
+  return series;
+}
+
+vector< string > DicomSeriesIndex::getSeriesFilenames( const string &uid ) {
+  vector< const Entry * > series = getSeries( uid );
+  vector< string > filenames;
+  filenames.reserve( series.size() );
+  for( vector< const Entry * >::iterator i = series.begin();
+       i != series.end(); ++i ) {
+    filenames.push_back( getFullPath( **i ) );
+  }
+  return filenames;
+}
+
+const DicomSeriesIndex::Entry *DicomSeriesIndex::findEntry(
+                                                const string &filename ) {
+  string relative = filename;
+  if( relative.size() > directory.size() &&
+      relative.compare( 0, directory.size(), directory ) == 0 &&
+      ( relative[ directory.size() ] == '/' ||
+        relative[ directory.size() ] == '\\' ) ) {
+    relative = relative.substr( directory.size() + 1 );
+  }
+  std::replace( relative.begin(), relative.end(), '\\', '/' );
+
+  Entry key;
+  key.filename = relative;
+  vector< Entry >::iterator i =
+    std::lower_bound( entries.begin(), entries.end(), key,
+                      DicomSeriesIndexInternals::entryFilenameLess );
+  if( i != entries.end() && i->filename == relative ) return &(*i);
+  return NULL;
+}
+
+#endif // HAVE_DCMTK
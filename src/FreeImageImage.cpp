@@ -172,6 +172,8 @@ void FreeImageImage::updateImageProperties(){
   h = FreeImage_GetHeight( bitmap );
   // update bit per pixel
   bits_per_pixel = FreeImage_GetBPP( bitmap );
+  // update the distance between rows
+  pitch = FreeImage_GetPitch( bitmap );
 
 }
 
@@ -0,0 +1,288 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file HalfFloat.cpp
+/// \brief CPP file for half float conversion functions.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/HalfFloat.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+
+#include <string.h>
+
+// The F16C instructions are used through intrinsics compiled for that
+// instruction set only, so the library still runs on CPUs without them.
+#if ( defined( __x86_64__ ) || defined( __i386__ ) ) && \
+  ( defined( __clang__ ) || ( defined( __GNUC__ ) && __GNUC__ >= 5 ) )
+#define H3DUTIL_HALF_F16C
+#define H3DUTIL_HALF_F16C_TARGET __attribute__(( target( "avx,f16c" ) ))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined( _MSC_VER ) && _MSC_VER >= 1700 && \
+  ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#define H3DUTIL_HALF_F16C
+#define H3DUTIL_HALF_F16C_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace HalfFloatInternals {
+#ifdef H3DUTIL_HALF_F16C
+  // Returns true if the CPU supports F16C and the operating system saves
+  // the AVX registers.
+  bool detectF16C() {
+    unsigned int ecx;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid( info, 1 );
+    ecx = (unsigned int) info[2];
+#else
+    unsigned int eax, ebx, edx;
+    if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return false;
+#endif
+    const unsigned int osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+    if( ( ecx & ( osxsave | avx | f16c ) ) != ( osxsave | avx | f16c ) ) {
+      return false;
+    }
+    // the XMM and YMM state must be enabled.
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv( 0 );
+#else
+    unsigned int xcr0_low, xcr0_high;
+    __asm__ __volatile__( "xgetbv" : "=a"( xcr0_low ), "=d"( xcr0_high )
+                          : "c"( 0 ) );
+    unsigned long long xcr0 = xcr0_low;
+#endif
+    return ( xcr0 & 6 ) == 6;
+  }
+
+  H3DUTIL_HALF_F16C_TARGET
+  void convertHalfToFloatF16C( const unsigned short *half_data,
+                               float *float_data,
+                               size_t nr_values ) {
+    size_t i = 0;
+    for( ; i + 8 <= nr_values; i += 8 ) {
+      __m128i h = _mm_loadu_si128( (const __m128i *)( half_data + i ) );
+      _mm256_storeu_ps( float_data + i, _mm256_cvtph_ps( h ) );
+    }
+    for( ; i < nr_values; ++i ) {
+      float_data[i] = halfToFloat( half_data[i] );
+    }
+  }
+
+  H3DUTIL_HALF_F16C_TARGET
+  void convertFloatToHalfF16C( const float *float_data,
+                               unsigned short *half_data,
+                               size_t nr_values ) {
+    size_t i = 0;
+    for( ; i + 8 <= nr_values; i += 8 ) {
+      __m256 f = _mm256_loadu_ps( float_data + i );
+      // rounding mode 0 is round to nearest even.
+      _mm_storeu_si128( (__m128i *)( half_data + i ),
+                        _mm256_cvtps_ph( f, 0 ) );
+    }
+    for( ; i < nr_values; ++i ) {
+      half_data[i] = floatToHalf( float_data[i] );
+    }
+  }
+#endif
+
+  // The number of values converted in each parallelFor index.
+  const unsigned int values_per_chunk = 1 << 16;
+
+  // State for the parallel image conversions.
+  struct ConvertState {
+    const void *src;
+    void *dst;
+    size_t nr_values;
+  };
+
+  void convertHalfChunks( unsigned int begin, unsigned int end, void *data ) {
+    ConvertState *state = static_cast< ConvertState * >( data );
+    size_t first = (size_t) begin * values_per_chunk;
+    size_t last = H3DMin( (size_t) end * values_per_chunk, state->nr_values );
+    convertHalfToFloat( (const unsigned short *) state->src + first,
+                        (float *) state->dst + first, last - first );
+  }
+
+  void convertFloatChunks( unsigned int begin, unsigned int end,
+                           void *data ) {
+    ConvertState *state = static_cast< ConvertState * >( data );
+    size_t first = (size_t) begin * values_per_chunk;
+    size_t last = H3DMin( (size_t) end * values_per_chunk, state->nr_values );
+    convertFloatToHalf( (const float *) state->src + first,
+                        (unsigned short *) state->dst + first, last - first );
+  }
+
+  // Create a PixelImage with components of the given number of bits and
+  // RATIONAL type. If the image has packed data in memory with components of
+  // src_bits bits the data is converted in parallel with chunk_func,
+  // otherwise each pixel is copied with getPixel and setPixel.
+  Image *createRationalImage( Image *image,
+                              unsigned int src_bits,
+                              unsigned int dst_bits,
+                              ParallelForFunc chunk_func,
+                              unsigned int nr_threads ) {
+    unsigned int w = image->width(), h = image->height(),
+      d = image->depth();
+    unsigned int nr_components = image->nrPixelComponents();
+    size_t nr_values = (size_t) w * h * d * nr_components;
+    unsigned char *data = new unsigned char[ nr_values * dst_bits / 8 ];
+    PixelImage *result =
+      new PixelImage( w, h, d, dst_bits * nr_components,
+                      image->pixelType(), Image::RATIONAL,
+                      data, false, image->pixelSize() );
+
+    const void *src = image->getImageData();
+    if( src && image->pixelComponentType() == Image::RATIONAL &&
+        image->bitsPerPixel() == src_bits * nr_components &&
+        image->compressionType() == Image::NO_COMPRESSION &&
+        image->hasPackedData() ) {
+      ConvertState state;
+      state.src = src;
+      state.dst = data;
+      state.nr_values = nr_values;
+      unsigned int nr_chunks = (unsigned int)
+        ( ( nr_values + values_per_chunk - 1 ) / values_per_chunk );
+      parallelFor( 0, nr_chunks, chunk_func, &state, 1, nr_threads );
+    } else {
+      for( unsigned int z = 0; z < d; ++z ) {
+        for( unsigned int y = 0; y < h; ++y ) {
+          for( unsigned int x = 0; x < w; ++x ) {
+            result->setPixel( image->getPixel( x, y, z ), x, y, z );
+          }
+        }
+      }
+    }
+    return result;
+  }
+}
+
+using namespace HalfFloatInternals;
+
+unsigned short H3DUtil::floatToHalf( float value ) {
+  unsigned int bits;
+  memcpy( &bits, &value, 4 );
+  unsigned int sign = ( bits >> 16 ) & 0x8000;
+  unsigned int abs_bits = bits & 0x7fffffff;
+
+  if( abs_bits >= 0x7f800000 ) {
+    // infinity or NaN, keep NaN a NaN.
+    if( abs_bits == 0x7f800000 ) return (unsigned short)( sign | 0x7c00 );
+    return (unsigned short)( sign | 0x7e00 | ( ( abs_bits >> 13 ) & 0x3ff ) );
+  }
+
+  // 65520 and above round to infinity.
+  if( abs_bits >= 0x477ff000 ) return (unsigned short)( sign | 0x7c00 );
+
+  if( abs_bits < 0x38800000 ) {
+    // the value is a denormalized half float. Values up to half of the
+    // smallest denormalized half float round to zero.
+    if( abs_bits <= 0x33000000 ) return (unsigned short) sign;
+    unsigned int mantissa = ( abs_bits & 0x7fffff ) | 0x800000;
+    unsigned int shift = 126 - ( abs_bits >> 23 );
+    unsigned int result = mantissa >> shift;
+    unsigned int rest = mantissa & ( ( 1u << shift ) - 1 );
+    unsigned int halfway = 1u << ( shift - 1 );
+    if( rest > halfway || ( rest == halfway && ( result & 1 ) ) ) ++result;
+    return (unsigned short)( sign | result );
+  }
+
+  // normalized value, rebias the exponent and round the mantissa to
+  // nearest even. A carry into the exponent gives the correct result.
+  unsigned int result = ( abs_bits - 0x38000000 ) >> 13;
+  unsigned int rest = abs_bits & 0x1fff;
+  if( rest > 0x1000 || ( rest == 0x1000 && ( result & 1 ) ) ) ++result;
+  return (unsigned short)( sign | result );
+}
+
+float H3DUtil::halfToFloat( unsigned short value ) {
+  unsigned int sign = ( (unsigned int) value & 0x8000 ) << 16;
+  unsigned int exponent = ( value >> 10 ) & 0x1f;
+  unsigned int mantissa = value & 0x3ff;
+  unsigned int bits;
+  if( exponent == 0 ) {
+    // zero or denormalized, mantissa * 2^-24.
+    float f = mantissa * 5.9604644775390625e-8f;
+    return sign ? -f : f;
+  } else if( exponent == 31 ) {
+    bits = sign | 0x7f800000 | ( mantissa << 13 );
+  } else {
+    bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+  }
+  float f;
+  memcpy( &f, &bits, 4 );
+  return f;
+}
+
+bool H3DUtil::hasHalfFloatInstructions() {
+#ifdef H3DUTIL_HALF_F16C
+  static bool has_f16c = detectF16C();
+  return has_f16c;
+#else
+  return false;
+#endif
+}
+
+void H3DUtil::convertHalfToFloat( const unsigned short *half_data,
+                                  float *float_data,
+                                  size_t nr_values ) {
+#ifdef H3DUTIL_HALF_F16C
+  if( hasHalfFloatInstructions() ) {
+    convertHalfToFloatF16C( half_data, float_data, nr_values );
+    return;
+  }
+#endif
+  for( size_t i = 0; i < nr_values; ++i ) {
+    float_data[i] = halfToFloat( half_data[i] );
+  }
+}
+
+void H3DUtil::convertFloatToHalf( const float *float_data,
+                                  unsigned short *half_data,
+                                  size_t nr_values ) {
+#ifdef H3DUTIL_HALF_F16C
+  if( hasHalfFloatInstructions() ) {
+    convertFloatToHalfF16C( float_data, half_data, nr_values );
+    return;
+  }
+#endif
+  for( size_t i = 0; i < nr_values; ++i ) {
+    half_data[i] = floatToHalf( float_data[i] );
+  }
+}
+
+Image *H3DUtil::createHalfFloatImage( Image *image,
+                                      unsigned int nr_threads ) {
+  return createRationalImage( image, 32, 16, convertFloatChunks,
+                              nr_threads );
+}
+
+Image *H3DUtil::createFloatImage( Image *image, unsigned int nr_threads ) {
+  return createRationalImage( image, 16, 32, convertHalfChunks,
+                              nr_threads );
+}
@@ -29,13 +29,12 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include <H3DUtil/Image.h>
+#include <H3DUtil/HalfFloat.h>
 #ifdef WIN32
 #undef max
 #endif
 #include <limits>
-#ifdef HAVE_OPENEXR
-#include <OpenEXR/half.h>
-#endif
+#include <vector>
 
 using namespace H3DUtil;
 
@@ -159,17 +158,10 @@ namespace ImageInternals {
       v = *((float *)i);
     } else if( bytes_to_read == 8 ) {
       v = *((double *)i);
-    } else if(bytes_to_read == 2){ 
-#ifdef HAVE_OPENEXR
-      unsigned short v_temp;
-      memcpy( &v_temp, i, bytes_to_read ); 
-      half v_temp_half;
-      v_temp_half.setBits(v_temp);
-      v = float(v_temp_half);
-#else
-      Console(LogLevel::Error)<<"ERROR: need openexr support to convert 16bit float to 32bit float "<<std::endl;
-#endif
-
+    } else if( bytes_to_read == 2 ) {
+      unsigned short v_half;
+      memcpy( &v_half, i, bytes_to_read );
+      v = halfToFloat( v_half );
     }
     return (H3DFloat) v;
   }
@@ -218,13 +210,8 @@ namespace ImageInternals {
     } else if( bytes_to_write == 8 ) {
       *((double *)i) = r;
     } else if( bytes_to_write == 2 ) {
-#ifdef HAVE_OPENEXR
-      half r_temp_half = half(r);
-      unsigned short r_temp = r_temp_half.bits();
-      memcpy( i, &r_temp, bytes_to_write );
-#else
-      Console(LogLevel::Error)<<"ERROR: need openexr support to convert float to half"<<std::endl;
-#endif
+      unsigned short r_half = floatToHalf( r );
+      memcpy( i, &r_half, bytes_to_write );
     }
   }
   inline void writeFloatAsValue( H3DFloat r,
@@ -767,6 +754,36 @@ void Image::RGBAToImageValue( const H3DUtil::RGBA &rgba, void *_pixel_data ) {
   };
 }
 
+void Image::getPackedSlices( unsigned int first_slice,
+                             unsigned int nr_slices,
+                             void *data ) {
+  unsigned int w = width(), h = height();
+  unsigned int bytes_per_pixel = bitsPerPixel() / 8;
+  size_t row_size = (size_t) w * bytes_per_pixel;
+  unsigned char *dst = (unsigned char *) data;
+  unsigned char *src = (unsigned char *) getImageData();
+  if( src ) {
+    size_t row_stride = rowStride();
+    size_t slice_stride = sliceStride();
+    for( unsigned int z = 0; z < nr_slices; ++z ) {
+      for( unsigned int y = 0; y < h; ++y ) {
+        memcpy( dst + ( (size_t) z * h + y ) * row_size,
+                src + ( first_slice + z ) * slice_stride + y * row_stride,
+                row_size );
+      }
+    }
+  } else {
+    for( unsigned int z = 0; z < nr_slices; ++z ) {
+      for( unsigned int y = 0; y < h; ++y ) {
+        for( unsigned int x = 0; x < w; ++x ) {
+          getElement( dst + ( ( (size_t) z * h + y ) * w + x ) *
+                      bytes_per_pixel, x, y, first_slice + z );
+        }
+      }
+    }
+  }
+}
+
 unsigned int Image::nrPixelComponents() {
   PixelType pixel_type = pixelType();
   if( pixel_type == LUMINANCE ||
@@ -795,7 +812,45 @@ namespace ImageInternals {
       if( normalized_data[i] < 0 ) normalized_data[i] = 0;
     }
   }
+
+  template< class A, class FloatType >
+  void copyRationalData( FloatType *float_data,
+                         void *orig_data,
+                         unsigned int nr_elements ) {
+    A *d = (A*) orig_data;
+    for (unsigned int i = 0; i < nr_elements; ++i) {
+      float_data[i] = (FloatType) d[i];
+    }
+  }
+
+  inline void copyHalfData( float *float_data,
+                            void *orig_data,
+                            unsigned int nr_elements ) {
+    convertHalfToFloat( (unsigned short *) orig_data, float_data,
+                        nr_elements );
+  }
+
+  inline void copyHalfData( double *float_data,
+                            void *orig_data,
+                            unsigned int nr_elements ) {
+    unsigned short *d = (unsigned short *) orig_data;
+    for (unsigned int i = 0; i < nr_elements; ++i) {
+      float_data[i] = halfToFloat( d[i] );
+    }
+  }
   
+  // Returns the image data without padding between rows and slices. If the
+  // image data is padded it is copied to packed_data.
+  void *getPackedImageData( Image *image,
+                            std::vector< unsigned char > &packed_data ) {
+    void *data = image->getImageData();
+    if( !data || image->hasPackedData() ) return data;
+    packed_data.resize( (size_t) image->width() * image->height() *
+                        image->depth() * image->bitsPerPixel() / 8 );
+    image->getPackedSlices( 0, image->depth(), &packed_data[0] );
+    return &packed_data[0];
+  }
+
   template< class FloatType >
   FloatType *convertToNormalizedData( Image *image ) {
     int width = image->width();
@@ -813,38 +868,55 @@ namespace ImageInternals {
     // allocate memory for normalized data.
     FloatType *normalized_data = NULL;
     try {
-      normalized_data = new FloatType[nr_voxels];
+      normalized_data = new FloatType[nr_voxels * nr_components];
     } catch (std::bad_alloc& ba) {
       Console(LogLevel::Error) << ba.what() << std::endl;
       return NULL;
     }
+
+    // use a packed copy of the data if the rows or slices are padded.
+    std::vector< unsigned char > packed_data;
+    void *image_data = getPackedImageData( image, packed_data );
     
     if( pixel_component_type ==Image::UNSIGNED ) {
       if( bits_per_pixel == 8*nr_components ) {
-        buildNormalizedData< unsigned char >( normalized_data, image->getImageData(), 
+        buildNormalizedData< unsigned char >( normalized_data, image_data, 
             nr_voxels * nr_components, (float)scale, (float)bias ); 
       } else if( bits_per_pixel == 16*nr_components ) {
-        buildNormalizedData< unsigned short >( normalized_data, image->getImageData(), 
+        buildNormalizedData< unsigned short >( normalized_data, image_data, 
                  nr_voxels * nr_components, (float)scale, (float)bias );
       } else if( bits_per_pixel == 32*nr_components ) {
-        buildNormalizedData< unsigned int >( normalized_data, image->getImageData(), 
+        buildNormalizedData< unsigned int >( normalized_data, image_data, 
                  nr_voxels * nr_components, (float)scale, (float)bias ); 
       } else {
         return NULL;
       }
     } else if( pixel_component_type == Image::SIGNED ) { 
       if( bits_per_pixel == 8*nr_components ) {
-        buildNormalizedData< char >( normalized_data, image->getImageData(), 
+        buildNormalizedData< char >( normalized_data, image_data, 
              nr_voxels * nr_components, (float)scale, (float)bias ); 
       } else if( bits_per_pixel == 16*nr_components ) {
-        buildNormalizedData< short >( normalized_data, image->getImageData(), 
+        buildNormalizedData< short >( normalized_data, image_data, 
               nr_voxels * nr_components, (float)scale, (float)bias );
       } else if( bits_per_pixel == 32*nr_components ) {
-        buildNormalizedData< int >( normalized_data, image->getImageData(), 
+        buildNormalizedData< int >( normalized_data, image_data, 
             nr_voxels * nr_components, (float)scale, (float)bias ); 
       } else { 
         return NULL;
       }
+    } else if( pixel_component_type == Image::RATIONAL ) {
+      if( bits_per_pixel == 16*nr_components ) {
+        copyHalfData( normalized_data, image_data,
+                      nr_voxels * nr_components );
+      } else if( bits_per_pixel == 32*nr_components ) {
+        copyRationalData< float >( normalized_data, image_data,
+                                   nr_voxels * nr_components );
+      } else if( bits_per_pixel == 64*nr_components ) {
+        copyRationalData< double >( normalized_data, image_data,
+                                    nr_voxels * nr_components );
+      } else {
+        return NULL;
+      }
     } else {
       return NULL;
     }
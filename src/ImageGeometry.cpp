@@ -0,0 +1,544 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageGeometry.cpp
+/// \brief CPP file for image geometry transforms.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/ImageGeometry.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Console.h>
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || \
+  ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define H3DUTIL_GEOMETRY_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace ImageGeometryInternals {
+  // The side of the tiles used when the source is read along a different
+  // axis than the destination is written, so that both the source and
+  // the destination lines of a tile stay in the cache.
+  const unsigned int tile_size = 32;
+
+  // Copy a pixel of N bytes, or bytes_per_pixel bytes if N is 0. The
+  // fixed size copies compile to single loads and stores.
+  template< unsigned int N >
+  inline void copyPixel( unsigned char *dst,
+                         const unsigned char *src,
+                         unsigned int bytes_per_pixel ) {
+    memcpy( dst, src, N ? N : bytes_per_pixel );
+  }
+
+  // Swap two pixels of N bytes, or bytes_per_pixel bytes if N is 0.
+  template< unsigned int N >
+  inline void swapPixels( unsigned char *a,
+                          unsigned char *b,
+                          unsigned int bytes_per_pixel ) {
+    std::swap_ranges( a, a + ( N ? N : bytes_per_pixel ), b );
+  }
+
+#ifdef H3DUTIL_GEOMETRY_SSE2
+  // Transpose a block of 8x8 16 bit pixels. Line j of the destination
+  // gets pixel j of each of the 8 source lines.
+  inline void transposeBlock16( const unsigned char *src,
+                                ptrdiff_t src_step,
+                                unsigned char *dst,
+                                ptrdiff_t dst_step ) {
+    __m128i r[8];
+    for( unsigned int i = 0; i < 8; ++i ) {
+      r[i] = _mm_loadu_si128( (const __m128i *)( src + i * src_step ) );
+    }
+    __m128i a0 = _mm_unpacklo_epi16( r[0], r[1] );
+    __m128i a1 = _mm_unpackhi_epi16( r[0], r[1] );
+    __m128i a2 = _mm_unpacklo_epi16( r[2], r[3] );
+    __m128i a3 = _mm_unpackhi_epi16( r[2], r[3] );
+    __m128i a4 = _mm_unpacklo_epi16( r[4], r[5] );
+    __m128i a5 = _mm_unpackhi_epi16( r[4], r[5] );
+    __m128i a6 = _mm_unpacklo_epi16( r[6], r[7] );
+    __m128i a7 = _mm_unpackhi_epi16( r[6], r[7] );
+    __m128i b0 = _mm_unpacklo_epi32( a0, a2 );
+    __m128i b1 = _mm_unpackhi_epi32( a0, a2 );
+    __m128i b2 = _mm_unpacklo_epi32( a1, a3 );
+    __m128i b3 = _mm_unpackhi_epi32( a1, a3 );
+    __m128i b4 = _mm_unpacklo_epi32( a4, a6 );
+    __m128i b5 = _mm_unpackhi_epi32( a4, a6 );
+    __m128i b6 = _mm_unpacklo_epi32( a5, a7 );
+    __m128i b7 = _mm_unpackhi_epi32( a5, a7 );
+    r[0] = _mm_unpacklo_epi64( b0, b4 );
+    r[1] = _mm_unpackhi_epi64( b0, b4 );
+    r[2] = _mm_unpacklo_epi64( b1, b5 );
+    r[3] = _mm_unpackhi_epi64( b1, b5 );
+    r[4] = _mm_unpacklo_epi64( b2, b6 );
+    r[5] = _mm_unpackhi_epi64( b2, b6 );
+    r[6] = _mm_unpacklo_epi64( b3, b7 );
+    r[7] = _mm_unpackhi_epi64( b3, b7 );
+    for( unsigned int i = 0; i < 8; ++i ) {
+      _mm_storeu_si128( (__m128i *)( dst + i * dst_step ), r[i] );
+    }
+  }
+
+  // Transpose a block of 4x4 32 bit pixels.
+  inline void transposeBlock32( const unsigned char *src,
+                                ptrdiff_t src_step,
+                                unsigned char *dst,
+                                ptrdiff_t dst_step ) {
+    __m128i r0 = _mm_loadu_si128( (const __m128i *)( src ) );
+    __m128i r1 = _mm_loadu_si128( (const __m128i *)( src + src_step ) );
+    __m128i r2 = _mm_loadu_si128( (const __m128i *)( src + 2 * src_step ) );
+    __m128i r3 = _mm_loadu_si128( (const __m128i *)( src + 3 * src_step ) );
+    __m128i a0 = _mm_unpacklo_epi32( r0, r1 );
+    __m128i a1 = _mm_unpackhi_epi32( r0, r1 );
+    __m128i a2 = _mm_unpacklo_epi32( r2, r3 );
+    __m128i a3 = _mm_unpackhi_epi32( r2, r3 );
+    _mm_storeu_si128( (__m128i *)( dst ), _mm_unpacklo_epi64( a0, a2 ) );
+    _mm_storeu_si128( (__m128i *)( dst + dst_step ),
+                      _mm_unpackhi_epi64( a0, a2 ) );
+    _mm_storeu_si128( (__m128i *)( dst + 2 * dst_step ),
+                      _mm_unpacklo_epi64( a1, a3 ) );
+    _mm_storeu_si128( (__m128i *)( dst + 3 * dst_step ),
+                      _mm_unpackhi_epi64( a1, a3 ) );
+  }
+#endif
+
+  // State for copying the pixels of an image into a new order.
+  struct ReorientState {
+    // the source pixel of destination pixel (0, 0, 0).
+    const unsigned char *src;
+    unsigned char *dst;
+    // the number of source bytes to move for each step along each
+    // destination axis, negative for reversed axes.
+    ptrdiff_t src_step[3];
+    // the destination strides, the destination has no padding.
+    ptrdiff_t dst_step[3];
+    // the size of the destination.
+    unsigned int size[3];
+    unsigned int bytes_per_pixel;
+    // the destination axis along which the source is contiguous if it is
+    // not the x axis, and the remaining axis.
+    unsigned int tile_axis, outer_axis;
+    // the number of tiles along tile_axis.
+    unsigned int nr_tiles;
+  };
+
+  // Copy destination rows from source lines that are contiguous along
+  // the destination x axis, possibly reversed.
+  template< unsigned int N >
+  void reorientRows( unsigned int begin, unsigned int end, void *data ) {
+    ReorientState *s = static_cast< ReorientState * >( data );
+    unsigned int bpp = N ? N : s->bytes_per_pixel;
+    unsigned int w = s->size[0];
+    for( unsigned int i = begin; i < end; ++i ) {
+      unsigned int y = i % s->size[1], z = i / s->size[1];
+      const unsigned char *src =
+        s->src + y * s->src_step[1] + z * s->src_step[2];
+      unsigned char *dst = s->dst + y * s->dst_step[1] + z * s->dst_step[2];
+      if( s->src_step[0] > 0 ) {
+        memcpy( dst, src, (size_t) w * bpp );
+      } else {
+        for( unsigned int x = 0; x < w; ++x ) {
+          copyPixel< N >( dst + x * bpp, src - (ptrdiff_t) x * bpp, bpp );
+        }
+      }
+    }
+  }
+
+  // Copy one tile, x in [x0, x1) and j in [j0, j1) along tile_axis,
+  // pixel by pixel.
+  template< unsigned int N >
+  inline void copyTile( ReorientState *s,
+                        const unsigned char *src,
+                        unsigned char *dst,
+                        unsigned int x0, unsigned int x1,
+                        unsigned int j0, unsigned int j1 ) {
+    unsigned int bpp = N ? N : s->bytes_per_pixel;
+    ptrdiff_t src_x = s->src_step[0];
+    ptrdiff_t src_j = s->src_step[ s->tile_axis ];
+    ptrdiff_t dst_j = s->dst_step[ s->tile_axis ];
+    for( unsigned int j = j0; j < j1; ++j ) {
+      const unsigned char *src_line = src + j * src_j;
+      unsigned char *dst_line = dst + j * dst_j;
+      for( unsigned int x = x0; x < x1; ++x ) {
+        copyPixel< N >( dst_line + x * bpp, src_line + x * src_x, bpp );
+      }
+    }
+  }
+
+  // Copy a tile, using SSE2 block transposes for the whole blocks of
+  // 16 and 32 bit pixels when the source lines are not reversed.
+  template< unsigned int N >
+  inline void transposeTile( ReorientState *s,
+                             const unsigned char *src,
+                             unsigned char *dst,
+                             unsigned int x0, unsigned int x1,
+                             unsigned int j0, unsigned int j1 ) {
+#ifdef H3DUTIL_GEOMETRY_SSE2
+    if( ( N == 2 || N == 4 ) &&
+        s->src_step[ s->tile_axis ] == (ptrdiff_t) N ) {
+      const unsigned int block = N == 2 ? 8 : 4;
+      ptrdiff_t src_x = s->src_step[0];
+      ptrdiff_t dst_j = s->dst_step[ s->tile_axis ];
+      unsigned int bx1 = x0 + ( x1 - x0 ) / block * block;
+      unsigned int bj1 = j0 + ( j1 - j0 ) / block * block;
+      for( unsigned int j = j0; j < bj1; j += block ) {
+        for( unsigned int x = x0; x < bx1; x += block ) {
+          const unsigned char *src_block = src + x * src_x + j * N;
+          unsigned char *dst_block = dst + j * dst_j + x * N;
+          if( N == 2 ) {
+            transposeBlock16( src_block, src_x, dst_block, dst_j );
+          } else {
+            transposeBlock32( src_block, src_x, dst_block, dst_j );
+          }
+        }
+      }
+      copyTile< N >( s, src, dst, bx1, x1, j0, bj1 );
+      copyTile< N >( s, src, dst, x0, x1, bj1, j1 );
+      return;
+    }
+#endif
+    copyTile< N >( s, src, dst, x0, x1, j0, j1 );
+  }
+
+  // Copy strips of tiles when the source is contiguous along another
+  // destination axis than x. Each index is one strip of tile_size lines
+  // along tile_axis for one position along outer_axis.
+  template< unsigned int N >
+  void reorientTiles( unsigned int begin, unsigned int end, void *data ) {
+    ReorientState *s = static_cast< ReorientState * >( data );
+    unsigned int w = s->size[0];
+    unsigned int n = s->size[ s->tile_axis ];
+    for( unsigned int i = begin; i < end; ++i ) {
+      unsigned int outer = i / s->nr_tiles;
+      unsigned int j0 = ( i % s->nr_tiles ) * tile_size;
+      unsigned int j1 = H3DMin( j0 + tile_size, n );
+      const unsigned char *src = s->src + outer * s->src_step[ s->outer_axis ];
+      unsigned char *dst = s->dst + outer * s->dst_step[ s->outer_axis ];
+      for( unsigned int x0 = 0; x0 < w; x0 += tile_size ) {
+        transposeTile< N >( s, src, dst,
+                            x0, H3DMin( x0 + tile_size, w ), j0, j1 );
+      }
+    }
+  }
+
+  // Returns func< bytes_per_pixel >, or func< 0 > for pixel sizes
+  // without a specialized copy.
+#define H3DUTIL_SELECT_PIXEL_FUNC( func, bytes_per_pixel )               \
+  ( bytes_per_pixel == 1 ? func< 1 > :                                  \
+    bytes_per_pixel == 2 ? func< 2 > :                                  \
+    bytes_per_pixel == 3 ? func< 3 > :                                  \
+    bytes_per_pixel == 4 ? func< 4 > :                                  \
+    bytes_per_pixel == 6 ? func< 6 > :                                  \
+    bytes_per_pixel == 8 ? func< 8 > :                                  \
+    bytes_per_pixel == 12 ? func< 12 > :                                \
+    bytes_per_pixel == 16 ? func< 16 > : func< 0 > )
+
+  // Throw InvalidImageAxis if axes is not a permutation of 0, 1 and 2.
+  void checkAxes( const unsigned int axes[3] ) {
+    bool used[3] = { false, false, false };
+    for( unsigned int i = 0; i < 3; ++i ) {
+      if( axes[i] > 2 || used[ axes[i] ] ) {
+        throw InvalidImageAxis( axes[i], "Image axes must be a permutation "
+                                "of 0, 1 and 2", H3D_FULL_LOCATION );
+      }
+      used[ axes[i] ] = true;
+    }
+  }
+
+  // Copy the pixels of src, with the given size and strides, to dst in
+  // the order given by axes and flip. dst gets no padding.
+  void reorientData( const unsigned char *src,
+                     const unsigned int src_size[3],
+                     const size_t src_stride[3],
+                     unsigned int bytes_per_pixel,
+                     const unsigned int axes[3],
+                     const bool flip[3],
+                     unsigned char *dst,
+                     unsigned int nr_threads ) {
+    ReorientState s;
+    s.src = src;
+    s.dst = dst;
+    s.bytes_per_pixel = bytes_per_pixel;
+    s.tile_axis = 0;
+    for( unsigned int i = 0; i < 3; ++i ) {
+      unsigned int a = axes[i];
+      s.size[i] = src_size[a];
+      s.src_step[i] = (ptrdiff_t) src_stride[a];
+      if( flip[i] ) {
+        s.src += ( src_size[a] - 1 ) * src_stride[a];
+        s.src_step[i] = -s.src_step[i];
+      }
+      if( a == 0 ) s.tile_axis = i;
+    }
+    s.dst_step[0] = bytes_per_pixel;
+    s.dst_step[1] = (ptrdiff_t) bytes_per_pixel * s.size[0];
+    s.dst_step[2] = s.dst_step[1] * s.size[1];
+    if( s.size[0] == 0 || s.size[1] == 0 || s.size[2] == 0 ) return;
+
+    if( s.tile_axis == 0 ) {
+      parallelFor( 0, s.size[1] * s.size[2],
+                   H3DUTIL_SELECT_PIXEL_FUNC( reorientRows, bytes_per_pixel ),
+                   &s, 16, nr_threads );
+    } else {
+      s.outer_axis = s.tile_axis == 1 ? 2 : 1;
+      s.nr_tiles = ( s.size[ s.tile_axis ] + tile_size - 1 ) / tile_size;
+      parallelFor( 0, s.nr_tiles * s.size[ s.outer_axis ],
+                   H3DUTIL_SELECT_PIXEL_FUNC( reorientTiles, bytes_per_pixel ),
+                   &s, 1, nr_threads );
+    }
+  }
+
+  // State for flipping data in place.
+  struct FlipState {
+    unsigned char *data;
+    unsigned int size[3];
+    size_t stride[3];
+    unsigned int bytes_per_pixel;
+    unsigned int axis;
+  };
+
+  // Reverse the pixels of rows in place. Each index is one row.
+  template< unsigned int N >
+  void flipRows( unsigned int begin, unsigned int end, void *data ) {
+    FlipState *s = static_cast< FlipState * >( data );
+    unsigned int bpp = N ? N : s->bytes_per_pixel;
+    unsigned int w = s->size[0];
+    for( unsigned int i = begin; i < end; ++i ) {
+      unsigned char *row = s->data + ( i % s->size[1] ) * s->stride[1] +
+        ( i / s->size[1] ) * s->stride[2];
+      unsigned char *last = row + ( w - 1 ) * bpp;
+      for( unsigned int x = 0; x < w / 2; ++x ) {
+        swapPixels< N >( row + x * bpp, last - x * bpp, bpp );
+      }
+    }
+  }
+
+  // Swap rows with their mirrored row along the y or z axis. Each index
+  // is one row in the first half of the axis.
+  void swapRows( unsigned int begin, unsigned int end, void *data ) {
+    FlipState *s = static_cast< FlipState * >( data );
+    unsigned int n = s->size[ s->axis ];
+    size_t row_size = (size_t) s->size[0] * s->bytes_per_pixel;
+    unsigned int other = s->axis == 1 ? 2 : 1;
+    unsigned int half = n / 2;
+    for( unsigned int i = begin; i < end; ++i ) {
+      unsigned int a = i % half, b = i / half;
+      unsigned char *row = s->data + a * s->stride[ s->axis ] +
+        b * s->stride[ other ];
+      unsigned char *mirror = row + ( n - 1 - 2 * a ) * s->stride[ s->axis ];
+      std::swap_ranges( row, row + row_size, mirror );
+    }
+  }
+
+  // Flip data with the given size and strides in place along an axis.
+  void flipDataInPlace( unsigned char *data,
+                        const unsigned int size[3],
+                        const size_t stride[3],
+                        unsigned int bytes_per_pixel,
+                        unsigned int axis,
+                        unsigned int nr_threads ) {
+    if( size[ axis ] < 2 || size[0] == 0 || size[1] == 0 || size[2] == 0 ) {
+      return;
+    }
+    FlipState s;
+    s.data = data;
+    s.bytes_per_pixel = bytes_per_pixel;
+    s.axis = axis;
+    for( unsigned int i = 0; i < 3; ++i ) {
+      s.size[i] = size[i];
+      s.stride[i] = stride[i];
+    }
+    if( axis == 0 ) {
+      parallelFor( 0, size[1] * size[2],
+                   H3DUTIL_SELECT_PIXEL_FUNC( flipRows, bytes_per_pixel ),
+                   &s, 16, nr_threads );
+    } else {
+      parallelFor( 0, size[ axis ] / 2 * size[ axis == 1 ? 2 : 1 ],
+                   swapRows, &s, 16, nr_threads );
+    }
+  }
+
+  // Returns true if the geometry functions can handle the image, prints
+  // an error otherwise.
+  bool checkImage( Image *image, const char *function ) {
+    if( image->compressionType() != Image::NO_COMPRESSION ||
+        image->bitsPerPixel() % 8 != 0 ) {
+      Console(LogLevel::Error) << "Error: " << function << " only supports "
+                               << "uncompressed images with whole bytes per "
+                               << "pixel." << std::endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+using namespace ImageGeometryInternals;
+
+void H3DUtil::flipImage( Image *image,
+                         unsigned int axis,
+                         unsigned int nr_threads ) {
+  if( axis > 2 ) {
+    throw InvalidImageAxis( axis, "Image axis must be 0, 1 or 2",
+                            H3D_FULL_LOCATION );
+  }
+  if( !checkImage( image, "flipImage" ) ) return;
+
+  unsigned int size[3] = { image->width(), image->height(), image->depth() };
+  unsigned int bytes_per_pixel = image->bitsPerPixel() / 8;
+  unsigned char *data = (unsigned char *) image->getImageData();
+  if( data ) {
+    size_t stride[3] = { bytes_per_pixel,
+                         image->rowStride(),
+                         image->sliceStride() };
+    flipDataInPlace( data, size, stride, bytes_per_pixel, axis, nr_threads );
+  } else {
+    std::vector< unsigned char > a( bytes_per_pixel ), b( bytes_per_pixel );
+    unsigned int end[3] = { size[0], size[1], size[2] };
+    end[ axis ] /= 2;
+    for( unsigned int z = 0; z < end[2]; ++z ) {
+      for( unsigned int y = 0; y < end[1]; ++y ) {
+        for( unsigned int x = 0; x < end[0]; ++x ) {
+          unsigned int p[3] = { x, y, z };
+          p[ axis ] = size[ axis ] - 1 - p[ axis ];
+          image->getElement( &a[0], x, y, z );
+          image->getElement( &b[0], p[0], p[1], p[2] );
+          image->setElement( &b[0], x, y, z );
+          image->setElement( &a[0], p[0], p[1], p[2] );
+        }
+      }
+    }
+  }
+}
+
+void H3DUtil::flipImageData( const void *src,
+                             void *dst,
+                             unsigned int width,
+                             unsigned int height,
+                             unsigned int depth,
+                             unsigned int bytes_per_pixel,
+                             unsigned int axis,
+                             unsigned int nr_threads ) {
+  if( axis > 2 ) {
+    throw InvalidImageAxis( axis, "Image axis must be 0, 1 or 2",
+                            H3D_FULL_LOCATION );
+  }
+  unsigned int size[3] = { width, height, depth };
+  size_t stride[3] = { bytes_per_pixel,
+                       (size_t) width * bytes_per_pixel,
+                       (size_t) width * height * bytes_per_pixel };
+  if( src == dst ) {
+    flipDataInPlace( (unsigned char *) dst, size, stride, bytes_per_pixel,
+                     axis, nr_threads );
+  } else {
+    unsigned int axes[3] = { 0, 1, 2 };
+    bool flip[3] = { false, false, false };
+    flip[ axis ] = true;
+    reorientData( (const unsigned char *) src, size, stride, bytes_per_pixel,
+                  axes, flip, (unsigned char *) dst, nr_threads );
+  }
+}
+
+Image *H3DUtil::reorientImage( Image *image,
+                               const unsigned int axes[3],
+                               const bool flip[3],
+                               unsigned int nr_threads ) {
+  checkAxes( axes );
+  if( !checkImage( image, "reorientImage" ) ) return NULL;
+
+  unsigned int src_size[3] = { image->width(),
+                               image->height(),
+                               image->depth() };
+  unsigned int bytes_per_pixel = image->bitsPerPixel() / 8;
+  size_t nr_pixels = (size_t) src_size[0] * src_size[1] * src_size[2];
+
+  // images without data in memory are copied to a packed buffer first.
+  std::vector< unsigned char > packed;
+  const unsigned char *src = (const unsigned char *) image->getImageData();
+  size_t src_stride[3] = { bytes_per_pixel,
+                           image->rowStride(),
+                           image->sliceStride() };
+  if( !src ) {
+    packed.resize( nr_pixels * bytes_per_pixel + 1 );
+    image->getPackedSlices( 0, src_size[2], &packed[0] );
+    src = &packed[0];
+    src_stride[1] = (size_t) src_size[0] * bytes_per_pixel;
+    src_stride[2] = src_stride[1] * src_size[1];
+  }
+
+  unsigned char *data = new unsigned char[ nr_pixels * bytes_per_pixel ];
+  reorientData( src, src_size, src_stride, bytes_per_pixel, axes, flip,
+                data, nr_threads );
+
+  Vec3f src_pixel_size = image->pixelSize();
+  Vec3f pixel_size( src_pixel_size[ axes[0] ],
+                    src_pixel_size[ axes[1] ],
+                    src_pixel_size[ axes[2] ] );
+  return new PixelImage( src_size[ axes[0] ],
+                         src_size[ axes[1] ],
+                         src_size[ axes[2] ],
+                         image->bitsPerPixel(),
+                         image->pixelType(),
+                         image->pixelComponentType(),
+                         data, false, pixel_size );
+}
+
+Image *H3DUtil::permuteImageAxes( Image *image,
+                                  unsigned int x_axis,
+                                  unsigned int y_axis,
+                                  unsigned int z_axis,
+                                  unsigned int nr_threads ) {
+  unsigned int axes[3] = { x_axis, y_axis, z_axis };
+  bool flip[3] = { false, false, false };
+  return reorientImage( image, axes, flip, nr_threads );
+}
+
+Image *H3DUtil::transposeImage( Image *image, unsigned int nr_threads ) {
+  return permuteImageAxes( image, 1, 0, 2, nr_threads );
+}
+
+Image *H3DUtil::rotateImage90( Image *image,
+                               int nr_turns,
+                               unsigned int nr_threads ) {
+  nr_turns = ( nr_turns % 4 + 4 ) % 4;
+  unsigned int axes[3] = { 0, 1, 2 };
+  bool flip[3] = { false, false, false };
+  if( nr_turns == 1 ) {
+    // pixel (x, y) of the result is pixel (y, h - 1 - x) of the image.
+    axes[0] = 1; axes[1] = 0;
+    flip[0] = true;
+  } else if( nr_turns == 2 ) {
+    flip[0] = true; flip[1] = true;
+  } else if( nr_turns == 3 ) {
+    // pixel (x, y) of the result is pixel (w - 1 - y, x) of the image.
+    axes[0] = 1; axes[1] = 0;
+    flip[1] = true;
+  }
+  return reorientImage( image, axes, flip, nr_threads );
+}
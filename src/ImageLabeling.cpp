@@ -0,0 +1,771 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageLabeling.cpp
+/// \brief CPP file with functions for connected component labeling and
+/// region growing.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/ImageLabeling.h>
+#include <H3DUtil/MinMaxGrid.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/H3DMath.h>
+#include <H3DUtil/Console.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace ImageLabelingInternals {
+  // The parent of voxels that are not included.
+  const unsigned int NO_PARENT = 0xffffffff;
+
+  // The states of the voxels while growing a region.
+  const unsigned char UNVISITED = 0;
+  const unsigned char IN_REGION = 1;
+  const unsigned char REJECTED = 2;
+
+  // The number of voxels of a layer of a growing region processed as one
+  // parallelFor chunk.
+  const unsigned int layer_chunk_size = 4096;
+
+#ifdef _MSC_VER
+  inline unsigned int atomicLoad( unsigned int *value ) {
+    return (unsigned int)InterlockedCompareExchange( (volatile LONG *)value,
+                                                     0, 0 );
+  }
+
+  inline bool atomicCompareExchange( unsigned int *value,
+                                     unsigned int expected,
+                                     unsigned int desired ) {
+    return (unsigned int)InterlockedCompareExchange(
+      (volatile LONG *)value, (LONG)desired, (LONG)expected ) == expected;
+  }
+
+  inline unsigned char atomicLoad( unsigned char *value ) {
+    return (unsigned char)_InterlockedCompareExchange8( (volatile char *)value,
+                                                       0, 0 );
+  }
+
+  inline bool atomicCompareExchange( unsigned char *value,
+                                     unsigned char expected,
+                                     unsigned char desired ) {
+    return (unsigned char)_InterlockedCompareExchange8(
+      (volatile char *)value, (char)desired, (char)expected ) == expected;
+  }
+#else
+  template< class T >
+  inline T atomicLoad( T *value ) {
+    return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+  }
+
+  template< class T >
+  inline bool atomicCompareExchange( T *value, T expected, T desired ) {
+    return __atomic_compare_exchange_n( value, &expected, desired, false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE );
+  }
+#endif
+
+  // The offset from a voxel to one of its neighbours.
+  struct Offset {
+    int dx, dy, dz;
+  };
+
+  // Returns the neighbours of a voxel with the given connectivity, only
+  // those before the voxel in memory if backward is true.
+  std::vector< Offset > neighbourOffsets( Connectivity connectivity,
+                                          bool backward ) {
+    int max_distance = connectivity == CONNECTIVITY_6 ? 1 :
+      connectivity == CONNECTIVITY_18 ? 2 : 3;
+    std::vector< Offset > offsets;
+    for( int dz = -1; dz <= 1; ++dz ) {
+      for( int dy = -1; dy <= 1; ++dy ) {
+        for( int dx = -1; dx <= 1; ++dx ) {
+          int distance = std::abs( dx ) + std::abs( dy ) + std::abs( dz );
+          if( distance == 0 || distance > max_distance ) continue;
+          if( backward &&
+              !( dz < 0 || ( dz == 0 && ( dy < 0 || ( dy == 0 && dx < 0 ) ) ) ) ) {
+            continue;
+          }
+          Offset o = { dx, dy, dz };
+          offsets.push_back( o );
+        }
+      }
+    }
+    return offsets;
+  }
+
+  // Sums used to compute ComponentStatistics.
+  struct Accumulator {
+    Accumulator():
+      nr_voxels( 0 ),
+      sum_x( 0 ), sum_y( 0 ), sum_z( 0 ), sum_value( 0 ),
+      min_value( 0 ), max_value( 0 ) {
+      min[0] = min[1] = min[2] = 0;
+      max[0] = max[1] = max[2] = 0;
+    }
+
+    inline void add( unsigned int x, unsigned int y, unsigned int z,
+                     H3DFloat value ) {
+      if( nr_voxels == 0 ) {
+        min[0] = max[0] = x;
+        min[1] = max[1] = y;
+        min[2] = max[2] = z;
+        min_value = max_value = value;
+      } else {
+        if( x < min[0] ) min[0] = x;
+        if( x > max[0] ) max[0] = x;
+        if( y < min[1] ) min[1] = y;
+        if( y > max[1] ) max[1] = y;
+        if( z < min[2] ) min[2] = z;
+        if( z > max[2] ) max[2] = z;
+        if( value < min_value ) min_value = value;
+        if( value > max_value ) max_value = value;
+      }
+      ++nr_voxels;
+      sum_x += x;
+      sum_y += y;
+      sum_z += z;
+      sum_value += value;
+    }
+
+    void add( const Accumulator &a ) {
+      if( a.nr_voxels == 0 ) return;
+      if( nr_voxels == 0 ) {
+        *this = a;
+        return;
+      }
+      for( unsigned int i = 0; i < 3; ++i ) {
+        if( a.min[i] < min[i] ) min[i] = a.min[i];
+        if( a.max[i] > max[i] ) max[i] = a.max[i];
+      }
+      if( a.min_value < min_value ) min_value = a.min_value;
+      if( a.max_value > max_value ) max_value = a.max_value;
+      nr_voxels += a.nr_voxels;
+      sum_x += a.sum_x;
+      sum_y += a.sum_y;
+      sum_z += a.sum_z;
+      sum_value += a.sum_value;
+    }
+
+    ComponentStatistics statistics( unsigned int label ) const {
+      ComponentStatistics s;
+      s.label = label;
+      s.nr_voxels = nr_voxels;
+      if( nr_voxels > 0 ) {
+        double n = (double) nr_voxels;
+        s.bounding_box_min = Vec3f( (H3DFloat) min[0], (H3DFloat) min[1],
+                                    (H3DFloat) min[2] );
+        s.bounding_box_max = Vec3f( (H3DFloat) max[0], (H3DFloat) max[1],
+                                    (H3DFloat) max[2] );
+        s.centroid = Vec3f( (H3DFloat)( sum_x / n ), (H3DFloat)( sum_y / n ),
+                            (H3DFloat)( sum_z / n ) );
+        s.min_value = min_value;
+        s.max_value = max_value;
+        s.mean_value = (H3DFloat)( sum_value / n );
+      }
+      return s;
+    }
+
+    H3DInt64 nr_voxels;
+    double sum_x, sum_y, sum_z, sum_value;
+    unsigned int min[3], max[3];
+    H3DFloat min_value, max_value;
+  };
+
+  inline unsigned int getLabel( const unsigned char *labels,
+                                unsigned int bytes,
+                                size_t i ) {
+    if( bytes == 1 ) return labels[i];
+    else if( bytes == 2 ) return ( (const unsigned short *) labels )[i];
+    else return ( (const unsigned int *) labels )[i];
+  }
+
+  inline void setLabel( unsigned char *labels,
+                        unsigned int bytes,
+                        size_t i,
+                        unsigned int label ) {
+    if( bytes == 1 ) labels[i] = (unsigned char) label;
+    else if( bytes == 2 ) ( (unsigned short *) labels )[i] =
+                            (unsigned short) label;
+    else ( (unsigned int *) labels )[i] = label;
+  }
+
+  // Find the root of a voxel with path halving. Only used on voxels that
+  // no other thread is using.
+  inline unsigned int findRoot( unsigned int *parent, unsigned int i ) {
+    while( parent[i] != i ) {
+      parent[i] = parent[ parent[i] ];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // Find the root of a voxel without changing the parents. The roots
+  // may be changed by other threads.
+  inline unsigned int findRootAtomic( unsigned int *parent, unsigned int i ) {
+    unsigned int p = atomicLoad( &parent[i] );
+    while( p != i ) {
+      i = p;
+      p = atomicLoad( &parent[i] );
+    }
+    return i;
+  }
+
+  // Join the trees of two voxels. The root of a tree is always its first
+  // voxel in memory, so the result does not depend on the order of the
+  // unions.
+  inline void unite( unsigned int *parent, unsigned int a, unsigned int b ) {
+    a = findRoot( parent, a );
+    b = findRoot( parent, b );
+    if( a < b ) parent[b] = a;
+    else if( b < a ) parent[a] = b;
+  }
+
+  // Join the trees of two voxels while other threads may do the same.
+  inline void uniteAtomic( unsigned int *parent,
+                           unsigned int a,
+                           unsigned int b ) {
+    while( true ) {
+      a = findRootAtomic( parent, a );
+      b = findRootAtomic( parent, b );
+      if( a == b ) return;
+      if( b < a ) std::swap( a, b );
+      // link b below a unless another thread has linked it first.
+      if( atomicCompareExchange( &parent[b], b, a ) ) return;
+    }
+  }
+
+  // The state of labelConnectedComponents.
+  struct Labeling {
+    Labeling( Image *image,
+              const IntensityPredicate &_predicate,
+              unsigned int component ) :
+      reader( image, component ),
+      predicate( _predicate ),
+      width( image->width() ),
+      height( image->height() ),
+      depth( image->depth() ),
+      slice_size( (size_t) width * height ),
+      nr_rows( height * depth ),
+      rows_per_slab( 1 ),
+      nr_slabs( 0 ),
+      labels( NULL ),
+      label_bytes( 4 ),
+      statistics( false ) {}
+
+    VoxelValueReader reader;
+    IntensityPredicate predicate;
+    std::vector< Offset > backward;
+    unsigned int width, height, depth;
+    size_t slice_size;
+
+    // The volume is divided into slabs of rows_per_slab rows, where row
+    // r is row r % height of slice r / height.
+    unsigned int nr_rows, rows_per_slab, nr_slabs;
+
+    // The union-find tree of the included voxels, NO_PARENT for the
+    // others.
+    std::vector< unsigned int > parent;
+
+    // The number of roots in each slab, then the first label of each
+    // slab.
+    std::vector< unsigned int > slab_labels;
+
+    unsigned char *labels;
+    unsigned int label_bytes;
+
+    // The statistics of each slab, the components with their root in the
+    // slab in local and the others, that started in an earlier slab, in
+    // earlier.
+    bool statistics;
+    std::vector< std::vector< Accumulator > > local;
+    std::vector< std::map< unsigned int, Accumulator > > earlier;
+
+    inline unsigned int slabBegin( unsigned int slab ) const {
+      return slab * rows_per_slab;
+    }
+
+    inline unsigned int slabEnd( unsigned int slab ) const {
+      return H3DMin( ( slab + 1 ) * rows_per_slab, nr_rows );
+    }
+
+    // Returns the index of the neighbour of voxel x in row r, or
+    // NO_PARENT if it is outside of the volume. Sets neighbour_row to the
+    // row of the neighbour.
+    inline unsigned int neighbour( unsigned int x, unsigned int y,
+                                   unsigned int z, const Offset &o,
+                                   unsigned int &neighbour_row ) const {
+      int nx = (int) x + o.dx;
+      int ny = (int) y + o.dy;
+      int nz = (int) z + o.dz;
+      if( nx < 0 || nx >= (int) width || ny < 0 || ny >= (int) height ||
+          nz < 0 || nz >= (int) depth ) return NO_PARENT;
+      neighbour_row = (unsigned int) nz * height + ny;
+      return (unsigned int)( nz * slice_size + (size_t) ny * width + nx );
+    }
+  };
+
+  // Build the trees of the slabs from the included voxels, only joining
+  // voxels in the same slab.
+  void labelSlabs( unsigned int begin, unsigned int end, void *data ) {
+    Labeling &l = *static_cast< Labeling * >( data );
+    std::vector< H3DFloat > values( l.width );
+    unsigned int *parent = &l.parent[0];
+    for( unsigned int slab = begin; slab < end; ++slab ) {
+      unsigned int row_begin = l.slabBegin( slab );
+      for( unsigned int r = row_begin; r < l.slabEnd( slab ); ++r ) {
+        unsigned int y = r % l.height;
+        unsigned int z = r / l.height;
+        l.reader.row( 0, y, z, l.width, &values[0] );
+        unsigned int i = (unsigned int)( z * l.slice_size +
+                                         (size_t) y * l.width );
+        for( unsigned int x = 0; x < l.width; ++x, ++i ) {
+          if( !l.predicate( values[x] ) ) {
+            parent[i] = NO_PARENT;
+            continue;
+          }
+          parent[i] = i;
+          for( unsigned int k = 0; k < l.backward.size(); ++k ) {
+            unsigned int row;
+            unsigned int j = l.neighbour( x, y, z, l.backward[k], row );
+            if( j != NO_PARENT && row >= row_begin &&
+                parent[j] != NO_PARENT ) {
+              unite( parent, i, j );
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Join the trees of voxels in the first rows of the slabs with those of
+  // their neighbours in earlier slabs.
+  void mergeSlabs( unsigned int begin, unsigned int end, void *data ) {
+    Labeling &l = *static_cast< Labeling * >( data );
+    unsigned int *parent = &l.parent[0];
+    for( unsigned int slab = H3DMax( begin, 1u ); slab < end; ++slab ) {
+      unsigned int row_begin = l.slabBegin( slab );
+      // the neighbours in earlier slabs are at most height + 1 rows back.
+      unsigned int row_end = H3DMin( l.slabEnd( slab ),
+                                     row_begin + l.height + 1 );
+      for( unsigned int r = row_begin; r < row_end; ++r ) {
+        unsigned int y = r % l.height;
+        unsigned int z = r / l.height;
+        unsigned int i = (unsigned int)( z * l.slice_size +
+                                         (size_t) y * l.width );
+        for( unsigned int x = 0; x < l.width; ++x, ++i ) {
+          if( atomicLoad( &parent[i] ) == NO_PARENT ) continue;
+          for( unsigned int k = 0; k < l.backward.size(); ++k ) {
+            unsigned int row;
+            unsigned int j = l.neighbour( x, y, z, l.backward[k], row );
+            if( j != NO_PARENT && row < row_begin &&
+                atomicLoad( &parent[j] ) != NO_PARENT ) {
+              uniteAtomic( parent, i, j );
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Count the roots in the slabs.
+  void countRoots( unsigned int begin, unsigned int end, void *data ) {
+    Labeling &l = *static_cast< Labeling * >( data );
+    for( unsigned int slab = begin; slab < end; ++slab ) {
+      unsigned int i = (unsigned int)( (size_t) l.slabBegin( slab ) *
+                                       l.width );
+      unsigned int i_end = (unsigned int)( (size_t) l.slabEnd( slab ) *
+                                           l.width );
+      unsigned int n = 0;
+      for( ; i < i_end; ++i ) {
+        if( l.parent[i] == i ) ++n;
+      }
+      l.slab_labels[slab] = n;
+    }
+  }
+
+  // Give the roots in the slabs their labels.
+  void labelRoots( unsigned int begin, unsigned int end, void *data ) {
+    Labeling &l = *static_cast< Labeling * >( data );
+    for( unsigned int slab = begin; slab < end; ++slab ) {
+      unsigned int i = (unsigned int)( (size_t) l.slabBegin( slab ) *
+                                       l.width );
+      unsigned int i_end = (unsigned int)( (size_t) l.slabEnd( slab ) *
+                                           l.width );
+      unsigned int label = l.slab_labels[slab];
+      for( ; i < i_end; ++i ) {
+        if( l.parent[i] == i ) setLabel( l.labels, l.label_bytes, i,
+                                         label++ );
+      }
+    }
+  }
+
+  // Give all voxels in the slabs the label of their root, and collect
+  // the statistics of the components.
+  void labelVoxels( unsigned int begin, unsigned int end, void *data ) {
+    Labeling &l = *static_cast< Labeling * >( data );
+    unsigned int *parent = &l.parent[0];
+    std::vector< H3DFloat > values( l.width );
+    for( unsigned int slab = begin; slab < end; ++slab ) {
+      unsigned int first_label = l.slab_labels[slab];
+      std::vector< Accumulator > &local = l.local[slab];
+      std::map< unsigned int, Accumulator > &earlier = l.earlier[slab];
+      if( l.statistics ) {
+        local.resize( l.slab_labels[slab + 1] - first_label );
+      }
+      for( unsigned int r = l.slabBegin( slab ); r < l.slabEnd( slab );
+           ++r ) {
+        unsigned int y = r % l.height;
+        unsigned int z = r / l.height;
+        unsigned int i = (unsigned int)( z * l.slice_size +
+                                         (size_t) y * l.width );
+        if( l.statistics ) l.reader.row( 0, y, z, l.width, &values[0] );
+        for( unsigned int x = 0; x < l.width; ++x, ++i ) {
+          if( parent[i] == NO_PARENT ) {
+            setLabel( l.labels, l.label_bytes, i, 0 );
+            continue;
+          }
+          unsigned int label;
+          if( parent[i] == i ) {
+            label = getLabel( l.labels, l.label_bytes, i );
+          } else {
+            label = getLabel( l.labels, l.label_bytes,
+                              findRootAtomic( parent, i ) );
+            setLabel( l.labels, l.label_bytes, i, label );
+          }
+          if( l.statistics ) {
+            if( label >= first_label ) {
+              local[ label - first_label ].add( x, y, z, values[x] );
+            } else {
+              earlier[label].add( x, y, z, values[x] );
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Labels the connected components and returns the label image.
+  Image *labelComponents( Image *image,
+                          const IntensityPredicate &predicate,
+                          Connectivity connectivity,
+                          std::vector< ComponentStatistics > *statistics,
+                          unsigned int component,
+                          unsigned int nr_threads ) {
+    Labeling l( image, predicate, component );
+    if( (size_t) l.width * l.height * l.depth >= NO_PARENT ) {
+      Console(LogLevel::Error) << "Error: Cannot label images with 2^32 - 1 "
+                               << "voxels or more." << std::endl;
+      return NULL;
+    }
+
+    if( nr_threads == 0 ) nr_threads = getNrHardwareThreads();
+    l.backward = neighbourOffsets( connectivity, true );
+    l.statistics = statistics != NULL;
+    // a few slabs per thread to even out the work.
+    unsigned int wanted_slabs = H3DMin( l.nr_rows, 4 * nr_threads );
+    if( wanted_slabs > 0 ) {
+      l.rows_per_slab = ( l.nr_rows + wanted_slabs - 1 ) / wanted_slabs;
+      l.nr_slabs = ( l.nr_rows + l.rows_per_slab - 1 ) / l.rows_per_slab;
+    }
+    l.parent.resize( (size_t) l.width * l.height * l.depth + 1 );
+    l.slab_labels.resize( l.nr_slabs + 1, 0 );
+    l.local.resize( l.nr_slabs );
+    l.earlier.resize( l.nr_slabs );
+
+    parallelFor( 0, l.nr_slabs, labelSlabs, &l, 1, nr_threads );
+    parallelFor( 1, l.nr_slabs, mergeSlabs, &l, 1, nr_threads );
+    parallelFor( 0, l.nr_slabs, countRoots, &l, 1, nr_threads );
+
+    unsigned int nr_labels = 0;
+    for( unsigned int slab = 0; slab < l.nr_slabs; ++slab ) {
+      unsigned int n = l.slab_labels[slab];
+      l.slab_labels[slab] = nr_labels + 1;
+      nr_labels += n;
+    }
+    l.slab_labels[l.nr_slabs] = nr_labels + 1;
+    l.label_bytes = nr_labels < 0x100 ? 1 : nr_labels < 0x10000 ? 2 : 4;
+
+    PixelImage *result = new PixelImage( l.width, l.height, l.depth,
+                                         8 * l.label_bytes,
+                                         Image::LUMINANCE, Image::UNSIGNED,
+                                         image->pixelSize() );
+    l.labels = (unsigned char *) result->getImageData();
+
+    parallelFor( 0, l.nr_slabs, labelRoots, &l, 1, nr_threads );
+    parallelFor( 0, l.nr_slabs, labelVoxels, &l, 1, nr_threads );
+
+    if( statistics ) {
+      std::vector< Accumulator > totals( nr_labels );
+      for( unsigned int slab = 0; slab < l.nr_slabs; ++slab ) {
+        unsigned int first_label = l.slab_labels[slab];
+        for( unsigned int i = 0; i < l.local[slab].size(); ++i ) {
+          totals[ first_label - 1 + i ].add( l.local[slab][i] );
+        }
+        for( std::map< unsigned int, Accumulator >::const_iterator a =
+               l.earlier[slab].begin(); a != l.earlier[slab].end(); ++a ) {
+          totals[ a->first - 1 ].add( a->second );
+        }
+      }
+      statistics->resize( nr_labels );
+      for( unsigned int i = 0; i < nr_labels; ++i ) {
+        (*statistics)[i] = totals[i].statistics( i + 1 );
+      }
+    }
+    return result;
+  }
+
+  // The state of extractLargestComponent.
+  struct LargestComponent {
+    const unsigned char *labels;
+    unsigned int label_bytes;
+    unsigned int label;
+    unsigned char *mask;
+    size_t row_size;
+  };
+
+  void maskComponentRows( unsigned int begin, unsigned int end,
+                          void *data ) {
+    LargestComponent &c = *static_cast< LargestComponent * >( data );
+    for( size_t i = begin * c.row_size; i < end * c.row_size; ++i ) {
+      c.mask[i] = getLabel( c.labels, c.label_bytes, i ) == c.label;
+    }
+  }
+
+  // The state of growRegion.
+  struct RegionGrowing {
+    RegionGrowing( Image *image,
+                   const IntensityPredicate &_predicate,
+                   unsigned int component ) :
+      reader( image, component ),
+      predicate( _predicate ),
+      width( image->width() ),
+      height( image->height() ),
+      depth( image->depth() ),
+      slice_size( (size_t) width * height ),
+      state( NULL ),
+      statistics( false ),
+      layer( NULL ) {}
+
+    VoxelValueReader reader;
+    IntensityPredicate predicate;
+    std::vector< Offset > neighbours;
+    unsigned int width, height, depth;
+    size_t slice_size;
+
+    // The state of each voxel, UNVISITED, IN_REGION or REJECTED.
+    unsigned char *state;
+    bool statistics;
+
+    // The voxels added in the last step, and the voxels added by each
+    // chunk of it in this step.
+    const std::vector< unsigned int > *layer;
+    std::vector< std::vector< unsigned int > > next_layer;
+    std::vector< Accumulator > accumulators;
+
+    // Visit a voxel, adding it to the region if the predicate is true.
+    // Returns true if it was added by this call.
+    inline bool visit( unsigned int x, unsigned int y, unsigned int z,
+                       unsigned int i, Accumulator &accumulator ) {
+      if( atomicLoad( &state[i] ) != UNVISITED ) return false;
+      H3DFloat value = reader( x, y, z );
+      bool include = predicate( value );
+      if( !atomicCompareExchange( &state[i], UNVISITED,
+                                  include ? IN_REGION : REJECTED ) ) {
+        // visited by another thread at the same time.
+        return false;
+      }
+      if( include && statistics ) accumulator.add( x, y, z, value );
+      return include;
+    }
+  };
+
+  // Visit the neighbours of the voxels of a range of the current layer.
+  void growLayer( unsigned int begin, unsigned int end, void *data ) {
+    RegionGrowing &g = *static_cast< RegionGrowing * >( data );
+    const std::vector< unsigned int > &layer = *g.layer;
+    for( unsigned int chunk = begin / layer_chunk_size;
+         chunk * layer_chunk_size < end; ++chunk ) {
+      std::vector< unsigned int > &next = g.next_layer[chunk];
+      Accumulator &accumulator = g.accumulators[chunk];
+      unsigned int chunk_end = H3DMin( ( chunk + 1 ) * layer_chunk_size,
+                                       end );
+      for( unsigned int k = H3DMax( chunk * layer_chunk_size, begin );
+           k < chunk_end; ++k ) {
+        unsigned int i = layer[k];
+        unsigned int z = (unsigned int)( i / g.slice_size );
+        unsigned int y = (unsigned int)( ( i % g.slice_size ) / g.width );
+        unsigned int x = (unsigned int)( i % g.width );
+        for( unsigned int n = 0; n < g.neighbours.size(); ++n ) {
+          const Offset &o = g.neighbours[n];
+          int nx = (int) x + o.dx;
+          int ny = (int) y + o.dy;
+          int nz = (int) z + o.dz;
+          if( nx < 0 || nx >= (int) g.width || ny < 0 ||
+              ny >= (int) g.height || nz < 0 || nz >= (int) g.depth ) {
+            continue;
+          }
+          unsigned int j = (unsigned int)( nz * g.slice_size +
+                                           (size_t) ny * g.width + nx );
+          if( g.visit( nx, ny, nz, j, accumulator ) ) next.push_back( j );
+        }
+      }
+    }
+  }
+
+  // Clear the rejected voxels of a range of slices.
+  void clearRejected( unsigned int begin, unsigned int end, void *data ) {
+    RegionGrowing &g = *static_cast< RegionGrowing * >( data );
+    for( size_t i = begin * g.slice_size; i < end * g.slice_size; ++i ) {
+      if( g.state[i] == REJECTED ) g.state[i] = UNVISITED;
+    }
+  }
+}
+
+using namespace ImageLabelingInternals;
+
+Image *H3DUtil::labelConnectedComponents(
+  Image *image,
+  const IntensityPredicate &predicate,
+  Connectivity connectivity,
+  std::vector< ComponentStatistics > *statistics,
+  unsigned int component,
+  unsigned int nr_threads ) {
+  return labelComponents( image, predicate, connectivity, statistics,
+                          component, nr_threads );
+}
+
+Image *H3DUtil::extractLargestComponent(
+  Image *image,
+  const IntensityPredicate &predicate,
+  Connectivity connectivity,
+  unsigned int component,
+  unsigned int nr_threads ) {
+  std::vector< ComponentStatistics > statistics;
+  Image *labels = labelComponents( image, predicate, connectivity,
+                                   &statistics, component, nr_threads );
+  if( !labels ) return NULL;
+
+  LargestComponent c;
+  c.labels = (const unsigned char *) labels->getImageData();
+  c.label_bytes = labels->bitsPerPixel() / 8;
+  c.label = 0;
+  H3DInt64 largest = 0;
+  for( unsigned int i = 0; i < statistics.size(); ++i ) {
+    if( statistics[i].nr_voxels > largest ) {
+      largest = statistics[i].nr_voxels;
+      c.label = statistics[i].label;
+    }
+  }
+
+  PixelImage *mask = new PixelImage( image->width(), image->height(),
+                                     image->depth(), 8,
+                                     Image::LUMINANCE, Image::UNSIGNED,
+                                     image->pixelSize() );
+  c.mask = (unsigned char *) mask->getImageData();
+  c.row_size = image->width();
+  parallelFor( 0, image->height() * image->depth(), maskComponentRows, &c,
+               64, nr_threads );
+  delete labels;
+  return mask;
+}
+
+Image *H3DUtil::growRegion( Image *image,
+                            const std::vector< Vec3f > &seeds,
+                            const IntensityPredicate &predicate,
+                            Connectivity connectivity,
+                            ComponentStatistics *statistics,
+                            unsigned int component,
+                            unsigned int nr_threads ) {
+  RegionGrowing g( image, predicate, component );
+  size_t nr_voxels = g.slice_size * g.depth;
+  if( nr_voxels >= NO_PARENT ) {
+    Console(LogLevel::Error) << "Error: Cannot grow regions in images with "
+                             << "2^32 - 1 voxels or more." << std::endl;
+    return NULL;
+  }
+
+  PixelImage *region = new PixelImage( g.width, g.height, g.depth, 8,
+                                       Image::LUMINANCE, Image::UNSIGNED,
+                                       image->pixelSize() );
+  g.state = (unsigned char *) region->getImageData();
+  memset( g.state, UNVISITED, nr_voxels );
+  g.neighbours = neighbourOffsets( connectivity, false );
+  g.statistics = statistics != NULL;
+
+  Accumulator total;
+  std::vector< unsigned int > layer;
+  for( unsigned int s = 0; s < seeds.size(); ++s ) {
+    H3DFloat sx = H3DFloor( seeds[s].x + 0.5f );
+    H3DFloat sy = H3DFloor( seeds[s].y + 0.5f );
+    H3DFloat sz = H3DFloor( seeds[s].z + 0.5f );
+    if( sx < 0 || sx >= g.width || sy < 0 || sy >= g.height ||
+        sz < 0 || sz >= g.depth ) continue;
+    unsigned int x = (unsigned int) sx;
+    unsigned int y = (unsigned int) sy;
+    unsigned int z = (unsigned int) sz;
+    unsigned int i = (unsigned int)( z * g.slice_size +
+                                     (size_t) y * g.width + x );
+    if( g.visit( x, y, z, i, total ) ) {
+      layer.push_back( i );
+    }
+  }
+
+  std::vector< unsigned int > next;
+  while( !layer.empty() ) {
+    unsigned int nr_chunks =
+      ( (unsigned int) layer.size() + layer_chunk_size - 1 ) /
+      layer_chunk_size;
+    g.layer = &layer;
+    g.next_layer.clear();
+    g.next_layer.resize( nr_chunks );
+    g.accumulators.clear();
+    g.accumulators.resize( nr_chunks );
+    parallelFor( 0, (unsigned int) layer.size(), growLayer, &g,
+                 layer_chunk_size, nr_threads );
+
+    next.clear();
+    for( unsigned int c = 0; c < nr_chunks; ++c ) {
+      next.insert( next.end(), g.next_layer[c].begin(),
+                   g.next_layer[c].end() );
+      total.add( g.accumulators[c] );
+    }
+    layer.swap( next );
+  }
+
+  parallelFor( 0, g.depth, clearRejected, &g, 1, nr_threads );
+  if( statistics ) *statistics = total.statistics( 1 );
+  return region;
+}
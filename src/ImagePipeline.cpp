@@ -0,0 +1,569 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImagePipeline.cpp
+/// \brief CPP file for ImageNode and the nodes of image processing
+/// pipelines.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/ImagePipeline.h>
+#include <H3DUtil/MinMaxGrid.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/H3DMath.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace H3DUtil;
+
+namespace ImagePipelineInternals {
+  // Read the values of a region of an image into values, in x, y, z
+  // order without padding.
+  void readRegion( Image *image,
+                   unsigned int component,
+                   const ImageRegion &region,
+                   std::vector< H3DFloat > &values ) {
+    VoxelValueReader reader( image, component );
+    values.resize( (size_t) region.width * region.height * region.depth );
+    H3DFloat *v = values.empty() ? NULL : &values[0];
+    for( unsigned int z = 0; z < region.depth; ++z ) {
+      for( unsigned int y = 0; y < region.height; ++y ) {
+        reader.row( region.x, region.y + y, region.z + z, region.width, v );
+        v += region.width;
+      }
+    }
+  }
+
+  // Create a 32 bit floating point LUMINANCE image with the size and
+  // pixel size of image.
+  PixelImage *createFloatImage( Image *image ) {
+    return new PixelImage( image->width(), image->height(), image->depth(),
+                           32, Image::LUMINANCE, Image::RATIONAL,
+                           image->pixelSize() );
+  }
+
+  // Returns a pointer to voxel (x, y, z) of an image created with
+  // createFloatImage.
+  inline H3DFloat *floatVoxel( Image *image,
+                               unsigned int x,
+                               unsigned int y,
+                               unsigned int z ) {
+    return (H3DFloat *) image->getImageData() +
+      ( (size_t) z * image->height() + y ) * image->width() + x;
+  }
+
+  // Convolve a line of values with a kernel of 2 * radius + 1 weights,
+  // repeating the first and last value outside of the line. Output k is
+  // centered on input offset + k.
+  void filterLine( const H3DFloat *in,
+                   size_t in_stride,
+                   unsigned int in_count,
+                   unsigned int offset,
+                   H3DFloat *out,
+                   size_t out_stride,
+                   unsigned int out_count,
+                   const std::vector< H3DFloat > &kernel,
+                   unsigned int radius ) {
+    int last = (int) in_count - 1;
+    for( unsigned int k = 0; k < out_count; ++k ) {
+      int center = (int)( offset + k );
+      H3DFloat sum = 0;
+      for( int j = -(int) radius; j <= (int) radius; ++j ) {
+        int i = center + j;
+        if( i < 0 ) i = 0;
+        else if( i > last ) i = last;
+        sum += kernel[ j + radius ] * in[ i * in_stride ];
+      }
+      out[ k * out_stride ] = sum;
+    }
+  }
+}
+
+using namespace ImagePipelineInternals;
+
+ImageRegion ImageRegion::clipped( unsigned int image_width,
+                                  unsigned int image_height,
+                                  unsigned int image_depth ) const {
+  if( x >= image_width || y >= image_height || z >= image_depth ) {
+    return ImageRegion();
+  }
+  return ImageRegion( x, y, z,
+                      H3DMin( width, image_width - x ),
+                      H3DMin( height, image_height - y ),
+                      H3DMin( depth, image_depth - z ) );
+}
+
+ImageRegion ImageRegion::expanded( unsigned int margin,
+                                   unsigned int image_width,
+                                   unsigned int image_height,
+                                   unsigned int image_depth ) const {
+  ImageRegion r = clipped( image_width, image_height, image_depth );
+  if( r.isEmpty() ) return r;
+  unsigned int x0 = r.x > margin ? r.x - margin : 0;
+  unsigned int y0 = r.y > margin ? r.y - margin : 0;
+  unsigned int z0 = r.z > margin ? r.z - margin : 0;
+  unsigned int x1 = (unsigned int) H3DMin( (H3DInt64) r.x + r.width + margin,
+                                           (H3DInt64) image_width );
+  unsigned int y1 = (unsigned int) H3DMin( (H3DInt64) r.y + r.height + margin,
+                                           (H3DInt64) image_height );
+  unsigned int z1 = (unsigned int) H3DMin( (H3DInt64) r.z + r.depth + margin,
+                                           (H3DInt64) image_depth );
+  return ImageRegion( x0, y0, z0, x1 - x0, y1 - y0, z1 - z0 );
+}
+
+ImageNode::ImageNode( unsigned int nr_inputs,
+                      unsigned int _brick_size ) :
+  inputs( nr_inputs ),
+  all_invalid( true ),
+  nr_invalid_bricks( 0 ),
+  bricks_x( 0 ),
+  bricks_y( 0 ),
+  bricks_z( 0 ),
+  brick_size( H3DMax( _brick_size, 1u ) ),
+  result_width( 0 ),
+  result_height( 0 ),
+  result_depth( 0 ),
+  nr_evaluations( 0 ),
+  nr_brick_evaluations( 0 ) {
+  type_name = "ImageNode";
+}
+
+ImageNode::~ImageNode() {
+  for( unsigned int i = 0; i < inputs.size(); ++i ) {
+    if( inputs[i] ) {
+      std::vector< ImageNode * > &o = inputs[i]->outputs;
+      std::vector< ImageNode * >::iterator n =
+        std::find( o.begin(), o.end(), this );
+      if( n != o.end() ) o.erase( n );
+    }
+  }
+}
+
+void ImageNode::setInput( unsigned int i, ImageNode *node ) {
+  if( i >= inputs.size() || inputs[i] == node ) return;
+  if( inputs[i] ) {
+    std::vector< ImageNode * > &o = inputs[i]->outputs;
+    std::vector< ImageNode * >::iterator n =
+      std::find( o.begin(), o.end(), this );
+    if( n != o.end() ) o.erase( n );
+  }
+  inputs.set( i, node );
+  if( node ) node->outputs.push_back( this );
+  invalidate();
+}
+
+Image *ImageNode::getImage( unsigned int nr_threads ) {
+  std::vector< Image * > input_images( inputs.size(), (Image *) NULL );
+  for( unsigned int i = 0; i < inputs.size(); ++i ) {
+    if( inputs[i] ) input_images[i] = inputs[i]->getImage( nr_threads );
+  }
+
+  if( all_invalid || !result.get() ) {
+    result.reset( evaluate( input_images, nr_threads ) );
+    ++nr_evaluations;
+    if( result.get() ) {
+      setupBricks( result.get() );
+      all_invalid = false;
+    }
+  } else if( nr_invalid_bricks > 0 ) {
+    std::vector< unsigned int > bricks;
+    bricks.reserve( nr_invalid_bricks );
+    for( unsigned int i = 0; i < invalid_bricks.size(); ++i ) {
+      if( invalid_bricks[i] ) {
+        bricks.push_back( i );
+        invalid_bricks[i] = false;
+      }
+    }
+    nr_invalid_bricks = 0;
+
+    BrickEvaluation e;
+    e.node = this;
+    e.input_images = &input_images;
+    e.result = result.get();
+    e.bricks = &bricks;
+    parallelFor( 0, (unsigned int) bricks.size(), evaluateBricks, &e,
+                 1, nr_threads );
+    nr_brick_evaluations += bricks.size();
+  }
+  return result.get();
+}
+
+void ImageNode::invalidate() {
+  // the nodes using an invalid result are always invalid themselves.
+  if( all_invalid ) return;
+  all_invalid = true;
+  for( unsigned int i = 0; i < outputs.size(); ++i ) {
+    outputs[i]->invalidate();
+  }
+}
+
+void ImageNode::invalidateRegion( const ImageRegion &region ) {
+  if( all_invalid ) return;
+  if( !canEvaluateRegions() ) {
+    invalidate();
+    return;
+  }
+
+  ImageRegion r = region.clipped( result_width, result_height,
+                                  result_depth );
+  if( r.isEmpty() ) return;
+
+  for( unsigned int z = r.z / brick_size;
+       z <= ( r.z + r.depth - 1 ) / brick_size; ++z ) {
+    for( unsigned int y = r.y / brick_size;
+         y <= ( r.y + r.height - 1 ) / brick_size; ++y ) {
+      for( unsigned int x = r.x / brick_size;
+           x <= ( r.x + r.width - 1 ) / brick_size; ++x ) {
+        unsigned int i = ( z * bricks_y + y ) * bricks_x + x;
+        if( !invalid_bricks[i] ) {
+          invalid_bricks[i] = true;
+          ++nr_invalid_bricks;
+        }
+      }
+    }
+  }
+
+  for( unsigned int i = 0; i < outputs.size(); ++i ) {
+    ImageNode *output = outputs[i];
+    for( unsigned int k = 0; k < output->inputs.size(); ++k ) {
+      if( output->inputs[k] == this ) {
+        output->invalidateRegion( output->affectedRegion( k, r ) );
+      }
+    }
+  }
+}
+
+bool ImageNode::isUpToDate() {
+  return !all_invalid && result.get() && nr_invalid_bricks == 0;
+}
+
+void ImageNode::setupBricks( Image *image ) {
+  result_width = image->width();
+  result_height = image->height();
+  result_depth = image->depth();
+  bricks_x = ( result_width + brick_size - 1 ) / brick_size;
+  bricks_y = ( result_height + brick_size - 1 ) / brick_size;
+  bricks_z = ( result_depth + brick_size - 1 ) / brick_size;
+  invalid_bricks.assign( (size_t) bricks_x * bricks_y * bricks_z, false );
+  nr_invalid_bricks = 0;
+}
+
+ImageRegion ImageNode::brickRegion( unsigned int i ) {
+  unsigned int x = ( i % bricks_x ) * brick_size;
+  unsigned int y = ( ( i / bricks_x ) % bricks_y ) * brick_size;
+  unsigned int z = ( i / ( bricks_x * bricks_y ) ) * brick_size;
+  return ImageRegion( x, y, z,
+                      H3DMin( brick_size, result_width - x ),
+                      H3DMin( brick_size, result_height - y ),
+                      H3DMin( brick_size, result_depth - z ) );
+}
+
+void ImageNode::evaluateAllRegions(
+  const std::vector< Image * > &input_images,
+  Image *image,
+  unsigned int nr_threads ) {
+  setupBricks( image );
+  std::vector< unsigned int > bricks( invalid_bricks.size() );
+  for( unsigned int i = 0; i < bricks.size(); ++i ) bricks[i] = i;
+
+  BrickEvaluation e;
+  e.node = this;
+  e.input_images = &input_images;
+  e.result = image;
+  e.bricks = &bricks;
+  parallelFor( 0, (unsigned int) bricks.size(), evaluateBricks, &e,
+               1, nr_threads );
+}
+
+void ImageNode::evaluateBricks( unsigned int begin, unsigned int end,
+                                void *data ) {
+  BrickEvaluation &e = *static_cast< BrickEvaluation * >( data );
+  for( unsigned int i = begin; i < end; ++i ) {
+    e.node->evaluateRegion( *e.input_images, e.result,
+                            e.node->brickRegion( (*e.bricks)[i] ) );
+  }
+}
+
+SourceImageNode::SourceImageNode( Image *_image ) :
+  ImageNode( 0 ),
+  image( _image ) {
+  type_name = "SourceImageNode";
+}
+
+void SourceImageNode::setImage( Image *_image ) {
+  image.reset( _image );
+  invalidate();
+}
+
+Image *SourceImageNode::evaluate(
+  const std::vector< Image * > & /*input_images*/,
+  unsigned int /*nr_threads*/ ) {
+  return image.get();
+}
+
+ConvertImageNode::ConvertImageNode( unsigned int _component,
+                                    H3DFloat _scale,
+                                    H3DFloat _offset ) :
+  ImageNode( 1 ),
+  component( _component ),
+  scale( _scale ),
+  offset( _offset ) {
+  type_name = "ConvertImageNode";
+}
+
+void ConvertImageNode::setComponent( unsigned int _component ) {
+  component = _component;
+  invalidate();
+}
+
+void ConvertImageNode::setScaleOffset( H3DFloat _scale, H3DFloat _offset ) {
+  scale = _scale;
+  offset = _offset;
+  invalidate();
+}
+
+Image *ConvertImageNode::evaluate( const std::vector< Image * > &input_images,
+                                   unsigned int nr_threads ) {
+  if( !input_images[0] ) return NULL;
+  Image *image = createFloatImage( input_images[0] );
+  evaluateAllRegions( input_images, image, nr_threads );
+  return image;
+}
+
+void ConvertImageNode::evaluateRegion(
+  const std::vector< Image * > &input_images,
+  Image *image,
+  const ImageRegion &region ) {
+  VoxelValueReader reader( input_images[0], component );
+  for( unsigned int z = region.z; z < region.z + region.depth; ++z ) {
+    for( unsigned int y = region.y; y < region.y + region.height; ++y ) {
+      H3DFloat *values = floatVoxel( image, region.x, y, z );
+      reader.row( region.x, y, z, region.width, values );
+      for( unsigned int x = 0; x < region.width; ++x ) {
+        values[x] = values[x] * scale + offset;
+      }
+    }
+  }
+}
+
+GaussianFilterNode::GaussianFilterNode( H3DFloat _sigma,
+                                        unsigned int _component ) :
+  ImageNode( 1 ),
+  sigma( _sigma ),
+  component( _component ),
+  radius( 0 ) {
+  type_name = "GaussianFilterNode";
+  updateKernel();
+}
+
+void GaussianFilterNode::setSigma( H3DFloat _sigma ) {
+  sigma = _sigma;
+  updateKernel();
+  invalidate();
+}
+
+void GaussianFilterNode::setComponent( unsigned int _component ) {
+  component = _component;
+  invalidate();
+}
+
+void GaussianFilterNode::updateKernel() {
+  radius = sigma > 0 ? (unsigned int) std::ceil( 3 * sigma ) : 0;
+  kernel.resize( 2 * radius + 1 );
+  H3DFloat sum = 0;
+  for( unsigned int i = 0; i < kernel.size(); ++i ) {
+    H3DFloat d = (H3DFloat) i - (H3DFloat) radius;
+    kernel[i] = radius > 0 ? std::exp( -d * d / ( 2 * sigma * sigma ) ) : 1;
+    sum += kernel[i];
+  }
+  for( unsigned int i = 0; i < kernel.size(); ++i ) kernel[i] /= sum;
+}
+
+Image *GaussianFilterNode::evaluate(
+  const std::vector< Image * > &input_images,
+  unsigned int nr_threads ) {
+  if( !input_images[0] ) return NULL;
+  Image *image = createFloatImage( input_images[0] );
+  evaluateAllRegions( input_images, image, nr_threads );
+  return image;
+}
+
+void GaussianFilterNode::evaluateRegion(
+  const std::vector< Image * > &input_images,
+  Image *image,
+  const ImageRegion &region ) {
+  Image *input = input_images[0];
+  ImageRegion src = region.expanded( radius, input->width(),
+                                     input->height(), input->depth() );
+  std::vector< H3DFloat > a;
+  readRegion( input, component, src, a );
+
+  // filter along x, y and z in turn, each time only computing the values
+  // needed for the region.
+  size_t sw = src.width, sh = src.height;
+  size_t rw = region.width, rh = region.height;
+  std::vector< H3DFloat > b( rw * sh * src.depth );
+  for( unsigned int z = 0; z < src.depth; ++z ) {
+    for( unsigned int y = 0; y < sh; ++y ) {
+      filterLine( &a[ ( z * sh + y ) * sw ], 1, src.width,
+                  region.x - src.x,
+                  &b[ ( z * sh + y ) * rw ], 1, region.width,
+                  kernel, radius );
+    }
+  }
+
+  std::vector< H3DFloat > c( rw * rh * src.depth );
+  for( unsigned int z = 0; z < src.depth; ++z ) {
+    for( unsigned int x = 0; x < rw; ++x ) {
+      filterLine( &b[ z * sh * rw + x ], rw, src.height,
+                  region.y - src.y,
+                  &c[ z * rh * rw + x ], rw, region.height,
+                  kernel, radius );
+    }
+  }
+
+  size_t slice_size = (size_t) image->width() * image->height();
+  for( unsigned int y = 0; y < rh; ++y ) {
+    for( unsigned int x = 0; x < rw; ++x ) {
+      filterLine( &c[ y * rw + x ], rw * rh, src.depth,
+                  region.z - src.z,
+                  floatVoxel( image, region.x + x, region.y + y, region.z ),
+                  slice_size, region.depth,
+                  kernel, radius );
+    }
+  }
+}
+
+ImageRegion GaussianFilterNode::affectedRegion( unsigned int /*input*/,
+                                                const ImageRegion &region ) {
+  return region.expanded( radius, result_width, result_height,
+                          result_depth );
+}
+
+GradientMagnitudeNode::GradientMagnitudeNode( unsigned int _component ) :
+  ImageNode( 1 ),
+  component( _component ) {
+  type_name = "GradientMagnitudeNode";
+}
+
+void GradientMagnitudeNode::setComponent( unsigned int _component ) {
+  component = _component;
+  invalidate();
+}
+
+Image *GradientMagnitudeNode::evaluate(
+  const std::vector< Image * > &input_images,
+  unsigned int nr_threads ) {
+  if( !input_images[0] ) return NULL;
+  Image *image = createFloatImage( input_images[0] );
+  evaluateAllRegions( input_images, image, nr_threads );
+  return image;
+}
+
+void GradientMagnitudeNode::evaluateRegion(
+  const std::vector< Image * > &input_images,
+  Image *image,
+  const ImageRegion &region ) {
+  Image *input = input_images[0];
+  unsigned int w = input->width();
+  unsigned int h = input->height();
+  unsigned int d = input->depth();
+  ImageRegion src = region.expanded( 1, w, h, d );
+  std::vector< H3DFloat > a;
+  readRegion( input, component, src, a );
+
+  Vec3f pixel_size = input->pixelSize();
+  H3DFloat sx = pixel_size.x > 0 ? pixel_size.x : 1;
+  H3DFloat sy = pixel_size.y > 0 ? pixel_size.y : 1;
+  H3DFloat sz = pixel_size.z > 0 ? pixel_size.z : 1;
+  size_t row_size = src.width;
+  size_t slice_size = row_size * src.height;
+
+  for( unsigned int z = region.z; z < region.z + region.depth; ++z ) {
+    unsigned int z0 = z > 0 ? z - 1 : z;
+    unsigned int z1 = z + 1 < d ? z + 1 : z;
+    for( unsigned int y = region.y; y < region.y + region.height; ++y ) {
+      unsigned int y0 = y > 0 ? y - 1 : y;
+      unsigned int y1 = y + 1 < h ? y + 1 : y;
+      H3DFloat *out = floatVoxel( image, region.x, y, z );
+      for( unsigned int x = region.x; x < region.x + region.width; ++x ) {
+        unsigned int x0 = x > 0 ? x - 1 : x;
+        unsigned int x1 = x + 1 < w ? x + 1 : x;
+        // the index in a of voxel (x, y, z).
+        size_t i = ( z - src.z ) * slice_size + ( y - src.y ) * row_size +
+          ( x - src.x );
+        H3DFloat gx = x1 > x0 ?
+          ( a[ i + ( x1 - x ) ] - a[ i - ( x - x0 ) ] ) /
+          ( ( x1 - x0 ) * sx ) : 0;
+        H3DFloat gy = y1 > y0 ?
+          ( a[ i + ( y1 - y ) * row_size ] -
+            a[ i - ( y - y0 ) * row_size ] ) / ( ( y1 - y0 ) * sy ) : 0;
+        H3DFloat gz = z1 > z0 ?
+          ( a[ i + ( z1 - z ) * slice_size ] -
+            a[ i - ( z - z0 ) * slice_size ] ) / ( ( z1 - z0 ) * sz ) : 0;
+        *out++ = H3DSqrt( gx * gx + gy * gy + gz * gz );
+      }
+    }
+  }
+}
+
+ImageRegion GradientMagnitudeNode::affectedRegion(
+  unsigned int /*input*/,
+  const ImageRegion &region ) {
+  return region.expanded( 1, result_width, result_height, result_depth );
+}
+
+ResampleImageNode::ResampleImageNode( unsigned int _width,
+                                      unsigned int _height,
+                                      unsigned int _depth ) :
+  ImageNode( 1 ),
+  width( _width ),
+  height( _height ),
+  depth( _depth ) {
+  type_name = "ResampleImageNode";
+}
+
+void ResampleImageNode::setSize( unsigned int _width,
+                                 unsigned int _height,
+                                 unsigned int _depth ) {
+  width = _width;
+  height = _height;
+  depth = _depth;
+  invalidate();
+}
+
+Image *ResampleImageNode::evaluate(
+  const std::vector< Image * > &input_images,
+  unsigned int /*nr_threads*/ ) {
+  Image *input = input_images[0];
+  if( !input || input->compressionType() != Image::NO_COMPRESSION ) {
+    return NULL;
+  }
+  return new PixelImage( input,
+                         width ? width : input->width(),
+                         height ? height : input->height(),
+                         depth ? depth : input->depth() );
+}
@@ -0,0 +1,463 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ImageReslice.cpp
+/// \brief CPP file for the functions reslicing volumes along arbitrary
+/// planes.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/ImageReslice.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Console.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <string.h>
+
+using namespace H3DUtil;
+
+namespace ImageResliceInternals {
+  // Positions are stepped along the rows in fixed point with FIXED_BITS
+  // fraction bits, offset by one voxel so that they are never negative.
+  const unsigned int FIXED_BITS = 24;
+  const H3DInt64 FIXED_ONE = (H3DInt64) 1 << FIXED_BITS;
+  const H3DInt64 FIXED_MASK = FIXED_ONE - 1;
+
+  inline H3DInt64 toFixed( double v ) {
+    return (H3DInt64) H3DFloor( v * FIXED_ONE + 0.5 );
+  }
+
+  // The type to interpolate values of type T in.
+  template< class T >
+  struct Accumulator { typedef float Type; };
+  template<>
+  struct Accumulator< int > { typedef double Type; };
+  template<>
+  struct Accumulator< unsigned int > { typedef double Type; };
+  template<>
+  struct Accumulator< double > { typedef double Type; };
+
+  // Convert an interpolated value to T, rounded and clamped for integer
+  // types.
+  template< class T, class A >
+  inline T fromAccumulator( A v ) {
+    if( !std::numeric_limits< T >::is_integer ) return (T) v;
+    v = H3DFloor( v + (A) 0.5 );
+    if( v <= (A) std::numeric_limits< T >::min() )
+      return std::numeric_limits< T >::min();
+    if( v >= (A) std::numeric_limits< T >::max() )
+      return std::numeric_limits< T >::max();
+    return (T) v;
+  }
+
+  // The state of a resliceImage call.
+  struct Reslice {
+    Image *image;
+    Image *output;
+    ResliceMode mode;
+
+    // The size of the volume and, if its data is in memory, the data and
+    // the strides of a pixel, row and slice.
+    int size[3];
+    const unsigned char *src;
+    size_t stride[3];
+    unsigned int bytes_per_pixel;
+
+    unsigned char *dst;
+    size_t dst_row_stride;
+    unsigned int width, height;
+
+    // The voxel coordinates of pixel (0, 0) and the steps to the next
+    // pixel along a row, the next row and along the plane normal.
+    Vec3d origin, step_x, step_y, step_z;
+
+    // The offsets along the plane normal of the samples of each pixel.
+    std::vector< double > slab_offsets;
+  };
+
+  // Get the pixels [i0, i1) of a row starting at p whose positions are
+  // inside the volume, between -0.5 and size - 0.5 along each axis.
+  // Returns false if no pixel is inside.
+  bool clipRow( const Reslice &r, const Vec3d &p,
+                unsigned int &i0, unsigned int &i1 ) {
+    double t0 = 0, t1 = r.width - 1;
+    for( unsigned int a = 0; a < 3; ++a ) {
+      double lo = -0.5, hi = r.size[a] - 0.5;
+      double d = r.step_x[a];
+      if( H3DAbs( d ) < 1e-12 ) {
+        if( p[a] < lo || p[a] > hi ) return false;
+      } else {
+        double ta = ( lo - p[a] ) / d, tb = ( hi - p[a] ) / d;
+        if( ta > tb ) std::swap( ta, tb );
+        if( ta > t0 ) t0 = ta;
+        if( tb < t1 ) t1 = tb;
+      }
+    }
+    if( t0 > t1 ) return false;
+    i0 = (unsigned int) H3DCeil( t0 );
+    i1 = (unsigned int) H3DFloor( t1 ) + 1;
+    return i0 < i1;
+  }
+
+  // Stepping of a position along a row in fixed point. The offset is
+  // added to the positions, 1 when getting cells and 1.5 when getting the
+  // nearest voxel.
+  struct RowStepper {
+    RowStepper( const Reslice &r, const Vec3d &p, unsigned int i0,
+                double offset ) {
+      for( unsigned int a = 0; a < 3; ++a ) {
+        q[a] = toFixed( p[a] + i0 * r.step_x[a] + offset );
+        dq[a] = toFixed( r.step_x[a] );
+        size[a] = r.size[a];
+      }
+    }
+
+    inline void step() {
+      q[0] += dq[0];
+      q[1] += dq[1];
+      q[2] += dq[2];
+    }
+
+    // Get the voxels of the cell around the position, clamped to the
+    // volume, and the position inside the cell.
+    template< class A >
+    inline void cell( int *v0, int *v1, A *f ) {
+      for( unsigned int a = 0; a < 3; ++a ) {
+        int i = (int)( q[a] >> FIXED_BITS ) - 1;
+        f[a] = (A)( q[a] & FIXED_MASK ) * ( (A) 1 / FIXED_ONE );
+        v0[a] = i < 0 ? 0 : ( i < size[a] ? i : size[a] - 1 );
+        v1[a] = i + 1 < size[a] ? i + 1 : size[a] - 1;
+        if( i < 0 ) f[a] = 0;
+      }
+    }
+
+    // Get the nearest voxel, for a stepper started with offset 1.5.
+    inline void nearest( int *v ) {
+      for( unsigned int a = 0; a < 3; ++a ) {
+        int i = (int)( q[a] >> FIXED_BITS ) - 1;
+        v[a] = i < 0 ? 0 : ( i < size[a] ? i : size[a] - 1 );
+      }
+    }
+
+    H3DInt64 q[3], dq[3];
+    int size[3];
+  };
+
+  // Copy the nearest voxel of each pixel of the rows [begin, end).
+  void nearestRows( unsigned int begin, unsigned int end, void *data ) {
+    Reslice &r = *static_cast< Reslice * >( data );
+    unsigned int bpp = r.bytes_per_pixel;
+    for( unsigned int j = begin; j < end; ++j ) {
+      unsigned char *out = r.dst + j * r.dst_row_stride;
+      memset( out, 0, (size_t) r.width * bpp );
+      Vec3d p = r.origin + r.step_y * (double) j;
+      unsigned int i0, i1;
+      if( !clipRow( r, p, i0, i1 ) ) continue;
+      RowStepper s( r, p, i0, 1.5 );
+      for( unsigned int i = i0; i < i1; ++i, s.step() ) {
+        int v[3];
+        s.nearest( v );
+        if( r.src ) {
+          memcpy( out + i * bpp,
+                  r.src + v[2] * r.stride[2] + v[1] * r.stride[1] +
+                  v[0] * r.stride[0], bpp );
+        } else {
+          r.image->getElement( out + i * bpp, v[0], v[1], v[2] );
+        }
+      }
+    }
+  }
+
+  // Interpolate the pixels of the rows [begin, end) from a volume with
+  // components of type T in memory.
+  template< class T >
+  void linearRows( unsigned int begin, unsigned int end, void *data ) {
+    typedef typename Accumulator< T >::Type A;
+    Reslice &r = *static_cast< Reslice * >( data );
+    unsigned int nr_components = r.bytes_per_pixel / sizeof( T );
+    std::vector< A > acc( r.width * nr_components );
+    std::vector< unsigned int > count( r.width );
+
+    for( unsigned int j = begin; j < end; ++j ) {
+      std::fill( count.begin(), count.end(), 0 );
+      Vec3d row = r.origin + r.step_y * (double) j;
+      for( unsigned int k = 0; k < r.slab_offsets.size(); ++k ) {
+        Vec3d p = row + r.step_z * r.slab_offsets[k];
+        unsigned int i0, i1;
+        if( !clipRow( r, p, i0, i1 ) ) continue;
+        RowStepper s( r, p, i0, 1.0 );
+        for( unsigned int i = i0; i < i1; ++i, s.step() ) {
+          int v0[3], v1[3];
+          A f[3];
+          s.cell( v0, v1, f );
+          size_t x0 = v0[0] * r.stride[0], x1 = v1[0] * r.stride[0];
+          const unsigned char *p00 =
+            r.src + v0[2] * r.stride[2] + v0[1] * r.stride[1];
+          const unsigned char *p01 =
+            r.src + v0[2] * r.stride[2] + v1[1] * r.stride[1];
+          const unsigned char *p10 =
+            r.src + v1[2] * r.stride[2] + v0[1] * r.stride[1];
+          const unsigned char *p11 =
+            r.src + v1[2] * r.stride[2] + v1[1] * r.stride[1];
+          A *a = &acc[ i * nr_components ];
+          for( unsigned int c = 0; c < nr_components; ++c ) {
+            const T *c000 = (const T *)( p00 + x0 ) + c;
+            const T *c100 = (const T *)( p00 + x1 ) + c;
+            const T *c010 = (const T *)( p01 + x0 ) + c;
+            const T *c110 = (const T *)( p01 + x1 ) + c;
+            const T *c001 = (const T *)( p10 + x0 ) + c;
+            const T *c101 = (const T *)( p10 + x1 ) + c;
+            const T *c011 = (const T *)( p11 + x0 ) + c;
+            const T *c111 = (const T *)( p11 + x1 ) + c;
+            A y0 = ( *c000 + ( *c100 - (A) *c000 ) * f[0] ) * ( 1 - f[1] ) +
+              ( *c010 + ( *c110 - (A) *c010 ) * f[0] ) * f[1];
+            A y1 = ( *c001 + ( *c101 - (A) *c001 ) * f[0] ) * ( 1 - f[1] ) +
+              ( *c011 + ( *c111 - (A) *c011 ) * f[0] ) * f[1];
+            A value = y0 + ( y1 - y0 ) * f[2];
+            if( count[i] == 0 ) a[c] = value;
+            else if( r.mode == RESLICE_MIP ) {
+              if( value > a[c] ) a[c] = value;
+            } else a[c] += value;
+          }
+          ++count[i];
+        }
+      }
+
+      T *out = (T *)( r.dst + j * r.dst_row_stride );
+      for( unsigned int i = 0; i < r.width; ++i ) {
+        A *a = &acc[ i * nr_components ];
+        for( unsigned int c = 0; c < nr_components; ++c, ++out ) {
+          if( count[i] == 0 ) *out = 0;
+          else if( r.mode == RESLICE_AVERAGE )
+            *out = fromAccumulator< T, A >( a[c] / count[i] );
+          else *out = fromAccumulator< T, A >( a[c] );
+        }
+      }
+    }
+  }
+
+  // Interpolate the pixels of the rows [begin, end) with getPixel, for
+  // volumes without their data in memory or with other component types.
+  void linearPixelRows( unsigned int begin, unsigned int end, void *data ) {
+    Reslice &r = *static_cast< Reslice * >( data );
+    std::vector< RGBA > acc( r.width );
+    std::vector< unsigned int > count( r.width );
+
+    for( unsigned int j = begin; j < end; ++j ) {
+      std::fill( count.begin(), count.end(), 0 );
+      Vec3d row = r.origin + r.step_y * (double) j;
+      for( unsigned int k = 0; k < r.slab_offsets.size(); ++k ) {
+        Vec3d p = row + r.step_z * r.slab_offsets[k];
+        unsigned int i0, i1;
+        if( !clipRow( r, p, i0, i1 ) ) continue;
+        RowStepper s( r, p, i0, 1.0 );
+        for( unsigned int i = i0; i < i1; ++i, s.step() ) {
+          int v0[3], v1[3];
+          H3DFloat f[3];
+          s.cell( v0, v1, f );
+          RGBA y0 =
+            ( r.image->getPixel( v0[0], v0[1], v0[2] ) * ( 1 - f[0] ) +
+              r.image->getPixel( v1[0], v0[1], v0[2] ) * f[0] ) *
+            ( 1 - f[1] ) +
+            ( r.image->getPixel( v0[0], v1[1], v0[2] ) * ( 1 - f[0] ) +
+              r.image->getPixel( v1[0], v1[1], v0[2] ) * f[0] ) * f[1];
+          RGBA y1 =
+            ( r.image->getPixel( v0[0], v0[1], v1[2] ) * ( 1 - f[0] ) +
+              r.image->getPixel( v1[0], v0[1], v1[2] ) * f[0] ) *
+            ( 1 - f[1] ) +
+            ( r.image->getPixel( v0[0], v1[1], v1[2] ) * ( 1 - f[0] ) +
+              r.image->getPixel( v1[0], v1[1], v1[2] ) * f[0] ) * f[1];
+          RGBA value = y0 * ( 1 - f[2] ) + y1 * f[2];
+          RGBA &a = acc[i];
+          if( count[i] == 0 ) a = value;
+          else if( r.mode == RESLICE_MIP ) {
+            a = RGBA( H3DMax( a.r, value.r ), H3DMax( a.g, value.g ),
+                      H3DMax( a.b, value.b ), H3DMax( a.a, value.a ) );
+          } else a = a + value;
+          ++count[i];
+        }
+      }
+
+      unsigned char *out = r.dst + j * r.dst_row_stride;
+      for( unsigned int i = 0; i < r.width; ++i, out += r.bytes_per_pixel ) {
+        if( count[i] == 0 ) {
+          memset( out, 0, r.bytes_per_pixel );
+        } else if( r.mode == RESLICE_AVERAGE ) {
+          r.output->RGBAToImageValue( acc[i] * ( 1.0f / count[i] ), out );
+        } else {
+          r.output->RGBAToImageValue( acc[i], out );
+        }
+      }
+    }
+  }
+
+  // Returns the function interpolating rows of the image with its data in
+  // memory, or NULL if the component type is not supported.
+  ParallelForFunc linearRowsFunc( Image *image ) {
+    unsigned int nr_components = image->nrPixelComponents();
+    if( image->bitsPerPixel() % ( 8 * nr_components ) != 0 ) return NULL;
+    unsigned int bytes_per_component =
+      image->bitsPerPixel() / ( 8 * nr_components );
+    switch( image->pixelComponentType() ) {
+    case Image::UNSIGNED:
+      if( bytes_per_component == 1 ) return &linearRows< unsigned char >;
+      if( bytes_per_component == 2 ) return &linearRows< unsigned short >;
+      if( bytes_per_component == 4 ) return &linearRows< unsigned int >;
+      break;
+    case Image::SIGNED:
+      if( bytes_per_component == 1 ) return &linearRows< signed char >;
+      if( bytes_per_component == 2 ) return &linearRows< short >;
+      if( bytes_per_component == 4 ) return &linearRows< int >;
+      break;
+    case Image::RATIONAL:
+    case Image::RATIONAL_UNSIGNED:
+      if( bytes_per_component == 4 ) return &linearRows< float >;
+      if( bytes_per_component == 8 ) return &linearRows< double >;
+      break;
+    default:
+      break;
+    }
+    return NULL;
+  }
+
+  // Convert physical coordinates of the image to voxel coordinates. A
+  // pixel size of 0 along an axis is used as 1.
+  inline Vec3d toVoxel( const Vec3f &p, const Vec3f &pixel_size ) {
+    Vec3d v( p.x, p.y, p.z );
+    for( unsigned int a = 0; a < 3; ++a ) {
+      if( pixel_size[a] > 0 ) v[a] /= pixel_size[a];
+    }
+    return v;
+  }
+}
+
+using namespace ImageResliceInternals;
+
+Image *H3DUtil::resliceImage( Image *image,
+                              const Matrix4f &plane_transform,
+                              unsigned int width,
+                              unsigned int height,
+                              const Vec2f &spacing,
+                              ResliceMode mode,
+                              H3DFloat slab_thickness,
+                              unsigned int nr_threads ) {
+  if( image->compressionType() != Image::NO_COMPRESSION ||
+      image->bitsPerPixel() % 8 != 0 ) {
+    Console(LogLevel::Error) << "Error: resliceImage only supports "
+                             << "uncompressed images with whole bytes per "
+                             << "pixel." << std::endl;
+    return NULL;
+  }
+  unsigned int bytes_per_pixel = image->bitsPerPixel() / 8;
+  unsigned char *data =
+    new unsigned char[ (size_t) width * height * bytes_per_pixel ];
+  PixelImage *output =
+    new PixelImage( width, height, 1,
+                    image->bitsPerPixel(),
+                    image->pixelType(),
+                    image->pixelComponentType(),
+                    data, false,
+                    Vec3f( spacing.x, spacing.y, slab_thickness ) );
+  resliceImage( image, plane_transform, output, spacing, mode,
+                slab_thickness, nr_threads );
+  return output;
+}
+
+bool H3DUtil::resliceImage( Image *image,
+                            const Matrix4f &plane_transform,
+                            Image *output,
+                            const Vec2f &spacing,
+                            ResliceMode mode,
+                            H3DFloat slab_thickness,
+                            unsigned int nr_threads ) {
+  if( image->compressionType() != Image::NO_COMPRESSION ||
+      image->bitsPerPixel() % 8 != 0 ) {
+    Console(LogLevel::Error) << "Error: resliceImage only supports "
+                             << "uncompressed images with whole bytes per "
+                             << "pixel." << std::endl;
+    return false;
+  }
+  if( !output->getImageData() ||
+      output->compressionType() != Image::NO_COMPRESSION ||
+      output->bitsPerPixel() != image->bitsPerPixel() ||
+      output->pixelType() != image->pixelType() ||
+      output->pixelComponentType() != image->pixelComponentType() ) {
+    Console(LogLevel::Error) << "Error: resliceImage needs an output image "
+                             << "with its data in memory and the same pixel "
+                             << "format as the volume." << std::endl;
+    return false;
+  }
+
+  Reslice r;
+  r.image = image;
+  r.output = output;
+  r.mode = mode;
+  r.size[0] = image->width();
+  r.size[1] = image->height();
+  r.size[2] = image->depth();
+  r.src = (const unsigned char *) image->getImageData();
+  r.bytes_per_pixel = image->bitsPerPixel() / 8;
+  r.stride[0] = r.bytes_per_pixel;
+  r.stride[1] = image->rowStride();
+  r.stride[2] = image->sliceStride();
+  r.dst = (unsigned char *) output->getImageData();
+  r.dst_row_stride = output->rowStride();
+  r.width = output->width();
+  r.height = output->height();
+  if( r.width == 0 || r.height == 0 ) return true;
+
+  // the voxel coordinates of pixel (0, 0) and of the steps along the
+  // axes of the plane.
+  Vec3f pixel_size = image->pixelSize();
+  Vec3f corner( ( 1 - (H3DFloat) r.width ) * 0.5f * spacing.x,
+                ( 1 - (H3DFloat) r.height ) * 0.5f * spacing.y, 0 );
+  r.origin = toVoxel( plane_transform * corner, pixel_size );
+  r.step_x = toVoxel( plane_transform * ( corner + Vec3f( spacing.x, 0, 0 ) ),
+                      pixel_size ) - r.origin;
+  r.step_y = toVoxel( plane_transform * ( corner + Vec3f( 0, spacing.y, 0 ) ),
+                      pixel_size ) - r.origin;
+  r.step_z = toVoxel( plane_transform * ( corner + Vec3f( 0, 0, 1 ) ),
+                      pixel_size ) - r.origin;
+
+  // sample the slab about once per voxel along the normal.
+  r.slab_offsets.push_back( 0 );
+  if( ( mode == RESLICE_MIP || mode == RESLICE_AVERAGE ) &&
+      slab_thickness > 0 ) {
+    unsigned int n =
+      (unsigned int) H3DCeil( slab_thickness * r.step_z.length() ) + 1;
+    r.slab_offsets.resize( n );
+    for( unsigned int k = 0; k < n; ++k ) {
+      r.slab_offsets[k] = slab_thickness * ( (double) k / ( n - 1 ) - 0.5 );
+    }
+  }
+
+  ParallelForFunc func = NULL;
+  if( mode == RESLICE_NEAREST ) func = &nearestRows;
+  else if( r.src ) func = linearRowsFunc( image );
+  if( !func ) func = &linearPixelRows;
+  parallelFor( 0, r.height, func, &r, 4, nr_threads );
+  return true;
+}
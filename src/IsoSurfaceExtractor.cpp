@@ -0,0 +1,683 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file IsoSurfaceExtractor.cpp
+/// \brief CPP file for IsoSurfaceExtractor.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/IsoSurfaceExtractor.h>
+#include <H3DUtil/Threads.h>
+
+#include <algorithm>
+
+using namespace H3DUtil;
+
+namespace IsoSurfaceExtractorInternals {
+  // The corners of each edge of a cell, with the lower corner first.
+  // Corner c is at ( c & 1, ( c >> 1 ) & 1, ( c >> 2 ) & 1 ) in the cell.
+  // Edges 0-3 are along x, 4-7 along y and 8-11 along z.
+  const unsigned int edge_corners[12][2] = {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+    { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+  };
+
+  // The triangles for each combination of corners inside the surface,
+  // where bit c of the index is set if corner c is inside. Each triangle
+  // is three edges and the list ends with -1. The table is built by
+  // following the contour of the surface around the faces of the cell,
+  // where the inside corners of an ambiguous face are always separated,
+  // so that neighbouring cells agree on their shared faces.
+  const signed char triangle_table[256][16] = {
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 5, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 5, 4, 8, 9, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 5, 1, 8, 9, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 11, 1, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 11, 0, 9, 11, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 4, 8, 11, 1, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 11, 10, 8, 5, 11, 8, 0, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 9, 11, 4, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 11, 10, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 2, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 2, 8, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 5, 4, 6, 9, 5, 6, 2, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 2, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 0, 1, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 2, 8, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 5, 1, 6, 9, 5, 6, 2, 9, -1, -1, -1, -1 },
+    { 6, 2, 8, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 2, 0, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 2, 8, 11, 0, 9, 11, 1, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 4, 6, 11, 1, 6, 9, 11, 6, 2, 9, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 5, 11, 6, 2, 8, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 11, 10, 6, 5, 11, 6, 0, 5, 6, 2, 0, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 9, 11, 4, 0, 9, 6, 2, 8, -1, -1, -1, -1 },
+    { 6, 11, 10, 6, 9, 11, 6, 2, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 5, 2, 7, 5, 0, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 5, 4, 8, 7, 5, 8, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 0, 1, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 5, 2, 7, 5, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 5, 1, 8, 7, 5, 8, 2, 7, -1, -1, -1, -1 },
+    { 11, 1, 5, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 11, 1, 5, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 11, 2, 7, 11, 0, 2, 11, 1, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 4, 8, 11, 1, 8, 7, 11, 8, 2, 7, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 5, 11, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 11, 10, 8, 5, 11, 8, 0, 5, 9, 2, 7, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 7, 11, 4, 2, 7, 4, 0, 2, -1, -1, -1, -1 },
+    { 8, 11, 10, 8, 7, 11, 8, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 9, 8, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 9, 0, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 8, 6, 5, 0, 6, 7, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 5, 4, 6, 7, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 9, 8, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 0, 1, 6, 9, 0, 6, 7, 9, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 0, 8, 6, 5, 0, 6, 7, 5, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 5, 1, 6, 7, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 9, 8, 6, 7, 9, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 9, 0, 6, 7, 9, 11, 1, 5, -1, -1, -1, -1 },
+    { 6, 0, 8, 6, 1, 0, 6, 11, 1, 6, 7, 11, -1, -1, -1, -1 },
+    { 6, 1, 4, 6, 11, 1, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 11, 10, 4, 5, 11, 6, 9, 8, 6, 7, 9, -1, -1, -1, -1 },
+    { 6, 11, 10, 6, 5, 11, 6, 0, 5, 6, 9, 0, 6, 7, 9, -1 },
+    { 4, 11, 10, 4, 7, 11, 4, 6, 7, 4, 8, 6, 4, 0, 8, -1 },
+    { 6, 11, 10, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 0, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 5, 4, 8, 9, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 1, 3, 8, 0, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 1, 3, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 1, 3, 8, 5, 1, 8, 9, 5, -1, -1, -1, -1 },
+    { 10, 3, 6, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 0, 4, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 11, 0, 9, 11, 1, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 1, 4, 8, 11, 1, 8, 9, 11, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 11, 3, 4, 5, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 11, 3, 8, 5, 11, 8, 0, 5, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 11, 3, 4, 9, 11, 4, 0, 9, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 11, 3, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 3, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 2, 0, 10, 3, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 3, 2, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 5, 4, 10, 9, 5, 10, 2, 9, 10, 3, 2, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 3, 2, 4, 1, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 0, 3, 2, 0, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 3, 2, 4, 1, 3, 5, 0, 9, -1, -1, -1, -1 },
+    { 5, 2, 9, 5, 3, 2, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 3, 2, 11, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 2, 0, 10, 3, 2, 11, 1, 5, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 3, 2, 11, 0, 9, 11, 1, 0, -1, -1, -1, -1 },
+    { 10, 1, 4, 10, 11, 1, 10, 9, 11, 10, 2, 9, 10, 3, 2, -1 },
+    { 4, 2, 8, 4, 3, 2, 4, 11, 3, 4, 5, 11, -1, -1, -1, -1 },
+    { 11, 0, 5, 11, 2, 0, 11, 3, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 3, 2, 4, 11, 3, 4, 9, 11, 4, 0, 9, -1 },
+    { 11, 2, 9, 11, 3, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 0, 4, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 5, 2, 7, 5, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 5, 4, 8, 7, 5, 8, 2, 7, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 1, 3, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 1, 3, 8, 0, 1, 9, 2, 7, -1, -1, -1, -1 },
+    { 4, 3, 6, 4, 1, 3, 5, 2, 7, 5, 0, 2, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 1, 3, 8, 5, 1, 8, 7, 5, 8, 2, 7, -1 },
+    { 10, 3, 6, 11, 1, 5, 9, 2, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 0, 4, 11, 1, 5, 9, 2, 7, -1, -1, -1, -1 },
+    { 10, 3, 6, 11, 2, 7, 11, 0, 2, 11, 1, 0, -1, -1, -1, -1 },
+    { 10, 3, 6, 8, 1, 4, 8, 11, 1, 8, 7, 11, 8, 2, 7, -1 },
+    { 4, 3, 6, 4, 11, 3, 4, 5, 11, 9, 2, 7, -1, -1, -1, -1 },
+    { 8, 3, 6, 8, 11, 3, 8, 5, 11, 8, 0, 5, 9, 2, 7, -1 },
+    { 4, 3, 6, 4, 11, 3, 4, 7, 11, 4, 2, 7, 4, 0, 2, -1 },
+    { 8, 3, 6, 8, 11, 3, 8, 7, 11, 8, 2, 7, -1, -1, -1, -1 },
+    { 10, 9, 8, 10, 7, 9, 10, 3, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 9, 0, 10, 7, 9, 10, 3, 7, -1, -1, -1, -1 },
+    { 10, 0, 8, 10, 5, 0, 10, 7, 5, 10, 3, 7, -1, -1, -1, -1 },
+    { 10, 5, 4, 10, 7, 5, 10, 3, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 9, 8, 4, 7, 9, 4, 3, 7, 4, 1, 3, -1, -1, -1, -1 },
+    { 9, 3, 7, 9, 1, 3, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 0, 8, 4, 5, 0, 4, 7, 5, 4, 3, 7, 4, 1, 3, -1 },
+    { 5, 3, 7, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 9, 8, 10, 7, 9, 10, 3, 7, 11, 1, 5, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 9, 0, 10, 7, 9, 10, 3, 7, 11, 1, 5, -1 },
+    { 10, 0, 8, 10, 1, 0, 10, 11, 1, 10, 7, 11, 10, 3, 7, -1 },
+    { 10, 1, 4, 10, 11, 1, 10, 7, 11, 10, 3, 7, -1, -1, -1, -1 },
+    { 4, 9, 8, 4, 7, 9, 4, 3, 7, 4, 11, 3, 4, 5, 11, -1 },
+    { 11, 0, 5, 11, 9, 0, 11, 7, 9, 11, 3, 7, -1, -1, -1, -1 },
+    { 4, 0, 8, 11, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 11, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 7, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 7, 3, 11, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 5, 4, 8, 9, 5, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 0, 1, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 7, 3, 11, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 5, 1, 8, 9, 5, 7, 3, 11, -1, -1, -1, -1 },
+    { 7, 1, 5, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 7, 1, 5, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 7, 0, 9, 7, 1, 0, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 4, 8, 3, 1, 8, 7, 3, 8, 9, 7, -1, -1, -1, -1 },
+    { 4, 3, 10, 4, 7, 3, 4, 5, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 10, 8, 7, 3, 8, 5, 7, 8, 0, 5, -1, -1, -1, -1 },
+    { 4, 3, 10, 4, 7, 3, 4, 9, 7, 4, 0, 9, -1, -1, -1, -1 },
+    { 8, 3, 10, 8, 7, 3, 8, 9, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 2, 8, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 2, 0, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 2, 8, 7, 3, 11, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 5, 4, 6, 9, 5, 6, 2, 9, 7, 3, 11, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 2, 8, 7, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 0, 1, 6, 2, 0, 7, 3, 11, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 2, 8, 7, 3, 11, 5, 0, 9, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 5, 1, 6, 9, 5, 6, 2, 9, 7, 3, 11, -1 },
+    { 6, 2, 8, 7, 1, 5, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 2, 0, 7, 1, 5, 7, 3, 1, -1, -1, -1, -1 },
+    { 6, 2, 8, 7, 0, 9, 7, 1, 0, 7, 3, 1, -1, -1, -1, -1 },
+    { 6, 1, 4, 6, 3, 1, 6, 7, 3, 6, 9, 7, 6, 2, 9, -1 },
+    { 4, 3, 10, 4, 7, 3, 4, 5, 7, 6, 2, 8, -1, -1, -1, -1 },
+    { 6, 3, 10, 6, 7, 3, 6, 5, 7, 6, 0, 5, 6, 2, 0, -1 },
+    { 4, 3, 10, 4, 7, 3, 4, 9, 7, 4, 0, 9, 6, 2, 8, -1 },
+    { 6, 3, 10, 6, 7, 3, 6, 9, 7, 6, 2, 9, -1, -1, -1, -1 },
+    { 9, 3, 11, 9, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 9, 3, 11, 9, 2, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 5, 3, 11, 5, 2, 3, 5, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 5, 4, 8, 11, 5, 8, 3, 11, 8, 2, 3, -1, -1, -1, -1 },
+    { 4, 1, 10, 9, 3, 11, 9, 2, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 0, 1, 9, 3, 11, 9, 2, 3, -1, -1, -1, -1 },
+    { 4, 1, 10, 5, 3, 11, 5, 2, 3, 5, 0, 2, -1, -1, -1, -1 },
+    { 8, 1, 10, 8, 5, 1, 8, 11, 5, 8, 3, 11, 8, 2, 3, -1 },
+    { 9, 1, 5, 9, 3, 1, 9, 2, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 0, 4, 9, 1, 5, 9, 3, 1, 9, 2, 3, -1, -1, -1, -1 },
+    { 2, 1, 0, 2, 3, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 1, 4, 8, 3, 1, 8, 2, 3, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 3, 10, 4, 2, 3, 4, 9, 2, 4, 5, 9, -1, -1, -1, -1 },
+    { 8, 3, 10, 8, 2, 3, 8, 9, 2, 8, 5, 9, 8, 0, 5, -1 },
+    { 4, 3, 10, 4, 2, 3, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 3, 10, 8, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 9, 8, 6, 11, 9, 6, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 9, 0, 6, 11, 9, 6, 3, 11, -1, -1, -1, -1 },
+    { 6, 0, 8, 6, 5, 0, 6, 11, 5, 6, 3, 11, -1, -1, -1, -1 },
+    { 6, 5, 4, 6, 11, 5, 6, 3, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 1, 10, 6, 9, 8, 6, 11, 9, 6, 3, 11, -1, -1, -1, -1 },
+    { 6, 1, 10, 6, 0, 1, 6, 9, 0, 6, 11, 9, 6, 3, 11, -1 },
+    { 4, 1, 10, 6, 0, 8, 6, 5, 0, 6, 11, 5, 6, 3, 11, -1 },
+    { 6, 1, 10, 6, 5, 1, 6, 11, 5, 6, 3, 11, -1, -1, -1, -1 },
+    { 6, 9, 8, 6, 5, 9, 6, 1, 5, 6, 3, 1, -1, -1, -1, -1 },
+    { 6, 0, 4, 6, 9, 0, 6, 5, 9, 6, 1, 5, 6, 3, 1, -1 },
+    { 6, 0, 8, 6, 1, 0, 6, 3, 1, -1, -1, -1, -1, -1, -1, -1 },
+    { 6, 1, 4, 6, 3, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 3, 10, 4, 6, 3, 4, 8, 6, 4, 9, 8, 4, 5, 9, -1 },
+    { 6, 3, 10, 9, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 3, 10, 4, 6, 3, 4, 8, 6, 4, 0, 8, -1, -1, -1, -1 },
+    { 6, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 11, 7, 8, 0, 4, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 11, 7, 5, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 11, 7, 8, 5, 4, 8, 9, 5, -1, -1, -1, -1 },
+    { 4, 7, 6, 4, 11, 7, 4, 1, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 7, 6, 8, 11, 7, 8, 1, 11, 8, 0, 1, -1, -1, -1, -1 },
+    { 4, 7, 6, 4, 11, 7, 4, 1, 11, 5, 0, 9, -1, -1, -1, -1 },
+    { 8, 7, 6, 8, 11, 7, 8, 1, 11, 8, 5, 1, 8, 9, 5, -1 },
+    { 10, 7, 6, 10, 5, 7, 10, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 5, 7, 10, 1, 5, 8, 0, 4, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 9, 7, 10, 0, 9, 10, 1, 0, -1, -1, -1, -1 },
+    { 10, 7, 6, 10, 9, 7, 10, 8, 9, 10, 4, 8, 10, 1, 4, -1 },
+    { 4, 7, 6, 4, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 7, 6, 8, 5, 7, 8, 0, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 7, 6, 4, 9, 7, 4, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 7, 6, 8, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 7, 2, 10, 11, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 2, 0, 10, 7, 2, 10, 11, 7, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 7, 2, 10, 11, 7, 5, 0, 9, -1, -1, -1, -1 },
+    { 10, 5, 4, 10, 9, 5, 10, 2, 9, 10, 7, 2, 10, 11, 7, -1 },
+    { 4, 2, 8, 4, 7, 2, 4, 11, 7, 4, 1, 11, -1, -1, -1, -1 },
+    { 7, 1, 11, 7, 0, 1, 7, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 7, 2, 4, 11, 7, 4, 1, 11, 5, 0, 9, -1 },
+    { 7, 1, 11, 7, 5, 1, 7, 9, 5, 7, 2, 9, -1, -1, -1, -1 },
+    { 10, 2, 8, 10, 7, 2, 10, 5, 7, 10, 1, 5, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 2, 0, 10, 7, 2, 10, 5, 7, 10, 1, 5, -1 },
+    { 10, 2, 8, 10, 7, 2, 10, 9, 7, 10, 0, 9, 10, 1, 0, -1 },
+    { 10, 1, 4, 7, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 7, 2, 4, 5, 7, -1, -1, -1, -1, -1, -1, -1 },
+    { 7, 0, 5, 7, 2, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 2, 8, 4, 7, 2, 4, 9, 7, 4, 0, 9, -1, -1, -1, -1 },
+    { 7, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 9, 2, 10, 11, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 9, 2, 10, 11, 9, 8, 0, 4, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 0, 2, 10, 5, 0, 10, 11, 5, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 8, 2, 10, 4, 8, 10, 5, 4, 10, 11, 5, -1 },
+    { 4, 2, 6, 4, 9, 2, 4, 11, 9, 4, 1, 11, -1, -1, -1, -1 },
+    { 8, 2, 6, 8, 9, 2, 8, 11, 9, 8, 1, 11, 8, 0, 1, -1 },
+    { 4, 2, 6, 4, 0, 2, 4, 5, 0, 4, 11, 5, 4, 1, 11, -1 },
+    { 8, 2, 6, 5, 1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 9, 2, 10, 5, 9, 10, 1, 5, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 9, 2, 10, 5, 9, 10, 1, 5, 8, 0, 4, -1 },
+    { 10, 2, 6, 10, 0, 2, 10, 1, 0, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 2, 6, 10, 8, 2, 10, 4, 8, 10, 1, 4, -1, -1, -1, -1 },
+    { 4, 2, 6, 4, 9, 2, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 2, 6, 8, 9, 2, 8, 5, 9, 8, 0, 5, -1, -1, -1, -1 },
+    { 4, 2, 6, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 8, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 9, 8, 10, 11, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 9, 0, 10, 11, 9, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 8, 10, 5, 0, 10, 11, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 5, 4, 10, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 9, 8, 4, 11, 9, 4, 1, 11, -1, -1, -1, -1, -1, -1, -1 },
+    { 9, 1, 11, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 0, 8, 4, 5, 0, 4, 11, 5, 4, 1, 11, -1, -1, -1, -1 },
+    { 5, 1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 9, 8, 10, 5, 9, 10, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 0, 4, 10, 9, 0, 10, 5, 9, 10, 1, 5, -1, -1, -1, -1 },
+    { 10, 0, 8, 10, 1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 10, 1, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 9, 8, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 9, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 4, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 }
+  };
+
+  const unsigned int NO_VERTEX = (unsigned int) -1;
+
+  // Access to the voxel values of one pixel component of an image, read
+  // with VoxelValueReader so that they agree with the MinMaxGrid.
+  struct VoxelValues {
+    VoxelValues( Image *image, unsigned int component ) :
+      reader( image, component ),
+      width( image->width() ),
+      height( image->height() ),
+      depth( image->depth() ) {}
+
+    inline H3DFloat operator()( unsigned int x,
+                                unsigned int y,
+                                unsigned int z ) const {
+      return reader( x, y, z );
+    }
+
+    // The gradient at a voxel in voxel coordinates, with central
+    // differences inside the volume and one-sided differences on the
+    // border.
+    Vec3f gradient( unsigned int x, unsigned int y, unsigned int z ) const;
+
+    VoxelValueReader reader;
+    unsigned int width, height, depth;
+  };
+
+  Vec3f VoxelValues::gradient( unsigned int x, unsigned int y,
+                               unsigned int z ) const {
+    unsigned int x0 = x > 0 ? x - 1 : x;
+    unsigned int x1 = x + 1 < width ? x + 1 : x;
+    unsigned int y0 = y > 0 ? y - 1 : y;
+    unsigned int y1 = y + 1 < height ? y + 1 : y;
+    unsigned int z0 = z > 0 ? z - 1 : z;
+    unsigned int z1 = z + 1 < depth ? z + 1 : z;
+    Vec3f g;
+    g.x = x1 > x0 ?
+      ( (*this)( x1, y, z ) - (*this)( x0, y, z ) ) / ( x1 - x0 ) : 0;
+    g.y = y1 > y0 ?
+      ( (*this)( x, y1, z ) - (*this)( x, y0, z ) ) / ( y1 - y0 ) : 0;
+    g.z = z1 > z0 ?
+      ( (*this)( x, y, z1 ) - (*this)( x, y, z0 ) ) / ( z1 - z0 ) : 0;
+    return g;
+  }
+
+  // The vertices of the surface in one slab, with a cache of the vertex
+  // on each edge of the slab's cells. Each edge belongs to the block of
+  // the MinMaxGrid containing its lower end in the xy-plane, which may
+  // contain the surface if the edge crosses it, so the caches are only
+  // kept for the blocks that may contain the surface.
+  struct SlabVertices {
+    SlabVertices( const VoxelValues &_values,
+                  H3DFloat _iso_value,
+                  const Vec3f &_voxel_size,
+                  unsigned int _block_size,
+                  unsigned int _first_slice,
+                  unsigned int _last_slice,
+                  std::vector< Vec3f > &_vertices,
+                  std::vector< Vec3f > &_normals,
+                  std::vector< std::pair< size_t, unsigned int > > &_first,
+                  std::vector< std::pair< size_t, unsigned int > > &_last ) :
+      values( _values ),
+      iso_value( _iso_value ),
+      voxel_size( _voxel_size ),
+      block_size( _block_size ),
+      block_area( _block_size * _block_size ),
+      first_slice( _first_slice ),
+      last_slice( _last_slice ),
+      slice( _first_slice ),
+      vertices( _vertices ),
+      normals( _normals ),
+      first( _first ),
+      last( _last ) {
+    }
+
+    // Set up the caches for the given blocks, where slots gives the
+    // index of each block in the slab among the blocks, or -1.
+    void init( const std::vector< int > &_slots, unsigned int nr_blocks_x,
+               unsigned int nr_slots ) {
+      slots = &_slots;
+      blocks_x = nr_blocks_x;
+      lower.assign( nr_slots * 2 * block_area, NO_VERTEX );
+      upper.assign( nr_slots * 2 * block_area, NO_VERTEX );
+      vertical.assign( nr_slots * block_area, NO_VERTEX );
+    }
+
+    // Start the cells between slice z and z + 1.
+    void startSlice( unsigned int z ) {
+      if( z != slice ) {
+        lower.swap( upper );
+        std::fill( upper.begin(), upper.end(), NO_VERTEX );
+      }
+      std::fill( vertical.begin(), vertical.end(), NO_VERTEX );
+      slice = z;
+    }
+
+    // Returns the index of the vertex on an edge of the cell at (x, y,
+    // slice), given the values at the lower and upper end of the edge.
+    unsigned int getVertex( unsigned int x, unsigned int y, unsigned int edge,
+                            H3DFloat value_a, H3DFloat value_b ) {
+      unsigned int a = edge_corners[edge][0];
+      unsigned int ax = x + ( a & 1 );
+      unsigned int ay = y + ( ( a >> 1 ) & 1 );
+      unsigned int az = slice + ( ( a >> 2 ) & 1 );
+      unsigned int axis = edge / 4;
+
+      unsigned int *cached = NULL;
+      int slot = (*slots)[ ( ay / block_size ) * blocks_x + ax / block_size ];
+      if( slot >= 0 ) {
+        unsigned int i = ( ay % block_size ) * block_size + ax % block_size;
+        if( axis == 2 ) {
+          cached = &vertical[ slot * block_area + i ];
+        } else {
+          std::vector< unsigned int > &plane = az == slice ? lower : upper;
+          cached = &plane[ ( slot * block_area + i ) * 2 + axis ];
+        }
+        if( *cached != NO_VERTEX ) return *cached;
+      }
+
+      unsigned int bx = ax + ( axis == 0 ), by = ay + ( axis == 1 ),
+        bz = az + ( axis == 2 );
+      H3DFloat t = ( iso_value - value_a ) / ( value_b - value_a );
+      Vec3f p( (H3DFloat) ax, (H3DFloat) ay, (H3DFloat) az );
+      p[axis] += t;
+      Vec3f g = values.gradient( ax, ay, az ) * ( 1 - t ) +
+        values.gradient( bx, by, bz ) * t;
+      Vec3f n( -g.x / voxel_size.x, -g.y / voxel_size.y, -g.z / voxel_size.z );
+      n.normalizeSafe();
+
+      unsigned int index = (unsigned int) vertices.size();
+      vertices.push_back( Vec3f( p.x * voxel_size.x, p.y * voxel_size.y,
+                                 p.z * voxel_size.z ) );
+      normals.push_back( n );
+      if( cached ) *cached = index;
+      if( axis != 2 && ( az == first_slice || az == last_slice ) ) {
+        size_t key = ( (size_t) ay * values.width + ax ) * 2 + axis;
+        ( az == first_slice ? first : last ).push_back(
+          std::make_pair( key, index ) );
+      }
+      return index;
+    }
+
+    const VoxelValues &values;
+    H3DFloat iso_value;
+    Vec3f voxel_size;
+    unsigned int block_size, block_area;
+    unsigned int first_slice, last_slice, slice;
+
+    const std::vector< int > *slots;
+    unsigned int blocks_x;
+
+    // The vertices on the x and y edges of slice and slice + 1, and on the
+    // z edges between them.
+    std::vector< unsigned int > lower, upper, vertical;
+
+    std::vector< Vec3f > &vertices;
+    std::vector< Vec3f > &normals;
+    std::vector< std::pair< size_t, unsigned int > > &first, &last;
+  };
+
+  // The state of an IsoSurfaceExtractor::extract call.
+  template< class Slab >
+  struct Extraction {
+    IsoSurfaceExtractor *extractor;
+    H3DFloat iso_value;
+    std::vector< Slab > slabs;
+    Vec3f *vertices;
+    Vec3f *normals;
+    unsigned int *indices;
+    unsigned int nr_vertices;
+  };
+}
+
+using namespace IsoSurfaceExtractorInternals;
+
+IsoSurfaceExtractor::IsoSurfaceExtractor( Image *_image,
+                                          unsigned int _component,
+                                          unsigned int block_size,
+                                          unsigned int nr_threads ) :
+  image( _image ),
+  component( _component ),
+  grid( _image, block_size, _component, nr_threads ) {
+}
+
+void IsoSurfaceExtractor::extractSlab( unsigned int slab,
+                                       H3DFloat iso_value,
+                                       Slab &result ) {
+  unsigned int width = image->width();
+  unsigned int height = image->height();
+  unsigned int depth = image->depth();
+  unsigned int block_size = grid.blockSize();
+  unsigned int z0 = slab * block_size;
+  if( width < 2 || height < 2 || z0 + 1 >= depth ) return;
+  unsigned int z1 = H3DMin( z0 + block_size, depth - 1 );
+
+  // find the blocks of the slab that may contain the surface.
+  unsigned int nx, ny, nz;
+  grid.getLevelSize( 0, nx, ny, nz );
+  std::vector< int > slots( nx * ny, -1 );
+  std::vector< unsigned int > blocks;
+  for( unsigned int by = 0; by < ny; ++by ) {
+    for( unsigned int bx = 0; bx < nx; ++bx ) {
+      H3DFloat mn, mx;
+      grid.getBlockRange( 0, bx, by, slab, mn, mx );
+      if( mn < iso_value && mx >= iso_value ) {
+        slots[ by * nx + bx ] = (int) blocks.size();
+        blocks.push_back( by * nx + bx );
+      }
+    }
+  }
+  if( blocks.empty() ) return;
+
+  // images without a known pixel size use voxel coordinates.
+  Vec3f voxel_size = image->pixelSize();
+  for( unsigned int i = 0; i < 3; ++i ) {
+    if( voxel_size[i] <= 0 ) voxel_size[i] = 1;
+  }
+
+  VoxelValues values( image, component );
+  SlabVertices slab_vertices( values, iso_value, voxel_size,
+                              block_size, z0, z1,
+                              result.vertices, result.normals,
+                              result.first_slice, result.last_slice );
+  slab_vertices.init( slots, nx, (unsigned int) blocks.size() );
+
+  // the values of the two slices of the cells of a block.
+  unsigned int n = block_size + 1;
+  std::vector< H3DFloat > cell_values( 2 * n * n );
+
+  for( unsigned int z = z0; z < z1; ++z ) {
+    slab_vertices.startSlice( z );
+    for( unsigned int b = 0; b < blocks.size(); ++b ) {
+      unsigned int x0 = ( blocks[b] % nx ) * block_size;
+      unsigned int y0 = ( blocks[b] / nx ) * block_size;
+      unsigned int x1 = H3DMin( x0 + block_size, width - 1 );
+      unsigned int y1 = H3DMin( y0 + block_size, height - 1 );
+      if( x0 >= x1 || y0 >= y1 ) continue;
+
+      for( unsigned int s = 0; s < 2; ++s ) {
+        for( unsigned int y = y0; y <= y1; ++y ) {
+          H3DFloat *v = &cell_values[ ( s * n + y - y0 ) * n ];
+          for( unsigned int x = x0; x <= x1; ++x ) {
+            v[ x - x0 ] = values( x, y, z + s );
+          }
+        }
+      }
+
+      for( unsigned int y = y0; y < y1; ++y ) {
+        for( unsigned int x = x0; x < x1; ++x ) {
+          const H3DFloat *v = &cell_values[ ( y - y0 ) * n + x - x0 ];
+          H3DFloat corners[8] = {
+            v[0], v[1], v[n], v[n + 1],
+            v[n * n], v[n * n + 1], v[n * n + n], v[n * n + n + 1]
+          };
+          unsigned int cube = 0;
+          for( unsigned int c = 0; c < 8; ++c ) {
+            if( corners[c] >= iso_value ) cube |= 1 << c;
+          }
+          const signed char *edges = triangle_table[cube];
+          for( unsigned int i = 0; edges[i] >= 0; ++i ) {
+            unsigned int e = (unsigned int) edges[i];
+            result.indices.push_back(
+              slab_vertices.getVertex( x, y, e,
+                                       corners[ edge_corners[e][0] ],
+                                       corners[ edge_corners[e][1] ] ) );
+          }
+        }
+      }
+    }
+  }
+
+  std::sort( result.first_slice.begin(), result.first_slice.end() );
+  std::sort( result.last_slice.begin(), result.last_slice.end() );
+}
+
+void IsoSurfaceExtractor::extractSlabs( unsigned int begin,
+                                        unsigned int end,
+                                        void *data ) {
+  Extraction< Slab > *extraction = static_cast< Extraction< Slab > * >( data );
+  for( unsigned int s = begin; s < end; ++s ) {
+    extraction->extractor->extractSlab( s, extraction->iso_value,
+                                        extraction->slabs[s] );
+  }
+}
+
+void IsoSurfaceExtractor::copySlabs( unsigned int begin,
+                                     unsigned int end,
+                                     void *data ) {
+  Extraction< Slab > *extraction = static_cast< Extraction< Slab > * >( data );
+  for( unsigned int s = begin; s < end; ++s ) {
+    Slab &slab = extraction->slabs[s];
+    // vertices welded to the next slab have indices past this slab.
+    unsigned int next_vertex = s + 1 < extraction->slabs.size() ?
+      extraction->slabs[ s + 1 ].first_vertex : extraction->nr_vertices;
+    for( unsigned int i = 0; i < slab.vertices.size(); ++i ) {
+      unsigned int g = slab.global_index[i];
+      if( g < next_vertex ) {
+        extraction->vertices[g] = slab.vertices[i];
+        extraction->normals[g] = slab.normals[i];
+      }
+    }
+    unsigned int *indices = extraction->indices + slab.first_index;
+    for( size_t i = 0; i < slab.indices.size(); ++i ) {
+      indices[i] = slab.global_index[ slab.indices[i] ];
+    }
+  }
+}
+
+void IsoSurfaceExtractor::extract( H3DFloat iso_value,
+                                   std::vector< Vec3f > &vertices,
+                                   std::vector< Vec3f > &normals,
+                                   std::vector< unsigned int > &indices,
+                                   unsigned int nr_threads ) {
+  unsigned int nx, ny, nz;
+  grid.getLevelSize( 0, nx, ny, nz );
+
+  Extraction< Slab > extraction;
+  extraction.extractor = this;
+  extraction.iso_value = iso_value;
+  extraction.slabs.resize( nz );
+  parallelFor( 0, nz, extractSlabs, &extraction, 1, nr_threads );
+
+  // weld the vertices on the last slice of each slab to the same vertices
+  // on the first slice of the next slab. global_index is first set to the
+  // index in the next slab for welded vertices.
+  std::vector< Slab > &slabs = extraction.slabs;
+  unsigned int nr_vertices = 0;
+  size_t nr_indices = 0;
+  for( unsigned int s = 0; s < nz; ++s ) {
+    Slab &slab = slabs[s];
+    slab.global_index.assign( slab.vertices.size(), NO_VERTEX );
+    unsigned int nr_welded = 0;
+    if( s + 1 < nz ) {
+      std::vector< std::pair< size_t, unsigned int > > &next =
+        slabs[ s + 1 ].first_slice;
+      size_t j = 0;
+      for( size_t i = 0; i < slab.last_slice.size(); ++i ) {
+        while( j < next.size() && next[j].first < slab.last_slice[i].first )
+          ++j;
+        if( j < next.size() && next[j].first == slab.last_slice[i].first ) {
+          slab.global_index[ slab.last_slice[i].second ] = next[j].second;
+          ++nr_welded;
+        }
+      }
+    }
+    slab.first_vertex = nr_vertices;
+    slab.first_index = nr_indices;
+    nr_vertices += (unsigned int) slab.vertices.size() - nr_welded;
+    nr_indices += slab.indices.size();
+  }
+
+  for( unsigned int s = nz; s-- > 0; ) {
+    Slab &slab = slabs[s];
+    unsigned int g = slab.first_vertex;
+    for( unsigned int i = 0; i < slab.global_index.size(); ++i ) {
+      if( slab.global_index[i] == NO_VERTEX ) {
+        slab.global_index[i] = g++;
+      } else {
+        slab.global_index[i] =
+          slabs[ s + 1 ].global_index[ slab.global_index[i] ];
+      }
+    }
+  }
+
+  vertices.resize( nr_vertices );
+  normals.resize( nr_vertices );
+  indices.resize( nr_indices );
+  if( nr_indices == 0 ) return;
+  extraction.vertices = &vertices[0];
+  extraction.normals = &normals[0];
+  extraction.indices = &indices[0];
+  extraction.nr_vertices = nr_vertices;
+  parallelFor( 0, nz, copySlabs, &extraction, 1, nr_threads );
+}
@@ -0,0 +1,184 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file LazyImage.cpp
+/// \brief CPP file for LazyImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/LazyImage.h>
+#include <H3DUtil/Console.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace LazyImageInternals {
+  // Atomic access to LazyImage::loaded, which is read without a lock.
+#ifdef _MSC_VER
+  inline long atomicLoad( volatile long *value ) {
+    return InterlockedCompareExchange( value, 0, 0 );
+  }
+
+  inline void atomicStore( volatile long *value, long new_value ) {
+    InterlockedExchange( value, new_value );
+  }
+#else
+  inline long atomicLoad( volatile long *value ) {
+    return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+  }
+
+  inline void atomicStore( volatile long *value, long new_value ) {
+    __atomic_store_n( value, new_value, __ATOMIC_RELEASE );
+  }
+#endif
+}
+
+using namespace LazyImageInternals;
+
+LazyImage::LazyImage( const std::string &_url,
+                      LoadFunction _load_function ) :
+  url( _url ),
+  load_function( _load_function ),
+  info( probeImage( _url ) ),
+  loaded( 0 ) {
+  if( info.format == ImageFileInfo::UNKNOWN_FORMAT ) {
+    // the properties are not known without loading the image.
+    if( !getLoadedImage() ) {
+      throw CouldNotLoadLazyImage( url, "Could not probe or load the image",
+                                   H3D_FULL_LOCATION );
+    }
+  }
+}
+
+LazyImage::LazyImage( const std::string &_url,
+                      const ImageFileInfo &_info,
+                      LoadFunction _load_function ) :
+  url( _url ),
+  load_function( _load_function ),
+  info( _info ),
+  loaded( 0 ) {
+}
+
+Image *LazyImage::currentImage() {
+  return isLoaded() ? image.get() : NULL;
+}
+
+bool LazyImage::isLoaded() {
+  return atomicLoad( &loaded ) != 0;
+}
+
+Image *LazyImage::getLoadedImage() {
+  // image never changes after loaded is set, so the lock is only needed
+  // while loading.
+  if( !isLoaded() ) {
+    load_lock.lock();
+    if( !isLoaded() ) {
+      Image *i = load_function ? load_function( url ) : loadImage( url );
+      if( !i ) {
+        Console(LogLevel::Error) << "Error: Could not load image \""
+                                 << url << "\"." << std::endl;
+      }
+      image.reset( i );
+      atomicStore( &loaded, 1 );
+    }
+    load_lock.unlock();
+  }
+  return image.get();
+}
+
+unsigned int LazyImage::width() {
+  Image *i = currentImage();
+  return i ? i->width() : info.width;
+}
+
+unsigned int LazyImage::height() {
+  Image *i = currentImage();
+  return i ? i->height() : info.height;
+}
+
+unsigned int LazyImage::depth() {
+  Image *i = currentImage();
+  return i ? i->depth() : info.depth;
+}
+
+unsigned int LazyImage::bitsPerPixel() {
+  Image *i = currentImage();
+  return i ? i->bitsPerPixel() : info.bits_per_pixel;
+}
+
+Image::PixelType LazyImage::pixelType() {
+  Image *i = currentImage();
+  return i ? i->pixelType() : info.pixel_type;
+}
+
+Image::PixelComponentType LazyImage::pixelComponentType() {
+  Image *i = currentImage();
+  return i ? i->pixelComponentType() : info.pixel_component_type;
+}
+
+Image::CompressionType LazyImage::compressionType() {
+  Image *i = currentImage();
+  return i ? i->compressionType() : info.compression_type;
+}
+
+Vec3f LazyImage::pixelSize() {
+  Image *i = currentImage();
+  return i ? i->pixelSize() : info.pixel_size;
+}
+
+void *LazyImage::getImageData() {
+  Image *i = getLoadedImage();
+  return i ? i->getImageData() : NULL;
+}
+
+void LazyImage::getElement( void *value, int x, int y, int z ) {
+  Image *i = getLoadedImage();
+  if( i ) {
+    i->getElement( value, x, y, z );
+  } else {
+    memset( value, 0, ( bitsPerPixel() + 7 ) / 8 );
+  }
+}
+
+void LazyImage::setElement( void *value, int x, int y, int z ) {
+  Image *i = getLoadedImage();
+  if( i ) i->setElement( value, x, y, z );
+}
+
+size_t LazyImage::rowStride() {
+  Image *i = getLoadedImage();
+  return i ? i->rowStride() : Image::rowStride();
+}
+
+size_t LazyImage::sliceStride() {
+  Image *i = getLoadedImage();
+  return i ? i->sliceStride() : Image::sliceStride();
+}
+
+int LazyImage::byteAlignment() {
+  Image *i = getLoadedImage();
+  return i ? i->byteAlignment() : Image::byteAlignment();
+}
@@ -27,6 +27,7 @@
 //
 //////////////////////////////////////////////////////////////////////////////
 #include <H3DUtil/LoadImageFunctions.h>
+#include <H3DUtil/MemoryStream.h>
 
 #ifdef HAVE_ZLIB
 #include <zlib.h>
@@ -34,7 +35,10 @@
 
 #ifdef HAVE_FREEIMAGE
 #include <H3DUtil/FreeImageImage.h>
+#include <H3DUtil/Threads.h>
 #include <FreeImage.h>
+#include <deque>
+#include <vector>
 #endif // HAVE_FREEIMAGE
 
 #ifdef HAVE_TEEM
@@ -54,6 +58,10 @@
 #include <dcmtk/dcmdata/dcmetinf.h>
 #include <dcmtk/dcmdata/dcdatset.h>
 #include <dcmtk/dcmdata/dcdeftag.h>
+#include <H3DUtil/DicomSeriesIndex.h>
+#include <H3DUtil/BatchFileReader.h>
+#include <H3DUtil/ImageGeometry.h>
+#include <H3DUtil/AutoRef.h>
 
 #ifndef WIN32 
 #include <dirent.h>
@@ -65,9 +73,14 @@
 #ifdef HAVE_OPENEXR
 #include <OpenEXR/ImfOutputFile.h>
 #include <OpenEXR/ImfInputFile.h>
+#include <OpenEXR/ImfIO.h>
+#include <OpenEXR/ImfInt64.h>
+#include <OpenEXR/Iex.h>
 #include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfMisc.h>
 #include <OpenEXR/ImfNamespace.h>
+#include <OpenEXR/ImfThreading.h>
+#include <H3DUtil/Threads.h>
 namespace IMF = OPENEXR_IMF_NAMESPACE;
 using namespace IMF;
 using namespace IMATH_NAMESPACE;
@@ -78,10 +91,76 @@ using namespace IMATH_NAMESPACE;
 #include <fstream>
 #include <memory>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 using namespace H3DUtil;
 using namespace std;
 
 #ifdef HAVE_FREEIMAGE
+// The data needed to expand the indices of a palette image to RGB(A).
+struct PaletteExpansion {
+  FIBITMAP *bitmap;
+  unsigned int width;
+  // The number of bits per index, 1, 2, 4 or 8.
+  unsigned int bits_per_index;
+  // 3 for RGB, 4 for RGBA output.
+  unsigned int bytes_per_pixel;
+  // The RGBA value of each index.
+  unsigned char lut[256][4];
+  // The output pixel data.
+  unsigned char *data;
+};
+
+// Callback for parallelFor that expands the rows begin to end of a
+// palette image through the lookup table of a PaletteExpansion.
+void expandPaletteRows( unsigned int begin, unsigned int end, void *arg ) {
+  PaletteExpansion *e = static_cast< PaletteExpansion * >( arg );
+  unsigned int width = e->width;
+  unsigned int row_size = width * e->bytes_per_pixel;
+  vector< unsigned char > indices( width );
+
+  for( unsigned int y = begin; y < end; ++y ) {
+    const BYTE *scanline = FreeImage_GetScanLine( e->bitmap, y );
+
+    // unpack the indices. FreeImage stores the first pixel in the most
+    // significant bits of each byte.
+    const unsigned char *row_indices = scanline;
+    if( e->bits_per_index < 8 ) {
+      unsigned int bits = e->bits_per_index;
+      unsigned int per_byte = 8 / bits;
+      unsigned int mask = ( 1 << bits ) - 1;
+      unsigned int x = 0;
+      for( unsigned int i = 0; x < width; ++i ) {
+        unsigned int b = scanline[i];
+        for( unsigned int j = 0; j < per_byte && x < width; ++j, ++x ) {
+          indices[x] = 
+            (unsigned char)( ( b >> ( 8 - bits * ( j + 1 ) ) ) & mask );
+        }
+      }
+      row_indices = &indices[0];
+    }
+
+    unsigned char *dst = e->data + y * row_size;
+    if( e->bytes_per_pixel == 4 ) {
+      for( unsigned int x = 0; x < width; ++x ) {
+        memcpy( dst + x * 4, e->lut[ row_indices[x] ], 4 );
+      }
+    } else if( width > 0 ) {
+      // write 4 bytes per pixel, the extra byte is overwritten by the next
+      // pixel. The last pixel is copied with 3 bytes to stay in the row.
+      for( unsigned int x = 0; x < width - 1; ++x ) {
+        memcpy( dst + x * 3, e->lut[ row_indices[x] ], 4 );
+      }
+      memcpy( dst + ( width - 1 ) * 3, e->lut[ row_indices[width - 1] ], 3 );
+    }
+  }
+}
+
 Image *loadFreeImageInternal( FIBITMAP* bm, const string& url= "" ) {
   // Take care of the case of 32 bit RGB images( alpha ignored ) that seems to
   // happen once in a while with png images
@@ -109,16 +188,43 @@ Image *loadFreeImageInternal( FIBITMAP* bm, const string& url= "" ) {
 
     // build the new pixel data
     unsigned char *data = new unsigned char[ size ];
-    for( unsigned int y = 0; y < height; ++y ) {
-      for( unsigned int x = 0; x < width; ++x ) {
-        unsigned int i = (x + y * width) * bytes_per_pixel;
-        BYTE index;
-        FreeImage_GetPixelIndex( bm, x, y, &index );
-        data[ i ] = palette[index].rgbRed;
-        data[ i + 1 ] = palette[index].rgbGreen;
-        data[ i + 2 ] = palette[index].rgbBlue;
-        if( is_transparent ) {
-          data[ i + 3 ] = transparency_table[index];
+    PaletteExpansion expansion;
+    expansion.bitmap = bm;
+    expansion.width = width;
+    expansion.bits_per_index = FreeImage_GetBPP( bm );
+    expansion.bytes_per_pixel = bytes_per_pixel;
+    expansion.data = data;
+
+    // Build the lookup table with the RGB(A) value of each index. Indices
+    // outside the palette are black and indices outside the transparency 
+    // table are opaque.
+    unsigned int nr_colors = FreeImage_GetColorsUsed( bm );
+    unsigned int nr_transparent = FreeImage_GetTransparencyCount( bm );
+    memset( expansion.lut, 0, sizeof( expansion.lut ) );
+    for( unsigned int i = 0; i < 256; ++i ) {
+      unsigned char *c = expansion.lut[i];
+      if( i < nr_colors ) {
+        c[0] = palette[i].rgbRed;
+        c[1] = palette[i].rgbGreen;
+        c[2] = palette[i].rgbBlue;
+      }
+      c[3] = i < nr_transparent ? transparency_table[i] : 255;
+    }
+
+    if( expansion.bits_per_index == 1 || expansion.bits_per_index == 2 ||
+        expansion.bits_per_index == 4 || expansion.bits_per_index == 8 ) {
+      // expand a few hundred kilobytes per task.
+      unsigned int rows_per_task = H3DMax( 1u, ( 1u << 18 ) / 
+                                           ( width * bytes_per_pixel + 1 ) );
+      parallelFor( 0, height, expandPaletteRows, &expansion, rows_per_task );
+    } else {
+      // should not happen, palettes are only used for up to 8 bits
+      for( unsigned int y = 0; y < height; ++y ) {
+        for( unsigned int x = 0; x < width; ++x ) {
+          BYTE index;
+          FreeImage_GetPixelIndex( bm, x, y, &index );
+          memcpy( data + (x + y * width) * bytes_per_pixel,
+                  expansion.lut[index], bytes_per_pixel );
         }
       }
     }
@@ -187,38 +293,354 @@ Image *H3DUtil::loadFreeImage( istream &is ) {
   return NULL;
 }
 
-bool H3DUtil::saveFreeImagePNG( const string &url,
-                                Image& image ) {
-  FIBITMAP *free_image = FreeImage_Allocate(image.width(),image.height(),image.bitsPerPixel());
-  RGBQUAD pixelcolor;
-  RGBA c;
-
-  // Transfer values from the image
-  for( unsigned int x = 0; x < image.width(); ++x ) {
-    for( unsigned y = 0; y < image.height(); ++y ) {
-      c= image.getPixel ( x, y );
-      pixelcolor.rgbRed = BYTE( c.r*255 );
-      pixelcolor.rgbGreen = BYTE( c.g*255 );
-      pixelcolor.rgbBlue = BYTE( c.b*255 );
-      pixelcolor.rgbReserved = BYTE( c.a*255 );
-      FreeImage_SetPixelColor(free_image,x,y,&pixelcolor);
+Image *H3DUtil::loadFreeImage( const void *data, size_t size ) {
+  FIMEMORY *memory =
+    FreeImage_OpenMemory( static_cast< BYTE * >( const_cast< void * >( data ) ),
+                          (DWORD) size );
+  if( !memory ) return NULL;
+
+  Image *image = NULL;
+  FREE_IMAGE_FORMAT format = FreeImage_GetFileTypeFromMemory( memory, 0 );
+  if( format != FIF_UNKNOWN && FreeImage_FIFSupportsReading( format ) ) {
+    FIBITMAP *bm = FreeImage_LoadFromMemory( format, memory, 0 );
+    if ( bm ) {
+      image = loadFreeImageInternal ( bm );
     }
   }
 
-  if( FreeImage_Save(FIF_PNG,free_image,url.c_str(),0) ) {
-    FreeImage_Unload(free_image);
-    return true;
+  FreeImage_CloseMemory( memory );
+  return image;
+}
+
+// Convert a compression level to flags for saving PNG files with
+// FreeImage.
+int freeImagePNGFlags( int compression_level ) {
+  if( compression_level < 0 ) return PNG_DEFAULT;
+  if( compression_level == 0 ) return PNG_Z_NO_COMPRESSION;
+  // the flags for levels 1-9 have the same values as the level.
+  return H3DMin( compression_level, (int)PNG_Z_BEST_COMPRESSION );
+}
+
+// Copy a row of width pixels from src to dst. component_map contains the
+// component of the source pixel to use for each component of the
+// destination pixel, or -1 if the component should be set to 0.
+template< class T >
+void copyFreeImageRow( const T *src, unsigned int src_components,
+                       T *dst, unsigned int dst_components,
+                       const int *component_map, unsigned int width ) {
+  bool identity = src_components == dst_components;
+  for( unsigned int c = 0; c < dst_components; ++c ) {
+    if( component_map[c] != (int)c ) identity = false;
+  }
+  if( identity ) {
+    memcpy( dst, src, width * src_components * sizeof( T ) );
+    return;
+  }
+  for( unsigned int x = 0; x < width; ++x ) {
+    for( unsigned int c = 0; c < dst_components; ++c ) {
+      dst[c] = component_map[c] == -1 ? 0 : src[ component_map[c] ];
+    }
+    src += src_components;
+    dst += dst_components;
+  }
+}
+
+// Create a FIBITMAP with the content of an image, suitable for saving as
+// PNG. Images with 8 or 16 bit unsigned components are copied row by row
+// with their own bit depth, other images are converted to 8 bits through
+// getPixel. Returns NULL if the image cannot be converted.
+FIBITMAP *createFreeImagePNGBitmap( Image &image ) {
+  if( image.compressionType() != Image::NO_COMPRESSION ) {
+    Console(LogLevel::Error) << "Cannot save compressed image as PNG." << endl;
+    return NULL;
+  }
+
+  unsigned int width = image.width();
+  unsigned int height = image.height();
+
+  // the component of the source pixel to use for red, green, blue and
+  // alpha, -1 if not available.
+  int src_index[4] = { 0, 0, 0, -1 };
+  unsigned int src_components = 1;
+  switch( image.pixelType() ) {
+  case Image::LUMINANCE:
+  case Image::R:
+    break;
+  case Image::LUMINANCE_ALPHA:
+    src_index[3] = 1;
+    src_components = 2;
+    break;
+  case Image::RG:
+    src_index[1] = 1;
+    src_index[2] = -1;
+    src_components = 2;
+    break;
+  case Image::RGB:
+  case Image::VEC3:
+    src_index[1] = 1;
+    src_index[2] = 2;
+    src_components = 3;
+    break;
+  case Image::BGR:
+    src_index[0] = 2;
+    src_index[1] = 1;
+    src_index[2] = 0;
+    src_components = 3;
+    break;
+  case Image::RGBA:
+    src_index[1] = 1;
+    src_index[2] = 2;
+    src_index[3] = 3;
+    src_components = 4;
+    break;
+  case Image::BGRA:
+    src_index[0] = 2;
+    src_index[1] = 1;
+    src_index[2] = 0;
+    src_index[3] = 3;
+    src_components = 4;
+    break;
+  }
+  bool has_alpha = src_index[3] != -1;
+  unsigned int dst_components =
+    src_components == 1 ? 1 : ( has_alpha ? 4 : 3 );
+
+  unsigned int bits_per_component = image.bitsPerPixel() / src_components;
+  bool bulk_copy = 
+    image.getImageData() != NULL &&
+    image.pixelComponentType() == Image::UNSIGNED &&
+    image.bitsPerPixel() % src_components == 0 &&
+    ( bits_per_component == 8 || bits_per_component == 16 );
+
+  FIBITMAP *bm;
+  if( bulk_copy && bits_per_component == 16 ) {
+    bm = FreeImage_AllocateT( dst_components == 1 ? FIT_UINT16 :
+                              ( dst_components == 3 ? FIT_RGB16 :
+                                FIT_RGBA16 ),
+                              width, height );
   } else {
-    FreeImage_Unload(free_image);
-    return false;
+    bm = FreeImage_Allocate( width, height, dst_components == 1 ? 8 :
+                             dst_components * 8 );
   }
+  if( !bm ) return NULL;
+
+  if( dst_components == 1 && !( bulk_copy && bits_per_component == 16 ) ) {
+    // 8 bit images need a greyscale palette.
+    RGBQUAD *palette = FreeImage_GetPalette( bm );
+    for( unsigned int i = 0; i < 256; ++i ) {
+      palette[i].rgbRed = palette[i].rgbGreen = palette[i].rgbBlue = (BYTE)i;
+      palette[i].rgbReserved = 0;
+    }
+  }
+
+  // The components of 8 bit FreeImage pixels are ordered according to
+  // the FI_RGBA_* defines while 16 bit pixels are always RGBA.
+  int dst_pos[4] = { 0, 1, 2, 3 };
+  if( !( bulk_copy && bits_per_component == 16 ) ) {
+    dst_pos[0] = FI_RGBA_RED;
+    dst_pos[1] = FI_RGBA_GREEN;
+    dst_pos[2] = FI_RGBA_BLUE;
+    dst_pos[3] = FI_RGBA_ALPHA;
+  }
+
+  if( bulk_copy ) {
+    int component_map[4] = { 0, 0, 0, 0 };
+    for( unsigned int c = 0; c < dst_components; ++c ) {
+      component_map[ dst_components == 1 ? 0 : dst_pos[c] ] = src_index[c];
+    }
+    unsigned char *data = (unsigned char *)image.getImageData();
+    size_t row_size = image.rowStride();
+    // both the image and FreeImage store the bottom row first.
+    for( unsigned int y = 0; y < height; ++y ) {
+      if( bits_per_component == 8 ) {
+        copyFreeImageRow( data + y * row_size, src_components,
+                          FreeImage_GetScanLine( bm, y ), dst_components,
+                          component_map, width );
+      } else {
+        copyFreeImageRow( (unsigned short *)( data + y * row_size ),
+                          src_components,
+                          (unsigned short *)FreeImage_GetScanLine( bm, y ),
+                          dst_components,
+                          component_map, width );
+      }
+    }
+  } else {
+    // Transfer values from the image
+    for( unsigned int y = 0; y < height; ++y ) {
+      BYTE *scanline = FreeImage_GetScanLine( bm, y );
+      for( unsigned int x = 0; x < width; ++x ) {
+        RGBA c = image.getPixel( x, y );
+        if( dst_components == 1 ) {
+          scanline[x] = BYTE( c.r*255 );
+        } else {
+          BYTE *pixel = scanline + x * dst_components;
+          pixel[ dst_pos[0] ] = BYTE( c.r*255 );
+          pixel[ dst_pos[1] ] = BYTE( c.g*255 );
+          pixel[ dst_pos[2] ] = BYTE( c.b*255 );
+          if( has_alpha ) pixel[ dst_pos[3] ] = BYTE( c.a*255 );
+        }
+      }
+    }
+  }
+
+  return bm;
+}
+
+bool H3DUtil::saveFreeImagePNG( const string &url,
+                                Image& image,
+                                int compression_level ) {
+  FIBITMAP *free_image = createFreeImagePNGBitmap( image );
+  if( !free_image ) return false;
+
+  bool success = FreeImage_Save( FIF_PNG, free_image, url.c_str(),
+                                 freeImagePNGFlags( compression_level ) ) != 0;
+  FreeImage_Unload(free_image);
+  return success;
+}
+
+// Saves the PNG images queued by saveFreeImagePNGAsync in a background
+// thread. The converted images are kept in the queue until they have
+// been saved and the total size of the queue is limited.
+class FreeImagePNGSaveQueue {
+public:
+  FreeImagePNGSaveQueue() :
+    queued_bytes( 0 ),
+    max_queued_bytes( 256 << 20 ),
+    nr_failed( 0 ),
+    thread( NULL ) {
+    thread = new SimpleThread( saveThread, this );
+    thread->setThreadName( "PNG save thread" );
+  }
+
+  // Add an image to the queue. Waits until there is room in the queue.
+  void add( FIBITMAP *bm, const string &url, int flags ) {
+    Job job;
+    job.bitmap = bm;
+    job.url = url;
+    job.flags = flags;
+    job.size = FreeImage_GetPitch( bm ) * FreeImage_GetHeight( bm );
+    lock.lock();
+    // always accept an image if the queue is empty, even if it is larger
+    // than the limit.
+    while( !jobs.empty() && queued_bytes + job.size > max_queued_bytes ) {
+      lock.wait();
+    }
+    jobs.push_back( job );
+    queued_bytes += job.size;
+    lock.broadcast();
+    lock.unlock();
+  }
+
+  // Wait until all queued images have been saved. Returns the number of
+  // images that could not be saved since the last call.
+  unsigned int waitUntilEmpty() {
+    lock.lock();
+    while( !jobs.empty() ) lock.wait();
+    unsigned int failed = nr_failed;
+    nr_failed = 0;
+    lock.unlock();
+    return failed;
+  }
+
+  void setMaxQueuedBytes( size_t max_bytes ) {
+    lock.lock();
+    max_queued_bytes = max_bytes;
+    lock.broadcast();
+    lock.unlock();
+  }
+
+protected:
+  struct Job {
+    FIBITMAP *bitmap;
+    string url;
+    int flags;
+    size_t size;
+  };
+
+  static void *saveThread( void *data ) {
+    FreeImagePNGSaveQueue *queue = static_cast< FreeImagePNGSaveQueue * >( data );
+    queue->lock.lock();
+    while( true ) {
+      while( queue->jobs.empty() ) queue->lock.wait();
+      // the job stays in the queue until it is saved so that
+      // waitUntilEmpty waits for it.
+      Job job = queue->jobs.front();
+      queue->lock.unlock();
+
+      bool success = FreeImage_Save( FIF_PNG, job.bitmap, 
+                                     job.url.c_str(), job.flags ) != 0;
+      FreeImage_Unload( job.bitmap );
+      if( !success ) {
+        Console(LogLevel::Error) << "Could not save PNG file "
+                                 << job.url << endl;
+      }
+
+      queue->lock.lock();
+      queue->jobs.pop_front();
+      queue->queued_bytes -= job.size;
+      if( !success ) ++queue->nr_failed;
+      queue->lock.broadcast();
+    }
+    return NULL;
+  }
+
+  ConditionLock lock;
+  std::deque< Job > jobs;
+  size_t queued_bytes;
+  size_t max_queued_bytes;
+  unsigned int nr_failed;
+  // Never deleted, like the queue itself.
+  SimpleThread *thread;
+};
+
+// The save queue is created when first used and never deleted, since the
+// thread cannot be stopped safely while waiting.
+MutexLock free_image_png_save_queue_lock;
+FreeImagePNGSaveQueue *free_image_png_save_queue = NULL;
+
+FreeImagePNGSaveQueue *getFreeImagePNGSaveQueue( bool create ) {
+  free_image_png_save_queue_lock.lock();
+  if( !free_image_png_save_queue && create )
+    free_image_png_save_queue = new FreeImagePNGSaveQueue;
+  FreeImagePNGSaveQueue *queue = free_image_png_save_queue;
+  free_image_png_save_queue_lock.unlock();
+  return queue;
+}
+
+// Saves the images remaining in the queue when the program exits.
+struct FreeImagePNGSaveQueueFlush {
+  ~FreeImagePNGSaveQueueFlush() {
+    FreeImagePNGSaveQueue *queue = getFreeImagePNGSaveQueue( false );
+    if( queue ) queue->waitUntilEmpty();
+  }
+} free_image_png_save_queue_flush;
+
+bool H3DUtil::saveFreeImagePNGAsync( const string &url,
+                                     Image& image,
+                                     int compression_level ) {
+  FIBITMAP *free_image = createFreeImagePNGBitmap( image );
+  if( !free_image ) return false;
+  getFreeImagePNGSaveQueue( true )->add( free_image, url,
+                                         freeImagePNGFlags( compression_level ) );
+  return true;
+}
+
+unsigned int H3DUtil::waitForFreeImagePNGSaves() {
+  FreeImagePNGSaveQueue *queue = getFreeImagePNGSaveQueue( false );
+  return queue ? queue->waitUntilEmpty() : 0;
+}
+
+void H3DUtil::setFreeImagePNGSaveQueueSize( size_t max_bytes ) {
+  getFreeImagePNGSaveQueue( true )->setMaxQueuedBytes( max_bytes );
 }
 
 #endif
 
-Image *H3DUtil::loadRawImage( const string &url,
-                              RawImageInfo &raw_image_info ) {
-  Image::PixelType pixel_type;
+// Get the pixel type and pixel component type from the strings in a
+// RawImageInfo. Returns false if they are invalid.
+bool getRawImageTypes( RawImageInfo &raw_image_info,
+                       Image::PixelType &pixel_type,
+                       Image::PixelComponentType &pixel_component_type ) {
   if( raw_image_info.pixel_type_string == "LUMINANCE" )
     pixel_type = Image::LUMINANCE;
   else if( raw_image_info.pixel_type_string == "LUMINANCE_ALPHA" )
@@ -236,10 +658,9 @@ Image *H3DUtil::loadRawImage( const string &url,
   else {
     Console(LogLevel::Warning) << "Warning: Invalid pixelType value \"" << raw_image_info.pixel_type_string
                << "\" in  RawImageLoader. " << endl;
-    return NULL;
+    return false;
   }
 
-  Image::PixelComponentType pixel_component_type;
   if( raw_image_info.pixel_component_type_string == "SIGNED" ) 
     pixel_component_type = Image::SIGNED; 
   else if( raw_image_info.pixel_component_type_string == "UNSIGNED" )
@@ -250,89 +671,282 @@ Image *H3DUtil::loadRawImage( const string &url,
     Console(LogLevel::Warning) << "Warning: Invalid pixelComponentType value \"" 
                << raw_image_info.pixel_component_type_string
                << "\" in  RawImageLoader. " << endl;
+    return false;
+  }
+  return true;
+}
+
+// Returns the size in bytes of the image described by a RawImageInfo.
+size_t rawImageSize( RawImageInfo &raw_image_info ) {
+  return (size_t) raw_image_info.width * raw_image_info.height *
+    raw_image_info.depth * ( raw_image_info.bits_per_pixel / 8 );
+}
+
+#ifdef HAVE_ZLIB
+// Decompress size bytes of zlib or gzip compressed raw data into a new
+// buffer of expected_size bytes. Returns NULL on failure.
+unsigned char *inflateRawData( const unsigned char *data, size_t size,
+                               size_t expected_size ) {
+  unsigned char * data2 = new unsigned char[expected_size];
+
+  int err;
+  z_stream strm = {
+    const_cast< unsigned char * >( data ), (uInt)size, 0,
+    data2, (uInt)expected_size, 0
+  };
+
+  err = inflateInit2(&strm,47);
+
+  if( err == Z_MEM_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib memory error." << endl;
+    delete[] data2;
+    return NULL;
+  }
+  if( err == Z_VERSION_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib version error." << endl;
+    delete[] data2;
     return NULL;
   }
-    
-  unsigned int expected_size = 
-    raw_image_info.width * raw_image_info.height * raw_image_info.depth *
-    ( raw_image_info.bits_per_pixel / 8 );
 
-  unsigned char * data = new unsigned char[expected_size];
-  
+  err = inflate(&strm,Z_FINISH);
+
+  if( err == Z_DATA_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib unrecognizable data error." << endl;
+    inflateEnd(&strm);
+    delete[] data2;
+    return NULL;
+  }
+  if( err == Z_STREAM_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib stream error." << endl;
+    inflateEnd(&strm);
+    delete[] data2;
+    return NULL;
+  }
+  if( err == Z_BUF_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib out of memory error." << endl;
+    inflateEnd(&strm);
+    delete[] data2;
+    return NULL;
+  }
+
+  err = inflateEnd(&strm);
+
+  if( err == Z_STREAM_ERROR ){
+    Console(LogLevel::Warning) << "Warning: zlib stream error." << endl;
+    delete[] data2;
+    return NULL;
+  }
+
+  Console(LogLevel::Debug) << "Inflated compressed raw file." << endl;
+  return data2;
+}
+#endif
+
+// Create the PixelImage of loadRawImage, taking ownership of data.
+Image *createRawImage( RawImageInfo &raw_image_info,
+                       Image::PixelType pixel_type,
+                       Image::PixelComponentType pixel_component_type,
+                       unsigned char *data ) {
+  return new PixelImage( raw_image_info.width,
+                         raw_image_info.height,
+                         raw_image_info.depth,
+                         raw_image_info.bits_per_pixel,
+                         pixel_type,
+                         pixel_component_type,
+                         data,
+                         false,
+                         raw_image_info.pixel_size );
+}
+
+Image *H3DUtil::loadRawImage( const string &url,
+                              RawImageInfo &raw_image_info ) {
   ifstream is( url.c_str(), ios::in | ios::binary );
   if( !is.good() ) {
     return NULL;
   }
-  
+  return loadRawImage( is, raw_image_info );
+}
+
+Image *H3DUtil::loadRawImage( istream &is,
+                              RawImageInfo &raw_image_info ) {
+  Image::PixelType pixel_type;
+  Image::PixelComponentType pixel_component_type;
+  if( !getRawImageTypes( raw_image_info, pixel_type,
+                         pixel_component_type ) ) {
+    return NULL;
+  }
+
+  size_t expected_size = rawImageSize( raw_image_info );
+  unsigned char * data = new unsigned char[expected_size];
+
   is.read( (char *)data, expected_size );
-  unsigned int actual_size = (unsigned int) is.gcount();
-  is.close();
-  
+  size_t actual_size = (size_t) is.gcount();
+
 #ifdef HAVE_ZLIB
-  
   if( actual_size < expected_size ){
-    
-    unsigned char * data2 = new unsigned char[expected_size];
-//    unsigned long int uncompressed_size = expected_size;
-    
-    int err;
-    z_stream strm = {
-      data, (uInt)actual_size, 0,
-      data2, expected_size, 0
-    };
-    
-    err = inflateInit2(&strm,47);
-    
-    if( err == Z_MEM_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib memory error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_VERSION_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib version error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    
-    err = inflate(&strm,Z_FINISH);
-    
-    if( err == Z_DATA_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib unrecognizable data error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_STREAM_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib stream error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    if( err == Z_BUF_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib out of memory error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    
-    err = inflateEnd(&strm);
-    
-    if( err == Z_STREAM_ERROR ){
-      Console(LogLevel::Warning) << "Warning: zlib stream error." << endl;
-      delete[] data;
-      delete[] data2;
-      return NULL;
-    }
-    
-    Console(LogLevel::Debug) << "Inflated compressed raw file." << endl;
+    unsigned char *inflated = inflateRawData( data, actual_size,
+                                              expected_size );
     delete[] data;
-    data = data2;
+    if( !inflated ) return NULL;
+    data = inflated;
   }
-  
 #endif
-  
+
+  return createRawImage( raw_image_info, pixel_type, pixel_component_type,
+                         data );
+}
+
+Image *H3DUtil::loadRawImage( const void *raw_data, size_t size,
+                              RawImageInfo &raw_image_info ) {
+  Image::PixelType pixel_type;
+  Image::PixelComponentType pixel_component_type;
+  if( !getRawImageTypes( raw_image_info, pixel_type,
+                         pixel_component_type ) ) {
+    return NULL;
+  }
+
+  size_t expected_size = rawImageSize( raw_image_info );
+  const unsigned char *src = static_cast< const unsigned char * >( raw_data );
+  unsigned char *data = NULL;
+
+#ifdef HAVE_ZLIB
+  if( size < expected_size ) {
+    data = inflateRawData( src, size, expected_size );
+    if( !data ) return NULL;
+  }
+#endif
+  if( !data ) {
+    data = new unsigned char[expected_size];
+    memcpy( data, src, H3DMin( size, expected_size ) );
+  }
+
+  return createRawImage( raw_image_info, pixel_type, pixel_component_type,
+                         data );
+}
+
+Image *H3DUtil::wrapRawImage( void *data, size_t size,
+                              RawImageInfo &raw_image_info,
+                              PixelImage::DataDeleter deleter,
+                              void *deleter_data ) {
+  Image::PixelType pixel_type;
+  Image::PixelComponentType pixel_component_type;
+  if( !getRawImageTypes( raw_image_info, pixel_type,
+                         pixel_component_type ) ) {
+    return NULL;
+  }
+
+  if( size < rawImageSize( raw_image_info ) ) {
+    Console(LogLevel::Warning) << "Warning: wrapRawImage: the data is "
+                               << "smaller than the image." << endl;
+    return NULL;
+  }
+
+  return new PixelImage( raw_image_info.width,
+                         raw_image_info.height,
+                         raw_image_info.depth,
+                         raw_image_info.bits_per_pixel,
+                         pixel_type,
+                         pixel_component_type,
+                         static_cast< unsigned char * >( data ),
+                         deleter,
+                         deleter_data,
+                         raw_image_info.pixel_size );
+}
+
+// The mapping of a file used as image data by mapRawImage.
+struct MappedImageData {
+  void *address;
+  size_t size;
+};
+
+// PixelImage::DataDeleter unmapping a MappedImageData.
+void unmapImageData( unsigned char * /*data*/, void *deleter_data ) {
+  MappedImageData *mapped = static_cast< MappedImageData * >( deleter_data );
+#ifdef WIN32
+  UnmapViewOfFile( mapped->address );
+#else
+  munmap( mapped->address, mapped->size );
+#endif
+  delete mapped;
+}
+
+// Map size bytes from offset in a file into memory with copy on write
+// access. Returns NULL if the file could not be mapped or is too small.
+MappedImageData *mapImageData( const string &url,
+                               H3DInt64 offset,
+                               H3DInt64 size,
+                               unsigned char *&data ) {
+  void *address = NULL;
+  H3DInt64 start = 0;
+#ifdef WIN32
+  HANDLE file = CreateFileA( url.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+  if( file == INVALID_HANDLE_VALUE ) return NULL;
+  LARGE_INTEGER file_size;
+  if( GetFileSizeEx( file, &file_size ) &&
+      file_size.QuadPart >= offset + size ) {
+    HANDLE mapping = CreateFileMapping( file, NULL, PAGE_WRITECOPY,
+                                        0, 0, NULL );
+    if( mapping ) {
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      // the view must start at a multiple of the allocation granularity.
+      start = offset - offset % info.dwAllocationGranularity;
+      address = MapViewOfFile( mapping, FILE_MAP_COPY,
+                               (DWORD)( start >> 32 ),
+                               (DWORD)( start & 0xffffffff ),
+                               (SIZE_T)( size + offset - start ) );
+      CloseHandle( mapping );
+    }
+  }
+  CloseHandle( file );
+  if( !address ) return NULL;
+#else
+  int fd = open( url.c_str(), O_RDONLY );
+  if( fd < 0 ) return NULL;
+  struct stat file_stat;
+  if( fstat( fd, &file_stat ) == 0 &&
+      (H3DInt64) file_stat.st_size >= offset + size ) {
+    // the mapping must start at a multiple of the page size.
+    long page_size = sysconf( _SC_PAGESIZE );
+    start = offset - offset % page_size;
+    address = mmap( NULL, (size_t)( size + offset - start ),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) start );
+    if( address == MAP_FAILED ) address = NULL;
+  }
+  close( fd );
+  if( !address ) return NULL;
+#endif
+  MappedImageData *mapped = new MappedImageData;
+  mapped->address = address;
+  mapped->size = (size_t)( size + offset - start );
+  data = (unsigned char *) address + ( offset - start );
+  return mapped;
+}
+
+Image *H3DUtil::mapRawImage( const string &url,
+                             RawImageInfo &raw_image_info,
+                             H3DInt64 offset ) {
+  Image::PixelType pixel_type;
+  Image::PixelComponentType pixel_component_type;
+  if( !getRawImageTypes( raw_image_info, pixel_type,
+                         pixel_component_type ) ) {
+    return NULL;
+  }
+
+  H3DInt64 size = (H3DInt64) raw_image_info.width * raw_image_info.height *
+    raw_image_info.depth * ( raw_image_info.bits_per_pixel / 8 );
+  unsigned char *data = NULL;
+  MappedImageData *mapped = size > 0 ?
+    mapImageData( url, offset, size, data ) : NULL;
+  if( !mapped ) {
+    // compressed files are smaller than the image data.
+    if( offset == 0 ) return loadRawImage( url, raw_image_info );
+    Console(LogLevel::Warning) << "Warning: Could not map raw file \""
+                               << url << "\"." << endl;
+    return NULL;
+  }
+
   return new PixelImage( raw_image_info.width,
                          raw_image_info.height,
                          raw_image_info.depth,
@@ -340,12 +954,20 @@ Image *H3DUtil::loadRawImage( const string &url,
                          pixel_type,
                          pixel_component_type,
                          data,
-                         false,
+                         unmapImageData,
+                         mapped,
                          raw_image_info.pixel_size );
 }
 
 #ifdef HAVE_TEEM
-Image *H3DUtil::loadNrrdFile( const string &url ) {
+// PixelImage::DataDeleter releasing the Nrrd that owns the data.
+void nukeNrrd( unsigned char *data, void *deleter_data ) {
+  nrrdNuke( static_cast< Nrrd * >( deleter_data ) );
+}
+
+// Read the header of a Nrrd file with teem and put the properties of the
+// image in info. Returns the Nrrd without data, NULL on failure.
+Nrrd *loadNrrdHeaderTeem( const string &url, ImageFileInfo &info ) {
   Nrrd *nin;
   
   /* create a new nrrd */
@@ -494,152 +1116,238 @@ Image *H3DUtil::loadNrrdFile( const string &url ) {
 			 << " lacks spacing information in axis 0. Sets to default 0.0003\n";
   }
 
-  // Allocate the data.
-  // The reason for allocating the memory for the data ourself instead of
-  // letting the teem library take care of that is to make sure that there
-  // are no problems with deleting data from H3DUtil that is allocated
-  // in another shared library on a Windows system.
-  unsigned bytes_per_pixel = 
-  bits_per_pixel % 8 == 0 ? 
-  bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
+  info.format = ImageFileInfo::NRRD_FORMAT;
+  info.width = width;
+  info.height = height;
+  info.depth = depth;
+  info.bits_per_pixel = bits_per_pixel;
+  info.pixel_type = pixel_type;
+  info.pixel_component_type = component_type;
+  info.pixel_size = spacing;
+  return nin;
+}
+
+// Load a Nrrd file using teem. Used for files that NrrdReader does not
+// support.
+Image *loadNrrdFileTeem( const string &url ) {
+  ImageFileInfo info;
+  Nrrd *nin = loadNrrdHeaderTeem( url, info );
+  if( !nin ) return NULL;
 
-  unsigned int size = (width * height * depth * bytes_per_pixel);
-  unsigned char * data = new unsigned char[ size ];
-  nin->data = data;
+  // Let teem allocate the data and give it to the PixelImage together with
+  // the nrrd, so that it is released by teem itself. This avoids problems
+  // with deleting data allocated in another shared library on Windows.
   if( nrrdLoad( nin, url.c_str(), NULL ) ) {
-    // free nrrd struct memory but not data.
-    nrrdNix(nin);
-    delete [] data;
+    nrrdNuke(nin);
     return NULL;
   }
-  // We assume this will work well on other systems, note that this is not
-  // yet tested properly.
-  Image *image =  new PixelImage( width, height, depth, bits_per_pixel,
-                                  pixel_type, component_type,
-                                  (unsigned char *)nin->data,
-                                  false, spacing );
-  // free nrrd struct memory but not data.
-  nrrdNix(nin);
+  return new PixelImage( info.width, info.height, info.depth,
+                         info.bits_per_pixel,
+                         info.pixel_type, info.pixel_component_type,
+                         (unsigned char *)nin->data,
+                         nukeNrrd, nin, info.pixel_size );
+}
+
+#endif // HAVE_TEEM
+
+Image *H3DUtil::loadNrrdFile( const string &url ) {
+  NrrdReader reader;
+  if( reader.open( url ) ) {
+    Image *image = reader.readImage();
+    if( !image ) {
+      Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
+    }
+    return image;
+  }
+#ifdef HAVE_TEEM
+  if( reader.hasUnsupportedFeature() ) {
+    return loadNrrdFileTeem( url );
+  }
+#endif
+  Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
+  return NULL;
+}
+
+// Read the image of a NrrdReader or BrickedVolumeReader for which open
+// returned opened, warning about any error.
+template< class Reader >
+Image *readOpenedImage( Reader &reader, bool opened ) {
+  Image *image = NULL;
+  if( opened ) {
+    image = reader.readImage();
+  }
+  if( !image ) {
+    Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
+  }
+  return image;
+}
+
+Image *H3DUtil::loadNrrdFile( const void *data, size_t size ) {
+  NrrdReader reader;
+  return readOpenedImage( reader, reader.open( data, size ) );
+}
+
+Image *H3DUtil::loadNrrdFile( istream &is ) {
+  NrrdReader reader;
+  return readOpenedImage( reader, reader.open( is ) );
+}
+
+Image *H3DUtil::loadNrrdFileSlices( const string &url,
+                                    unsigned int first_slice,
+                                    unsigned int nr_slices ) {
+  NrrdReader reader;
+  Image *image = NULL;
+  if( reader.open( url ) ) {
+    image = reader.readSlab( first_slice, nr_slices );
+  }
+  if( !image ) {
+    Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
+  }
   return image;
 }
 
 int H3DUtil::saveImageAsNrrdFile( const string &filename,
-                                  Image *image ) {
-    Nrrd *nin;
-  
-  /* create a new nrrd */
-  nin = nrrdNew();
+                                  Image *image,
+                                  NrrdFile::Encoding encoding ) {
+  NrrdWriter writer;
+  bool success = writer.open( filename, 
+                              image->width(), image->height(), image->depth(),
+                              image->bitsPerPixel(),
+                              image->pixelType(), image->pixelComponentType(),
+                              image->pixelSize(), encoding );
+  void *data = image->getImageData();
+  if( success && data && image->hasPackedData() ) {
+    success = writer.writeSlices( data, image->depth() );
+  } else if( success ) {
+    // remove the row padding or read the pixels one slice at a time.
+    vector< unsigned char > slice( (size_t) image->width() * image->height() *
+                                   image->bitsPerPixel() / 8 );
+    for( unsigned int z = 0; success && z < image->depth(); ++z ) {
+      image->getPackedSlices( z, 1, &slice[0] );
+      success = writer.writeSlices( &slice[0], 1 );
+    }
+  }
+  if( !success || !writer.close() ) {
+    Console(LogLevel::Warning) << "Warning: " << writer.getError() << endl;
+    return -1;
+  }
+  return 0;
+}
+
+Image *H3DUtil::loadBrickedVolumeFile( const string &url ) {
+  BrickedVolumeReader reader;
+  Image *image = NULL;
+  if( reader.open( url ) ) {
+    image = reader.readImage();
+  }
+  if( !image ) {
+    Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
+  }
+  return image;
+}
+
+Image *H3DUtil::loadBrickedVolumeFile( const void *data, size_t size ) {
+  BrickedVolumeReader reader;
+  return readOpenedImage( reader, reader.open( data, size ) );
+}
+
+Image *H3DUtil::loadBrickedVolumeFile( istream &is ) {
+  BrickedVolumeReader reader;
+  return readOpenedImage( reader, reader.open( is ) );
+}
 
-  unsigned int bits_per_pixel = image->bitsPerPixel();
- 
-  Image::PixelComponentType component_type = image->pixelComponentType();
-  Image::PixelType pixel_type = image->pixelType();
-  const Vec3f &voxel_size = image->pixelSize(); 
-
-  // dimensions
-  unsigned int nr_components = 1;
-  if( pixel_type == Image::LUMINANCE ) {
-    nr_components = 1;
-  } else if( pixel_type == Image::LUMINANCE_ALPHA ) {
-    nr_components = 2;
-  } else if( pixel_type == Image::BGR || pixel_type == Image::RGB || 
-             pixel_type == Image::VEC3) {
-    nr_components = 3;
-  } else if( pixel_type == Image::RGBA || pixel_type == Image::BGRA ) {
-    nr_components = 4;
-  } else {
-    return -1;
+Image *H3DUtil::loadBrickedVolumeFileRegion( const string &url,
+                                             unsigned int x,
+                                             unsigned int y,
+                                             unsigned int z,
+                                             unsigned int width,
+                                             unsigned int height,
+                                             unsigned int depth ) {
+  BrickedVolumeReader reader;
+  Image *image = NULL;
+  if( reader.open( url ) ) {
+    image = reader.readRegionImage( x, y, z, width, height, depth );
+  }
+  if( !image ) {
+    Console(LogLevel::Warning) << "Warning: " << reader.getError() << endl;
   }
+  return image;
+}
 
-  int bytes_per_component =  bits_per_pixel / (nr_components * 8);
-  if( bits_per_pixel % (nr_components * 8) > 0 ) ++bytes_per_component;
-
-  // save the type
-  if( component_type == Image::SIGNED ) {
-    if( bytes_per_component == 1 ) nin->type = nrrdTypeChar;
-    else if( bytes_per_component == 2 ) nin->type = nrrdTypeShort;
-    else if( bytes_per_component == 4 ) nin->type = nrrdTypeInt;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeLLong;
-    else return -1; 
-  } else if( component_type == Image::UNSIGNED ) {
-    if( bytes_per_component == 1 ) nin->type = nrrdTypeUChar;
-    else if( bytes_per_component == 2 ) nin->type = nrrdTypeUShort;
-    else if( bytes_per_component == 4 ) nin->type = nrrdTypeUInt;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeULLong;
-    else return -1; 
-  } else  if( component_type == Image::RATIONAL ) {
-    if(  bytes_per_component == 4 ) nin->type = nrrdTypeFloat;
-    else if( bytes_per_component == 8 ) nin->type = nrrdTypeDouble;
-    else return -1; 
-  } else {
-    return -1; 
+int H3DUtil::saveImageAsBrickedVolumeFile( const string &url,
+                                           Image *image,
+                                           BrickedVolumeFile::Encoding
+                                           encoding ) {
+  BrickedVolumeWriter writer;
+  if( !writer.writeImage( url, image, encoding ) ) {
+    Console(LogLevel::Warning) << "Warning: " << writer.getError() << endl;
+    return -1;
   }
+  return 0;
+}
 
 
+#ifdef HAVE_DCMTK
+// Create an image with the rows of a loaded DicomImage in bottom to top
+// order. Dicom data is specified from the topleft corner while images are
+// specified from the bottomleft corner.
+Image *createFlippedDicomImage( DicomImage &slice_2d ) {
+  // get properties from dicom image
+  unsigned int width  = slice_2d.width();
+  unsigned int height = slice_2d.height();
+  // multi-frame files contain one frame per slice
+  unsigned int depth = slice_2d.depth();
+  Vec3f pixel_size = slice_2d.pixelSize();
+  Image::PixelType pixel_type = slice_2d.pixelType();
+  unsigned int bits_per_pixel = slice_2d.bitsPerPixel();
+  Image::PixelComponentType component_type = 
+    slice_2d.pixelComponentType();    
 
-  nin->dim = 4;
-  nin->axis[0].size = nr_components;
-  nin->axis[1].size = image->width();
-  nin->axis[2].size = image->height();
-  nin->axis[3].size = image->depth();
+  unsigned bytes_per_pixel = 
+    bits_per_pixel % 8 == 0 ? 
+    bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
 
-  nin->axis[1].spacing = voxel_size.x;
-  nin->axis[2].spacing = voxel_size.y;
-  nin->axis[3].spacing = voxel_size.z;
+  // allocate and copy data into correct order.
+  unsigned char *data = 
+    new unsigned char[ width * height * depth * bytes_per_pixel ];
 
-  nin->data = image->getImageData();
+  flipImageData( slice_2d.getImageData(), data,
+                 width, height, depth, bytes_per_pixel, 1 );
 
-  int res = nrrdSave( filename.c_str(), nin, NULL );
-  char *err = biffGetDone( NRRD );
+  // return new image with the correct row order.
+  return new PixelImage( width, height, depth, 
+                         bits_per_pixel, pixel_type, component_type,
+                         data, false, pixel_size );
+}
 
-  // free nrrd struct memory but not data.
-  nrrdNix( nin );
+H3DUTIL_API Image *H3DUtil::loadDicomFileFromMemory( const void *data,
+                                                     size_t size,
+                                                     bool native_values ) {
+  try {
+    AutoRef< DicomImage > slice_2d( DicomImage::fromMemory( data, size,
+                                                             native_values ) );
+    return createFlippedDicomImage( *slice_2d );
+  } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+    cerr << e << endl;
+    return NULL;
+  }
+}
 
-  return res;
+H3DUTIL_API Image *H3DUtil::loadDicomFile( istream &is,
+                                           bool native_values ) {
+  vector< unsigned char > data;
+  if( !readWholeStream( is, data ) ) return NULL;
+  return loadDicomFileFromMemory( &data[0], data.size(), native_values );
 }
-#endif
 
-#ifdef HAVE_DCMTK
 H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
-                                           bool load_single_file ) {
+                                           bool load_single_file,
+                                           bool use_series_index,
+                                           bool native_values ) {
   if( load_single_file ) {
    try {
-     // dicom data is specified from topleft corner. we have to convert it so
-     // it is specified from the bottomleft corner
-     auto_ptr< DicomImage > slice_2d( new DicomImage( url ) );
-
-     // get properties from dicom image
-     unsigned int width  = slice_2d->width();
-     unsigned int height = slice_2d->height();
-     // depth will be incremented below depending on the number of slices
-     // used
-     unsigned int depth = 1;
-     Vec3f pixel_size = slice_2d->pixelSize();
-     Image::PixelType pixel_type = slice_2d->pixelType();
-     unsigned int bits_per_pixel = slice_2d->bitsPerPixel();
-     Image::PixelComponentType component_type = 
-       slice_2d->pixelComponentType();    
-     
-     unsigned bytes_per_pixel = 
-       bits_per_pixel % 8 == 0 ? 
-       bits_per_pixel / 8 : bits_per_pixel / 8 + 1;
-     
-     // allocate and copy data into correct order.
-     unsigned char *data = 
-       new unsigned char[ width * height * bytes_per_pixel ];
-     
-     unsigned char * slice_data = (unsigned char *)slice_2d->getImageData();
-     for( unsigned int row = 0; row < height; ++row ) {
-       memcpy( data + row*width* bytes_per_pixel, 
-               slice_data + (height - row - 1 ) * width * bytes_per_pixel,
-               width * bytes_per_pixel );
-     }
-
-     // return new image with the correct row order.
-     return new PixelImage( width, height, depth, 
-                            bits_per_pixel, pixel_type, component_type,
-                            data, false, pixel_size );
-
+     DicomImage slice_2d( url, native_values );
+     return createFlippedDicomImage( slice_2d );
     } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
       cerr << e << endl;
       return NULL;
@@ -660,39 +1368,79 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
       filename = url;
     }
 
-    // find files in the same directory as the original file that starts
-    // with the same characters.
-#ifdef WIN32
-    LPWIN32_FIND_DATA find_data = new WIN32_FIND_DATA;
-    HANDLE handle = FindFirstFile( 
-      (path + "/" + filename.substr( 0,3 ) +"*" ).c_str(), find_data );
-    if( handle != INVALID_HANDLE_VALUE ) {
-      string name = path + "\\" + find_data->cFileName;
-      filenames.push_back( name );
-      //Console(LogLevel::Warning) << name << endl;
-      while( FindNextFile(handle, find_data) ) {
-        //Console(LogLevel::Warning) << find_data->cFileName << endl;
-        filenames.push_back( string( path + "\\" + find_data->cFileName ) );
+    // The slice distance found from ImagePositionPatient when the files
+    // are ordered by a DicomSeriesIndex. Negative if not found.
+    H3DFloat index_slice_distance = -1;
+
+    // If true the files in filenames are all in the same series and are
+    // already sorted in the order they should be stacked.
+    bool ordered_by_index = false;
+
+    if( use_series_index ) {
+      DicomSeriesIndex index( path.empty() ? "." : path, false );
+      index.update();
+      const DicomSeriesIndex::Entry *entry = index.findEntry( filename );
+      if( entry && entry->is_dicom && !entry->series_instance_uid.empty() ) {
+        vector< const DicomSeriesIndex::Entry * > series =
+          index.getSeries( entry->series_instance_uid );
+        for( unsigned int i = 0; i < series.size(); ++i ) {
+          filenames.push_back( index.getFullPath( *series[i] ) );
+        }
+        ordered_by_index = true;
+
+        if( series.size() >= 2 &&
+            series[0]->has_position && series[1]->has_position ) {
+          Vec3d normal = 
+            series[0]->row_orientation % series[0]->column_orientation;
+          index_slice_distance = (H3DFloat)
+            H3DAbs( ( series[0]->position - series[1]->position ) * normal );
+          if( ( series[0]->row_orientation - Vec3d( 1, 0, 0 ) ).length() >
+              Constants::f_epsilon ||
+              ( series[0]->column_orientation - Vec3d( 0, 1, 0 ) ).length() >
+              Constants::f_epsilon ) {
+            Console(LogLevel::Warning) << "Warning: ImageOrientationPatient is not "
+                       << "the assumed default. Dicom image might not "
+                       << "be read correctly." << endl;
+          }
+        }
       }
     }
-    delete find_data;
+
+    if( !ordered_by_index ) {
+      // find files in the same directory as the original file that starts
+      // with the same characters.
+#ifdef WIN32
+      LPWIN32_FIND_DATA find_data = new WIN32_FIND_DATA;
+      HANDLE handle = FindFirstFile( 
+        (path + "/" + filename.substr( 0,3 ) +"*" ).c_str(), find_data );
+      if( handle != INVALID_HANDLE_VALUE ) {
+        string name = path + "\\" + find_data->cFileName;
+        filenames.push_back( name );
+        //Console(LogLevel::Warning) << name << endl;
+        while( FindNextFile(handle, find_data) ) {
+          //Console(LogLevel::Warning) << find_data->cFileName << endl;
+          filenames.push_back( string( path + "\\" + find_data->cFileName ) );
+        }
+      }
+      delete find_data;
 #else
-    string prefix = filename.substr( 0,3 );
-    DIR *dp;
-    struct dirent *dirp;
-    if((dp  = opendir(path.c_str())) != NULL) {
-      while ((dirp = readdir(dp)) != NULL) {
-        string name = string(dirp->d_name);
-        if( prefix == name.substr( 0,3 ) ) {
-          filenames.push_back( string( path.c_str() ) + "/" + name );
+      string prefix = filename.substr( 0,3 );
+      DIR *dp;
+      struct dirent *dirp;
+      if((dp  = opendir(path.c_str())) != NULL) {
+        while ((dirp = readdir(dp)) != NULL) {
+          string name = string(dirp->d_name);
+          if( prefix == name.substr( 0,3 ) ) {
+            filenames.push_back( string( path.c_str() ) + "/" + name );
+          }
         }
+        closedir(dp);
       }
-      closedir(dp);
-    }
 #endif
 
-    // sort them in alphabetical order
-    std::sort( filenames.begin(), filenames.end() );
+      // sort them in alphabetical order
+      std::sort( filenames.begin(), filenames.end() );
+    }
 
     if( filenames.empty() ) return NULL;
 
@@ -700,7 +1448,7 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
     
     // read the original slice in order to get image information
     try {
-      slice_2d.reset( new DicomImage( url ) );
+      slice_2d.reset( new DicomImage( url, native_values ) );
     } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
       Console(LogLevel::Warning) << e << endl;
       return NULL;
@@ -732,7 +1480,9 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
                                                          orig_series_instance_UID );
    
 
-    bool use_all_files = (res != EC_Normal || orig_series_instance_UID == "" );
+    bool use_all_files = 
+      ordered_by_index || 
+      (res != EC_Normal || orig_series_instance_UID == "" );
 
     // Checking the z value of the ImagePositionPatient to know in which
     // order the dicom files should be read.
@@ -746,7 +1496,9 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
     // Iterate through filename and get the two first valid ones and try
     // to read information from them. If information is read from two, then
     // break. This could perhaps be coupled with the other for loop.
-    for( unsigned int i = 0; i < filenames.size(); ++i ) {
+    // Not needed if the files have been ordered by the series index.
+    for( unsigned int i = 0; 
+         !ordered_by_index && i < filenames.size(); ++i ) {
       DcmFileFormat fileformat;
       if( fileformat.loadFile(filenames[i].c_str()).good() ) {
         OFString string_value;
@@ -827,14 +1579,26 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
     if( second_patient_pos_set ) {
       H3DFloat slice_distance( H3DAbs(patient_pos1 - patient_pos2) );
       pixel_size.z = slice_distance * H3DFloat( 1e-3 ); // to metres
+    } else if( index_slice_distance >= 0 ) {
+      pixel_size.z = index_slice_distance * H3DFloat( 1e-3 ); // to metres
     }
 
-    // read all files and compose them into one image.
+    // read all files and compose them into one image. The files are read
+    // in the background ahead of the slice being decoded.
+    BatchFileReader file_reader;
+    file_reader.start( filenames );
     for( unsigned int i = 0; i < filenames.size(); ++i ) {
-      DcmFileFormat fileformat;
+      const unsigned char *file_data;
+      size_t file_size;
+      bool file_read = file_reader.waitForFile( i, file_data, file_size );
       OFString series_instance_UID;
 
-      if (fileformat.loadFile(filenames[i].c_str()).good()) {
+      // the series of the file only has to be checked if not all files
+      // are used.
+      DcmFileFormat fileformat;
+      if( !use_all_files && file_read &&
+          DicomImage::readFromMemory( fileformat, file_data,
+                                      file_size ).good() ) {
         DcmDataset *dataset = fileformat.getDataset();
         OFCondition res = dataset->findAndGetOFString( DCM_SeriesInstanceUID,
                                                        series_instance_UID );
@@ -844,7 +1608,14 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
       // file.
       if( use_all_files || series_instance_UID == orig_series_instance_UID ) {
         try {
-          slice_2d.reset( new DicomImage( filenames[i] ) );
+          if( !file_read ) {
+            throw DicomImage::CouldNotLoadDicomImage( filenames[i],
+                                                      "Could not read file.",
+                                                      H3D_FULL_LOCATION );
+          }
+          slice_2d.reset( DicomImage::fromMemory( file_data, file_size,
+                                                  native_values,
+                                                  filenames[i] ) );
         } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
           Console(LogLevel::Warning) << e << endl;
           delete [] data;
@@ -853,15 +1624,12 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
 
         // dicom data is specified from topleft corner. we have to convert it
         // so it is specified from the bottomleft corner
-        unsigned char * slice_data = (unsigned char *)slice_2d->getImageData();
-        for( unsigned int row = 0; row < height; ++row ) {
-          memcpy( data + (width * height * depth  + row*width)*
-                         bytes_per_pixel,
-                  slice_data + (height - row - 1 ) * width * bytes_per_pixel,
-                  width * bytes_per_pixel );
-        }
+        flipImageData( slice_2d->getImageData(),
+                       data + width * height * depth * bytes_per_pixel,
+                       width, height, 1, bytes_per_pixel, 1 );
         ++depth;
       }
+      file_reader.releaseFile( i );
     }
    
     return new PixelImage( width, height, depth, 
@@ -872,6 +1640,36 @@ H3DUTIL_API Image *H3DUtil::loadDicomFile( const string &url,
 #endif
 
 #ifdef HAVE_OPENEXR
+// Set the number of threads used by OpenEXR to read and write files to the
+// number of hardware threads, unless the application has already set it.
+void initOpenEXRThreads() {
+  if( IMF::globalThreadCount() == 0 ) {
+    IMF::setGlobalThreadCount( getNrHardwareThreads() );
+  }
+}
+
+// Insert a slice for each of the R, G, B and A channels whose offset is
+// not -1 into frame_buffer. offsets are given in number of components from
+// the start of a pixel. base is the address of pixel (0,0) in the data
+// window coordinates of the file, y_stride may be negative.
+void insertOpenEXRSlices( FrameBuffer &frame_buffer,
+                          IMF::PixelType type,
+                          const int offsets[4],
+                          char *base,
+                          size_t x_stride,
+                          ptrdiff_t y_stride ) {
+  const char *names[4] = { "R", "G", "B", "A" };
+  for( unsigned int i = 0; i < 4; ++i ) {
+    if( offsets[i] != -1 ) {
+      frame_buffer.insert( names[i],
+                           Slice( type,
+                                  base + offsets[i] * pixelTypeSize( type ),
+                                  x_stride,
+                                  (size_t) y_stride ) );
+    }
+  }
+}
+
 H3DUTIL_API bool H3DUtil::saveOpenEXRImage( const string &url,
                                             Image& image ) {
   
@@ -937,12 +1735,14 @@ H3DUTIL_API bool H3DUtil::saveOpenEXRImage( const string &url,
     break;
   }
 
-  if ( bytes_per_pixel/nr_channel != sizeof(float) ) {
+  if ( nr_channel == 0 || bytes_per_pixel/nr_channel != sizeof(float) ) {
     Console(LogLevel::Error) << "Cannot save image as OpenEXR, bits per pixel per channel "
                   "does not match size of float! Only float images are supported!" << endl;
     return false;
   }
 
+  initOpenEXRThreads();
+
   try {
     
     Header header (image.width(), image.height());
@@ -955,54 +1755,25 @@ H3DUTIL_API bool H3DUtil::saveOpenEXRImage( const string &url,
 
     FrameBuffer frameBuffer;
 
+    // OpenEXR stores the rows from top to bottom while the image data
+    // starts with the bottom row, so the rows are written from the last row
+    // of the image data using a negative y stride.
+    ptrdiff_t row_size = (ptrdiff_t) image.rowStride();
     char* image_data = (char*)image.getImageData();
-    int image_width = image.width();
-    int image_height = image.height();
-    char* image_data_flipped = new char[image_width*image_height*bytes_per_pixel];
-
-    for( int i = 0; i<image_width*bytes_per_pixel; ++i ) {
-      for( int j = 0; j<image_height; ++j ){
-        image_data_flipped[i+j*image_width*bytes_per_pixel] = 
-          image_data[i+(image_height-1-j)*bytes_per_pixel*image_width];
-      }
-    }
-
-
-    if ( offsets[0] != -1 ) {
-      frameBuffer.insert ("R",					                                  // name
-		          Slice (IMF::FLOAT,			                                    // type
-              image_data_flipped + offsets[0]*sizeof(float),		// base
-              bytes_per_pixel,		                                        // xStride
-			        bytes_per_pixel * image.width()));	                        // yStride
-    }
-
-    if ( offsets[1] != -1 ) {
-      frameBuffer.insert ("G",					                                  // name
-		          Slice (IMF::FLOAT,			                                    // type
-              image_data_flipped + offsets[1]*sizeof(float),		// base
-			        bytes_per_pixel,		                                        // xStride
-			        bytes_per_pixel * image.width()));	                        // yStride
-    }
-
-    if ( offsets[2] != -1 ) {
-      frameBuffer.insert ("B",					                                  // name
-		          Slice (IMF::FLOAT,			                                    // type
-              image_data_flipped + offsets[2]*sizeof(float),		// base
-			        bytes_per_pixel,		                                        // xStride
-			        bytes_per_pixel * image.width()));	                        // yStride
-    }
-
-    if ( offsets[3] != -1 ) {
-      frameBuffer.insert ("A",					                                  // name
-		          Slice (IMF::FLOAT,			                                    // type
-              image_data_flipped + offsets[3]*sizeof(float),		// base
-			        bytes_per_pixel,		                                        // xStride
-			        bytes_per_pixel * image.width()));	                        // yStride
+    vector< char > packed_data;
+    if( !image_data ) {
+      packed_data.resize( (size_t) bytes_per_pixel * image.width() *
+                          image.height() );
+      image.getPackedSlices( 0, 1, &packed_data[0] );
+      image_data = &packed_data[0];
+      row_size = (ptrdiff_t) bytes_per_pixel * image.width();
     }
+    insertOpenEXRSlices( frameBuffer, IMF::FLOAT, offsets,
+                         image_data + row_size * ( image.height() - 1 ),
+                         bytes_per_pixel, -row_size );
 
     file.setFrameBuffer (frameBuffer);
     file.writePixels (image.height());
-    delete[] image_data_flipped;
   } catch ( const std::exception& e ) {
     Console(LogLevel::Error) << e.what() << endl;
     return false;
@@ -1011,112 +1782,231 @@ H3DUTIL_API bool H3DUtil::saveOpenEXRImage( const string &url,
   return true;
 }
 
+// Load an OpenEXR image. If use_region is true only the given region is
+// loaded, with region_x and region_y given from the bottom left corner of
+// the image.
+// An OpenEXR input stream reading a file in memory. OpenEXR uses the data
+// in place through readMemoryMapped.
+class OpenEXRMemoryStream: public IMF::IStream {
+public:
+  OpenEXRMemoryStream( const void *_data, size_t _size ) :
+    IMF::IStream( "<memory>" ),
+    data( static_cast< const char * >( _data ) ),
+    size( _size ),
+    pos( 0 ) {}
+
+  virtual bool isMemoryMapped() const { return true; }
+
+  virtual bool read( char c[], int n ) {
+    memcpy( c, readMemoryMapped( n ), n );
+    return pos < size;
+  }
 
-H3DUTIL_API Image* H3DUtil::loadOpenEXRImage ( const string &url ) {
+  virtual char *readMemoryMapped( int n ) {
+    if( n < 0 || pos > size || (size_t) n > size - pos ) {
+      throw IEX_NAMESPACE::InputExc( "Unexpected end of file." );
+    }
+    char *p = const_cast< char * >( data ) + pos;
+    pos += n;
+    return p;
+  }
 
-  try {
+  virtual IMF::Int64 tellg() { return pos; }
 
-    InputFile file (url.c_str());
-    // The InputFile class cause something that looks like memory leaks.
-    // It is most probably just some static intialization that is caught a bit to early when exiting.
-    // Either way the "memory leak" seems to not grow when exiting. It might for programs that frequently
-    // load and unload H3DUtil but H3DUtil is not intended for that.
-    // See http://lists.nongnu.org/archive/html/openexr-devel/2013-11/msg00003.html
+  virtual void seekg( IMF::Int64 p ) { pos = (size_t) p; }
 
-    Box2i dw = file.header().dataWindow();
-    
-    int width  = dw.max.x - dw.min.x + 1;
-    int height = dw.max.y - dw.min.y + 1;
+protected:
+  const char *data;
+  size_t size;
+  size_t pos;
+};
 
-    FrameBuffer frameBuffer;
+// An OpenEXR input stream reading from a std::istream.
+class OpenEXRStdIStream: public IMF::IStream {
+public:
+  OpenEXRStdIStream( istream &_is ) :
+    IMF::IStream( "<stream>" ),
+    is( _is ) {}
+
+  virtual bool read( char c[], int n ) {
+    is.read( c, n );
+    if( is.gcount() != n ) {
+      throw IEX_NAMESPACE::InputExc( "Unexpected end of file." );
+    }
+    return is.good();
+  }
 
-    const Channel* r= file.header().channels().findChannel ( "R" );
-    const Channel* g= file.header().channels().findChannel ( "G" );
-    const Channel* b= file.header().channels().findChannel ( "B" );
-    const Channel* a= file.header().channels().findChannel ( "A" );
+  virtual IMF::Int64 tellg() { return (IMF::Int64) streamoff( is.tellg() ); }
 
-    int bytes_per_pixel= 0;
+  virtual void seekg( IMF::Int64 p ) { is.seekg( (streamoff) p ); }
 
-    if ( r ) bytes_per_pixel+= pixelTypeSize ( r->type );
-    if ( g ) bytes_per_pixel+= pixelTypeSize ( g->type );
-    if ( b ) bytes_per_pixel+= pixelTypeSize ( b->type );
-    if ( a ) bytes_per_pixel+= pixelTypeSize ( a->type );
+  virtual void clear() { is.clear(); }
 
-    Image::PixelType pixel_type;
-    if ( r && g && b && !a ) {
-      pixel_type= Image::RGB;
-    } else if ( r && g && b && a ) {
-      pixel_type= Image::RGBA;
-    } else {
-      Console(LogLevel::Error) << "Error: Only RGB and RGBA images are supported!" << endl;
-      return NULL;
-    }
+protected:
+  istream &is;
+};
 
-    char *data = 
-        new char[ width * height * bytes_per_pixel ];
+// Load an OpenEXR image from an opened file. url is used in error
+// messages.
+Image* loadOpenEXRInputFile( InputFile &file,
+                             const string &url,
+                             bool use_region,
+                             int region_x,
+                             int region_y,
+                             int region_width,
+                             int region_height ) {
+  Box2i dw = file.header().dataWindow();
   
-    if ( r ) {
-      frameBuffer.insert ("R",					    // name
-        Slice (r->type,			                // type
-			         data,	                      // base
-			         bytes_per_pixel,	            // xStride
-			         bytes_per_pixel * width ) );	// fillValue
-    }
-    if ( g ) {
-      frameBuffer.insert ("G",					    // name
-        Slice (r->type,			                // type
-               // base
-			         data + pixelTypeSize ( r->type ),
-			         bytes_per_pixel,	            // xStride
-			         bytes_per_pixel * width ) );	// fillValue
-    }
-    if ( b ) {
-      frameBuffer.insert ("B",					    // name
-        Slice (r->type,			                // type
-			         // base
-			         data + pixelTypeSize ( r->type ) 
-                    + pixelTypeSize ( g->type ),
-			         bytes_per_pixel,	            // xStride
-			         bytes_per_pixel * width ) );	// fillValue
-    }
-    if ( a ) {
-      frameBuffer.insert ("A",					    // name
-        Slice (r->type,			                // type
-			         // base
-			         data + pixelTypeSize ( r->type ) 
-                    + pixelTypeSize ( g->type ) 
-                    + pixelTypeSize ( b->type ),
-			         bytes_per_pixel,	            // xStride
-			         bytes_per_pixel * width ) );	// fillValue
+  int file_width  = dw.max.x - dw.min.x + 1;
+  int file_height = dw.max.y - dw.min.y + 1;
+
+  int x0 = 0, y0 = 0;
+  int width = file_width, height = file_height;
+  if( use_region ) {
+    if( region_x < 0 || region_y < 0 ||
+        region_width <= 0 || region_height <= 0 ||
+        region_x + region_width > file_width ||
+        region_y + region_height > file_height ) {
+      Console(LogLevel::Error) << "Error: Region outside of OpenEXR image "
+                               << url << "." << endl;
+      return NULL;
     }
+    x0 = region_x;
+    y0 = region_y;
+    width = region_width;
+    height = region_height;
+  }
+
+  const Channel* r= file.header().channels().findChannel ( "R" );
+  const Channel* g= file.header().channels().findChannel ( "G" );
+  const Channel* b= file.header().channels().findChannel ( "B" );
+  const Channel* a= file.header().channels().findChannel ( "A" );
+
+  Image::PixelType pixel_type;
+  int offsets[4] = { 0, 1, 2, -1 };
+  if ( r && g && b && !a ) {
+    pixel_type= Image::RGB;
+  } else if ( r && g && b && a ) {
+    pixel_type= Image::RGBA;
+    offsets[3] = 3;
+  } else {
+    Console(LogLevel::Error) << "Error: Only RGB and RGBA images are supported!" << endl;
+    return NULL;
+  }
+
+  // all channels are read with the same type, half if all channels are
+  // half and float otherwise. OpenEXR converts the values when reading.
+  IMF::PixelType type = IMF::HALF;
+  if( r->type != IMF::HALF || g->type != IMF::HALF || b->type != IMF::HALF ||
+      ( a && a->type != IMF::HALF ) ) {
+    type = IMF::FLOAT;
+  }
+
+  size_t bytes_per_pixel = pixelTypeSize( type ) * ( a ? 4 : 3 );
+  ptrdiff_t row_size = (ptrdiff_t)( bytes_per_pixel * width );
+
+  char *data = 
+      new char[ row_size * height ];
+
+  // the rows in data window coordinates of the region to read.
+  int first_row = dw.max.y - y0 - height + 1;
+  int last_row = dw.max.y - y0;
+
+  FrameBuffer frameBuffer;
+  if( width == file_width ) {
+    // OpenEXR reads the rows from top to bottom while the image data
+    // starts with the bottom row, so the rows are read directly into
+    // their place using a negative y stride.
+    char *base = data - (ptrdiff_t)bytes_per_pixel * dw.min.x +
+                 row_size * last_row;
+    insertOpenEXRSlices( frameBuffer, type, offsets, base,
+                         bytes_per_pixel, -row_size );
     file.setFrameBuffer (frameBuffer);
-    file.readPixels (dw.min.y, dw.max.y);
-    
-    
-    // openexr read data from top to bottom in y direction, 
-    // need to flip the data in y direction
-    char* data_flipped = new char[ width * height * bytes_per_pixel ];
-
-    for( int i = 0; i<width*bytes_per_pixel; ++i ) {
-      for( int j = 0; j<height; ++j ){
-        data_flipped[i+j*width*bytes_per_pixel] = 
-          data[i+(height-1-j)*bytes_per_pixel*width];
+    file.readPixels (first_row, last_row);
+  } else {
+    // OpenEXR writes whole rows of the data window so the rows are read
+    // in bands into a buffer from which the region is copied.
+    const int band_height = 64;
+    ptrdiff_t file_row_size = (ptrdiff_t)( bytes_per_pixel * file_width );
+    vector< char > band( file_row_size * H3DMin( band_height, height ) );
+    for( int row = first_row; row <= last_row; row += band_height ) {
+      int band_end = H3DMin( row + band_height - 1, last_row );
+      char *base = &band[0] - (ptrdiff_t)bytes_per_pixel * dw.min.x -
+                   file_row_size * row;
+      insertOpenEXRSlices( frameBuffer, type, offsets, base,
+                           bytes_per_pixel, file_row_size );
+      file.setFrameBuffer (frameBuffer);
+      file.readPixels (row, band_end);
+      for( int y = row; y <= band_end; ++y ) {
+        memcpy( data + ( last_row - y ) * row_size,
+                &band[0] + ( y - row ) * file_row_size +
+                x0 * bytes_per_pixel,
+                row_size );
       }
     }
-    delete[] data;
-    return new PixelImage( width,
-                           height,
-                           1,
-                           bytes_per_pixel*8,
-                           pixel_type,
-                           Image::RATIONAL,
-                           (unsigned char*)data_flipped );
+  }
+
+  return new PixelImage( width,
+                         height,
+                         1,
+                         (unsigned int) bytes_per_pixel*8,
+                         pixel_type,
+                         Image::RATIONAL,
+                         (unsigned char*)data );
+}
+
+// Load an OpenEXR image from stream, or from url if stream is NULL. url is
+// used in error messages in both cases.
+Image* loadOpenEXRImageInternal( const string &url,
+                                 IMF::IStream *stream,
+                                 bool use_region,
+                                 int region_x,
+                                 int region_y,
+                                 int region_width,
+                                 int region_height ) {
+  initOpenEXRThreads();
 
+  try {
+    // The InputFile class cause something that looks like memory leaks.
+    // It is most probably just some static intialization that is caught a bit to early when exiting.
+    // Either way the "memory leak" seems to not grow when exiting. It might for programs that frequently
+    // load and unload H3DUtil but H3DUtil is not intended for that.
+    // See http://lists.nongnu.org/archive/html/openexr-devel/2013-11/msg00003.html
+    if( stream ) {
+      InputFile file( *stream );
+      return loadOpenEXRInputFile( file, url, use_region,
+                                   region_x, region_y,
+                                   region_width, region_height );
+    }
+    InputFile file( url.c_str() );
+    return loadOpenEXRInputFile( file, url, use_region,
+                                 region_x, region_y,
+                                 region_width, region_height );
   } catch ( const std::exception& e ) {
     Console(LogLevel::Error) << e.what() << endl;
     return NULL;
   }
 }
+
+H3DUTIL_API Image* H3DUtil::loadOpenEXRImage ( const string &url ) {
+  return loadOpenEXRImageInternal( url, NULL, false, 0, 0, 0, 0 );
+}
+
+H3DUTIL_API Image* H3DUtil::loadOpenEXRImage( const void *data, size_t size ) {
+  OpenEXRMemoryStream stream( data, size );
+  return loadOpenEXRImageInternal( "<memory>", &stream, false, 0, 0, 0, 0 );
+}
+
+H3DUTIL_API Image* H3DUtil::loadOpenEXRImage( istream &is ) {
+  OpenEXRStdIStream stream( is );
+  return loadOpenEXRImageInternal( "<stream>", &stream, false, 0, 0, 0, 0 );
+}
+
+H3DUTIL_API Image* H3DUtil::loadOpenEXRImage ( const string &url,
+                                               int x, int y,
+                                               int width, int height ) {
+  return loadOpenEXRImageInternal( url, NULL, true, x, y, width, height );
+}
 #endif
 
 // Structures from DDS file format
@@ -1168,7 +2058,11 @@ H3DUTIL_API Image* H3DUtil::loadDDSImage( const std::string &url ) {
   return loadDDSImage( is, url );
 }
 
-H3DUTIL_API Image* H3DUtil::loadDDSImage( std::istream &is, const std::string& url ) {
+// Read the header of a DDS file and put the properties of the image in
+// info. block_size is set to the number of bytes per block of 4x4 pixels.
+// Returns false if the format is not supported.
+bool readDDSHeader( istream &is, const string &url,
+                    ImageFileInfo &info, int &block_size ) {
   // DDS contants
 
   // Magic number
@@ -1210,7 +2104,7 @@ H3DUTIL_API Image* H3DUtil::loadDDSImage( std::istream &is, const std::string& u
   if( !is || magic_no != dds_magic_no ) {
     // Not a DDS file
     Console( LogLevel::Error ) << "loadDDSImage(): Not a DSS file " << url << endl;
-    return NULL;
+    return false;
   }
 
   // Read header
@@ -1221,7 +2115,7 @@ H3DUTIL_API Image* H3DUtil::loadDDSImage( std::istream &is, const std::string& u
   Image::CompressionType type = Image::NO_COMPRESSION;
   Image::PixelType pixel_type = Image::RGBA;
   Image::PixelComponentType pixel_component_type = Image::UNSIGNED;
-  int block_size = 0;
+  block_size = 0;
 
   if( header.pixelFormat.flags & dds_fourcc ) {
     switch( header.pixelFormat.fourCC ) {
@@ -1348,28 +2242,425 @@ H3DUTIL_API Image* H3DUtil::loadDDSImage( std::istream &is, const std::string& u
 
       Console( LogLevel::Error )
         << "loadDDSImage(): Unhandled compressed format: " << buf << " (0x" << hex << header.pixelFormat.fourCC << ") in " << url << endl;
-      return NULL;
+      return false;
     }
   } else {
     // Only compressed formats are handled now
     Console( LogLevel::Error ) << "Unhandled format in " << url << endl;
-    return NULL;
+    return false;
   }
 
-  // Read pixel data
   int size = ((header.width + 3) / 4)*((header.height + 3) / 4) * block_size;
+  info.format = ImageFileInfo::DDS_FORMAT;
+  info.width = header.width;
+  info.height = header.height;
+  info.depth = 1;
+  info.bits_per_pixel = 
+    int( 8 * (float( size ) / (header.width*header.height)) );
+  info.pixel_type = pixel_type;
+  info.pixel_component_type = pixel_component_type;
+  info.compression_type = type;
+  info.pixel_size = Vec3f( 0, 0, 0 );
+  return true;
+}
+
+H3DUTIL_API Image* H3DUtil::loadDDSImage( std::istream &is, const std::string& url ) {
+  ImageFileInfo info;
+  int block_size;
+  if( !readDDSHeader( is, url, info, block_size ) ) return NULL;
+
+  // Read pixel data
+  int size = ((info.width + 3) / 4)*((info.height + 3) / 4) * block_size;
   char* buffer = new char[size];
   is.read( buffer, size );
 
-  int bits_per_pixel = int( 8 * (float( size ) / (header.width*header.height)) );
-
   return new PixelImage(
-    header.width,
-    header.height,
+    info.width,
+    info.height,
     1,
-    bits_per_pixel,
-    pixel_type,
-    pixel_component_type,
+    info.bits_per_pixel,
+    info.pixel_type,
+    info.pixel_component_type,
     (unsigned char*)buffer,
-    false, Vec3f( 0, 0, 0 ), type );
-}
\ No newline at end of file
+    false, info.pixel_size, info.compression_type );
+}
+
+H3DUTIL_API Image* H3DUtil::loadDDSImage( const void *data, size_t size ) {
+  MemoryInputStream is( data, size );
+  return loadDDSImage( is, "<memory>" );
+}
+
+#ifdef HAVE_FREEIMAGE
+// Get the properties of the image loadFreeImage gives for a file. Only the
+// header is read if FreeImage supports that for the format, otherwise the
+// image is loaded.
+bool probeFreeImage( const string &url, ImageFileInfo &info ) {
+  FREE_IMAGE_FORMAT format = FreeImage_GetFileType( url.c_str() );
+  if( format == FIF_UNKNOWN ) {
+    format = FreeImage_GetFIFFromFilename( url.c_str() );
+  }
+  if( format == FIF_UNKNOWN || !FreeImage_FIFSupportsReading( format ) ) {
+    return false;
+  }
+
+  FIBITMAP *bm = NULL;
+#ifdef FIF_LOAD_NOPIXELS
+  if( FreeImage_FIFSupportsNoPixels( format ) ) {
+    bm = FreeImage_Load( format, url.c_str(), FIF_LOAD_NOPIXELS );
+  }
+#endif
+
+  Image *image = NULL;
+  if( bm ) {
+    FREE_IMAGE_COLOR_TYPE t = FreeImage_GetColorType( bm );
+    if( t == FIC_PALETTE ) {
+      // expanded to RGB or RGBA by loadFreeImage.
+      bool is_transparent = FreeImage_GetTransparencyCount( bm ) > 0;
+      info.width = FreeImage_GetWidth( bm );
+      info.height = FreeImage_GetHeight( bm );
+      info.depth = 1;
+      info.bits_per_pixel = is_transparent ? 32 : 24;
+      info.pixel_type = is_transparent ? Image::RGBA : Image::RGB;
+      info.pixel_component_type = Image::UNSIGNED;
+      FreeImage_Unload( bm );
+      info.format = ImageFileInfo::FREEIMAGE_FORMAT;
+      return true;
+    }
+    // 32 bit RGB images are converted to 24 bits by loadFreeImage.
+    bool rgb_32 = t == FIC_RGB && FreeImage_GetBPP( bm ) == 32;
+    try {
+      image = new FreeImageImage( bm );
+    } catch( const Exception::H3DException & ) {
+      FreeImage_Unload( bm );
+      return false;
+    }
+    info.bits_per_pixel = rgb_32 ? 24 : image->bitsPerPixel();
+  } else {
+    image = loadFreeImage( url );
+    if( !image ) return false;
+    info.bits_per_pixel = image->bitsPerPixel();
+  }
+  info.format = ImageFileInfo::FREEIMAGE_FORMAT;
+  info.width = image->width();
+  info.height = image->height();
+  info.depth = image->depth();
+  info.pixel_type = image->pixelType();
+  info.pixel_component_type = image->pixelComponentType();
+  info.pixel_size = image->pixelSize();
+  delete image;
+  return true;
+}
+#endif
+
+#ifdef HAVE_DCMTK
+// The number of bits needed for the values in [min_value, max_value],
+// including a sign bit if min_value is negative.
+unsigned int dicomRangeToBits( double min_value, double max_value ) {
+  double magnitude = max_value;
+  if( min_value < 0 ) magnitude = H3DMax( magnitude, -min_value - 1 );
+  unsigned int bits = 1;
+  while( bits < 64 && magnitude >= pow( 2.0, (double) bits ) ) ++bits;
+  return min_value < 0 ? bits + 1 : bits;
+}
+
+// Get the properties of the image loadDicomFile gives for a single file
+// from the header of the file. The number of bits of the rendered values
+// is found from the range of the stored values after the modality
+// rescaling, in the same way as DCMTK does.
+bool probeDicomFile( const string &url, ImageFileInfo &info ) {
+  // elements larger than this are not loaded.
+  const Uint32 max_read_length = 4096;
+  DcmFileFormat fileformat;
+#if OFFIS_DCMTK_VERSION_NUMBER >= 361
+  OFCondition res = fileformat.loadFileUntilTag( url.c_str(),
+                                                 EXS_Unknown,
+                                                 EGL_noChange,
+                                                 max_read_length,
+                                                 ERM_autoDetect,
+                                                 DCM_PixelData );
+#else
+  OFCondition res = fileformat.loadFile( url.c_str(),
+                                         EXS_Unknown,
+                                         EGL_noChange,
+                                         max_read_length,
+                                         ERM_autoDetect );
+#endif
+  if( res.bad() ) return false;
+  DcmDataset *dataset = fileformat.getDataset();
+
+  Uint16 rows, columns;
+  if( dataset->findAndGetUint16( DCM_Rows, rows ).bad() ||
+      dataset->findAndGetUint16( DCM_Columns, columns ).bad() ) {
+    return false;
+  }
+  Sint32 nr_frames;
+  if( dataset->findAndGetSint32( DCM_NumberOfFrames, nr_frames ).bad() ||
+      nr_frames < 1 ) {
+    nr_frames = 1;
+  }
+  Uint16 samples_per_pixel, bits_stored, pixel_representation;
+  if( dataset->findAndGetUint16( DCM_SamplesPerPixel,
+                                 samples_per_pixel ).bad() ) {
+    samples_per_pixel = 1;
+  }
+  if( dataset->findAndGetUint16( DCM_BitsStored, bits_stored ).bad() &&
+      dataset->findAndGetUint16( DCM_BitsAllocated, bits_stored ).bad() ) {
+    return false;
+  }
+  if( dataset->findAndGetUint16( DCM_PixelRepresentation,
+                                 pixel_representation ).bad() ) {
+    pixel_representation = 0;
+  }
+
+  unsigned int bits;
+  if( samples_per_pixel == 1 ) {
+    double min_value = 0;
+    double max_value = pow( 2.0, (double) bits_stored ) - 1;
+    if( pixel_representation == 1 ) {
+      min_value = -pow( 2.0, (double)( bits_stored - 1 ) );
+      max_value = -min_value - 1;
+    }
+    Float64 slope, intercept;
+    if( dataset->findAndGetFloat64( DCM_RescaleSlope, slope ).bad() )
+      slope = 1;
+    if( dataset->findAndGetFloat64( DCM_RescaleIntercept, intercept ).bad() )
+      intercept = 0;
+    if( slope != 0 && ( slope != 1 || intercept != 0 ) ) {
+      double a = min_value * slope + intercept;
+      double b = max_value * slope + intercept;
+      min_value = H3DMin( a, b );
+      max_value = H3DMax( a, b );
+    }
+    bits = dicomRangeToBits( min_value, max_value );
+  } else {
+    bits = bits_stored;
+  }
+  if( !isPowerOfTwo( bits ) ) bits = nextPowerOfTwo( bits );
+
+  double size_x, size_y, size_z;
+  if( dataset->findAndGetFloat64( DCM_PixelSpacing, size_x, 0 ).bad() )
+    size_x = 1;
+  if( dataset->findAndGetFloat64( DCM_PixelSpacing, size_y, 1 ).bad() )
+    size_y = 1;
+  if( dataset->findAndGetFloat64( DCM_SliceThickness, size_z ).bad() )
+    size_z = 1;
+
+  info.format = ImageFileInfo::DICOM_FORMAT;
+  info.width = columns;
+  info.height = rows;
+  info.depth = nr_frames;
+  info.pixel_component_type = Image::UNSIGNED;
+  if( samples_per_pixel == 1 ) {
+    info.pixel_type = Image::LUMINANCE;
+    info.bits_per_pixel = bits;
+  } else {
+    info.pixel_type = Image::RGB;
+    info.bits_per_pixel = bits * 3;
+  }
+  info.pixel_size = Vec3f( (H3DFloat) size_x,
+                           (H3DFloat) size_y,
+                           (H3DFloat) size_z ) * 0.001;
+  return true;
+}
+#endif
+
+#ifdef HAVE_OPENEXR
+// Get the properties of the image loadOpenEXRImage gives for a file from
+// the header of the file.
+bool probeOpenEXRImage( const string &url, ImageFileInfo &info ) {
+  try {
+    InputFile file( url.c_str() );
+    Box2i dw = file.header().dataWindow();
+    const ChannelList &channels = file.header().channels();
+    const Channel *r = channels.findChannel( "R" );
+    const Channel *g = channels.findChannel( "G" );
+    const Channel *b = channels.findChannel( "B" );
+    const Channel *a = channels.findChannel( "A" );
+    if( !r || !g || !b ) return false;
+    bool half = r->type == IMF::HALF && g->type == IMF::HALF &&
+      b->type == IMF::HALF && ( !a || a->type == IMF::HALF );
+
+    info.format = ImageFileInfo::OPENEXR_FORMAT;
+    info.width = dw.max.x - dw.min.x + 1;
+    info.height = dw.max.y - dw.min.y + 1;
+    info.depth = 1;
+    info.pixel_type = a ? Image::RGBA : Image::RGB;
+    info.bits_per_pixel = ( half ? 16 : 32 ) * ( a ? 4 : 3 );
+    info.pixel_component_type = Image::RATIONAL;
+    info.pixel_size = Vec3f( 0, 0, 0 );
+    return true;
+  } catch( const std::exception & ) {
+    return false;
+  }
+}
+#endif
+
+// Find the format of the file starting with the given 132 bytes, zero
+// padded if the file is shorter, from the magic numbers of the formats
+// that have them.
+ImageFileInfo::Format findImageFormat( const unsigned char *magic ) {
+  if( memcmp( magic, "NRRD", 4 ) == 0 ) {
+    return ImageFileInfo::NRRD_FORMAT;
+  } else if( memcmp( magic, "H3DBVOL\n", 8 ) == 0 ) {
+    return ImageFileInfo::BRICKED_VOLUME_FORMAT;
+  } else if( memcmp( magic, "DDS ", 4 ) == 0 ) {
+    return ImageFileInfo::DDS_FORMAT;
+  }
+#ifdef HAVE_OPENEXR
+  if( magic[0] == 0x76 && magic[1] == 0x2f &&
+      magic[2] == 0x31 && magic[3] == 0x01 ) {
+    return ImageFileInfo::OPENEXR_FORMAT;
+  }
+#endif
+#ifdef HAVE_DCMTK
+  if( memcmp( magic + 128, "DICM", 4 ) == 0 ) {
+    return ImageFileInfo::DICOM_FORMAT;
+  }
+#endif
+  return ImageFileInfo::UNKNOWN_FORMAT;
+}
+
+// Find the format of an image file from its first bytes, or with
+// FreeImage.
+ImageFileInfo::Format findImageFileFormat( const string &url ) {
+  ifstream is( url.c_str(), ios::in | ios::binary );
+  if( !is ) return ImageFileInfo::UNKNOWN_FORMAT;
+  unsigned char magic[132];
+  memset( magic, 0, sizeof( magic ) );
+  is.read( (char *) magic, sizeof( magic ) );
+
+  ImageFileInfo::Format file_format = findImageFormat( magic );
+  if( file_format != ImageFileInfo::UNKNOWN_FORMAT ) return file_format;
+#ifdef HAVE_FREEIMAGE
+  FREE_IMAGE_FORMAT format = FreeImage_GetFileType( url.c_str() );
+  if( format == FIF_UNKNOWN ) {
+    format = FreeImage_GetFIFFromFilename( url.c_str() );
+  }
+  if( format != FIF_UNKNOWN && FreeImage_FIFSupportsReading( format ) ) {
+    return ImageFileInfo::FREEIMAGE_FORMAT;
+  }
+#endif
+  return ImageFileInfo::UNKNOWN_FORMAT;
+}
+
+ImageFileInfo H3DUtil::probeImage( const string &url ) {
+  ImageFileInfo info;
+  bool success = false;
+  switch( findImageFileFormat( url ) ) {
+  case ImageFileInfo::NRRD_FORMAT: {
+    NrrdReader reader;
+    if( reader.open( url ) ) {
+      info.width = reader.width();
+      info.height = reader.height();
+      info.depth = reader.depth();
+      info.bits_per_pixel = reader.bitsPerPixel();
+      info.pixel_type = reader.pixelType();
+      info.pixel_component_type = reader.pixelComponentType();
+      info.pixel_size = reader.pixelSize();
+      info.format = ImageFileInfo::NRRD_FORMAT;
+      success = true;
+    }
+#ifdef HAVE_TEEM
+    else if( reader.hasUnsupportedFeature() ) {
+      Nrrd *nin = loadNrrdHeaderTeem( url, info );
+      if( nin ) nrrdNuke( nin );
+      success = nin != NULL;
+    }
+#endif
+    break;
+  }
+  case ImageFileInfo::BRICKED_VOLUME_FORMAT: {
+    BrickedVolumeReader reader;
+    if( reader.open( url ) ) {
+      info.width = reader.width();
+      info.height = reader.height();
+      info.depth = reader.depth();
+      info.bits_per_pixel = reader.bitsPerPixel();
+      info.pixel_type = reader.pixelType();
+      info.pixel_component_type = reader.pixelComponentType();
+      info.pixel_size = reader.pixelSize();
+      info.format = ImageFileInfo::BRICKED_VOLUME_FORMAT;
+      success = true;
+    }
+    break;
+  }
+  case ImageFileInfo::DDS_FORMAT: {
+    ifstream is( url.c_str(), ios::in | ios::binary );
+    int block_size;
+    success = readDDSHeader( is, url, info, block_size );
+    break;
+  }
+#ifdef HAVE_OPENEXR
+  case ImageFileInfo::OPENEXR_FORMAT:
+    success = probeOpenEXRImage( url, info );
+    break;
+#endif
+#ifdef HAVE_DCMTK
+  case ImageFileInfo::DICOM_FORMAT:
+    success = probeDicomFile( url, info );
+    break;
+#endif
+#ifdef HAVE_FREEIMAGE
+  case ImageFileInfo::FREEIMAGE_FORMAT:
+    success = probeFreeImage( url, info );
+    break;
+#endif
+  default:
+    break;
+  }
+
+  if( !success ) return ImageFileInfo();
+  return info;
+}
+
+Image *H3DUtil::loadImage( const string &url ) {
+  switch( findImageFileFormat( url ) ) {
+#ifdef HAVE_FREEIMAGE
+  case ImageFileInfo::FREEIMAGE_FORMAT: return loadFreeImage( url );
+#endif
+  case ImageFileInfo::NRRD_FORMAT: return loadNrrdFile( url );
+  case ImageFileInfo::BRICKED_VOLUME_FORMAT:
+    return loadBrickedVolumeFile( url );
+#ifdef HAVE_DCMTK
+  case ImageFileInfo::DICOM_FORMAT: return loadDicomFile( url );
+#endif
+#ifdef HAVE_OPENEXR
+  case ImageFileInfo::OPENEXR_FORMAT: return loadOpenEXRImage( url );
+#endif
+  case ImageFileInfo::DDS_FORMAT: return loadDDSImage( url );
+  default: return NULL;
+  }
+}
+
+Image *H3DUtil::loadImage( const void *data, size_t size ) {
+  unsigned char magic[132];
+  memset( magic, 0, sizeof( magic ) );
+  memcpy( magic, data, H3DMin( size, sizeof( magic ) ) );
+
+  switch( findImageFormat( magic ) ) {
+  case ImageFileInfo::NRRD_FORMAT: return loadNrrdFile( data, size );
+  case ImageFileInfo::BRICKED_VOLUME_FORMAT:
+    return loadBrickedVolumeFile( data, size );
+#ifdef HAVE_DCMTK
+  case ImageFileInfo::DICOM_FORMAT:
+    return loadDicomFileFromMemory( data, size );
+#endif
+#ifdef HAVE_OPENEXR
+  case ImageFileInfo::OPENEXR_FORMAT: return loadOpenEXRImage( data, size );
+#endif
+  case ImageFileInfo::DDS_FORMAT: return loadDDSImage( data, size );
+  default:
+#ifdef HAVE_FREEIMAGE
+    // loadFreeImage finds the format of the data itself.
+    return loadFreeImage( data, size );
+#else
+    return NULL;
+#endif
+  }
+}
+
+Image *H3DUtil::loadImage( istream &is ) {
+  vector< unsigned char > data;
+  if( !readWholeStream( is, data ) ) return NULL;
+  return loadImage( &data[0], data.size() );
+}
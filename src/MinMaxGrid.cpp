@@ -0,0 +1,471 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file MinMaxGrid.cpp
+/// \brief CPP file for MinMaxGrid.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/MinMaxGrid.h>
+#include <H3DUtil/Threads.h>
+
+#include <limits>
+#include <cmath>
+
+using namespace H3DUtil;
+
+namespace MinMaxGridInternals {
+  // The state of a MinMaxGrid::computeBlocks call.
+  struct BlockRows {
+    MinMaxGrid *grid;
+    unsigned int level;
+    unsigned int x0, x1, y0, z0;
+    unsigned int nr_rows_y;
+  };
+}
+
+using namespace MinMaxGridInternals;
+
+template< class T >
+void VoxelValueReader::useStoredValues( ValueType type ) {
+  value_type = type;
+  value_func = &storedValueFunc< T >;
+  row_func = &storedRowFunc< T >;
+}
+
+template< class T >
+H3DFloat VoxelValueReader::storedValueFunc( const VoxelValueReader &reader,
+                                            unsigned int x,
+                                            unsigned int y,
+                                            unsigned int z ) {
+  return (H3DFloat) reader.storedValue< T >( x, y, z );
+}
+
+template< class T >
+void VoxelValueReader::storedRowFunc( const VoxelValueReader &reader,
+                                      unsigned int x,
+                                      unsigned int y,
+                                      unsigned int z,
+                                      unsigned int n,
+                                      H3DFloat *values ) {
+  const unsigned char *p = reader.data + z * reader.slice_stride +
+    y * reader.row_stride + x * reader.pixel_stride;
+  for( unsigned int i = 0; i < n; ++i, p += reader.pixel_stride ) {
+    values[i] = (H3DFloat) *(const T *)p;
+  }
+}
+
+VoxelValueReader::VoxelValueReader( Image *_image,
+                                    unsigned int _component ) :
+  image( _image ),
+  component( _component ),
+  value_type( PIXEL_VALUE ),
+  data( NULL ),
+  pixel_stride( 0 ),
+  row_stride( 0 ),
+  slice_stride( 0 ),
+  value_func( &pixelValueFunc ),
+  row_func( &pixelRowFunc ) {
+  const unsigned char *image_data =
+    (const unsigned char *) image->getImageData();
+  unsigned int nr_components = image->nrPixelComponents();
+  if( !image_data || image->compressionType() != Image::NO_COMPRESSION ||
+      component >= nr_components ||
+      image->bitsPerPixel() % ( 8 * nr_components ) != 0 ) return;
+  unsigned int bytes_per_component =
+    image->bitsPerPixel() / ( 8 * nr_components );
+  data = image_data + component * bytes_per_component;
+  pixel_stride = image->bitsPerPixel() / 8;
+  row_stride = image->rowStride();
+  slice_stride = image->sliceStride();
+  switch( image->pixelComponentType() ) {
+  case Image::UNSIGNED:
+    if( bytes_per_component == 1 )
+      useStoredValues< unsigned char >( UNSIGNED_8 );
+    else if( bytes_per_component == 2 )
+      useStoredValues< unsigned short >( UNSIGNED_16 );
+    else if( bytes_per_component == 4 )
+      useStoredValues< unsigned int >( UNSIGNED_32 );
+    break;
+  case Image::SIGNED:
+    if( bytes_per_component == 1 )
+      useStoredValues< signed char >( SIGNED_8 );
+    else if( bytes_per_component == 2 )
+      useStoredValues< short >( SIGNED_16 );
+    else if( bytes_per_component == 4 )
+      useStoredValues< int >( SIGNED_32 );
+    break;
+  case Image::RATIONAL:
+  case Image::RATIONAL_UNSIGNED:
+    if( bytes_per_component == 4 )
+      useStoredValues< float >( FLOAT_32 );
+    else if( bytes_per_component == 8 )
+      useStoredValues< double >( FLOAT_64 );
+    break;
+  default:
+    break;
+  }
+}
+
+H3DFloat VoxelValueReader::pixelValueFunc( const VoxelValueReader &reader,
+                                           unsigned int x,
+                                           unsigned int y,
+                                           unsigned int z ) {
+  RGBA p = reader.image->getPixel( x, y, z );
+  return reader.component == 0 ? p.r : reader.component == 1 ? p.g :
+    reader.component == 2 ? p.b : p.a;
+}
+
+void VoxelValueReader::pixelRowFunc( const VoxelValueReader &reader,
+                                     unsigned int x,
+                                     unsigned int y,
+                                     unsigned int z,
+                                     unsigned int n,
+                                     H3DFloat *values ) {
+  for( unsigned int i = 0; i < n; ++i ) {
+    values[i] = pixelValueFunc( reader, x + i, y, z );
+  }
+}
+
+MinMaxGrid::MinMaxGrid( Image *_image,
+                        unsigned int _block_size,
+                        unsigned int _component,
+                        unsigned int nr_threads ) :
+  image( _image ),
+  block_size( H3DMax( _block_size, 1u ) ),
+  component( _component ) {
+  initLevels();
+  for( unsigned int l = 0; l < levels.size(); ++l ) {
+    computeBlocks( l, 0, 0, 0,
+                   levels[l].nx - 1, levels[l].ny - 1, levels[l].nz - 1,
+                   nr_threads );
+  }
+}
+
+void MinMaxGrid::initLevels() {
+  levels.clear();
+  Level level;
+  level.nx = H3DMax( ( image->width() + block_size - 1 ) / block_size, 1u );
+  level.ny = H3DMax( ( image->height() + block_size - 1 ) / block_size, 1u );
+  level.nz = H3DMax( ( image->depth() + block_size - 1 ) / block_size, 1u );
+  while( true ) {
+    level.min_values.resize( level.nx * level.ny * level.nz );
+    level.max_values.resize( level.nx * level.ny * level.nz );
+    levels.push_back( level );
+    if( level.nx == 1 && level.ny == 1 && level.nz == 1 ) break;
+    level.nx = ( level.nx + 1 ) / 2;
+    level.ny = ( level.ny + 1 ) / 2;
+    level.nz = ( level.nz + 1 ) / 2;
+  }
+}
+
+void MinMaxGrid::computeBlock( unsigned int x, unsigned int y,
+                               unsigned int z ) {
+  // include the voxels on the upper border of the block.
+  unsigned int x0 = x * block_size, y0 = y * block_size, z0 = z * block_size;
+  unsigned int x1 = H3DMin( x0 + block_size, image->width() - 1 );
+  unsigned int y1 = H3DMin( y0 + block_size, image->height() - 1 );
+  unsigned int z1 = H3DMin( z0 + block_size, image->depth() - 1 );
+
+  VoxelValueReader reader( image, component );
+  std::vector< H3DFloat > values( x1 - x0 + 1 );
+  H3DFloat mn = std::numeric_limits< H3DFloat >::max();
+  H3DFloat mx = -std::numeric_limits< H3DFloat >::max();
+  for( unsigned int pz = z0; pz <= z1; ++pz ) {
+    for( unsigned int py = y0; py <= y1; ++py ) {
+      reader.row( x0, py, pz, x1 - x0 + 1, &values[0] );
+      for( unsigned int i = 0; i < values.size(); ++i ) {
+        if( values[i] < mn ) mn = values[i];
+        if( values[i] > mx ) mx = values[i];
+      }
+    }
+  }
+
+  Level &l = levels[0];
+  unsigned int i = ( z * l.ny + y ) * l.nx + x;
+  l.min_values[i] = mn;
+  l.max_values[i] = mx;
+}
+
+void MinMaxGrid::combineBlock( unsigned int level, unsigned int x,
+                               unsigned int y, unsigned int z ) {
+  Level &below = levels[ level - 1 ];
+  H3DFloat mn = std::numeric_limits< H3DFloat >::max();
+  H3DFloat mx = -std::numeric_limits< H3DFloat >::max();
+  for( unsigned int cz = 2 * z; cz < H3DMin( 2 * z + 2, below.nz ); ++cz ) {
+    for( unsigned int cy = 2 * y; cy < H3DMin( 2 * y + 2, below.ny ); ++cy ) {
+      for( unsigned int cx = 2 * x; cx < H3DMin( 2 * x + 2, below.nx ); ++cx ) {
+        unsigned int i = ( cz * below.ny + cy ) * below.nx + cx;
+        if( below.min_values[i] < mn ) mn = below.min_values[i];
+        if( below.max_values[i] > mx ) mx = below.max_values[i];
+      }
+    }
+  }
+  Level &l = levels[level];
+  unsigned int i = ( z * l.ny + y ) * l.nx + x;
+  l.min_values[i] = mn;
+  l.max_values[i] = mx;
+}
+
+void MinMaxGrid::computeBlocks( unsigned int level,
+                                unsigned int x0, unsigned int y0,
+                                unsigned int z0,
+                                unsigned int x1, unsigned int y1,
+                                unsigned int z1,
+                                unsigned int nr_threads ) {
+  BlockRows rows;
+  rows.grid = this;
+  rows.level = level;
+  rows.x0 = x0;
+  rows.x1 = x1;
+  rows.y0 = y0;
+  rows.z0 = z0;
+  rows.nr_rows_y = y1 - y0 + 1;
+  parallelFor( 0, ( y1 - y0 + 1 ) * ( z1 - z0 + 1 ), computeBlockRows,
+               &rows, 1, nr_threads );
+}
+
+void MinMaxGrid::computeBlockRows( unsigned int begin,
+                                   unsigned int end,
+                                   void *data ) {
+  BlockRows *rows = static_cast< BlockRows * >( data );
+  MinMaxGrid *grid = rows->grid;
+  for( unsigned int r = begin; r < end; ++r ) {
+    unsigned int y = rows->y0 + r % rows->nr_rows_y;
+    unsigned int z = rows->z0 + r / rows->nr_rows_y;
+    for( unsigned int x = rows->x0; x <= rows->x1; ++x ) {
+      if( rows->level == 0 ) grid->computeBlock( x, y, z );
+      else grid->combineBlock( rows->level, x, y, z );
+    }
+  }
+}
+
+void MinMaxGrid::update( unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int width,
+                         unsigned int height,
+                         unsigned int depth,
+                         unsigned int nr_threads ) {
+  if( width == 0 || height == 0 || depth == 0 ) return;
+  Level &l0 = levels[0];
+  // a voxel on the lower border of a block is also part of the block
+  // below it.
+  unsigned int x0 = x > 0 ? ( x - 1 ) / block_size : 0;
+  unsigned int y0 = y > 0 ? ( y - 1 ) / block_size : 0;
+  unsigned int z0 = z > 0 ? ( z - 1 ) / block_size : 0;
+  unsigned int x1 = H3DMin( ( x + width - 1 ) / block_size, l0.nx - 1 );
+  unsigned int y1 = H3DMin( ( y + height - 1 ) / block_size, l0.ny - 1 );
+  unsigned int z1 = H3DMin( ( z + depth - 1 ) / block_size, l0.nz - 1 );
+  if( x0 > x1 || y0 > y1 || z0 > z1 ) return;
+
+  for( unsigned int l = 0; l < levels.size(); ++l ) {
+    computeBlocks( l, x0, y0, z0, x1, y1, z1, nr_threads );
+    x0 /= 2; y0 /= 2; z0 /= 2;
+    x1 /= 2; y1 /= 2; z1 /= 2;
+  }
+}
+
+bool MinMaxGrid::boxToBlocks( const Vec3f &box_min, const Vec3f &box_max,
+                              unsigned int *b0, unsigned int *b1 ) {
+  unsigned int size[3] = { image->width(), image->height(), image->depth() };
+  unsigned int nr_blocks[3] = { levels[0].nx, levels[0].ny, levels[0].nz };
+  for( unsigned int a = 0; a < 3; ++a ) {
+    H3DFloat lo = H3DMax( box_min[a], (H3DFloat) 0 );
+    H3DFloat hi = H3DMin( box_max[a], (H3DFloat)( size[a] - 1 ) );
+    if( lo > hi ) return false;
+    b0[a] = H3DMin( (unsigned int)( lo / block_size ), nr_blocks[a] - 1 );
+    b1[a] = H3DMin( (unsigned int)( hi / block_size ), nr_blocks[a] - 1 );
+  }
+  return true;
+}
+
+void MinMaxGrid::rangeInBlocks( unsigned int level,
+                                unsigned int x, unsigned int y,
+                                unsigned int z,
+                                const unsigned int *b0,
+                                const unsigned int *b1,
+                                H3DFloat &min_value, H3DFloat &max_value ) {
+  // the level 0 blocks covered by this block.
+  unsigned int c[3] = { x, y, z };
+  bool inside = true;
+  for( unsigned int a = 0; a < 3; ++a ) {
+    unsigned int first = c[a] << level;
+    unsigned int last = ( ( c[a] + 1 ) << level ) - 1;
+    if( last < b0[a] || first > b1[a] ) return;
+    if( first < b0[a] || last > b1[a] ) inside = false;
+  }
+
+  Level &l = levels[level];
+  if( inside || level == 0 ) {
+    unsigned int i = ( z * l.ny + y ) * l.nx + x;
+    if( l.min_values[i] < min_value ) min_value = l.min_values[i];
+    if( l.max_values[i] > max_value ) max_value = l.max_values[i];
+    return;
+  }
+
+  Level &below = levels[ level - 1 ];
+  for( unsigned int cz = 2 * z; cz < H3DMin( 2 * z + 2, below.nz ); ++cz )
+    for( unsigned int cy = 2 * y; cy < H3DMin( 2 * y + 2, below.ny ); ++cy )
+      for( unsigned int cx = 2 * x; cx < H3DMin( 2 * x + 2, below.nx ); ++cx )
+        rangeInBlocks( level - 1, cx, cy, cz, b0, b1, min_value, max_value );
+}
+
+bool MinMaxGrid::blocksMayContain( unsigned int level,
+                                   unsigned int x, unsigned int y,
+                                   unsigned int z,
+                                   const unsigned int *b0,
+                                   const unsigned int *b1,
+                                   H3DFloat low, H3DFloat high ) {
+  unsigned int c[3] = { x, y, z };
+  bool inside = true;
+  for( unsigned int a = 0; a < 3; ++a ) {
+    unsigned int first = c[a] << level;
+    unsigned int last = ( ( c[a] + 1 ) << level ) - 1;
+    if( last < b0[a] || first > b1[a] ) return false;
+    if( first < b0[a] || last > b1[a] ) inside = false;
+  }
+
+  if( !blockMayContain( level, x, y, z, low, high ) ) return false;
+  if( inside || level == 0 ) return true;
+
+  Level &below = levels[ level - 1 ];
+  for( unsigned int cz = 2 * z; cz < H3DMin( 2 * z + 2, below.nz ); ++cz )
+    for( unsigned int cy = 2 * y; cy < H3DMin( 2 * y + 2, below.ny ); ++cy )
+      for( unsigned int cx = 2 * x; cx < H3DMin( 2 * x + 2, below.nx ); ++cx )
+        if( blocksMayContain( level - 1, cx, cy, cz, b0, b1, low, high ) )
+          return true;
+  return false;
+}
+
+bool MinMaxGrid::getRange( const Vec3f &box_min, const Vec3f &box_max,
+                           H3DFloat &min_value, H3DFloat &max_value ) {
+  unsigned int b0[3], b1[3];
+  if( !boxToBlocks( box_min, box_max, b0, b1 ) ) return false;
+  min_value = std::numeric_limits< H3DFloat >::max();
+  max_value = -std::numeric_limits< H3DFloat >::max();
+  rangeInBlocks( nrLevels() - 1, 0, 0, 0, b0, b1, min_value, max_value );
+  return true;
+}
+
+bool MinMaxGrid::mayContain( const Vec3f &box_min, const Vec3f &box_max,
+                             H3DFloat low, H3DFloat high ) {
+  unsigned int b0[3], b1[3];
+  if( !boxToBlocks( box_min, box_max, b0, b1 ) ) return false;
+  return blocksMayContain( nrLevels() - 1, 0, 0, 0, b0, b1, low, high );
+}
+
+bool MinMaxGrid::nextInterval( const Vec3f &origin, const Vec3f &direction,
+                               H3DFloat t_start, H3DFloat t_end,
+                               H3DFloat low, H3DFloat high,
+                               H3DFloat &t0, H3DFloat &t1 ) {
+  // clip the ray to the volume.
+  H3DFloat size[3] = { (H3DFloat) image->width() - 1,
+                       (H3DFloat) image->height() - 1,
+                       (H3DFloat) image->depth() - 1 };
+  H3DFloat max_dir = 0;
+  for( unsigned int a = 0; a < 3; ++a ) {
+    max_dir = H3DMax( max_dir, H3DAbs( direction[a] ) );
+    if( direction[a] == 0 ) {
+      if( origin[a] < 0 || origin[a] > size[a] ) return false;
+    } else {
+      H3DFloat ta = -origin[a] / direction[a];
+      H3DFloat tb = ( size[a] - origin[a] ) / direction[a];
+      t_start = H3DMax( t_start, H3DMin( ta, tb ) );
+      t_end = H3DMin( t_end, H3DMax( ta, tb ) );
+    }
+  }
+  if( t_start > t_end || max_dir == 0 ) return false;
+
+  // a step that moves the position a small fraction of a voxel, used to
+  // get into the next block after reaching the border of a block.
+  H3DFloat t_eps = 1e-4f / max_dir;
+  unsigned int top = nrLevels() - 1;
+
+  H3DFloat t = t_start;
+  bool found = false;
+  while( t <= t_end ) {
+    Vec3f p = origin + direction * t;
+    // find the coarsest block containing p that cannot contain the
+    // values, or a level 0 block that may contain them.
+    int level = top;
+    unsigned int b[3];
+    for( ; level >= 0; --level ) {
+      Level &l = levels[level];
+      unsigned int bs = blockSize( level );
+      unsigned int n[3] = { l.nx, l.ny, l.nz };
+      for( unsigned int a = 0; a < 3; ++a ) {
+        b[a] = H3DMin( (unsigned int) H3DMax( p[a], (H3DFloat) 0 ) / bs,
+                       n[a] - 1 );
+      }
+      if( !blockMayContain( level, b[0], b[1], b[2], low, high ) ) break;
+    }
+    if( level < 0 ) {
+      found = true;
+      break;
+    }
+
+    // skip to the exit of the empty block.
+    H3DFloat bs = (H3DFloat) blockSize( level );
+    H3DFloat t_exit = t_end + t_eps;
+    for( unsigned int a = 0; a < 3; ++a ) {
+      if( direction[a] > 0 ) {
+        t_exit = H3DMin( t_exit, ( ( b[a] + 1 ) * bs - origin[a] ) /
+                         direction[a] );
+      } else if( direction[a] < 0 ) {
+        t_exit = H3DMin( t_exit, ( b[a] * bs - origin[a] ) / direction[a] );
+      }
+    }
+    t = H3DMax( t_exit, t ) + t_eps;
+  }
+  if( !found ) return false;
+  t0 = t;
+
+  // step through the level 0 blocks until one that cannot contain the
+  // values.
+  Level &l = levels[0];
+  unsigned int n[3] = { l.nx, l.ny, l.nz };
+  H3DFloat bs = (H3DFloat) block_size;
+  while( t <= t_end ) {
+    Vec3f p = origin + direction * t;
+    unsigned int b[3];
+    for( unsigned int a = 0; a < 3; ++a ) {
+      b[a] = H3DMin( (unsigned int) H3DMax( p[a], (H3DFloat) 0 ) / block_size,
+                     n[a] - 1 );
+    }
+    if( !blockMayContain( 0, b[0], b[1], b[2], low, high ) ) {
+      t1 = t;
+      return true;
+    }
+    H3DFloat t_exit = t_end + t_eps;
+    for( unsigned int a = 0; a < 3; ++a ) {
+      if( direction[a] > 0 ) {
+        t_exit = H3DMin( t_exit, ( ( b[a] + 1 ) * bs - origin[a] ) /
+                         direction[a] );
+      } else if( direction[a] < 0 ) {
+        t_exit = H3DMin( t_exit, ( b[a] * bs - origin[a] ) / direction[a] );
+      }
+    }
+    t = H3DMax( t_exit, t ) + t_eps;
+  }
+  t1 = t_end;
+  return true;
+}
@@ -0,0 +1,1417 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file NrrdFile.cpp
+/// \brief .cpp file for NrrdReader and NrrdWriter.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/NrrdFile.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+#include <H3DUtil/Console.h>
+#include <H3DUtil/MemoryStream.h>
+#include <H3DUtil/BatchFileReader.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+#include <sstream>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace H3DUtil;
+
+namespace NrrdFileInternals {
+  // Size of the buffers used when streaming data to and from files.
+  const size_t stream_buffer_size = 1 << 20;
+
+  // Size of the chunks uncompressed data is read in when a progress
+  // callback is used.
+  const H3DInt64 progress_chunk_size = 4 << 20;
+
+  // Maximum number of bytes of raw data that the operating system is
+  // asked to read ahead, the kernel read-ahead takes care of the rest.
+  const H3DInt64 raw_read_ahead_size = 64 << 20;
+
+  // Default uncompressed size of the blocks written by NrrdWriter.
+  const H3DInt64 default_block_size = 4 << 20;
+
+  // Number of digits used for each block size in the header, so that
+  // the sizes can be filled in when the data has been written.
+  const unsigned int block_size_digits = 12;
+
+  // The key of the key/value pair containing the block sizes.
+  const std::string block_sizes_key = "H3DUtil_block_sizes";
+
+  bool isLittleEndian() {
+    union {
+      H3DUInt32 i;
+      unsigned char c[4];
+    } u;
+    u.i = 1;
+    return u.c[0] == 1;
+  }
+
+  std::string trim( const std::string &s ) {
+    std::string::size_type start = s.find_first_not_of( " \t\r\n" );
+    if( start == std::string::npos ) return "";
+    std::string::size_type end = s.find_last_not_of( " \t\r\n" );
+    return s.substr( start, end - start + 1 );
+  }
+
+  std::string toLower( const std::string &s ) {
+    std::string result = s;
+    for( std::string::size_type i = 0; i < result.size(); ++i ) {
+      result[i] = (char)tolower( result[i] );
+    }
+    return result;
+  }
+
+  // Value used for undefined spacings.
+  double undefinedValue() {
+    return std::numeric_limits< double >::quiet_NaN();
+  }
+
+  bool isNaN( double v ) {
+    return v != v;
+  }
+
+  // Parse a double, accepting "nan" for undefined values.
+  double parseDouble( const std::string &s ) {
+    if( toLower( s ) == "nan" ) return undefinedValue();
+    return strtod( s.c_str(), NULL );
+  }
+
+  // Reverse the byte order of each element in data.
+  void swapBytes( unsigned char *data, H3DInt64 size,
+                  unsigned int element_size ) {
+    if( element_size < 2 ) return;
+    for( H3DInt64 i = 0; i + element_size <= size; i += element_size ) {
+      unsigned char *e = data + i;
+      for( unsigned int j = 0; j < element_size / 2; ++j ) {
+        unsigned char tmp = e[j];
+        e[j] = e[element_size - 1 - j];
+        e[element_size - 1 - j] = tmp;
+      }
+    }
+  }
+
+  // Get the size in bytes and component type of a Nrrd type name.
+  // Returns false if the type is not supported.
+  bool parseType( const std::string &type,
+                  unsigned int &bytes,
+                  Image::PixelComponentType &component_type ) {
+    if( type == "signed char" || type == "int8" || type == "int8_t" ) {
+      bytes = 1; component_type = Image::SIGNED;
+    } else if( type == "uchar" || type == "unsigned char" ||
+               type == "uint8" || type == "uint8_t" ) {
+      bytes = 1; component_type = Image::UNSIGNED;
+    } else if( type == "short" || type == "short int" ||
+               type == "signed short" || type == "signed short int" ||
+               type == "int16" || type == "int16_t" ) {
+      bytes = 2; component_type = Image::SIGNED;
+    } else if( type == "ushort" || type == "unsigned short" ||
+               type == "unsigned short int" || type == "uint16" ||
+               type == "uint16_t" ) {
+      bytes = 2; component_type = Image::UNSIGNED;
+    } else if( type == "int" || type == "signed int" ||
+               type == "int32" || type == "int32_t" ) {
+      bytes = 4; component_type = Image::SIGNED;
+    } else if( type == "uint" || type == "unsigned int" ||
+               type == "uint32" || type == "uint32_t" ) {
+      bytes = 4; component_type = Image::UNSIGNED;
+    } else if( type == "longlong" || type == "long long" ||
+               type == "long long int" || type == "signed long long" ||
+               type == "signed long long int" || type == "int64" ||
+               type == "int64_t" ) {
+      bytes = 8; component_type = Image::SIGNED;
+    } else if( type == "ulonglong" || type == "unsigned long long" ||
+               type == "unsigned long long int" || type == "uint64" ||
+               type == "uint64_t" ) {
+      bytes = 8; component_type = Image::UNSIGNED;
+    } else if( type == "float" ) {
+      bytes = 4; component_type = Image::RATIONAL;
+    } else if( type == "double" ) {
+      bytes = 8; component_type = Image::RATIONAL;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Get the Nrrd type name for the given size and component type.
+  // Returns an empty string if there is no such type.
+  std::string typeName( unsigned int bytes,
+                        Image::PixelComponentType component_type ) {
+    if( component_type == Image::SIGNED ) {
+      if( bytes == 1 ) return "int8";
+      if( bytes == 2 ) return "int16";
+      if( bytes == 4 ) return "int32";
+      if( bytes == 8 ) return "int64";
+    } else if( component_type == Image::UNSIGNED ) {
+      if( bytes == 1 ) return "uint8";
+      if( bytes == 2 ) return "uint16";
+      if( bytes == 4 ) return "uint32";
+      if( bytes == 8 ) return "uint64";
+    } else if( component_type == Image::RATIONAL ) {
+      if( bytes == 4 ) return "float";
+      if( bytes == 8 ) return "double";
+    }
+    return "";
+  }
+
+  // Incremental compression or decompression of a gzip or bzip2 stream.
+  class StreamCodec {
+  public:
+    typedef enum {
+      CODEC_OK,
+      CODEC_END,
+      CODEC_ERROR
+    } Result;
+
+    StreamCodec( NrrdFile::Encoding _encoding, bool _compress,
+                 int _level = -1 ) :
+      encoding( _encoding ),
+      compress( _compress ),
+      level( _level ),
+      valid( false ) {
+      init();
+    }
+
+    ~StreamCodec() {
+      end();
+    }
+
+    bool isValid() {
+      return valid;
+    }
+
+    // Start a new stream, e.g. the next member of concatenated gzip files.
+    bool reset() {
+      end();
+      init();
+      return valid;
+    }
+
+    // Compress or decompress from in to out. The pointers and sizes are
+    // updated to the remaining input and output. If finish is true the
+    // end of the stream is written when compressing.
+    Result process( const unsigned char *&in, size_t &in_size,
+                    unsigned char *&out, size_t &out_size,
+                    bool finish ) {
+      if( !valid ) return CODEC_ERROR;
+      // the libraries use 32 bit sizes.
+      const size_t max_size = 1 << 30;
+      unsigned int avail_in =
+        (unsigned int)( in_size < max_size ? in_size : max_size );
+      unsigned int avail_out =
+        (unsigned int)( out_size < max_size ? out_size : max_size );
+      bool last_input = finish && avail_in == in_size;
+      unsigned int remaining_in = avail_in, remaining_out = avail_out;
+      Result result = CODEC_ERROR;
+#ifdef HAVE_ZLIB
+      if( encoding == NrrdFile::GZIP ) {
+        zstream.next_in = (Bytef *)in;
+        zstream.avail_in = avail_in;
+        zstream.next_out = (Bytef *)out;
+        zstream.avail_out = avail_out;
+        int err;
+        if( compress )
+          err = deflate( &zstream, last_input ? Z_FINISH : Z_NO_FLUSH );
+        else
+          err = inflate( &zstream, Z_NO_FLUSH );
+        if( err == Z_STREAM_END ) result = CODEC_END;
+        else if( err == Z_OK || err == Z_BUF_ERROR ) result = CODEC_OK;
+        remaining_in = zstream.avail_in;
+        remaining_out = zstream.avail_out;
+      }
+#endif
+#ifdef HAVE_BZIP2
+      if( encoding == NrrdFile::BZIP2 ) {
+        bzstream.next_in = (char *)in;
+        bzstream.avail_in = avail_in;
+        bzstream.next_out = (char *)out;
+        bzstream.avail_out = avail_out;
+        int err;
+        if( compress )
+          err = BZ2_bzCompress( &bzstream, last_input ? BZ_FINISH : BZ_RUN );
+        else
+          err = BZ2_bzDecompress( &bzstream );
+        if( err == BZ_STREAM_END ) result = CODEC_END;
+        else if( err == BZ_OK || err == BZ_RUN_OK || err == BZ_FINISH_OK )
+          result = CODEC_OK;
+        remaining_in = bzstream.avail_in;
+        remaining_out = bzstream.avail_out;
+      }
+#endif
+      in += avail_in - remaining_in;
+      in_size -= avail_in - remaining_in;
+      out += avail_out - remaining_out;
+      out_size -= avail_out - remaining_out;
+      return result;
+    }
+
+  protected:
+    void init() {
+      valid = false;
+#ifdef HAVE_ZLIB
+      if( encoding == NrrdFile::GZIP ) {
+        memset( &zstream, 0, sizeof( zstream ) );
+        int err;
+        if( compress ) {
+          // 16 is added to the window bits to write a gzip header.
+          err = deflateInit2( &zstream,
+                              level < 0 ? Z_DEFAULT_COMPRESSION : level,
+                              Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY );
+        } else {
+          // 32 is added to the window bits to detect gzip or zlib headers.
+          err = inflateInit2( &zstream, 15 + 32 );
+        }
+        valid = err == Z_OK;
+      }
+#endif
+#ifdef HAVE_BZIP2
+      if( encoding == NrrdFile::BZIP2 ) {
+        memset( &bzstream, 0, sizeof( bzstream ) );
+        int err;
+        if( compress ) {
+          err = BZ2_bzCompressInit( &bzstream,
+                                    level < 1 || level > 9 ? 9 : level,
+                                    0, 0 );
+        } else {
+          err = BZ2_bzDecompressInit( &bzstream, 0, 0 );
+        }
+        valid = err == BZ_OK;
+      }
+#endif
+    }
+
+    void end() {
+      if( !valid ) return;
+#ifdef HAVE_ZLIB
+      if( encoding == NrrdFile::GZIP ) {
+        if( compress ) deflateEnd( &zstream );
+        else inflateEnd( &zstream );
+      }
+#endif
+#ifdef HAVE_BZIP2
+      if( encoding == NrrdFile::BZIP2 ) {
+        if( compress ) BZ2_bzCompressEnd( &bzstream );
+        else BZ2_bzDecompressEnd( &bzstream );
+      }
+#endif
+      valid = false;
+    }
+
+    NrrdFile::Encoding encoding;
+    bool compress;
+    int level;
+    bool valid;
+#ifdef HAVE_ZLIB
+    z_stream zstream;
+#endif
+#ifdef HAVE_BZIP2
+    bz_stream bzstream;
+#endif
+  };
+
+  // Compress size bytes from data as one stream into output.
+  bool compressBlock( NrrdFile::Encoding encoding, int level,
+                      const unsigned char *data, H3DInt64 size,
+                      std::vector< unsigned char > &output ) {
+    StreamCodec codec( encoding, true, level );
+    if( !codec.isValid() ) return false;
+    output.resize( (size_t)( size + size / 100 + 1024 ) );
+    const unsigned char *in = data;
+    size_t in_size = (size_t) size;
+    size_t produced = 0;
+    while( true ) {
+      unsigned char *out = &output[0] + produced;
+      size_t out_size = output.size() - produced;
+      size_t before = out_size;
+      StreamCodec::Result result =
+        codec.process( in, in_size, out, out_size, true );
+      produced += before - out_size;
+      if( result == StreamCodec::CODEC_END ) break;
+      if( result == StreamCodec::CODEC_ERROR ) return false;
+      if( out_size == 0 ) output.resize( output.size() * 2 );
+    }
+    output.resize( produced );
+    return true;
+  }
+
+  // Decompress one complete stream from data into output, which must be
+  // exactly the uncompressed size of the stream.
+  bool decompressBlock( StreamCodec &codec,
+                        const unsigned char *data, H3DInt64 size,
+                        unsigned char *output, H3DInt64 output_size ) {
+    if( !codec.reset() ) return false;
+    const unsigned char *in = data;
+    size_t in_size = (size_t) size;
+    unsigned char *out = output;
+    size_t out_size = (size_t) output_size;
+    while( true ) {
+      size_t in_before = in_size, out_before = out_size;
+      StreamCodec::Result result =
+        codec.process( in, in_size, out, out_size, true );
+      if( result == StreamCodec::CODEC_END ) return out_size == 0;
+      if( result == StreamCodec::CODEC_ERROR ) return false;
+      // no progress possible, the data is truncated or corrupt.
+      if( in_size == in_before && out_size == out_before ) return false;
+    }
+  }
+
+  // Deletes a stream from NrrdReader::openDataStream when it goes out of
+  // scope.
+  class DataStream {
+  public:
+    DataStream( std::istream *_is ) : is( _is ) {}
+
+    ~DataStream() {
+      delete is;
+    }
+
+    inline std::istream &operator*() {
+      return *is;
+    }
+
+    inline std::istream *operator->() {
+      return is;
+    }
+
+  protected:
+    // not copyable.
+    DataStream( const DataStream & );
+    DataStream &operator=( const DataStream & );
+
+    std::istream *is;
+  };
+}
+
+using namespace NrrdFileInternals;
+
+NrrdFile::NrrdFile() :
+  w( 0 ), h( 0 ), d( 0 ),
+  bits_per_pixel( 0 ),
+  pixel_type( Image::LUMINANCE ),
+  pixel_component_type( Image::UNSIGNED ),
+  pixel_size( 0, 0, 0 ),
+  data_encoding( RAW ),
+  nr_worker_threads( 0 ),
+  block_size( 0 ) {
+}
+
+bool NrrdFile::isEncodingSupported( Encoding e ) {
+  if( e == RAW ) return true;
+#ifdef HAVE_ZLIB
+  if( e == GZIP ) return true;
+#endif
+#ifdef HAVE_BZIP2
+  if( e == BZIP2 ) return true;
+#endif
+  return false;
+}
+
+void NrrdFile::setError( const std::string &message ) {
+  error_message = message;
+}
+
+std::string NrrdFile::encodingName( Encoding e ) {
+  if( e == GZIP ) return "gzip";
+  if( e == BZIP2 ) return "bzip2";
+  return "raw";
+}
+
+unsigned int NrrdFile::nrComponents( Image::PixelType type ) {
+  switch( type ) {
+  case Image::LUMINANCE:
+  case Image::R:
+    return 1;
+  case Image::LUMINANCE_ALPHA:
+  case Image::RG:
+    return 2;
+  case Image::RGB:
+  case Image::BGR:
+  case Image::VEC3:
+    return 3;
+  case Image::RGBA:
+  case Image::BGRA:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+NrrdReader::NrrdReader() :
+  memory_data( NULL ),
+  memory_size( 0 ),
+  data_in_memory( false ),
+  data_offset( 0 ),
+  line_skip( 0 ),
+  byte_skip( 0 ),
+  swap_bytes( false ),
+  unsupported_feature( false ),
+  dimension( 0 ),
+  has_encoding( false ),
+  read_offset( 0 ),
+  read_size( 0 ),
+  read_data( NULL ),
+  read_failed( false ),
+  progress_callback( NULL ),
+  progress_data( NULL ),
+  progress_slices( 0 ) {
+}
+
+bool NrrdReader::open( const std::string &url ) {
+  resetHeader();
+  memory_data = NULL;
+  memory_size = 0;
+  stream_data.clear();
+  std::ifstream is( url.c_str(), std::ios::in | std::ios::binary );
+  if( !is.good() ) {
+    setError( "Could not open file \"" + url + "\"." );
+    return false;
+  }
+  return readHeader( is, url );
+}
+
+bool NrrdReader::open( const void *data, size_t size,
+                       const std::string &name ) {
+  resetHeader();
+  stream_data.clear();
+  memory_data = static_cast< const unsigned char * >( data );
+  memory_size = (H3DInt64) size;
+  MemoryInputStream is( data, size );
+  return readHeader( is, name );
+}
+
+bool NrrdReader::open( std::istream &is, const std::string &name ) {
+  resetHeader();
+  std::vector< unsigned char > buffer;
+  readWholeStream( is, buffer );
+  stream_data.swap( buffer );
+  memory_data = stream_data.empty() ? NULL : &stream_data[0];
+  memory_size = (H3DInt64) stream_data.size();
+  MemoryInputStream memory_is( memory_data, stream_data.size() );
+  return readHeader( memory_is, name );
+}
+
+void NrrdReader::resetHeader() {
+  w = h = d = bits_per_pixel = 0;
+  data_encoding = RAW;
+  data_filename = "";
+  data_offset = line_skip = byte_skip = 0;
+  swap_bytes = false;
+  unsupported_feature = false;
+  type_string = "";
+  dimension = 0;
+  sizes.clear();
+  spacings.clear();
+  direction_lengths.clear();
+  space_units.clear();
+  has_encoding = false;
+  block_size = 0;
+  block_sizes.clear();
+  block_offsets.clear();
+  error_message = "";
+  data_in_memory = false;
+}
+
+bool NrrdReader::readHeader( std::istream &is, const std::string &url ) {
+  std::string line;
+  std::getline( is, line );
+  if( line.compare( 0, 7, "NRRD000" ) != 0 ) {
+    setError( "\"" + url + "\" is not a Nrrd file." );
+    return false;
+  }
+
+  bool attached_data = false;
+  while( std::getline( is, line ) ) {
+    if( !line.empty() && line[ line.size() - 1 ] == '\r' )
+      line.erase( line.size() - 1 );
+    if( line.empty() ) {
+      // an empty line ends the header and the data follows.
+      attached_data = true;
+      break;
+    }
+    if( line[0] == '#' ) continue;
+
+    std::string::size_type kv_pos = line.find( ":=" );
+    std::string::size_type field_pos = line.find( ": " );
+    if( kv_pos != std::string::npos &&
+        ( field_pos == std::string::npos || kv_pos < field_pos ) ) {
+      parseKeyValue( line.substr( 0, kv_pos ), line.substr( kv_pos + 2 ) );
+    } else if( field_pos != std::string::npos ) {
+      if( !parseField( trim( line.substr( 0, field_pos ) ),
+                       trim( line.substr( field_pos + 2 ) ),
+                       url ) ) {
+        return false;
+      }
+    } else {
+      setError( "Invalid line in header of \"" + url + "\": " + line );
+      return false;
+    }
+  }
+
+  if( data_filename.empty() ) {
+    if( !attached_data ) {
+      setError( "No data found in \"" + url + "\"." );
+      return false;
+    }
+    data_filename = url;
+    data_offset = (H3DInt64) is.tellg();
+    data_in_memory = memory_data != NULL;
+  }
+
+  if( !setupImage( url ) ) return false;
+
+  // find the start of the data in the data file.
+  DataStream data_stream( openDataStream() );
+  std::istream &data_is = *data_stream;
+  if( !data_is.good() ) {
+    setError( "Could not open data file \"" + data_filename + "\"." );
+    return false;
+  }
+  data_is.seekg( data_offset );
+  for( H3DInt64 i = 0; i < line_skip; ++i ) {
+    data_is.ignore( std::numeric_limits< std::streamsize >::max(), '\n' );
+  }
+  data_offset = (H3DInt64) data_is.tellg();
+  H3DInt64 total_size = sliceSize() * d;
+  if( byte_skip == -1 ) {
+    if( data_encoding != RAW ) {
+      setError( "Byte skip -1 is only allowed for raw encoding in \"" +
+                url + "\"." );
+      return false;
+    }
+    data_is.seekg( 0, std::ios::end );
+    data_offset = (H3DInt64) data_is.tellg() - total_size;
+  } else if( data_encoding == RAW ) {
+    data_offset += byte_skip;
+  }
+  // for compressed data the byte skip applies to the decompressed data
+  // and is handled by readStream.
+  if( !data_is.good() || data_offset < 0 ) {
+    setError( "Invalid data offset in \"" + data_filename + "\"." );
+    return false;
+  }
+
+  // the block sizes can only be used if they match the data.
+  if( data_encoding != RAW && block_size > 0 && byte_skip == 0 ) {
+    H3DInt64 nr_blocks = ( total_size + block_size - 1 ) / block_size;
+    if( (H3DInt64) block_sizes.size() == nr_blocks ) {
+      H3DInt64 offset = data_offset;
+      block_offsets.resize( block_sizes.size() );
+      for( size_t i = 0; i < block_sizes.size(); ++i ) {
+        block_offsets[i] = offset;
+        offset += block_sizes[i];
+      }
+    } else {
+      block_size = 0;
+      block_sizes.clear();
+    }
+  } else {
+    block_size = 0;
+    block_sizes.clear();
+  }
+  return true;
+}
+
+bool NrrdReader::parseField( const std::string &field,
+                             const std::string &value,
+                             const std::string &url ) {
+  if( field == "type" ) {
+    type_string = value;
+  } else if( field == "dimension" ) {
+    dimension = atoi( value.c_str() );
+  } else if( field == "sizes" ) {
+    std::istringstream s( value );
+    H3DInt64 size;
+    while( s >> size ) sizes.push_back( size );
+  } else if( field == "spacings" ) {
+    std::istringstream s( value );
+    std::string v;
+    while( s >> v ) spacings.push_back( parseDouble( v ) );
+  } else if( field == "space directions" ) {
+    std::istringstream s( value );
+    std::string v;
+    while( s >> v ) {
+      if( v == "none" ) {
+        direction_lengths.push_back( undefinedValue() );
+      } else {
+        // vector of the form (x,y,z)
+        for( std::string::size_type i = 0; i < v.size(); ++i ) {
+          if( v[i] == '(' || v[i] == ')' || v[i] == ',' ) v[i] = ' ';
+        }
+        std::istringstream vs( v );
+        double c, length2 = 0;
+        while( vs >> c ) length2 += c * c;
+        direction_lengths.push_back( H3DSqrt( length2 ) );
+      }
+    }
+  } else if( field == "space units" ) {
+    std::string::size_type pos = value.find( '"' );
+    while( pos != std::string::npos ) {
+      std::string::size_type end = value.find( '"', pos + 1 );
+      if( end == std::string::npos ) break;
+      space_units.push_back( value.substr( pos + 1, end - pos - 1 ) );
+      pos = value.find( '"', end + 1 );
+    }
+  } else if( field == "encoding" ) {
+    has_encoding = true;
+    if( value == "raw" ) {
+      data_encoding = RAW;
+    } else if( value == "gzip" || value == "gz" ) {
+      data_encoding = GZIP;
+    } else if( value == "bzip2" || value == "bz2" ) {
+      data_encoding = BZIP2;
+    } else {
+      unsupported_feature = true;
+      setError( "Unsupported encoding \"" + value + "\" in \"" + url +
+                "\"." );
+      return false;
+    }
+    if( !isEncodingSupported( data_encoding ) ) {
+      unsupported_feature = true;
+      setError( "Encoding \"" + value + "\" in \"" + url +
+                "\" is not supported by this build." );
+      return false;
+    }
+  } else if( field == "endian" ) {
+    swap_bytes = ( value == "little" ) != isLittleEndian();
+  } else if( field == "data file" || field == "datafile" ) {
+    if( value.compare( 0, 4, "LIST" ) == 0 ||
+        value.find( '%' ) != std::string::npos ) {
+      unsupported_feature = true;
+      setError( "Data divided into several files is not supported in \"" +
+                url + "\"." );
+      return false;
+    }
+    data_filename = value;
+    bool absolute =
+      ( !value.empty() && ( value[0] == '/' || value[0] == '\\' ) ) ||
+      ( value.size() > 1 && value[1] == ':' );
+    if( !absolute ) {
+      std::string::size_type pos = url.find_last_of( "/\\" );
+      if( pos != std::string::npos )
+        data_filename = url.substr( 0, pos + 1 ) + value;
+    }
+  } else if( field == "line skip" || field == "lineskip" ) {
+    line_skip = atoi( value.c_str() );
+  } else if( field == "byte skip" || field == "byteskip" ) {
+    byte_skip = atoi( value.c_str() );
+  }
+  // other fields do not affect how the data is read as an image.
+  return true;
+}
+
+void NrrdReader::parseKeyValue( const std::string &key,
+                                const std::string &value ) {
+  if( key == block_sizes_key ) {
+    std::istringstream s( value );
+    if( s >> block_size ) {
+      H3DInt64 size;
+      while( s >> size ) block_sizes.push_back( size );
+    } else {
+      block_size = 0;
+    }
+  }
+}
+
+bool NrrdReader::setupImage( const std::string &url ) {
+  unsigned int bytes_per_component;
+  if( !parseType( type_string, bytes_per_component, pixel_component_type ) ) {
+    unsupported_feature = true;
+    setError( "Unsupported type \"" + type_string + "\" in \"" +
+              url + "\"." );
+    return false;
+  }
+  if( !has_encoding ) {
+    setError( "No encoding specified in \"" + url + "\"." );
+    return false;
+  }
+  if( dimension < 1 || dimension > 4 || sizes.size() != dimension ) {
+    unsupported_feature = dimension > 4;
+    setError( "Invalid dimension or sizes in \"" + url + "\"." );
+    return false;
+  }
+
+  unsigned int nr_components = 1;
+  unsigned int first_axis = 0;
+  if( dimension == 4 ) {
+    // if dimension == 4, we assume the first dimension is used for each
+    // voxel value
+    first_axis = 1;
+    nr_components = (unsigned int) sizes[0];
+    if( nr_components < 1 || nr_components > 4 ) {
+      unsupported_feature = true;
+      setError( "Unsupported number of components in \"" + url + "\"." );
+      return false;
+    }
+  }
+
+  const Image::PixelType pixel_types[] = { Image::LUMINANCE,
+                                           Image::LUMINANCE_ALPHA,
+                                           Image::RGB,
+                                           Image::RGBA };
+  pixel_type = pixel_types[ nr_components - 1 ];
+  bits_per_pixel = bytes_per_component * 8 * nr_components;
+  if( bytes_per_component == 1 ) swap_bytes = false;
+
+  unsigned int dims[3] = { 1, 1, 1 };
+  H3DFloat spacing[3] = { 0.0003f, 0.0003f, 0.0003f };
+  for( unsigned int i = 0; i < 3 && first_axis + i < dimension; ++i ) {
+    unsigned int axis = first_axis + i;
+    dims[i] = (unsigned int) sizes[axis];
+    if( axis < spacings.size() && !isNaN( spacings[axis] ) ) {
+      spacing[i] = (H3DFloat) spacings[axis];
+    } else if( axis < direction_lengths.size() &&
+               !isNaN( direction_lengths[axis] ) ) {
+      // The space direction contains the spacings
+      spacing[i] = (H3DFloat) direction_lengths[axis];
+      // Check for space units
+      if( i < space_units.size() ) {
+        if( space_units[i] == "mm" ) spacing[i] *= 0.001f;
+        else if( space_units[i] == "cm" ) spacing[i] *= 0.01f;
+      }
+    } else {
+      Console(LogLevel::Warning) << "Warning: NRRD file " << url
+        << " lacks spacing information in axis " << i
+        << ". Sets to default 0.0003" << std::endl;
+    }
+  }
+  w = dims[0];
+  h = dims[1];
+  d = dims[2];
+  pixel_size = Vec3f( spacing[0], spacing[1], spacing[2] );
+  return true;
+}
+
+bool NrrdReader::readSlices( unsigned int first_slice,
+                             unsigned int nr_slices,
+                             void *data ) {
+  if( data_filename.empty() && !data_in_memory ) {
+    setError( "No Nrrd file open." );
+    return false;
+  }
+  if( first_slice + nr_slices > d || first_slice + nr_slices < first_slice ) {
+    setError( "Slices outside of image in \"" + data_filename + "\"." );
+    return false;
+  }
+  if( nr_slices == 0 ) return true;
+
+  H3DInt64 offset = first_slice * sliceSize();
+  H3DInt64 size = nr_slices * sliceSize();
+  unsigned char *dest = (unsigned char *)data;
+  progress_slices = 0;
+  if( !data_in_memory && data_encoding == RAW ) {
+    // let the disk read ahead of the reads below, which are done in
+    // chunks when reporting progress.
+    adviseFileRead( data_filename, (size_t)( data_offset + offset ),
+                    (size_t) H3DMin( size, raw_read_ahead_size ) );
+  }
+  bool success;
+  if( data_encoding != RAW && block_size == 0 ) {
+    success = readStream( offset, size, dest );
+  } else if( !progress_callback ) {
+    if( data_encoding == RAW ) success = readRaw( offset, size, dest );
+    else success = readBlocks( offset, size, dest );
+  } else {
+    // read in chunks to be able to report progress. Blocks are read one
+    // per thread at a time and the chunks end at block boundaries so that
+    // no block is decompressed twice.
+    H3DInt64 chunk_size = progress_chunk_size;
+    if( data_encoding != RAW ) {
+      chunk_size = block_size * ( nr_worker_threads == 0 ?
+                                  getNrHardwareThreads() :
+                                  nr_worker_threads );
+    }
+    success = true;
+    H3DInt64 done = 0;
+    while( success && done < size ) {
+      H3DInt64 chunk_end =
+        H3DMin( ( ( offset + done ) / chunk_size + 1 ) * chunk_size - offset,
+                size );
+      if( data_encoding == RAW ) {
+        success = readRaw( offset + done, chunk_end - done, dest + done );
+      } else {
+        success = readBlocks( offset + done, chunk_end - done, dest + done );
+      }
+      done = chunk_end;
+      if( success ) success = reportProgress( dest, done );
+    }
+  }
+
+  // the byte order has already been converted by reportProgress if a
+  // progress callback is used.
+  if( success && swap_bytes && !progress_callback ) {
+    unsigned int nr_components = nrComponents( pixel_type );
+    swapBytes( dest, size, bits_per_pixel / ( 8 * nr_components ) );
+  }
+  return success;
+}
+
+Image *NrrdReader::readImage() {
+  return readSlab( 0, d );
+}
+
+Image *NrrdReader::readSlab( unsigned int first_slice,
+                             unsigned int nr_slices ) {
+  if( first_slice + nr_slices > d ) {
+    setError( "Slices outside of image in \"" + data_filename + "\"." );
+    return NULL;
+  }
+  unsigned char *data =
+    new unsigned char[ (size_t)( sliceSize() * nr_slices ) ];
+  if( !readSlices( first_slice, nr_slices, data ) ) {
+    delete [] data;
+    return NULL;
+  }
+  return new PixelImage( w, h, nr_slices, bits_per_pixel,
+                         pixel_type, pixel_component_type,
+                         data, false, pixel_size );
+}
+
+bool NrrdReader::readRaw( H3DInt64 offset, H3DInt64 size,
+                          unsigned char *data ) {
+  DataStream is( openDataStream() );
+  is->seekg( data_offset + offset );
+  is->read( (char *)data, size );
+  if( is->gcount() != size ) {
+    setError( "Unexpected end of data in \"" + data_filename + "\"." );
+    return false;
+  }
+  return true;
+}
+
+bool NrrdReader::readStream( H3DInt64 offset, H3DInt64 size,
+                             unsigned char *data ) {
+  // the byte skip is counted in the decompressed data.
+  offset += byte_skip;
+  DataStream data_stream( openDataStream() );
+  std::istream &is = *data_stream;
+  is.seekg( data_offset );
+  StreamCodec codec( data_encoding, false );
+  if( !is.good() || !codec.isValid() ) {
+    setError( "Could not read data in \"" + data_filename + "\"." );
+    return false;
+  }
+
+  std::vector< unsigned char > input( stream_buffer_size );
+  // the data before offset is decompressed into this buffer and discarded.
+  std::vector< unsigned char > skip_buffer;
+  if( offset > 0 )
+    skip_buffer.resize( (size_t) H3DMin( offset,
+                                         (H3DInt64) stream_buffer_size ) );
+
+  const unsigned char *in = NULL;
+  size_t in_size = 0;
+  H3DInt64 skipped = 0, done = 0;
+  bool input_ended = false;
+  while( done < size ) {
+    if( in_size == 0 ) {
+      if( input_ended ) {
+        setError( "Unexpected end of data in \"" + data_filename + "\"." );
+        return false;
+      }
+      if( data_in_memory ) {
+        // data in memory is decompressed directly from its buffer.
+        in = memory_data + data_offset;
+        in_size = (size_t)( memory_size - data_offset );
+        input_ended = true;
+      } else {
+        is.read( (char *)&input[0], input.size() );
+        in_size = (size_t) is.gcount();
+        in = &input[0];
+        input_ended = in_size < input.size();
+      }
+    }
+
+    unsigned char *out;
+    size_t out_size;
+    if( skipped < offset ) {
+      out = &skip_buffer[0];
+      out_size = (size_t) H3DMin( offset - skipped,
+                                  (H3DInt64) skip_buffer.size() );
+    } else {
+      out = data + done;
+      out_size = (size_t) H3DMin( size - done, (H3DInt64) 1 << 30 );
+    }
+    size_t out_before = out_size;
+    StreamCodec::Result result =
+      codec.process( in, in_size, out, out_size, false );
+    if( skipped < offset ) {
+      skipped += out_before - out_size;
+    } else {
+      done += out_before - out_size;
+      if( progress_callback && !reportProgress( data, done ) ) return false;
+    }
+
+    if( result == StreamCodec::CODEC_ERROR ) {
+      setError( "Could not decompress data in \"" + data_filename + "\"." );
+      return false;
+    } else if( result == StreamCodec::CODEC_END && done < size ) {
+      // the data may consist of several concatenated streams.
+      if( !codec.reset() ) {
+        setError( "Could not decompress data in \"" +
+                  data_filename + "\"." );
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool NrrdReader::readBlocks( H3DInt64 offset, H3DInt64 size,
+                             unsigned char *data ) {
+  read_offset = offset;
+  read_size = size;
+  read_data = data;
+  read_failed = false;
+  unsigned int first_block = (unsigned int)( offset / block_size );
+  unsigned int last_block = (unsigned int)( ( offset + size - 1 ) /
+                                            block_size );
+  parallelFor( first_block, last_block + 1, readBlockRange, this,
+               1, nr_worker_threads );
+  if( read_failed ) {
+    setError( "Could not decompress data in \"" + data_filename + "\"." );
+    return false;
+  }
+  return true;
+}
+
+void NrrdReader::readBlockRange( unsigned int begin, unsigned int end,
+                                 void *data ) {
+  NrrdReader *reader = static_cast< NrrdReader * >( data );
+  DataStream is( reader->openDataStream() );
+  StreamCodec codec( reader->data_encoding, false );
+  H3DInt64 total_size = reader->sliceSize() * reader->d;
+  H3DInt64 read_end = reader->read_offset + reader->read_size;
+  std::vector< unsigned char > input, output;
+  for( unsigned int i = begin; i < end && !reader->readFailed(); ++i ) {
+    H3DInt64 block_start = i * reader->block_size;
+    H3DInt64 block_end = H3DMin( block_start + reader->block_size,
+                                 total_size );
+    // blocks in memory are decompressed directly from their buffer.
+    const unsigned char *block_data;
+    size_t block_data_size = (size_t) reader->block_sizes[i];
+    if( reader->data_in_memory ) {
+      if( reader->block_offsets[i] + reader->block_sizes[i] >
+          reader->memory_size ) {
+        reader->setReadFailed();
+        return;
+      }
+      block_data = reader->memory_data + reader->block_offsets[i];
+    } else {
+      input.resize( block_data_size );
+      is->seekg( reader->block_offsets[i] );
+      is->read( (char *)&input[0], input.size() );
+      if( is->gcount() != (std::streamsize) input.size() ) {
+        reader->setReadFailed();
+        return;
+      }
+      block_data = &input[0];
+    }
+
+    H3DInt64 copy_start = H3DMax( block_start, reader->read_offset );
+    H3DInt64 copy_end = H3DMin( block_end, read_end );
+    bool success;
+    if( copy_start == block_start && copy_end == block_end ) {
+      // the whole block is used so decompress directly into its place.
+      success = decompressBlock( codec,
+                                 block_data, block_data_size,
+                                 reader->read_data +
+                                 ( block_start - reader->read_offset ),
+                                 block_end - block_start );
+    } else {
+      output.resize( (size_t)( block_end - block_start ) );
+      success = decompressBlock( codec,
+                                 block_data, block_data_size,
+                                 &output[0], output.size() );
+      if( success ) {
+        memcpy( reader->read_data + ( copy_start - reader->read_offset ),
+                &output[0] + ( copy_start - block_start ),
+                (size_t)( copy_end - copy_start ) );
+      }
+    }
+    if( !success ) {
+      reader->setReadFailed();
+      return;
+    }
+  }
+}
+
+bool NrrdReader::readFailed() {
+  failed_lock.lock();
+  bool failed = read_failed;
+  failed_lock.unlock();
+  return failed;
+}
+
+void NrrdReader::setReadFailed() {
+  failed_lock.lock();
+  read_failed = true;
+  failed_lock.unlock();
+}
+
+std::istream *NrrdReader::openDataStream() {
+  if( data_in_memory ) {
+    return new MemoryInputStream( memory_data, (size_t) memory_size );
+  }
+  return new std::ifstream( data_filename.c_str(),
+                            std::ios::in | std::ios::binary );
+}
+
+bool NrrdReader::reportProgress( unsigned char *data, H3DInt64 size ) {
+  unsigned int nr_slices = (unsigned int)( size / sliceSize() );
+  if( nr_slices <= progress_slices ) return true;
+  if( swap_bytes ) {
+    unsigned int nr_components = nrComponents( pixel_type );
+    swapBytes( data + progress_slices * sliceSize(),
+               ( nr_slices - progress_slices ) * sliceSize(),
+               bits_per_pixel / ( 8 * nr_components ) );
+  }
+  progress_slices = nr_slices;
+  if( !progress_callback( this, nr_slices, progress_data ) ) {
+    setError( "Reading of \"" + data_filename + "\" was cancelled." );
+    return false;
+  }
+  return true;
+}
+
+NrrdWriter::NrrdWriter() :
+  compression_level( -1 ),
+  detached_header( false ),
+  block_sizes_pos( 0 ),
+  bytes_written( 0 ),
+  stream_codec( NULL ),
+  compress_input( NULL ),
+  compress_failed( false ) {
+  block_size = default_block_size;
+}
+
+NrrdWriter::~NrrdWriter() {
+  if( header_stream.is_open() ) close();
+}
+
+bool NrrdWriter::open( const std::string &url,
+                       unsigned int width,
+                       unsigned int height,
+                       unsigned int depth,
+                       unsigned int _bits_per_pixel,
+                       Image::PixelType _pixel_type,
+                       Image::PixelComponentType _pixel_component_type,
+                       const Vec3f &_pixel_size,
+                       Encoding encoding ) {
+  if( header_stream.is_open() ) close();
+  error_message = "";
+
+  unsigned int nr_components = nrComponents( _pixel_type );
+  if( nr_components == 0 || _bits_per_pixel % ( 8 * nr_components ) != 0 ||
+      typeName( _bits_per_pixel / ( 8 * nr_components ),
+                _pixel_component_type ).empty() ) {
+    setError( "Unsupported pixel format for Nrrd file \"" + url + "\"." );
+    return false;
+  }
+  if( !isEncodingSupported( encoding ) ) {
+    setError( "Encoding " + encodingName( encoding ) +
+              " is not supported by this build." );
+    return false;
+  }
+
+  w = width;
+  h = height;
+  d = depth;
+  bits_per_pixel = _bits_per_pixel;
+  pixel_type = _pixel_type;
+  pixel_component_type = _pixel_component_type;
+  pixel_size = _pixel_size;
+  data_encoding = encoding;
+  bytes_written = 0;
+  pending_data.clear();
+  block_sizes.clear();
+  block_sizes_pos = 0;
+
+  std::string data_file;
+  std::string lower_url = toLower( url );
+  detached_header = lower_url.size() > 5 &&
+    lower_url.compare( lower_url.size() - 5, 5, ".nhdr" ) == 0;
+  if( detached_header ) {
+    std::string data_url = url.substr( 0, url.size() - 5 ) + ".raw";
+    if( encoding == GZIP ) data_url += ".gz";
+    else if( encoding == BZIP2 ) data_url += ".bz2";
+    std::string::size_type pos = data_url.find_last_of( "/\\" );
+    data_file = pos == std::string::npos ?
+      data_url : data_url.substr( pos + 1 );
+    data_stream.open( data_url.c_str(), std::ios::out | std::ios::binary );
+    if( !data_stream.good() ) {
+      setError( "Could not open file \"" + data_url + "\" for writing." );
+      return false;
+    }
+  }
+
+  header_stream.open( url.c_str(), std::ios::out | std::ios::binary );
+  if( !header_stream.good() ) {
+    if( detached_header ) data_stream.close();
+    setError( "Could not open file \"" + url + "\" for writing." );
+    return false;
+  }
+
+  if( encoding != RAW ) {
+    if( block_size <= 0 ) {
+      block_size = 0;
+      stream_codec = new StreamCodec( encoding, true, compression_level );
+    }
+  }
+
+  if( !writeHeader( header_stream, data_file,
+                    encoding != RAW && block_size > 0 ?
+                    &block_sizes_pos : NULL ) ) {
+    setError( "Could not write header to \"" + url + "\"." );
+    return false;
+  }
+  return true;
+}
+
+bool NrrdWriter::writeHeader( std::ostream &os,
+                              const std::string &data_file,
+                              std::streamoff *sizes_pos ) {
+  unsigned int nr_components = nrComponents( pixel_type );
+  unsigned int bytes_per_component = bits_per_pixel / ( 8 * nr_components );
+
+  os << "NRRD0004" << std::endl;
+  os << "# Complete NRRD file format specification at:" << std::endl;
+  os << "# http://teem.sourceforge.net/nrrd/format.html" << std::endl;
+  os << "type: " << typeName( bytes_per_component, pixel_component_type )
+     << std::endl;
+  if( nr_components > 1 ) {
+    os << "dimension: 4" << std::endl;
+    os << "sizes: " << nr_components << " "
+       << w << " " << h << " " << d << std::endl;
+    os << "spacings: nan ";
+  } else {
+    os << "dimension: 3" << std::endl;
+    os << "sizes: " << w << " " << h << " " << d << std::endl;
+    os << "spacings: ";
+  }
+  os << pixel_size.x << " " << pixel_size.y << " " << pixel_size.z
+     << std::endl;
+  os << "encoding: " << encodingName( data_encoding ) << std::endl;
+  if( bytes_per_component > 1 )
+    os << "endian: " << ( isLittleEndian() ? "little" : "big" ) << std::endl;
+  if( !data_file.empty() )
+    os << "data file: " << data_file << std::endl;
+
+  if( sizes_pos ) {
+    // reserve room for the block sizes, they are written by close().
+    H3DInt64 total_size = sliceSize() * d;
+    H3DInt64 nr_blocks = ( total_size + block_size - 1 ) / block_size;
+    os << block_sizes_key << ":=" << block_size;
+    *sizes_pos = (std::streamoff) os.tellp();
+    std::string placeholder( block_size_digits + 1, '0' );
+    placeholder[0] = ' ';
+    for( H3DInt64 i = 0; i < nr_blocks; ++i ) os << placeholder;
+    os << std::endl;
+  }
+
+  // an empty line separates the header from attached data.
+  if( data_file.empty() ) os << std::endl;
+  return os.good();
+}
+
+bool NrrdWriter::writeSlices( const void *data, unsigned int nr_slices ) {
+  if( !header_stream.is_open() ) {
+    setError( "No Nrrd file open for writing." );
+    return false;
+  }
+  H3DInt64 size = nr_slices * sliceSize();
+  if( bytes_written + size > sliceSize() * d ) {
+    setError( "Too many slices written to Nrrd file." );
+    return false;
+  }
+
+  const unsigned char *in = (const unsigned char *)data;
+  std::ofstream &os = dataStream();
+  bytes_written += size;
+
+  if( data_encoding == RAW ) {
+    os.write( (const char *)in, size );
+    return os.good();
+  }
+
+  if( stream_codec ) {
+    StreamCodec *codec = static_cast< StreamCodec * >( stream_codec );
+    std::vector< unsigned char > output( stream_buffer_size );
+    size_t in_size = (size_t) size;
+    while( in_size > 0 ) {
+      unsigned char *out = &output[0];
+      size_t out_size = output.size();
+      if( codec->process( in, in_size, out, out_size, false ) ==
+          StreamCodec::CODEC_ERROR ) {
+        setError( "Could not compress Nrrd data." );
+        return false;
+      }
+      os.write( (const char *)&output[0], output.size() - out_size );
+    }
+    return os.good();
+  }
+
+  // fill up the incomplete block from the last call first.
+  H3DInt64 remaining = size;
+  if( !pending_data.empty() ) {
+    H3DInt64 n = H3DMin( block_size - (H3DInt64) pending_data.size(),
+                         remaining );
+    pending_data.insert( pending_data.end(), in, in + n );
+    in += n;
+    remaining -= n;
+    if( (H3DInt64) pending_data.size() == block_size ) {
+      if( !writeBlock( &pending_data[0], block_size ) ) return false;
+      pending_data.clear();
+    }
+  }
+
+  unsigned int nr_blocks = (unsigned int)( remaining / block_size );
+  if( nr_blocks > 0 ) {
+    if( !writeBlocks( in, nr_blocks ) ) return false;
+    in += nr_blocks * block_size;
+    remaining -= nr_blocks * block_size;
+  }
+
+  if( remaining > 0 ) pending_data.insert( pending_data.end(),
+                                           in, in + remaining );
+  return true;
+}
+
+bool NrrdWriter::writeBlock( const unsigned char *data, H3DInt64 size ) {
+  std::vector< unsigned char > output;
+  if( !compressBlock( data_encoding, compression_level,
+                      data, size, output ) ) {
+    setError( "Could not compress Nrrd data." );
+    return false;
+  }
+  dataStream().write( (const char *)&output[0], output.size() );
+  block_sizes.push_back( output.size() );
+  return dataStream().good();
+}
+
+bool NrrdWriter::writeBlocks( const unsigned char *data,
+                              unsigned int nr_blocks ) {
+  // compress a limited number of blocks at a time to bound the memory
+  // used for compressed data.
+  unsigned int nr_threads = nr_worker_threads == 0 ?
+    getNrHardwareThreads() : nr_worker_threads;
+  unsigned int batch_size = 2 * nr_threads;
+  for( unsigned int b = 0; b < nr_blocks; b += batch_size ) {
+    unsigned int n = H3DMin( batch_size, nr_blocks - b );
+    compress_input = data + b * block_size;
+    compress_failed = false;
+    compressed_blocks.resize( n );
+    parallelFor( 0, n, compressBlockRange, this, 1, nr_worker_threads );
+    if( compress_failed ) {
+      setError( "Could not compress Nrrd data." );
+      return false;
+    }
+    for( unsigned int i = 0; i < n; ++i ) {
+      dataStream().write( (const char *)&compressed_blocks[i][0],
+                          compressed_blocks[i].size() );
+      block_sizes.push_back( compressed_blocks[i].size() );
+    }
+  }
+  compressed_blocks.clear();
+  return dataStream().good();
+}
+
+void NrrdWriter::compressBlockRange( unsigned int begin, unsigned int end,
+                                     void *data ) {
+  NrrdWriter *writer = static_cast< NrrdWriter * >( data );
+  for( unsigned int i = begin; i < end; ++i ) {
+    if( !compressBlock( writer->data_encoding, writer->compression_level,
+                        writer->compress_input + i * writer->block_size,
+                        writer->block_size,
+                        writer->compressed_blocks[i] ) ) {
+      writer->failed_lock.lock();
+      writer->compress_failed = true;
+      writer->failed_lock.unlock();
+    }
+  }
+}
+
+bool NrrdWriter::close() {
+  if( !header_stream.is_open() ) return false;
+  bool success = true;
+
+  if( bytes_written != sliceSize() * d ) {
+    setError( "Not all slices were written to Nrrd file." );
+    success = false;
+  }
+
+  if( stream_codec ) {
+    StreamCodec *codec = static_cast< StreamCodec * >( stream_codec );
+    std::vector< unsigned char > output( stream_buffer_size );
+    StreamCodec::Result result = StreamCodec::CODEC_OK;
+    while( result == StreamCodec::CODEC_OK ) {
+      const unsigned char *in = NULL;
+      size_t in_size = 0;
+      unsigned char *out = &output[0];
+      size_t out_size = output.size();
+      result = codec->process( in, in_size, out, out_size, true );
+      dataStream().write( (const char *)&output[0],
+                          output.size() - out_size );
+    }
+    if( result == StreamCodec::CODEC_ERROR ) {
+      setError( "Could not compress Nrrd data." );
+      success = false;
+    }
+    delete codec;
+    stream_codec = NULL;
+  } else if( data_encoding != RAW ) {
+    if( !pending_data.empty() ) {
+      success = writeBlock( &pending_data[0], pending_data.size() ) &&
+        success;
+      pending_data.clear();
+    }
+    // fill in the block sizes in the header.
+    if( success ) {
+      header_stream.seekp( block_sizes_pos );
+      for( size_t i = 0; i < block_sizes.size(); ++i ) {
+        char size_string[32];
+        sprintf( size_string, " %0*lld", (int) block_size_digits,
+                 (long long) block_sizes[i] );
+        header_stream << size_string;
+      }
+    }
+  }
+
+  success = dataStream().good() && header_stream.good() && success;
+  if( detached_header ) data_stream.close();
+  header_stream.close();
+  return success;
+}
@@ -0,0 +1,374 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file PagedImage.cpp
+/// \brief CPP file for PagedImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/PagedImage.h>
+
+#include <deque>
+#include <set>
+
+using namespace H3DUtil;
+
+namespace PagedImageInternals {
+  // Reads bricks for all PagedImage instances in a background thread.
+  // The thread is created when first needed and is never stopped, an
+  // image removes its requests when it is destroyed.
+  class PrefetchQueue {
+  public:
+    PrefetchQueue() : current( NULL ), thread( NULL ) {
+      thread = new SimpleThread( prefetchThread, this );
+      thread->setThreadName( "PagedImage prefetch thread" );
+    }
+
+    // Replace the requests of image with the given bricks.
+    void setRequests( PagedImage *image,
+                      const std::vector< unsigned int > &bricks ) {
+      lock.lock();
+      removeRequests( image );
+      for( unsigned int i = 0; i < bricks.size(); ++i ) {
+        requests.push_back( std::make_pair( image, bricks[i] ) );
+      }
+      lock.broadcast();
+      lock.unlock();
+    }
+
+    // Remove all requests of image and wait until the brick of image
+    // that is being read, if any, is done.
+    void removeImage( PagedImage *image ) {
+      lock.lock();
+      removeRequests( image );
+      while( current == image ) lock.wait();
+      lock.unlock();
+    }
+
+  protected:
+    typedef std::deque< std::pair< PagedImage *, unsigned int > > Requests;
+
+    // Remove the requests of image. Must be called with lock locked.
+    void removeRequests( PagedImage *image ) {
+      Requests remaining;
+      for( Requests::iterator i = requests.begin();
+           i != requests.end(); ++i ) {
+        if( (*i).first != image ) remaining.push_back( *i );
+      }
+      requests.swap( remaining );
+    }
+
+    static void *prefetchThread( void *data ) {
+      PrefetchQueue *queue = static_cast< PrefetchQueue * >( data );
+      queue->lock.lock();
+      while( true ) {
+        while( queue->requests.empty() ) queue->lock.wait();
+        std::pair< PagedImage *, unsigned int > request =
+          queue->requests.front();
+        queue->requests.pop_front();
+        queue->current = request.first;
+        queue->lock.unlock();
+
+        request.first->prefetchBrick( request.second );
+
+        queue->lock.lock();
+        queue->current = NULL;
+        queue->lock.broadcast();
+      }
+      return NULL;
+    }
+
+    ConditionLock lock;
+    Requests requests;
+    PagedImage *current;
+    // Never deleted, like the queue itself.
+    SimpleThread *thread;
+  };
+
+  MutexLock prefetch_queue_lock;
+  PrefetchQueue *prefetch_queue = NULL;
+
+  PrefetchQueue *getPrefetchQueue( bool create ) {
+    prefetch_queue_lock.lock();
+    if( !prefetch_queue && create ) prefetch_queue = new PrefetchQueue;
+    PrefetchQueue *queue = prefetch_queue;
+    prefetch_queue_lock.unlock();
+    return queue;
+  }
+}
+
+using namespace PagedImageInternals;
+
+PagedImage::PagedImage( const std::string &url,
+                        H3DInt64 _cache_size ) :
+  cache_size( _cache_size ),
+  cached_bytes( 0 ) {
+  if( !reader.open( url ) ) {
+    throw CouldNotOpenPagedImage( url, reader.getError(),
+                                  H3D_FULL_LOCATION );
+  }
+  cache.resize( reader.nrBricks() );
+}
+
+PagedImage::~PagedImage() {
+  PrefetchQueue *queue = getPrefetchQueue( false );
+  if( queue ) queue->removeImage( this );
+}
+
+void PagedImage::getElement( void *value, int x, int y, int z ) {
+  unsigned int bytes_per_pixel = reader.bytesPerPixel();
+  if( x < 0 || y < 0 || z < 0 ||
+      (unsigned int) x >= reader.width() ||
+      (unsigned int) y >= reader.height() ||
+      (unsigned int) z >= reader.depth() ) {
+    memset( value, 0, bytes_per_pixel );
+    return;
+  }
+
+  unsigned int bw = reader.brickWidth();
+  unsigned int bh = reader.brickHeight();
+  unsigned int bd = reader.brickDepth();
+  unsigned int bx = x / bw, by = y / bh, bz = z / bd;
+  // the size of the brick, bricks at the upper edges are cropped.
+  unsigned int brick_w = H3DMin( bw, reader.width() - bx * bw );
+  unsigned int brick_h = H3DMin( bh, reader.height() - by * bh );
+  size_t offset = ( ( (size_t)( z - bz * bd ) * brick_h +
+                      ( y - by * bh ) ) * brick_w +
+                    ( x - bx * bw ) ) * bytes_per_pixel;
+
+  cache_lock.lock();
+  unsigned char *brick = getBrick( reader.brickIndex( bx, by, bz ) );
+  if( brick ) {
+    memcpy( value, brick + offset, bytes_per_pixel );
+  } else {
+    memset( value, 0, bytes_per_pixel );
+  }
+  cache_lock.unlock();
+}
+
+bool PagedImage::getRegion( unsigned int x, unsigned int y, unsigned int z,
+                            unsigned int width,
+                            unsigned int height,
+                            unsigned int depth,
+                            void *data ) {
+  if( x + width > reader.width() || y + height > reader.height() ||
+      z + depth > reader.depth() ) {
+    return false;
+  }
+  if( width == 0 || height == 0 || depth == 0 ) return true;
+
+  unsigned int bytes_per_pixel = reader.bytesPerPixel();
+  unsigned char *dst = (unsigned char *)data;
+  unsigned int bw = reader.brickWidth();
+  unsigned int bh = reader.brickHeight();
+  unsigned int bd = reader.brickDepth();
+  bool success = true;
+  cache_lock.lock();
+  for( unsigned int bz = z / bd; bz <= ( z + depth - 1 ) / bd; ++bz ) {
+    for( unsigned int by = y / bh; by <= ( y + height - 1 ) / bh; ++by ) {
+      for( unsigned int bx = x / bw; bx <= ( x + width - 1 ) / bw; ++bx ) {
+        unsigned int index = reader.brickIndex( bx, by, bz );
+        unsigned int x0, y0, z0, brick_w, brick_h, brick_d;
+        reader.getBrickBox( index, x0, y0, z0, brick_w, brick_h, brick_d );
+        unsigned char *brick = getBrick( index );
+        if( !brick ) {
+          success = false;
+          continue;
+        }
+        // copy the intersection of the brick and the region.
+        unsigned int sx = H3DMax( x0, x ), ex = H3DMin( x0 + brick_w, x + width );
+        unsigned int sy = H3DMax( y0, y ), ey = H3DMin( y0 + brick_h, y + height );
+        unsigned int sz = H3DMax( z0, z ), ez = H3DMin( z0 + brick_d, z + depth );
+        for( unsigned int pz = sz; pz < ez; ++pz ) {
+          for( unsigned int py = sy; py < ey; ++py ) {
+            memcpy( dst + ( ( (size_t)( pz - z ) * height + ( py - y ) ) *
+                            width + ( sx - x ) ) * bytes_per_pixel,
+                    brick + ( ( (size_t)( pz - z0 ) * brick_h + ( py - y0 ) ) *
+                              brick_w + ( sx - x0 ) ) * bytes_per_pixel,
+                    ( ex - sx ) * bytes_per_pixel );
+          }
+        }
+      }
+    }
+  }
+  cache_lock.unlock();
+  return success;
+}
+
+unsigned char *PagedImage::getBrick( unsigned int index, bool prefetch ) {
+  CacheEntry &entry = cache[index];
+  // another thread is reading the brick, wait for it instead of reading
+  // it again.
+  while( entry.loading ) cache_lock.wait();
+
+  if( !entry.data.empty() ) {
+    if( !prefetch ) ++statistics.hits;
+    lru_list.splice( lru_list.begin(), lru_list, entry.lru_position );
+    return &entry.data[0];
+  }
+
+  if( prefetch ) ++statistics.prefetched_bricks;
+  else ++statistics.misses;
+  entry.loading = true;
+  std::vector< unsigned char > data( (size_t) reader.brickDataSize( index ) );
+  cache_lock.unlock();
+  bool success = reader.readBrick( index, &data[0] );
+  cache_lock.lock();
+  entry.loading = false;
+  cache_lock.broadcast();
+  if( !success ) return NULL;
+
+  entry.data.swap( data );
+  lru_list.push_front( index );
+  entry.lru_position = lru_list.begin();
+  cached_bytes += entry.data.size();
+  statistics.bytes_paged += entry.data.size();
+  statistics.bytes_read += reader.brickFileSize( index );
+  evictBricks( index );
+  return &entry.data[0];
+}
+
+void PagedImage::evictBricks( unsigned int keep ) {
+  while( cached_bytes > cache_size && !lru_list.empty() ) {
+    unsigned int index = lru_list.back();
+    if( index == keep ) break;
+    lru_list.pop_back();
+    cached_bytes -= cache[index].data.size();
+    std::vector< unsigned char >().swap( cache[index].data );
+    ++statistics.evicted_bricks;
+  }
+}
+
+void PagedImage::prefetchBrick( unsigned int index ) {
+  cache_lock.lock();
+  if( index < cache.size() && cache[index].data.empty() ) {
+    getBrick( index, true );
+  }
+  cache_lock.unlock();
+}
+
+void PagedImage::setPrefetchBricks( std::vector< unsigned int > &bricks ) {
+  // bricks beyond what fits in half of the cache would only replace
+  // each other.
+  H3DInt64 bytes = 0;
+  unsigned int n = 0;
+  for( ; n < bricks.size(); ++n ) {
+    bytes += reader.brickDataSize( bricks[n] );
+    if( n > 0 && bytes > cache_size / 2 ) break;
+  }
+  bricks.resize( n );
+  getPrefetchQueue( true )->setRequests( this, bricks );
+}
+
+void PagedImage::prefetchRegion( unsigned int x, unsigned int y,
+                                 unsigned int z,
+                                 unsigned int width,
+                                 unsigned int height,
+                                 unsigned int depth ) {
+  std::vector< unsigned int > bricks;
+  if( x < reader.width() && y < reader.height() && z < reader.depth() &&
+      width > 0 && height > 0 && depth > 0 ) {
+    unsigned int x1 = H3DMin( x + width, reader.width() ) - 1;
+    unsigned int y1 = H3DMin( y + height, reader.height() ) - 1;
+    unsigned int z1 = H3DMin( z + depth, reader.depth() ) - 1;
+    for( unsigned int bz = z / reader.brickDepth();
+         bz <= z1 / reader.brickDepth(); ++bz ) {
+      for( unsigned int by = y / reader.brickHeight();
+           by <= y1 / reader.brickHeight(); ++by ) {
+        for( unsigned int bx = x / reader.brickWidth();
+             bx <= x1 / reader.brickWidth(); ++bx ) {
+          bricks.push_back( reader.brickIndex( bx, by, bz ) );
+        }
+      }
+    }
+  }
+  setPrefetchBricks( bricks );
+}
+
+void PagedImage::prefetchDirection( const Vec3f &position,
+                                    const Vec3f &direction,
+                                    unsigned int nr_bricks ) {
+  std::vector< unsigned int > bricks;
+  std::set< unsigned int > added;
+  Vec3f dir = direction;
+  H3DFloat length = dir.length();
+  if( length > 0 ) {
+    // step with half the smallest brick dimension so no brick is missed
+    // when moving along an axis.
+    H3DFloat step = 0.5f * H3DMin( H3DMin( reader.brickWidth(),
+                                           reader.brickHeight() ),
+                                   reader.brickDepth() );
+    dir = dir * ( step / length );
+    Vec3f p = position;
+    while( bricks.size() < nr_bricks ) {
+      if( p.x < 0 || p.y < 0 || p.z < 0 ||
+          p.x >= reader.width() || p.y >= reader.height() ||
+          p.z >= reader.depth() ) break;
+      unsigned int index =
+        reader.brickIndex( (unsigned int) p.x / reader.brickWidth(),
+                           (unsigned int) p.y / reader.brickHeight(),
+                           (unsigned int) p.z / reader.brickDepth() );
+      if( added.insert( index ).second ) bricks.push_back( index );
+      p += dir;
+    }
+  }
+  setPrefetchBricks( bricks );
+}
+
+void PagedImage::setCacheSize( H3DInt64 size ) {
+  cache_lock.lock();
+  cache_size = size;
+  evictBricks( lru_list.empty() ? 0 : lru_list.front() );
+  cache_lock.unlock();
+}
+
+H3DInt64 PagedImage::cachedBytes() {
+  cache_lock.lock();
+  H3DInt64 bytes = cached_bytes;
+  cache_lock.unlock();
+  return bytes;
+}
+
+void PagedImage::clearCache() {
+  cache_lock.lock();
+  for( std::list< unsigned int >::iterator i = lru_list.begin();
+       i != lru_list.end(); ++i ) {
+    std::vector< unsigned char >().swap( cache[*i].data );
+  }
+  lru_list.clear();
+  cached_bytes = 0;
+  cache_lock.unlock();
+}
+
+PagedImage::CacheStatistics PagedImage::getCacheStatistics() {
+  cache_lock.lock();
+  CacheStatistics s = statistics;
+  cache_lock.unlock();
+  return s;
+}
+
+void PagedImage::resetCacheStatistics() {
+  cache_lock.lock();
+  statistics = CacheStatistics();
+  cache_lock.unlock();
+}
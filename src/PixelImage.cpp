@@ -30,8 +30,24 @@
 
 #include "H3DUtil/PixelImage.h"
 
+#include <stdlib.h>
+
 using namespace H3DUtil;
 
+void PixelImage::deleteArrayData( unsigned char *data,
+                                  void * /*deleter_data*/ ) {
+  delete [] data;
+}
+
+void PixelImage::freeData( unsigned char *data,
+                           void * /*deleter_data*/ ) {
+  free( data );
+}
+
+void PixelImage::keepData( unsigned char * /*data*/,
+                           void * /*deleter_data*/ ) {
+}
+
  PixelImage::PixelImage( unsigned int _width,
                          unsigned int _height,
                          unsigned int _depth,
@@ -49,7 +65,11 @@ using namespace H3DUtil;
    pixel_type( _pixel_type ),
    pixel_component_type( _pixel_component_type ),
    pixel_size( _pixel_size ),
-   compression_type( _compression_type ) {
+   compression_type( _compression_type ),
+   row_stride( 0 ),
+   slice_stride( 0 ),
+   data_deleter( NULL ),
+   data_deleter_data( NULL ) {
    if( copy_data ) {
      unsigned int size = (w * h * d * bits_per_pixel)/8;
      image_data = new unsigned char[ size ];
@@ -66,6 +86,9 @@ PixelImage::PixelImage( unsigned int _width,
                         unsigned int _bits_per_pixel,
                         PixelType _pixel_type,
                         PixelComponentType _pixel_component_type,
+                        unsigned char *data,
+                        DataDeleter deleter,
+                        void *deleter_data,
                         const Vec3f &_pixel_size,
                         CompressionType _compression_type ):
   w( _width ),
@@ -75,7 +98,34 @@ PixelImage::PixelImage( unsigned int _width,
   pixel_type( _pixel_type ),
   pixel_component_type( _pixel_component_type ),
   pixel_size( _pixel_size ),
-  compression_type( _compression_type ) {
+  compression_type( _compression_type ),
+  image_data( data ),
+  row_stride( 0 ),
+  slice_stride( 0 ),
+  data_deleter( deleter ),
+  data_deleter_data( deleter_data ) {
+}
+
+PixelImage::PixelImage( unsigned int _width,
+                        unsigned int _height,
+                        unsigned int _depth,
+                        unsigned int _bits_per_pixel,
+                        PixelType _pixel_type,
+                        PixelComponentType _pixel_component_type,
+                        const Vec3f &_pixel_size,
+                        CompressionType _compression_type ):
+  w( _width ),
+  h( _height ),
+  d( _depth ),
+  bits_per_pixel( _bits_per_pixel ),
+  pixel_type( _pixel_type ),
+  pixel_component_type( _pixel_component_type ),
+  pixel_size( _pixel_size ),
+  compression_type( _compression_type ),
+  row_stride( 0 ),
+  slice_stride( 0 ),
+  data_deleter( NULL ),
+  data_deleter_data( NULL ) {
   unsigned int size = (w * h * d * bits_per_pixel)/8;
   image_data = new unsigned char[ size ];
 } 
@@ -83,7 +133,12 @@ PixelImage::PixelImage( unsigned int _width,
 PixelImage::PixelImage( Image *image,
                         unsigned int new_width,
                         unsigned int new_height,
-                        unsigned int new_depth ) {
+                        unsigned int new_depth ) :
+  image_data( NULL ),
+  row_stride( 0 ),
+  slice_stride( 0 ),
+  data_deleter( NULL ),
+  data_deleter_data( NULL ) {
   
   if( image && image->compressionType() == NO_COMPRESSION ) {
     unsigned int width = image->width ();
@@ -100,9 +155,15 @@ PixelImage::PixelImage( Image *image,
       pixel_type = image->pixelType();
       pixel_component_type = image->pixelComponentType();
       pixel_size = image->pixelSize();
+      compression_type = NO_COMPRESSION;
       unsigned int size = (w * h * d * bits_per_pixel)/8;
       image_data = new unsigned char[ size ];
-      memcpy( image_data, image->getImageData(), size );
+      unsigned char *src = (unsigned char *) image->getImageData();
+      if( src && image->hasPackedData() ) {
+        memcpy( image_data, src, size );
+      } else {
+        image->getPackedSlices( 0, d, image_data );
+      }
     } else {
       unsigned int size = 
         (new_width * new_height * new_depth * bits_per_pixel)/8;
@@ -0,0 +1,493 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file ProgressiveImageLoader.cpp
+/// \brief CPP file for ProgressiveImageLoader.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/ProgressiveImageLoader.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/NrrdFile.h>
+#include <H3DUtil/BrickedVolumeFile.h>
+#include <H3DUtil/LoadImageFunctions.h>
+
+#ifdef HAVE_DCMTK
+#include <H3DUtil/DicomImage.h>
+#include <H3DUtil/DicomSeriesIndex.h>
+#include <H3DUtil/BatchFileReader.h>
+#include <H3DUtil/ImageGeometry.h>
+#include <sstream>
+#endif
+
+using namespace H3DUtil;
+
+namespace ProgressiveImageLoaderInternals {
+  // Returns the number of bytes used for each pixel.
+  unsigned int bytesPerPixel( unsigned int bits_per_pixel ) {
+    return ( bits_per_pixel + 7 ) / 8;
+  }
+
+  // Create a PixelImage with the given properties and all data set to 0.
+  Image *createEmptyImage( unsigned int width,
+                           unsigned int height,
+                           unsigned int depth,
+                           unsigned int bits_per_pixel,
+                           Image::PixelType pixel_type,
+                           Image::PixelComponentType component_type,
+                           const Vec3f &pixel_size ) {
+    size_t size = (size_t) width * height * depth *
+      bytesPerPixel( bits_per_pixel );
+    unsigned char *data = new unsigned char[ size ]();
+    return new PixelImage( width, height, depth, bits_per_pixel,
+                           pixel_type, component_type,
+                           data, false, pixel_size );
+  }
+}
+
+using namespace ProgressiveImageLoaderInternals;
+
+ProgressiveImageLoader::ProgressiveImageLoader() :
+  source( IMAGE_FILE_SOURCE ),
+  nr_slices( 0 ),
+  nr_slices_loaded( 0 ),
+  done( true ),
+  finished( true ),
+  failed( false ),
+  cancelled( false ),
+  progress_callback( NULL ),
+  progress_data( NULL ),
+  nrrd_reader( NULL ),
+  bricked_reader( NULL ),
+  dicom_native_values( false ),
+  thread( NULL ) {
+}
+
+ProgressiveImageLoader::~ProgressiveImageLoader() {
+  cancel();
+}
+
+void ProgressiveImageLoader::setProgressCallback( ProgressCallback callback,
+                                                  void *data ) {
+  lock.lock();
+  progress_callback = callback;
+  progress_data = data;
+  lock.unlock();
+}
+
+bool ProgressiveImageLoader::load( const std::string &_url ) {
+  cancel();
+
+  ImageFileInfo info = probeImage( _url );
+  if( info.format == ImageFileInfo::NRRD_FORMAT ) {
+    NrrdReader *reader = new NrrdReader;
+    if( reader->open( _url ) ) {
+      startLoad( _url, NRRD_SOURCE,
+                 createEmptyImage( reader->width(),
+                                   reader->height(),
+                                   reader->depth(),
+                                   reader->bitsPerPixel(),
+                                   reader->pixelType(),
+                                   reader->pixelComponentType(),
+                                   reader->pixelSize() ),
+                 reader->depth() );
+      nrrd_reader = reader;
+      startThread();
+      return true;
+    }
+    // files using features NrrdReader does not support are loaded as a
+    // whole by loadImage.
+    bool unsupported = reader->hasUnsupportedFeature();
+    std::string error = reader->getError();
+    delete reader;
+    if( !unsupported ) {
+      loadFailed( _url, error );
+      return false;
+    }
+  } else if( info.format == ImageFileInfo::BRICKED_VOLUME_FORMAT ) {
+    BrickedVolumeReader *reader = new BrickedVolumeReader;
+    if( !reader->open( _url ) ) {
+      std::string error = reader->getError();
+      delete reader;
+      loadFailed( _url, error );
+      return false;
+    }
+    startLoad( _url, BRICKED_VOLUME_SOURCE,
+               createEmptyImage( reader->width(),
+                                 reader->height(),
+                                 reader->depth(),
+                                 reader->bitsPerPixel(),
+                                 reader->pixelType(),
+                                 reader->pixelComponentType(),
+                                 reader->pixelSize() ),
+               reader->depth() );
+    bricked_reader = reader;
+    startThread();
+    return true;
+  } else if( info.format == ImageFileInfo::UNKNOWN_FORMAT ) {
+    loadFailed( _url, "Could not read image file \"" + _url + "\"." );
+    return false;
+  }
+
+  startLoad( _url, IMAGE_FILE_SOURCE, NULL, info.depth );
+  startThread();
+  return true;
+}
+
+#ifdef HAVE_DCMTK
+bool ProgressiveImageLoader::loadDicomSeries( const std::string &_url,
+                                              bool native_values ) {
+  cancel();
+
+  size_t found = _url.find_last_of( "/\\" );
+  std::string path, filename;
+  if( found != std::string::npos ) {
+    path = _url.substr( 0, found );
+    filename = _url.substr( found + 1 );
+  } else {
+    filename = _url;
+  }
+
+  // find the files of the series in the order used by loadDicomFile.
+  std::vector< std::string > files;
+  H3DFloat slice_distance = -1;
+  DicomSeriesIndex index( path.empty() ? "." : path, false );
+  index.update();
+  const DicomSeriesIndex::Entry *entry = index.findEntry( filename );
+  if( entry && entry->is_dicom && !entry->series_instance_uid.empty() ) {
+    std::vector< const DicomSeriesIndex::Entry * > series =
+      index.getSeries( entry->series_instance_uid );
+    for( unsigned int i = 0; i < series.size(); ++i ) {
+      files.push_back( index.getFullPath( *series[i] ) );
+    }
+    if( series.size() >= 2 &&
+        series[0]->has_position && series[1]->has_position ) {
+      Vec3d normal =
+        series[0]->row_orientation % series[0]->column_orientation;
+      slice_distance = (H3DFloat)
+        H3DAbs( ( series[0]->position - series[1]->position ) * normal );
+    }
+  }
+  if( files.empty() ) files.push_back( _url );
+
+  // the first slice is read here to get the properties of the volume.
+  AutoRef< DicomImage > first_slice;
+  try {
+    first_slice.reset( new DicomImage( files[0], native_values ) );
+  } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+    std::stringstream s;
+    s << e;
+    loadFailed( _url, s.str() );
+    return false;
+  }
+
+  Vec3f pixel_size = first_slice->pixelSize();
+  if( slice_distance >= 0 ) {
+    pixel_size.z = slice_distance * H3DFloat( 1e-3 ); // to metres
+  }
+  unsigned int width = first_slice->width();
+  unsigned int height = first_slice->height();
+  Image *volume = createEmptyImage( width, height,
+                                    (unsigned int) files.size(),
+                                    first_slice->bitsPerPixel(),
+                                    first_slice->pixelType(),
+                                    first_slice->pixelComponentType(),
+                                    pixel_size );
+
+  // dicom data is specified from the top left corner, the slices are
+  // flipped so that they start from the bottom left corner.
+  flipImageData( first_slice->getImageData(), volume->getImageData(),
+                 width, height, 1,
+                 bytesPerPixel( first_slice->bitsPerPixel() ), 1 );
+
+  startLoad( _url, DICOM_SOURCE, volume, (unsigned int) files.size() );
+  nr_slices_loaded = 1;
+  dicom_files = files;
+  dicom_native_values = native_values;
+  startThread();
+  return true;
+}
+#endif
+
+Image *ProgressiveImageLoader::getImage() {
+  lock.lock();
+  Image *i = image.get();
+  lock.unlock();
+  return i;
+}
+
+unsigned int ProgressiveImageLoader::nrSlices() {
+  lock.lock();
+  unsigned int n = nr_slices;
+  lock.unlock();
+  return n;
+}
+
+unsigned int ProgressiveImageLoader::nrSlicesLoaded() {
+  lock.lock();
+  unsigned int n = nr_slices_loaded;
+  lock.unlock();
+  return n;
+}
+
+bool ProgressiveImageLoader::waitForSlices( unsigned int n ) {
+  lock.lock();
+  while( !finished && nr_slices_loaded < n ) lock.wait();
+  bool loaded = nr_slices_loaded >= n;
+  lock.unlock();
+  return loaded;
+}
+
+bool ProgressiveImageLoader::wait() {
+  lock.lock();
+  while( !finished ) lock.wait();
+  bool success = !failed;
+  lock.unlock();
+  return success;
+}
+
+bool ProgressiveImageLoader::isDone() {
+  lock.lock();
+  bool d = done;
+  lock.unlock();
+  return d;
+}
+
+bool ProgressiveImageLoader::hasFailed() {
+  lock.lock();
+  bool f = failed;
+  lock.unlock();
+  return f;
+}
+
+std::string ProgressiveImageLoader::getError() {
+  lock.lock();
+  std::string message = error_message;
+  lock.unlock();
+  return message;
+}
+
+void ProgressiveImageLoader::cancel() {
+  if( !thread ) return;
+  lock.lock();
+  cancelled = true;
+  lock.unlock();
+  thread->join();
+  delete thread;
+  thread = NULL;
+  delete nrrd_reader;
+  nrrd_reader = NULL;
+  delete bricked_reader;
+  bricked_reader = NULL;
+  dicom_files.clear();
+}
+
+void ProgressiveImageLoader::startLoad( const std::string &_url,
+                                        Source _source,
+                                        Image *_image,
+                                        unsigned int _nr_slices ) {
+  lock.lock();
+  url = _url;
+  source = _source;
+  image.reset( _image );
+  nr_slices = _nr_slices;
+  nr_slices_loaded = 0;
+  done = false;
+  finished = false;
+  failed = false;
+  cancelled = false;
+  error_message = "";
+  lock.unlock();
+}
+
+void ProgressiveImageLoader::loadFailed( const std::string &_url,
+                                         const std::string &message ) {
+  startLoad( _url, IMAGE_FILE_SOURCE, NULL, 0 );
+  lock.lock();
+  done = true;
+  finished = true;
+  failed = true;
+  error_message = message;
+  lock.broadcast();
+  lock.unlock();
+}
+
+void ProgressiveImageLoader::startThread() {
+  thread = new SimpleThread( loadThread, this );
+  thread->setThreadName( "Progressive image loading thread" );
+}
+
+bool ProgressiveImageLoader::publishSlices( unsigned int n ) {
+  lock.lock();
+  if( n > nr_slices_loaded ) nr_slices_loaded = n;
+  lock.broadcast();
+  bool proceed = !cancelled;
+  ProgressCallback callback = progress_callback;
+  void *data = progress_data;
+  lock.unlock();
+  if( callback && proceed ) callback( this, n, data );
+  return proceed;
+}
+
+void ProgressiveImageLoader::finish( bool success,
+                                     const std::string &message ) {
+  lock.lock();
+  done = true;
+  failed = !success;
+  if( cancelled && !success ) {
+    error_message = "Loading of \"" + url + "\" was cancelled.";
+  } else {
+    error_message = message;
+  }
+  unsigned int n = nr_slices_loaded;
+  ProgressCallback callback = progress_callback;
+  void *data = progress_data;
+  lock.unlock();
+  if( callback ) callback( this, n, data );
+
+  // wait and waitForSlices return when the last callback has been made.
+  lock.lock();
+  finished = true;
+  lock.broadcast();
+  lock.unlock();
+}
+
+void *ProgressiveImageLoader::loadThread( void *data ) {
+  ProgressiveImageLoader *loader =
+    static_cast< ProgressiveImageLoader * >( data );
+  switch( loader->source ) {
+  case NRRD_SOURCE: loader->loadNrrdData(); break;
+  case BRICKED_VOLUME_SOURCE: loader->loadBrickedVolumeData(); break;
+#ifdef HAVE_DCMTK
+  case DICOM_SOURCE: loader->loadDicomData(); break;
+#endif
+  default: loader->loadImageFileData(); break;
+  }
+  return NULL;
+}
+
+bool ProgressiveImageLoader::nrrdProgress( NrrdReader * /*reader*/,
+                                           unsigned int n,
+                                           void *data ) {
+  ProgressiveImageLoader *loader =
+    static_cast< ProgressiveImageLoader * >( data );
+  return loader->publishSlices( n );
+}
+
+void ProgressiveImageLoader::loadNrrdData() {
+  nrrd_reader->setProgressCallback( nrrdProgress, this );
+  if( nrrd_reader->readSlices( 0, nr_slices, image->getImageData() ) ) {
+    finish( true );
+  } else {
+    finish( false, nrrd_reader->getError() );
+  }
+}
+
+void ProgressiveImageLoader::loadBrickedVolumeData() {
+  // one layer of bricks is read at a time, the bricks of a layer are
+  // decompressed in parallel.
+  unsigned int width = bricked_reader->width();
+  unsigned int height = bricked_reader->height();
+  unsigned int step = bricked_reader->brickDepth();
+  size_t slice_size =
+    (size_t) width * height * bricked_reader->bytesPerPixel();
+  unsigned char *data = (unsigned char *) image->getImageData();
+  for( unsigned int z = 0; z < nr_slices; z += step ) {
+    unsigned int n = H3DMin( step, nr_slices - z );
+    if( !bricked_reader->readRegion( 0, 0, z, width, height, n,
+                                     data + z * slice_size ) ) {
+      finish( false, bricked_reader->getError() );
+      return;
+    }
+    if( !publishSlices( z + n ) ) {
+      finish( false );
+      return;
+    }
+  }
+  finish( true );
+}
+
+void ProgressiveImageLoader::loadImageFileData() {
+  Image *loaded = H3DUtil::loadImage( url );
+  if( !loaded ) {
+    finish( false, "Could not load image file \"" + url + "\"." );
+    return;
+  }
+  lock.lock();
+  image.reset( loaded );
+  nr_slices = loaded->depth();
+  lock.unlock();
+  publishSlices( loaded->depth() );
+  finish( true );
+}
+
+#ifdef HAVE_DCMTK
+void ProgressiveImageLoader::loadDicomData() {
+  unsigned int width = image->width();
+  unsigned int height = image->height();
+  unsigned int bits_per_pixel = image->bitsPerPixel();
+  size_t slice_size =
+    (size_t) width * height * bytesPerPixel( bits_per_pixel );
+  unsigned char *data = (unsigned char *) image->getImageData();
+
+  // the first file has already been loaded, the rest are read in the
+  // background ahead of the slice being decoded.
+  BatchFileReader file_reader;
+  file_reader.start( std::vector< std::string >( dicom_files.begin() + 1,
+                                                 dicom_files.end() ) );
+  for( unsigned int i = 1; i < nr_slices; ++i ) {
+    AutoRef< DicomImage > slice;
+    try {
+      const unsigned char *file_data;
+      size_t file_size;
+      if( !file_reader.waitForFile( i - 1, file_data, file_size ) ) {
+        throw DicomImage::CouldNotLoadDicomImage( dicom_files[i],
+                                                  "Could not read file.",
+                                                  H3D_FULL_LOCATION );
+      }
+      slice.reset( new DicomImage( file_data, file_size,
+                                   dicom_native_values, dicom_files[i] ) );
+      file_reader.releaseFile( i - 1 );
+    } catch( const DicomImage::CouldNotLoadDicomImage &e ) {
+      std::stringstream s;
+      s << e;
+      finish( false, s.str() );
+      return;
+    }
+    if( slice->width() != width || slice->height() != height ||
+        slice->bitsPerPixel() != bits_per_pixel ) {
+      finish( false, "The DICOM file \"" + dicom_files[i] +
+              "\" does not have the same size as the first file "
+              "of the series." );
+      return;
+    }
+    flipImageData( slice->getImageData(), data + i * slice_size,
+                   width, height, 1, bytesPerPixel( bits_per_pixel ), 1 );
+    if( !publishSlices( i + 1 ) ) {
+      finish( false );
+      return;
+    }
+  }
+  finish( true );
+}
+#endif
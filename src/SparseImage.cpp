@@ -0,0 +1,348 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file SparseImage.cpp
+/// \brief CPP file for SparseImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/SparseImage.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+
+using namespace H3DUtil;
+
+namespace SparseImageInternals {
+  // Returns true if all pixels in a box of width x height x depth pixels
+  // are equal to value. row_stride and slice_stride are the distances in
+  // bytes between rows and slices of the data.
+  bool isUniform( const unsigned char *data,
+                  size_t row_stride, size_t slice_stride,
+                  unsigned int width, unsigned int height, unsigned int depth,
+                  unsigned int bytes_per_pixel,
+                  const unsigned char *value ) {
+    std::vector< unsigned char > row( width * bytes_per_pixel );
+    for( unsigned int x = 0; x < width; ++x ) {
+      memcpy( &row[ x * bytes_per_pixel ], value, bytes_per_pixel );
+    }
+    for( unsigned int z = 0; z < depth; ++z ) {
+      for( unsigned int y = 0; y < height; ++y ) {
+        if( memcmp( data + z * slice_stride + y * row_stride,
+                    &row[0], row.size() ) != 0 ) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Returns true if all bytes are 0.
+  bool isZero( const unsigned char *value, unsigned int size ) {
+    for( unsigned int i = 0; i < size; ++i ) {
+      if( value[i] != 0 ) return false;
+    }
+    return true;
+  }
+}
+
+using namespace SparseImageInternals;
+
+SparseImage::SparseImage( unsigned int _width,
+                          unsigned int _height,
+                          unsigned int _depth,
+                          unsigned int _bits_per_pixel,
+                          PixelType _pixel_type,
+                          PixelComponentType _pixel_component_type,
+                          const Vec3f &_pixel_size,
+                          const void *value,
+                          unsigned int _brick_size ) :
+  w( _width ),
+  h( _height ),
+  d( _depth ),
+  bits_per_pixel( _bits_per_pixel ),
+  bytes_per_pixel( _bits_per_pixel / 8 ),
+  pixel_type( _pixel_type ),
+  pixel_component_type( _pixel_component_type ),
+  pixel_size( _pixel_size ),
+  brick_size( H3DMax( _brick_size, 1u ) ),
+  source_image( NULL ) {
+  initBricks();
+  if( value ) {
+    for( unsigned int i = 0; i < bricks.size(); ++i ) {
+      memcpy( &uniform_values[ i * bytes_per_pixel ], value,
+              bytes_per_pixel );
+    }
+  }
+}
+
+SparseImage::SparseImage( Image *image,
+                          unsigned int _brick_size,
+                          unsigned int nr_threads ) :
+  w( image->width() ),
+  h( image->height() ),
+  d( image->depth() ),
+  bits_per_pixel( image->bitsPerPixel() ),
+  bytes_per_pixel( image->bitsPerPixel() / 8 ),
+  pixel_type( image->pixelType() ),
+  pixel_component_type( image->pixelComponentType() ),
+  pixel_size( image->pixelSize() ),
+  brick_size( H3DMax( _brick_size, 1u ) ),
+  source_image( image ) {
+  initBricks();
+  parallelFor( 0, nrBricks(), convertBricks, this, 1, nr_threads );
+  source_image = NULL;
+}
+
+SparseImage::~SparseImage() {
+  for( unsigned int i = 0; i < bricks.size(); ++i ) {
+    delete [] bricks[i];
+  }
+}
+
+void SparseImage::initBricks() {
+  bricks_x = ( w + brick_size - 1 ) / brick_size;
+  bricks_y = ( h + brick_size - 1 ) / brick_size;
+  bricks_z = ( d + brick_size - 1 ) / brick_size;
+  bricks.assign( bricks_x * bricks_y * bricks_z, (unsigned char *) NULL );
+  uniform_values.assign( bricks.size() * bytes_per_pixel, 0 );
+}
+
+void SparseImage::getBrickBox( unsigned int index,
+                               unsigned int &x,
+                               unsigned int &y,
+                               unsigned int &z,
+                               unsigned int &width,
+                               unsigned int &height,
+                               unsigned int &depth ) {
+  x = ( index % bricks_x ) * brick_size;
+  y = ( ( index / bricks_x ) % bricks_y ) * brick_size;
+  z = ( index / ( bricks_x * bricks_y ) ) * brick_size;
+  width = H3DMin( brick_size, w - x );
+  height = H3DMin( brick_size, h - y );
+  depth = H3DMin( brick_size, d - z );
+}
+
+void SparseImage::convertBricks( unsigned int begin,
+                                 unsigned int end,
+                                 void *data ) {
+  SparseImage *sparse = static_cast< SparseImage * >( data );
+  Image *image = sparse->source_image;
+  unsigned int bpp = sparse->bytes_per_pixel;
+  unsigned int bs = sparse->brick_size;
+  unsigned char *image_data = (unsigned char *) image->getImageData();
+  size_t row_stride = image->rowStride();
+  size_t slice_stride = image->sliceStride();
+  size_t brick_bytes = (size_t) bs * bs * bs * bpp;
+
+  for( unsigned int i = begin; i < end; ++i ) {
+    unsigned int x0, y0, z0, bw, bh, bd;
+    sparse->getBrickBox( i, x0, y0, z0, bw, bh, bd );
+    unsigned char *value = &sparse->uniform_values[ i * bpp ];
+
+    if( image_data ) {
+      // check the source data directly so that uniform bricks are never
+      // copied.
+      const unsigned char *src =
+        image_data + z0 * slice_stride + y0 * row_stride + (size_t) x0 * bpp;
+      memcpy( value, src, bpp );
+      if( isUniform( src, row_stride, slice_stride, bw, bh, bd,
+                     bpp, value ) ) {
+        continue;
+      }
+      unsigned char *brick = new unsigned char[ brick_bytes ];
+      memset( brick, 0, brick_bytes );
+      for( unsigned int z = 0; z < bd; ++z ) {
+        for( unsigned int y = 0; y < bh; ++y ) {
+          memcpy( brick + ( (size_t) z * bs + y ) * bs * bpp,
+                  src + z * slice_stride + y * row_stride,
+                  bw * bpp );
+        }
+      }
+      sparse->bricks[i] = brick;
+    } else {
+      unsigned char *brick = new unsigned char[ brick_bytes ];
+      memset( brick, 0, brick_bytes );
+      for( unsigned int z = 0; z < bd; ++z ) {
+        for( unsigned int y = 0; y < bh; ++y ) {
+          for( unsigned int x = 0; x < bw; ++x ) {
+            image->getElement( brick + ( ( (size_t) z * bs + y ) * bs + x ) * bpp,
+                               x0 + x, y0 + y, z0 + z );
+          }
+        }
+      }
+      sparse->bricks[i] = brick;
+      sparse->compactBrick( i );
+    }
+  }
+}
+
+void SparseImage::getElement( void *value, int x, int y, int z ) {
+  unsigned int index;
+  size_t offset = pixelOffset( x, y, z, index );
+  if( bricks[index] ) {
+    memcpy( value, bricks[index] + offset, bytes_per_pixel );
+  } else {
+    memcpy( value, &uniform_values[ index * bytes_per_pixel ],
+            bytes_per_pixel );
+  }
+}
+
+void SparseImage::setElement( void *value, int x, int y, int z ) {
+  unsigned int index;
+  size_t offset = pixelOffset( x, y, z, index );
+  if( !bricks[index] ) {
+    if( memcmp( value, &uniform_values[ index * bytes_per_pixel ],
+                bytes_per_pixel ) == 0 ) {
+      return;
+    }
+    allocateBrick( index );
+  }
+  memcpy( bricks[index] + offset, value, bytes_per_pixel );
+}
+
+void SparseImage::allocateBrick( unsigned int index ) {
+  size_t nr_pixels = (size_t) brick_size * brick_size * brick_size;
+  unsigned char *brick = new unsigned char[ nr_pixels * bytes_per_pixel ];
+  const unsigned char *value = &uniform_values[ index * bytes_per_pixel ];
+  for( size_t i = 0; i < nr_pixels; ++i ) {
+    memcpy( brick + i * bytes_per_pixel, value, bytes_per_pixel );
+  }
+  bricks[index] = brick;
+}
+
+bool SparseImage::getRegion( unsigned int x, unsigned int y, unsigned int z,
+                             unsigned int width,
+                             unsigned int height,
+                             unsigned int depth,
+                             void *data ) {
+  if( x + width > w || y + height > h || z + depth > d ) return false;
+  if( width == 0 || height == 0 || depth == 0 ) return true;
+
+  unsigned char *dst = (unsigned char *)data;
+  for( unsigned int bz = z / brick_size;
+       bz <= ( z + depth - 1 ) / brick_size; ++bz ) {
+    for( unsigned int by = y / brick_size;
+         by <= ( y + height - 1 ) / brick_size; ++by ) {
+      for( unsigned int bx = x / brick_size;
+           bx <= ( x + width - 1 ) / brick_size; ++bx ) {
+        unsigned int index = ( bz * bricks_y + by ) * bricks_x + bx;
+        unsigned int x0 = bx * brick_size;
+        unsigned int y0 = by * brick_size;
+        unsigned int z0 = bz * brick_size;
+        // the intersection of the brick and the region.
+        unsigned int sx = H3DMax( x0, x );
+        unsigned int ex = H3DMin( x0 + brick_size, x + width );
+        unsigned int sy = H3DMax( y0, y );
+        unsigned int ey = H3DMin( y0 + brick_size, y + height );
+        unsigned int sz = H3DMax( z0, z );
+        unsigned int ez = H3DMin( z0 + brick_size, z + depth );
+        for( unsigned int pz = sz; pz < ez; ++pz ) {
+          for( unsigned int py = sy; py < ey; ++py ) {
+            unsigned char *row = dst +
+              ( ( (size_t)( pz - z ) * height + ( py - y ) ) * width +
+                ( sx - x ) ) * bytes_per_pixel;
+            if( bricks[index] ) {
+              memcpy( row,
+                      bricks[index] +
+                      ( ( (size_t)( pz - z0 ) * brick_size + ( py - y0 ) ) *
+                        brick_size + ( sx - x0 ) ) * bytes_per_pixel,
+                      ( ex - sx ) * bytes_per_pixel );
+            } else {
+              const unsigned char *value =
+                &uniform_values[ index * bytes_per_pixel ];
+              for( unsigned int px = sx; px < ex; ++px ) {
+                memcpy( row + ( px - sx ) * bytes_per_pixel, value,
+                        bytes_per_pixel );
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+Image *SparseImage::createPixelImage() {
+  unsigned char *data =
+    new unsigned char[ (size_t) w * h * d * bytes_per_pixel ];
+  getRegion( 0, 0, 0, w, h, d, data );
+  return new PixelImage( w, h, d, bits_per_pixel,
+                         pixel_type, pixel_component_type,
+                         data, false, pixel_size );
+}
+
+void SparseImage::compactBrick( unsigned int index ) {
+  unsigned char *brick = bricks[index];
+  if( !brick ) return;
+  unsigned int x0, y0, z0, bw, bh, bd;
+  getBrickBox( index, x0, y0, z0, bw, bh, bd );
+  size_t row_stride = (size_t) brick_size * bytes_per_pixel;
+  if( isUniform( brick, row_stride, row_stride * brick_size,
+                 bw, bh, bd, bytes_per_pixel, brick ) ) {
+    memcpy( &uniform_values[ index * bytes_per_pixel ], brick,
+            bytes_per_pixel );
+    bricks[index] = NULL;
+    delete [] brick;
+  }
+}
+
+void SparseImage::compactBricks( unsigned int begin,
+                                 unsigned int end,
+                                 void *data ) {
+  SparseImage *sparse = static_cast< SparseImage * >( data );
+  for( unsigned int i = begin; i < end; ++i ) {
+    sparse->compactBrick( i );
+  }
+}
+
+void SparseImage::compact( unsigned int nr_threads ) {
+  parallelFor( 0, nrBricks(), compactBricks, this, 1, nr_threads );
+}
+
+bool SparseImage::isBrickEmpty( unsigned int index ) {
+  return !bricks[index] &&
+    isZero( &uniform_values[ index * bytes_per_pixel ], bytes_per_pixel );
+}
+
+std::vector< unsigned int > SparseImage::getOccupiedBricks() {
+  std::vector< unsigned int > occupied;
+  for( unsigned int i = 0; i < bricks.size(); ++i ) {
+    if( !isBrickEmpty( i ) ) occupied.push_back( i );
+  }
+  return occupied;
+}
+
+unsigned int SparseImage::nrAllocatedBricks() {
+  unsigned int n = 0;
+  for( unsigned int i = 0; i < bricks.size(); ++i ) {
+    if( bricks[i] ) ++n;
+  }
+  return n;
+}
+
+H3DInt64 SparseImage::memoryUsage() {
+  return (H3DInt64) nrAllocatedBricks() *
+    brick_size * brick_size * brick_size * bytes_per_pixel +
+    uniform_values.size();
+}
@@ -465,7 +465,8 @@ PeriodicThread::~PeriodicThread() {
 
 SimpleThread::SimpleThread( void *(func) (void *),
                             void *args,
-                            int thread_priority ) {
+                            int thread_priority ) :
+  joined( false ) {
   pthread_attr_t attr;
   sched_param p;
   p.sched_priority = thread_priority;
@@ -477,7 +478,8 @@ SimpleThread::SimpleThread( void *(func) (void *),
 
 SimpleThread::SimpleThread( void *(func) (void *),
                             void *args,
-                            Priority thread_priority ){
+                            Priority thread_priority ) :
+  joined( false ) {
   pthread_attr_t attr;
   sched_param p;
   
@@ -519,10 +521,14 @@ SimpleThread::SimpleThread( void *(func) (void *),
 }
 
 int SimpleThread::join() {
-  return pthread_join( thread_id, NULL );
+  int result = pthread_join( thread_id, NULL );
+  if( result == 0 ) joined = true;
+  return result;
 }
 
 SimpleThread::~SimpleThread() {
+  // a joined thread no longer exists and must not be cancelled.
+  if( joined ) return;
   ThreadId this_thread = getCurrentThreadId();
   if( !pthread_equal( this_thread, thread_id ) ) {
     pthread_cancel( thread_id );  
@@ -801,3 +807,97 @@ bool ThreadBase::inMainThread() {
 
 
 
+
+unsigned int H3DUtil::getNrHardwareThreads() {
+#ifdef WIN32
+  SYSTEM_INFO system_info;
+  GetSystemInfo( &system_info );
+  int nr_threads = (int)system_info.dwNumberOfProcessors;
+#else
+  int nr_threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+  return nr_threads > 0 ? (unsigned int)nr_threads : 1;
+}
+
+namespace ThreadsInternal {
+  // State shared between all threads working on one parallelFor call.
+  struct ParallelForData {
+    MutexLock lock;
+    unsigned int next;
+    unsigned int end;
+    unsigned int chunk_size;
+    ParallelForFunc func;
+    void *data;
+  };
+
+  // Thread function for parallelFor. Takes chunks from the shared range
+  // until there are none left.
+  void *parallelForWorker( void *_data ) {
+    ParallelForData *pf = static_cast< ParallelForData * >( _data );
+    while( true ) {
+      pf->lock.lock();
+      unsigned int chunk_begin = pf->next;
+      unsigned int chunk_end = chunk_begin;
+      if( chunk_begin < pf->end ) {
+        chunk_end = pf->end - chunk_begin > pf->chunk_size ?
+          chunk_begin + pf->chunk_size : pf->end;
+        pf->next = chunk_end;
+      }
+      pf->lock.unlock();
+      if( chunk_begin == chunk_end ) break;
+      pf->func( chunk_begin, chunk_end, pf->data );
+    }
+    return NULL;
+  }
+}
+
+void H3DUtil::parallelFor( unsigned int begin,
+                           unsigned int end,
+                           ParallelForFunc func,
+                           void *data,
+                           unsigned int chunk_size,
+                           unsigned int nr_threads ) {
+  if( end <= begin ) return;
+  if( chunk_size == 0 ) chunk_size = 1;
+  if( nr_threads == 0 ) nr_threads = getNrHardwareThreads();
+
+  unsigned int nr_chunks = ( end - begin + chunk_size - 1 ) / chunk_size;
+  if( nr_threads > nr_chunks ) nr_threads = nr_chunks;
+
+  if( nr_threads <= 1 ) {
+    // process the chunks in order in the calling thread so that func
+    // gets the same ranges as with several threads.
+    while( begin < end ) {
+      unsigned int chunk_end = end - begin > chunk_size ?
+        begin + chunk_size : end;
+      func( begin, chunk_end, data );
+      begin = chunk_end;
+    }
+    return;
+  }
+
+  ThreadsInternal::ParallelForData pf;
+  pf.next = begin;
+  pf.end = end;
+  pf.chunk_size = chunk_size;
+  pf.func = func;
+  pf.data = data;
+
+  // The calling thread is one of the workers so only nr_threads - 1 new
+  // threads are started.
+  vector< pthread_t > threads;
+  threads.reserve( nr_threads - 1 );
+  for( unsigned int i = 0; i < nr_threads - 1; ++i ) {
+    pthread_t thread;
+    if( pthread_create( &thread, NULL,
+                        ThreadsInternal::parallelForWorker, &pf ) == 0 ) {
+      threads.push_back( thread );
+    }
+  }
+
+  ThreadsInternal::parallelForWorker( &pf );
+
+  for( unsigned int i = 0; i < threads.size(); ++i ) {
+    pthread_join( threads[i], NULL );
+  }
+}
@@ -0,0 +1,468 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file TimeSeriesImage.cpp
+/// \brief CPP file for TimeSeriesImage.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/TimeSeriesImage.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/LoadImageFunctions.h>
+#include <H3DUtil/H3DMath.h>
+#include <H3DUtil/Console.h>
+
+#include <cmath>
+#include <sstream>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+using namespace H3DUtil;
+
+namespace TimeSeriesImageInternals {
+  // Sequentially consistent atomic operations on the members of the
+  // frames that are used without holding the lock.
+#ifdef _MSC_VER
+  inline long atomicAdd( volatile long *value, long delta ) {
+    return InterlockedExchangeAdd( value, delta ) + delta;
+  }
+
+  inline long atomicLoad( volatile long *value ) {
+    return InterlockedCompareExchange( value, 0, 0 );
+  }
+
+  inline long atomicExchange( volatile long *value, long new_value ) {
+    return InterlockedExchange( value, new_value );
+  }
+
+  inline Image *atomicLoad( Image *volatile *image ) {
+    return (Image *)InterlockedCompareExchangePointer(
+      (void *volatile *)image, NULL, NULL );
+  }
+
+  inline Image *atomicExchange( Image *volatile *image, Image *new_image ) {
+    return (Image *)InterlockedExchangePointer( (void *volatile *)image,
+                                                new_image );
+  }
+#else
+  inline long atomicAdd( volatile long *value, long delta ) {
+    return __atomic_add_fetch( value, delta, __ATOMIC_SEQ_CST );
+  }
+
+  inline long atomicLoad( volatile long *value ) {
+    return __atomic_load_n( value, __ATOMIC_SEQ_CST );
+  }
+
+  inline long atomicExchange( volatile long *value, long new_value ) {
+    return __atomic_exchange_n( value, new_value, __ATOMIC_SEQ_CST );
+  }
+
+  inline Image *atomicLoad( Image *volatile *image ) {
+    return __atomic_load_n( image, __ATOMIC_SEQ_CST );
+  }
+
+  inline Image *atomicExchange( Image *volatile *image, Image *new_image ) {
+    return __atomic_exchange_n( image, new_image, __ATOMIC_SEQ_CST );
+  }
+#endif
+
+  // The time in milliseconds the prefetch thread waits for a new playback
+  // position before looking again. setPlaybackPosition only signals the
+  // thread if it can do so without waiting for the lock, so a change can
+  // be missed for this long.
+  const unsigned int prefetch_poll_time = 10;
+
+  std::string frameName( unsigned int i ) {
+    std::stringstream s;
+    s << "frame " << i;
+    return s.str();
+  }
+}
+
+using namespace TimeSeriesImageInternals;
+
+TimeSeriesImage::TimeSeriesImage( Image *_volume,
+                                  unsigned int nr_frames,
+                                  H3DTime _frame_duration ) :
+  load_function( NULL ),
+  volume( _volume ),
+  frame_duration( _frame_duration ),
+  max_cached_frames( nr_frames ),
+  prefetch_frames( 0 ),
+  loaded_frames( 0 ),
+  playback_position( 0 ),
+  use_counter( 0 ),
+  stopped( true ),
+  thread( NULL ) {
+  unsigned char *data =
+    _volume ? (unsigned char *)_volume->getImageData() : NULL;
+  if( !data || nr_frames == 0 ||
+      _volume->compressionType() != Image::NO_COMPRESSION ||
+      _volume->depth() % nr_frames != 0 ) {
+    throw InvalidTimeSeries( "volume",
+                             "The volume cannot be divided into frames",
+                             H3D_FULL_LOCATION );
+  }
+
+  setProperties( _volume );
+  d = _volume->depth() / nr_frames;
+  size_t row_stride = _volume->rowStride();
+  size_t slice_stride = _volume->sliceStride();
+
+  frames.resize( nr_frames );
+  for( unsigned int i = 0; i < nr_frames; ++i ) {
+    PixelImage *frame =
+      new PixelImage( w, h, d, bits_per_pixel,
+                      pixel_type, pixel_component_type,
+                      data + (size_t)i * d * slice_stride,
+                      PixelImage::keepData, NULL, pixel_size );
+    frame->setStrides( row_stride, slice_stride );
+    frame->ref();
+    frames[i].image = frame;
+  }
+  loaded_frames = nr_frames;
+}
+
+TimeSeriesImage::TimeSeriesImage( const std::vector< Image * > &_frames,
+                                  H3DTime _frame_duration ) :
+  load_function( NULL ),
+  frame_duration( _frame_duration ),
+  max_cached_frames( (unsigned int) _frames.size() ),
+  prefetch_frames( 0 ),
+  loaded_frames( 0 ),
+  playback_position( 0 ),
+  use_counter( 0 ),
+  stopped( true ),
+  thread( NULL ) {
+  if( _frames.empty() || !_frames[0] ) {
+    throw InvalidTimeSeries( frameName( 0 ), "Missing frame",
+                             H3D_FULL_LOCATION );
+  }
+
+  setProperties( _frames[0] );
+  for( unsigned int i = 1; i < _frames.size(); ++i ) {
+    if( !_frames[i] || !hasProperties( _frames[i] ) ) {
+      throw InvalidTimeSeries( frameName( i ),
+                               "The frame is missing or does not have the "
+                               "size and pixel format of the first frame",
+                               H3D_FULL_LOCATION );
+    }
+  }
+
+  frames.resize( _frames.size() );
+  for( unsigned int i = 0; i < _frames.size(); ++i ) {
+    _frames[i]->ref();
+    frames[i].image = _frames[i];
+  }
+  loaded_frames = nrFrames();
+}
+
+TimeSeriesImage::TimeSeriesImage( const std::vector< std::string > &_urls,
+                                  unsigned int _max_cached_frames,
+                                  LoadFunction _load_function,
+                                  H3DTime _frame_duration ) :
+  urls( _urls ),
+  load_function( _load_function ),
+  frame_duration( _frame_duration ),
+  max_cached_frames( H3DMax( _max_cached_frames, 2u ) ),
+  prefetch_frames( max_cached_frames / 2 ),
+  loaded_frames( 0 ),
+  playback_position( 0 ),
+  use_counter( 0 ),
+  stopped( false ),
+  thread( NULL ) {
+  if( urls.empty() ) {
+    throw InvalidTimeSeries( frameName( 0 ), "Missing frame",
+                             H3D_FULL_LOCATION );
+  }
+  frames.resize( urls.size() );
+
+  ImageFileInfo info = probeImage( urls[0] );
+  if( info.format == ImageFileInfo::UNKNOWN_FORMAT ) {
+    // the properties are not known without loading the first frame.
+    Image *image = load_function ? load_function( urls[0] ) :
+                                   loadImage( urls[0] );
+    if( !image ) {
+      throw InvalidTimeSeries( urls[0],
+                               "Could not probe or load the first frame",
+                               H3D_FULL_LOCATION );
+    }
+    setProperties( image );
+    image->ref();
+    frames[0].image = image;
+    loaded_frames = 1;
+  } else {
+    w = info.width;
+    h = info.height;
+    d = info.depth;
+    bits_per_pixel = info.bits_per_pixel;
+    pixel_type = info.pixel_type;
+    pixel_component_type = info.pixel_component_type;
+    pixel_size = info.pixel_size;
+  }
+
+  thread = new SimpleThread( prefetchThread, this );
+}
+
+TimeSeriesImage::~TimeSeriesImage() {
+  if( thread ) {
+    lock.lock();
+    stopped = true;
+    lock.signal();
+    lock.unlock();
+    thread->join();
+    delete thread;
+    thread = NULL;
+  }
+
+  for( unsigned int i = 0; i < frames.size(); ++i ) {
+    if( frames[i].image ) {
+      frames[i].image->unref();
+      frames[i].image = NULL;
+    }
+  }
+}
+
+void TimeSeriesImage::setProperties( Image *image ) {
+  w = image->width();
+  h = image->height();
+  d = image->depth();
+  bits_per_pixel = image->bitsPerPixel();
+  pixel_type = image->pixelType();
+  pixel_component_type = image->pixelComponentType();
+  pixel_size = image->pixelSize();
+}
+
+bool TimeSeriesImage::hasProperties( Image *image ) {
+  return
+    image->width() == w &&
+    image->height() == h &&
+    image->depth() == d &&
+    image->bitsPerPixel() == bits_per_pixel &&
+    image->pixelType() == pixel_type &&
+    image->pixelComponentType() == pixel_component_type;
+}
+
+unsigned int TimeSeriesImage::frameAtTime( H3DTime time ) {
+  if( frame_duration <= 0 || frames.empty() ) return 0;
+  H3DTime frame = std::floor( time / frame_duration );
+  H3DTime n = (H3DTime) frames.size();
+  frame -= std::floor( frame / n ) * n;
+  return H3DMin( (unsigned int) frame, nrFrames() - 1 );
+}
+
+Image *TimeSeriesImage::tryAcquireFrame( unsigned int i ) {
+  if( i >= frames.size() ) return NULL;
+  Frame &frame = frames[i];
+  // pin the frame before looking at it. evictFrames removes the image
+  // before it looks at the pins, so either the frame is seen as removed
+  // here or the pin is seen there.
+  atomicAdd( &frame.pins, 1 );
+  Image *image = atomicLoad( &frame.image );
+  if( image ) {
+    atomicExchange( &frame.last_used, atomicAdd( &use_counter, 1 ) );
+  } else {
+    atomicAdd( &frame.pins, -1 );
+  }
+  return image;
+}
+
+Image *TimeSeriesImage::acquireFrame( unsigned int i ) {
+  Image *image = tryAcquireFrame( i );
+  if( image || i >= frames.size() || urls.empty() ) return image;
+
+  lock.lock();
+  while( true ) {
+    Frame &frame = frames[i];
+    if( frame.image ) {
+      // frames are only removed with lock held.
+      atomicAdd( &frame.pins, 1 );
+      atomicExchange( &frame.last_used, atomicAdd( &use_counter, 1 ) );
+      image = frame.image;
+      break;
+    } else if( frame.failed ) {
+      break;
+    } else if( frame.loading ) {
+      lock.wait();
+    } else {
+      frame.loading = true;
+      lock.unlock();
+      image = loadFrame( i, true );
+      lock.lock();
+      break;
+    }
+  }
+  lock.unlock();
+  return image;
+}
+
+void TimeSeriesImage::releaseFrame( unsigned int i ) {
+  if( i < frames.size() ) atomicAdd( &frames[i].pins, -1 );
+}
+
+void TimeSeriesImage::setPlaybackPosition( unsigned int i, int direction ) {
+  if( i >= frames.size() ) return;
+  long position = (long) i * 2 + ( direction < 0 ? 1 : 0 );
+  if( atomicExchange( &playback_position, position ) != position &&
+      thread ) {
+    // wake the prefetch thread if it is waiting. If the lock is taken the
+    // thread is busy and sees the new position within prefetch_poll_time.
+    if( lock.tryLock() ) {
+      lock.signal();
+      lock.unlock();
+    }
+  }
+}
+
+bool TimeSeriesImage::isFrameLoaded( unsigned int i ) {
+  return i < frames.size() && atomicLoad( &frames[i].image ) != NULL;
+}
+
+unsigned int TimeSeriesImage::nrLoadedFrames() {
+  lock.lock();
+  unsigned int n = loaded_frames;
+  lock.unlock();
+  return n;
+}
+
+void TimeSeriesImage::setNrPrefetchFrames( unsigned int nr_frames ) {
+  lock.lock();
+  prefetch_frames = H3DMin( nr_frames, max_cached_frames - 1 );
+  lock.signal();
+  lock.unlock();
+}
+
+Image *TimeSeriesImage::loadFrame( unsigned int i, bool pin ) {
+  Image *image = load_function ? load_function( urls[i] ) :
+                                 loadImage( urls[i] );
+  if( !image ) {
+    Console(LogLevel::Error) << "Error: Could not load frame " << i
+                             << " of time series, \"" << urls[i] << "\"."
+                             << std::endl;
+  } else if( !hasProperties( image ) ) {
+    Console(LogLevel::Error) << "Error: Frame " << i
+                             << " of time series, \"" << urls[i]
+                             << "\", does not have the size and pixel "
+                             << "format of the first frame." << std::endl;
+    delete image;
+    image = NULL;
+  }
+
+  lock.lock();
+  Frame &frame = frames[i];
+  frame.loading = false;
+  if( image ) {
+    image->ref();
+    if( pin ) atomicAdd( &frame.pins, 1 );
+    atomicExchange( &frame.last_used, atomicAdd( &use_counter, 1 ) );
+    atomicExchange( &frame.image, image );
+    ++loaded_frames;
+    evictFrames( i );
+  } else {
+    frame.failed = true;
+  }
+  lock.broadcast();
+  lock.unlock();
+  return image;
+}
+
+bool TimeSeriesImage::inPrefetchWindow( unsigned int i ) {
+  long position = atomicLoad( &playback_position );
+  unsigned int current = (unsigned int)( position / 2 );
+  unsigned int n = nrFrames();
+  unsigned int offset = ( position & 1 ) ?
+    ( current + n - i ) % n :
+    ( i + n - current ) % n;
+  return offset <= prefetch_frames;
+}
+
+unsigned int TimeSeriesImage::nextPrefetchFrame() {
+  long position = atomicLoad( &playback_position );
+  unsigned int current = (unsigned int)( position / 2 );
+  unsigned int n = nrFrames();
+  unsigned int window = H3DMin( prefetch_frames + 1, n );
+  for( unsigned int k = 0; k < window; ++k ) {
+    unsigned int i = ( position & 1 ) ?
+      ( current + n - k ) % n :
+      ( current + k ) % n;
+    const Frame &frame = frames[i];
+    if( !frame.image && !frame.loading && !frame.failed ) return i;
+  }
+  return n;
+}
+
+void TimeSeriesImage::evictFrames( unsigned int keep ) {
+  while( loaded_frames > max_cached_frames ) {
+    unsigned int n = nrFrames();
+    unsigned int best = n;
+    bool best_in_window = true;
+    long best_used = 0;
+    for( unsigned int i = 0; i < n; ++i ) {
+      Frame &frame = frames[i];
+      if( i == keep || !frame.image || atomicLoad( &frame.pins ) > 0 ) {
+        continue;
+      }
+      bool in_window = inPrefetchWindow( i );
+      long used = atomicLoad( &frame.last_used );
+      if( best == n || ( best_in_window && !in_window ) ||
+          ( in_window == best_in_window && used < best_used ) ) {
+        best = i;
+        best_in_window = in_window;
+        best_used = used;
+      }
+    }
+    // all other frames are acquired.
+    if( best == n ) break;
+
+    Frame &frame = frames[best];
+    Image *image = atomicExchange( &frame.image, (Image *)NULL );
+    if( atomicLoad( &frame.pins ) > 0 ) {
+      // acquired with tryAcquireFrame after it was chosen, keep it.
+      atomicExchange( &frame.image, image );
+      continue;
+    }
+    --loaded_frames;
+    image->unref();
+  }
+}
+
+void *TimeSeriesImage::prefetchThread( void *data ) {
+  TimeSeriesImage *series = static_cast< TimeSeriesImage * >( data );
+  series->lock.lock();
+  while( !series->stopped ) {
+    unsigned int i = series->nextPrefetchFrame();
+    if( i < series->nrFrames() ) {
+      series->frames[i].loading = true;
+      series->lock.unlock();
+      series->loadFrame( i, false );
+      series->lock.lock();
+    } else {
+      series->lock.timedWait( prefetch_poll_time );
+    }
+  }
+  series->lock.unlock();
+  return NULL;
+}
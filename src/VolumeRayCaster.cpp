@@ -0,0 +1,450 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file VolumeRayCaster.cpp
+/// \brief CPP file for VolumeRayCaster.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#include <H3DUtil/VolumeRayCaster.h>
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/Threads.h>
+
+#include <limits>
+
+using namespace H3DUtil;
+
+namespace VolumeRayCasterInternals {
+  // The size in pixels of the tiles that are rendered in parallel.
+  const unsigned int TILE_SIZE = 16;
+
+  // The state of a VolumeRayCaster::render call.
+  struct RayCast {
+    // Reads the values of the volume as the grid does.
+    const VoxelValueReader *reader;
+    MinMaxGrid *grid;
+
+    VolumeRayCaster::RenderMode mode;
+    H3DFloat iso_value;
+    H3DFloat step_size;
+    H3DFloat termination_opacity;
+    RGBA background;
+
+    // The transfer function, with the alpha of COMPOSITE corrected for the
+    // step size, and the range of values where it is not transparent.
+    std::vector< RGBA > lut;
+    H3DFloat lut_min, lut_scale;
+    H3DFloat visible_min, visible_max;
+
+    // The largest value of the volume.
+    H3DFloat max_value;
+
+    // The size of the volume and the pixel size used.
+    int size[3];
+    Vec3f voxel_size;
+
+    // The camera and the projection.
+    Matrix4f camera_transform;
+    bool orthographic;
+    H3DFloat pixel_scale;
+
+    unsigned int width, height, tiles_x, tiles_y;
+    unsigned char *data;
+
+    // The value of the transfer function.
+    inline RGBA transfer( H3DFloat v ) const {
+      H3DFloat f = ( v - lut_min ) * lut_scale;
+      if( !( f > 0 ) ) return lut.front();
+      if( f >= lut.size() - 1 ) return lut.back();
+      unsigned int i = (unsigned int) f;
+      f -= i;
+      return lut[i] * ( 1 - f ) + lut[ i + 1 ] * f;
+    }
+  };
+
+  // Reads the stored values of type T of a volume in memory.
+  template< class T >
+  struct StoredVoxels {
+    StoredVoxels( const VoxelValueReader &_reader ) : reader( _reader ) {}
+
+    inline H3DFloat operator()( int x, int y, int z ) const {
+      return (H3DFloat) reader.storedValue< T >( x, y, z );
+    }
+
+    const VoxelValueReader &reader;
+  };
+
+  // Reads the values of a volume through the function of the reader, used
+  // when the values are not stored values.
+  struct ReaderVoxels {
+    ReaderVoxels( const VoxelValueReader &_reader ) : reader( _reader ) {}
+
+    inline H3DFloat operator()( int x, int y, int z ) const {
+      return reader( x, y, z );
+    }
+
+    const VoxelValueReader &reader;
+  };
+
+  // The trilinearly interpolated value at a position in voxel
+  // coordinates, clamped to the volume.
+  template< class Voxels >
+  inline H3DFloat sample( const Voxels &voxels, const int *size,
+                          const Vec3f &p ) {
+    int v0[3], v1[3];
+    H3DFloat f[3];
+    for( unsigned int a = 0; a < 3; ++a ) {
+      H3DFloat fl = H3DFloor( p[a] );
+      int i = (int) fl;
+      f[a] = p[a] - fl;
+      v0[a] = i < 0 ? 0 : ( i < size[a] ? i : size[a] - 1 );
+      v1[a] = i + 1 < 0 ? 0 : ( i + 1 < size[a] ? i + 1 : size[a] - 1 );
+    }
+    H3DFloat c00 = voxels( v0[0], v0[1], v0[2] ) * ( 1 - f[0] ) +
+      voxels( v1[0], v0[1], v0[2] ) * f[0];
+    H3DFloat c10 = voxels( v0[0], v1[1], v0[2] ) * ( 1 - f[0] ) +
+      voxels( v1[0], v1[1], v0[2] ) * f[0];
+    H3DFloat c01 = voxels( v0[0], v0[1], v1[2] ) * ( 1 - f[0] ) +
+      voxels( v1[0], v0[1], v1[2] ) * f[0];
+    H3DFloat c11 = voxels( v0[0], v1[1], v1[2] ) * ( 1 - f[0] ) +
+      voxels( v1[0], v1[1], v1[2] ) * f[0];
+    H3DFloat c0 = c00 * ( 1 - f[1] ) + c10 * f[1];
+    H3DFloat c1 = c01 * ( 1 - f[1] ) + c11 * f[1];
+    return c0 * ( 1 - f[2] ) + c1 * f[2];
+  }
+
+  // Trace a ray in voxel coordinates with a direction of unit length and
+  // return the color, with the color components multiplied by alpha.
+  template< class Voxels >
+  RGBA traceRay( const RayCast &rc, const Voxels &voxels,
+                 const Vec3f &origin, const Vec3f &direction ) {
+    // clip the ray to the volume, between the centers of the outer voxels.
+    H3DFloat t_enter = 0;
+    H3DFloat t_exit = std::numeric_limits< H3DFloat >::max();
+    for( unsigned int a = 0; a < 3; ++a ) {
+      H3DFloat hi = (H3DFloat) rc.size[a] - 1;
+      if( direction[a] == 0 ) {
+        if( origin[a] < 0 || origin[a] > hi ) return RGBA( 0, 0, 0, 0 );
+      } else {
+        H3DFloat ta = -origin[a] / direction[a];
+        H3DFloat tb = ( hi - origin[a] ) / direction[a];
+        t_enter = H3DMax( t_enter, H3DMin( ta, tb ) );
+        t_exit = H3DMin( t_exit, H3DMax( ta, tb ) );
+      }
+    }
+    if( t_enter > t_exit ) return RGBA( 0, 0, 0, 0 );
+
+    const H3DFloat max_float = std::numeric_limits< H3DFloat >::max();
+    H3DFloat step = rc.step_size;
+    H3DFloat t = t_enter, t0, t1;
+
+    if( rc.mode == VolumeRayCaster::MAXIMUM_INTENSITY ) {
+      // only the blocks that may contain values above the current maximum
+      // are visited.
+      H3DFloat m = -max_float;
+      bool found = false;
+      while( rc.grid->nextInterval( origin, direction, t, t_exit,
+                                    m, max_float, t0, t1 ) ) {
+        H3DFloat ts = t_enter + H3DCeil( ( t0 - t_enter ) / step ) * step;
+        for( ; ts <= t1; ts += step ) {
+          H3DFloat v = sample( voxels, rc.size, origin + direction * ts );
+          if( v > m ) m = v;
+          found = true;
+        }
+        if( t1 >= t_exit || t1 <= t || m >= rc.max_value ) break;
+        t = t1;
+      }
+      if( !found ) return RGBA( 0, 0, 0, 0 );
+      RGBA c = rc.transfer( m );
+      return RGBA( c.r * c.a, c.g * c.a, c.b * c.a, c.a );
+    }
+
+    if( rc.mode == VolumeRayCaster::ISO_SURFACE ) {
+      H3DFloat iso = rc.iso_value;
+      while( rc.grid->nextInterval( origin, direction, t, t_exit,
+                                    iso, max_float, t0, t1 ) ) {
+        // the values before t0 are below the iso-value, so the surface is
+        // between t0 and the first sample reaching it.
+        H3DFloat t_prev = t0;
+        H3DFloat v_prev = sample( voxels, rc.size, origin + direction * t0 );
+        H3DFloat t_hit = -1;
+        if( v_prev >= iso ) {
+          t_hit = t0;
+        } else {
+          H3DFloat ts = t_enter +
+            ( H3DFloor( ( t0 - t_enter ) / step ) + 1 ) * step;
+          for( ; ts <= t1; ts += step ) {
+            H3DFloat v = sample( voxels, rc.size, origin + direction * ts );
+            if( v >= iso ) {
+              t_hit = t_prev + ( ts - t_prev ) * ( iso - v_prev ) /
+                ( v - v_prev );
+              break;
+            }
+            t_prev = ts;
+            v_prev = v;
+          }
+        }
+
+        if( t_hit >= 0 ) {
+          // shade with the gradient, with a light at the camera.
+          Vec3f p = origin + direction * t_hit;
+          Vec3f g;
+          for( unsigned int a = 0; a < 3; ++a ) {
+            Vec3f d;
+            d[a] = 1;
+            g[a] = ( sample( voxels, rc.size, p + d ) -
+                     sample( voxels, rc.size, p - d ) ) /
+              ( 2 * rc.voxel_size[a] );
+          }
+          Vec3f light( direction.x / rc.voxel_size.x,
+                       direction.y / rc.voxel_size.y,
+                       direction.z / rc.voxel_size.z );
+          g.normalizeSafe();
+          light.normalizeSafe();
+          H3DFloat diffuse = H3DAbs( g * light );
+          RGBA c = rc.transfer( iso );
+          H3DFloat shade = 0.2f + 0.8f * diffuse;
+          return RGBA( c.r * shade, c.g * shade, c.b * shade, 1 );
+        }
+        if( t1 >= t_exit || t1 <= t ) break;
+        t = t1;
+      }
+      return RGBA( 0, 0, 0, 0 );
+    }
+
+    // front to back compositing, skipping blocks where the transfer
+    // function is transparent.
+    RGBA result( 0, 0, 0, 0 );
+    if( rc.visible_min > rc.visible_max ) return result;
+    while( rc.grid->nextInterval( origin, direction, t, t_exit,
+                                  rc.visible_min, rc.visible_max,
+                                  t0, t1 ) ) {
+      H3DFloat ts = t_enter + H3DCeil( ( t0 - t_enter ) / step ) * step;
+      for( ; ts <= t1; ts += step ) {
+        RGBA c = rc.transfer( sample( voxels, rc.size,
+                                      origin + direction * ts ) );
+        H3DFloat w = ( 1 - result.a ) * c.a;
+        result.r += w * c.r;
+        result.g += w * c.g;
+        result.b += w * c.b;
+        result.a += w;
+        if( result.a >= rc.termination_opacity ) return result;
+      }
+      if( t1 >= t_exit || t1 <= t ) break;
+      t = t1;
+    }
+    return result;
+  }
+
+  inline unsigned char toByte( H3DFloat v ) {
+    if( !( v > 0 ) ) return 0;
+    if( v >= 1 ) return 255;
+    return (unsigned char)( v * 255 + 0.5f );
+  }
+
+  // Render a range of tiles.
+  template< class Voxels >
+  void renderTiles( unsigned int begin, unsigned int end, void *data ) {
+    RayCast &rc = *static_cast< RayCast * >( data );
+    Voxels voxels( *rc.reader );
+    Vec3f eye = rc.camera_transform * Vec3f( 0, 0, 0 );
+    for( unsigned int tile = begin; tile < end; ++tile ) {
+      unsigned int x0 = ( tile % rc.tiles_x ) * TILE_SIZE;
+      unsigned int y0 = ( tile / rc.tiles_x ) * TILE_SIZE;
+      unsigned int x1 = H3DMin( x0 + TILE_SIZE, rc.width );
+      unsigned int y1 = H3DMin( y0 + TILE_SIZE, rc.height );
+      for( unsigned int y = y0; y < y1; ++y ) {
+        unsigned char *out = rc.data + ( (size_t) y * rc.width + x0 ) * 4;
+        for( unsigned int x = x0; x < x1; ++x, out += 4 ) {
+          // the ray through the center of the pixel in physical
+          // coordinates.
+          Vec3f p( ( x + 0.5f - rc.width * 0.5f ) * rc.pixel_scale,
+                   ( y + 0.5f - rc.height * 0.5f ) * rc.pixel_scale, 0 );
+          Vec3f from, to;
+          if( rc.orthographic ) {
+            from = rc.camera_transform * p;
+            to = rc.camera_transform * ( p - Vec3f( 0, 0, 1 ) );
+          } else {
+            from = eye;
+            to = rc.camera_transform * ( p - Vec3f( 0, 0, 1 ) );
+          }
+          Vec3f origin( from.x / rc.voxel_size.x, from.y / rc.voxel_size.y,
+                        from.z / rc.voxel_size.z );
+          Vec3f direction( to.x / rc.voxel_size.x, to.y / rc.voxel_size.y,
+                           to.z / rc.voxel_size.z );
+          direction -= origin;
+          direction.normalizeSafe();
+
+          RGBA c = traceRay( rc, voxels, origin, direction );
+          H3DFloat w = ( 1 - c.a ) * rc.background.a;
+          c.r += w * rc.background.r;
+          c.g += w * rc.background.g;
+          c.b += w * rc.background.b;
+          c.a += w;
+          H3DFloat inv_a = c.a > 0 ? 1 / c.a : 0;
+          out[0] = toByte( c.r * inv_a );
+          out[1] = toByte( c.g * inv_a );
+          out[2] = toByte( c.b * inv_a );
+          out[3] = toByte( c.a );
+        }
+      }
+    }
+  }
+
+  // Returns the function rendering tiles with the values of reader.
+  ParallelForFunc renderTilesFunc( const VoxelValueReader &reader ) {
+    switch( reader.valueType() ) {
+    case VoxelValueReader::UNSIGNED_8:
+      return &renderTiles< StoredVoxels< unsigned char > >;
+    case VoxelValueReader::UNSIGNED_16:
+      return &renderTiles< StoredVoxels< unsigned short > >;
+    case VoxelValueReader::UNSIGNED_32:
+      return &renderTiles< StoredVoxels< unsigned int > >;
+    case VoxelValueReader::SIGNED_8:
+      return &renderTiles< StoredVoxels< signed char > >;
+    case VoxelValueReader::SIGNED_16:
+      return &renderTiles< StoredVoxels< short > >;
+    case VoxelValueReader::SIGNED_32:
+      return &renderTiles< StoredVoxels< int > >;
+    case VoxelValueReader::FLOAT_32:
+      return &renderTiles< StoredVoxels< float > >;
+    case VoxelValueReader::FLOAT_64:
+      return &renderTiles< StoredVoxels< double > >;
+    default:
+      return &renderTiles< ReaderVoxels >;
+    }
+  }
+}
+
+using namespace VolumeRayCasterInternals;
+
+VolumeRayCaster::VolumeRayCaster( Image *_image,
+                                  unsigned int _component,
+                                  unsigned int block_size,
+                                  unsigned int nr_threads ) :
+  image( _image ),
+  component( _component ),
+  grid( _image, block_size, _component, nr_threads ),
+  lut_min( 0 ),
+  lut_max( 1 ),
+  mode( COMPOSITE ),
+  iso_value( 0 ),
+  step_size( 0.5f ),
+  termination_opacity( 0.99f ),
+  background( 0, 0, 0, 0 ),
+  orthographic( false ),
+  field_of_view( (H3DFloat) Constants::pi / 4 ),
+  orthographic_size( 1 ) {
+}
+
+void VolumeRayCaster::setTransferFunction( const std::vector< RGBA > &_lut,
+                                           H3DFloat min_value,
+                                           H3DFloat max_value ) {
+  lut = _lut;
+  lut_min = min_value;
+  lut_max = max_value;
+}
+
+Image *VolumeRayCaster::render( const Matrix4f &camera_transform,
+                                unsigned int width,
+                                unsigned int height,
+                                unsigned int nr_threads ) {
+  VoxelValueReader reader( image, component );
+  RayCast rc;
+  rc.reader = &reader;
+  rc.grid = &grid;
+  rc.mode = mode;
+  rc.iso_value = iso_value;
+  rc.step_size = H3DMax( step_size, 1e-3f );
+  rc.termination_opacity = termination_opacity;
+  rc.background = background;
+  rc.size[0] = image->width();
+  rc.size[1] = image->height();
+  rc.size[2] = image->depth();
+  rc.voxel_size = image->pixelSize();
+  for( unsigned int a = 0; a < 3; ++a ) {
+    if( rc.voxel_size[a] <= 0 ) rc.voxel_size[a] = 1;
+  }
+
+  H3DFloat range_min, range_max;
+  grid.getBlockRange( grid.nrLevels() - 1, 0, 0, 0, range_min, range_max );
+  rc.max_value = range_max;
+
+  // the transfer function, by default a ramp over the range of the
+  // volume.
+  H3DFloat lut_low = lut_min, lut_high = lut_max;
+  if( lut.empty() ) {
+    lut_low = range_min;
+    lut_high = range_max;
+    rc.lut.resize( 256 );
+    for( unsigned int i = 0; i < 256; ++i ) {
+      H3DFloat v = i / 255.0f;
+      rc.lut[i] = RGBA( v, v, v, v );
+    }
+  } else {
+    rc.lut = lut;
+  }
+  rc.lut_min = lut_low;
+  rc.lut_scale = rc.lut.size() > 1 && lut_high > lut_low ?
+    ( rc.lut.size() - 1 ) / ( lut_high - lut_low ) : 0;
+
+  // the range of values where the transfer function is not transparent,
+  // with the alpha of each entry corrected for the step size.
+  const H3DFloat max_float = std::numeric_limits< H3DFloat >::max();
+  rc.visible_min = max_float;
+  rc.visible_max = -max_float;
+  unsigned int n = (unsigned int) rc.lut.size();
+  for( unsigned int i = 0; i < n; ++i ) {
+    if( mode == COMPOSITE ) {
+      rc.lut[i].a = 1 - H3DPow( 1 - H3DMin( H3DMax( rc.lut[i].a, 0.0f ),
+                                            1.0f ),
+                                rc.step_size );
+    }
+    if( rc.lut[i].a <= 0 ) continue;
+    H3DFloat low = i == 0 || rc.lut_scale == 0 ? -max_float :
+      rc.lut_min + ( i - 1 ) / rc.lut_scale;
+    H3DFloat high = i == n - 1 || rc.lut_scale == 0 ? max_float :
+      rc.lut_min + ( i + 1 ) / rc.lut_scale;
+    rc.visible_min = H3DMin( rc.visible_min, low );
+    rc.visible_max = H3DMax( rc.visible_max, high );
+  }
+
+  rc.camera_transform = camera_transform;
+  rc.orthographic = orthographic;
+  H3DFloat min_size = (H3DFloat) H3DMax( H3DMin( width, height ), 1u );
+  rc.pixel_scale = orthographic ? orthographic_size / min_size :
+    2 * H3DTan( field_of_view / 2 ) / min_size;
+
+  rc.width = width;
+  rc.height = height;
+  rc.tiles_x = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+  rc.tiles_y = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+  rc.data = new unsigned char[ (size_t) width * height * 4 ];
+
+  parallelFor( 0, rc.tiles_x * rc.tiles_y, renderTilesFunc( reader ), &rc,
+               1, nr_threads );
+
+  return new PixelImage( width, height, 1, 32, Image::RGBA, Image::UNSIGNED,
+                         rc.data, false,
+                         Vec3f( rc.pixel_scale, rc.pixel_scale, 0 ) );
+}
@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file BatchFileReaderBenchmark.cpp
+/// \brief Measures loading a series of slice files from a cold page cache,
+/// one file at a time compared to with BatchFileReader.
+///
+/// Usage: BatchFileReaderBenchmark [dir [nr_files [file_size_kb]]]
+///
+/// A local dataset of nr_files files is written to dir, which must be on
+/// a real disk for the numbers to mean anything. Before each run the
+/// files are evicted from the page cache. Each file is "decoded" by
+/// summing its bytes, so that the batched reads can overlap with it.
+/// The benchmark is not run by ctest.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <H3DUtil/BatchFileReader.h>
+#include <H3DUtil/TimeStamp.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace H3DUtil;
+using namespace std;
+
+namespace {
+  // Remove the files from the page cache so that the next read goes to
+  // the disk.
+  bool evictFiles( const vector< string > &urls ) {
+#if defined( __linux__ )
+    for( size_t i = 0; i < urls.size(); ++i ) {
+      int fd = open( urls[i].c_str(), O_RDONLY );
+      if( fd < 0 ) return false;
+      fdatasync( fd );
+      posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+      close( fd );
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  unsigned int decode( const unsigned char *data, size_t size ) {
+    unsigned int sum = 0;
+    for( size_t i = 0; i < size; ++i ) sum += data[i];
+    return sum;
+  }
+
+  // Read and decode the files one at a time, the way the loaders did.
+  unsigned int loadSequential( const vector< string > &urls ) {
+    unsigned int sum = 0;
+    vector< unsigned char > data;
+    for( size_t i = 0; i < urls.size(); ++i ) {
+      ifstream is( urls[i].c_str(), ios::binary );
+      is.seekg( 0, ios::end );
+      data.resize( (size_t) is.tellg() );
+      is.seekg( 0, ios::beg );
+      if( !data.empty() ) is.read( (char *) &data[0], data.size() );
+      sum += decode( data.empty() ? NULL : &data[0], (size_t) is.gcount() );
+    }
+    return sum;
+  }
+
+  unsigned int loadBatched( const vector< string > &urls, bool &io_uring ) {
+    unsigned int sum = 0;
+    BatchFileReader reader;
+    reader.start( urls );
+    io_uring = reader.usesIoUring();
+    for( unsigned int i = 0; i < urls.size(); ++i ) {
+      const unsigned char *data;
+      size_t size;
+      if( reader.waitForFile( i, data, size ) ) sum += decode( data, size );
+      reader.releaseFile( i );
+    }
+    return sum;
+  }
+}
+
+int main( int argc, char *argv[] ) {
+  string dir = argc > 1 ? argv[1] : ".";
+  unsigned int nr_files = argc > 2 ? atoi( argv[2] ) : 400;
+  size_t file_size = ( argc > 3 ? atoi( argv[3] ) : 512 ) * 1024;
+
+  vector< string > urls;
+  vector< unsigned char > content( file_size );
+  for( size_t i = 0; i < file_size; ++i ) content[i] = (unsigned char) i;
+  for( unsigned int i = 0; i < nr_files; ++i ) {
+    char name[32];
+    sprintf( name, "/slice%04u.raw", i );
+    urls.push_back( dir + name );
+    ofstream os( urls.back().c_str(), ios::binary );
+    os.write( (const char *) &content[0], content.size() );
+    if( !os ) {
+      cerr << "Could not write " << urls.back() << endl;
+      return 1;
+    }
+  }
+
+  if( !evictFiles( urls ) ) {
+    cerr << "Warning: the files could not be evicted from the page cache, "
+         << "the times are for a warm cache." << endl;
+  }
+
+  cout << nr_files << " files of " << file_size / 1024 << " kB" << endl;
+  int result = 0;
+  for( int run = 0; run < 3; ++run ) {
+    evictFiles( urls );
+    TimeStamp start;
+    unsigned int sequential_sum = loadSequential( urls );
+    double sequential_time = TimeStamp() - start;
+
+    evictFiles( urls );
+    bool io_uring = false;
+    start = TimeStamp();
+    unsigned int batched_sum = loadBatched( urls, io_uring );
+    double batched_time = TimeStamp() - start;
+
+    if( sequential_sum != batched_sum ) {
+      cerr << "The batched reads gave different data." << endl;
+      result = 1;
+    }
+    cout << "sequential: " << sequential_time << " s, batched ("
+         << ( io_uring ? "io_uring" : "threads" ) << "): "
+         << batched_time << " s" << endl;
+  }
+
+  for( size_t i = 0; i < urls.size(); ++i ) remove( urls[i].c_str() );
+  return result;
+}
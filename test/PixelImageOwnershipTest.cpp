@@ -0,0 +1,227 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file PixelImageOwnershipTest.cpp
+/// \brief Tests the ways a PixelImage can own its data: new[] data, data
+/// with a custom deleter, malloc'ed data, borrowed data, memory mapped
+/// files and data handed back with releaseImageData.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "TestCheck.h"
+
+#include <H3DUtil/PixelImage.h>
+#include <H3DUtil/LoadImageFunctions.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace H3DUtil;
+
+namespace {
+  const unsigned int width = 4, height = 3, depth = 2;
+  const unsigned int size = width * height * depth;
+
+  // Records the calls of countingDeleter.
+  struct DeleterCalls {
+    DeleterCalls() : nr_calls( 0 ), data( NULL ) {}
+    int nr_calls;
+    unsigned char *data;
+  };
+
+  void countingDeleter( unsigned char *data, void *deleter_data ) {
+    DeleterCalls *calls = static_cast< DeleterCalls * >( deleter_data );
+    ++calls->nr_calls;
+    calls->data = data;
+  }
+
+  PixelImage *createImage( unsigned char *data,
+                           PixelImage::DataDeleter deleter,
+                           void *deleter_data ) {
+    return new PixelImage( width, height, depth, 8,
+                           Image::LUMINANCE, Image::UNSIGNED,
+                           data, deleter, deleter_data );
+  }
+
+  void fill( unsigned char *data ) {
+    for( unsigned int i = 0; i < size; ++i ) data[i] = (unsigned char) i;
+  }
+
+  // new[] data given without a deleter is released with delete[].
+  void testArrayData() {
+    unsigned char *data = new unsigned char[ size ];
+    fill( data );
+    PixelImage *image = new PixelImage( width, height, depth, 8,
+                                        Image::LUMINANCE, Image::UNSIGNED,
+                                        data );
+    TEST_CHECK( image->getImageData() == data );
+    PixelImage::DataDeleter deleter = &PixelImage::keepData;
+    void *deleter_data = &deleter;
+    TEST_CHECK( image->releaseImageData( &deleter, &deleter_data ) == data );
+    TEST_CHECK( deleter == NULL );
+    TEST_CHECK( deleter_data == NULL );
+    delete image;
+    delete [] data;
+
+    // the destructor deletes the data, checked by memory tools.
+    image = new PixelImage( width, height, depth, 8,
+                            Image::LUMINANCE, Image::UNSIGNED,
+                            new unsigned char[ size ] );
+    delete image;
+    image = createImage( new unsigned char[ size ],
+                         &PixelImage::deleteArrayData, NULL );
+    delete image;
+  }
+
+  // A custom deleter is called once with the data and its deleter data,
+  // both when the image is deleted and when the data is replaced.
+  void testCustomDeleter() {
+    unsigned char data[ size ];
+    DeleterCalls calls;
+    PixelImage *image = createImage( data, &countingDeleter, &calls );
+    TEST_CHECK( calls.nr_calls == 0 );
+    delete image;
+    TEST_CHECK( calls.nr_calls == 1 );
+    TEST_CHECK( calls.data == data );
+
+    unsigned char other_data[ size ];
+    DeleterCalls other_calls;
+    calls = DeleterCalls();
+    image = createImage( data, &countingDeleter, &calls );
+    image->setImageData( other_data, &countingDeleter, &other_calls );
+    TEST_CHECK( calls.nr_calls == 1 );
+    TEST_CHECK( calls.data == data );
+    TEST_CHECK( other_calls.nr_calls == 0 );
+    TEST_CHECK( image->getImageData() == other_data );
+    delete image;
+    TEST_CHECK( calls.nr_calls == 1 );
+    TEST_CHECK( other_calls.nr_calls == 1 );
+    TEST_CHECK( other_calls.data == other_data );
+  }
+
+  // malloc'ed data is released with free.
+  void testMallocData() {
+    unsigned char *data = (unsigned char *) malloc( size );
+    fill( data );
+    PixelImage *image = createImage( data, &PixelImage::freeData, NULL );
+    TEST_CHECK( image->getImageData() == data );
+    TEST_CHECK( image->getPixel( 5, 1, 0 ).r == 9 / 255.0f );
+    delete image;
+  }
+
+  // Borrowed data is used in place and left alone.
+  void testKeptData() {
+    unsigned char data[ size ];
+    fill( data );
+    PixelImage *image = createImage( data, &PixelImage::keepData, NULL );
+    TEST_CHECK( image->getImageData() == data );
+    unsigned char value = 200;
+    image->setElement( &value, 1, 2, 1 );
+    TEST_CHECK( data[ ( 1 * height + 2 ) * width + 1 ] == 200 );
+    delete image;
+    TEST_CHECK( data[0] == 0 && data[ size - 1 ] == size - 1 );
+  }
+
+  // A mapped raw file is used without a copy and unmapped by its deleter.
+  // The mapping is copy on write so changes do not reach the file.
+  void testMappedData() {
+    const char *url = "PixelImageOwnershipTest.raw";
+    const unsigned int offset = 16;
+    unsigned char file_data[ offset + size ];
+    memset( file_data, 0xff, offset );
+    fill( file_data + offset );
+    {
+      std::ofstream os( url, std::ios::binary );
+      os.write( (const char *) file_data, sizeof( file_data ) );
+    }
+
+    RawImageInfo info( width, height, depth, "LUMINANCE", "UNSIGNED", 8,
+                       Vec3f( 1, 1, 1 ) );
+    PixelImage *image =
+      dynamic_cast< PixelImage * >( mapRawImage( url, info, offset ) );
+    TEST_CHECK( image != NULL );
+    if( image ) {
+      unsigned char *data = (unsigned char *) image->getImageData();
+      TEST_CHECK( memcmp( data, file_data + offset, size ) == 0 );
+      data[0] = 100;
+      delete image;
+    }
+
+    // the data is unmapped by the deleter returned by releaseImageData.
+    image = dynamic_cast< PixelImage * >( mapRawImage( url, info, offset ) );
+    TEST_CHECK( image != NULL );
+    if( image ) {
+      TEST_CHECK( ( (unsigned char *) image->getImageData() )[0] == 0 );
+      PixelImage::DataDeleter deleter = NULL;
+      void *deleter_data = NULL;
+      unsigned char *data = image->releaseImageData( &deleter, &deleter_data );
+      TEST_CHECK( image->getImageData() == NULL );
+      delete image;
+      TEST_CHECK( deleter != NULL );
+      TEST_CHECK( deleter_data != NULL );
+      TEST_CHECK( data && memcmp( data, file_data + offset, size ) == 0 );
+      if( deleter ) deleter( data, deleter_data );
+    }
+    remove( url );
+  }
+
+  // releaseImageData hands the data and its deleter to the caller, and the
+  // image no longer releases it.
+  void testReleaseImageData() {
+    unsigned char data[ size ];
+    DeleterCalls calls;
+    PixelImage *image = createImage( data, &countingDeleter, &calls );
+    PixelImage::DataDeleter deleter = NULL;
+    void *deleter_data = NULL;
+    TEST_CHECK( image->releaseImageData( &deleter, &deleter_data ) == data );
+    TEST_CHECK( deleter == &countingDeleter );
+    TEST_CHECK( deleter_data == &calls );
+    TEST_CHECK( image->getImageData() == NULL );
+    TEST_CHECK( image->releaseImageData() == NULL );
+    delete image;
+    TEST_CHECK( calls.nr_calls == 0 );
+    deleter( data, deleter_data );
+    TEST_CHECK( calls.nr_calls == 1 );
+
+    // data set after a release is owned by the image again.
+    calls = DeleterCalls();
+    image = createImage( data, &countingDeleter, &calls );
+    image->releaseImageData();
+    image->setImageData( data, &countingDeleter, &calls );
+    delete image;
+    TEST_CHECK( calls.nr_calls == 1 );
+  }
+}
+
+int main() {
+  testArrayData();
+  testCustomDeleter();
+  testMallocData();
+  testKeptData();
+  testMappedData();
+  testReleaseImageData();
+  return TestCheck::result();
+}
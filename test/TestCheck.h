@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file TestCheck.h
+/// \brief Checks used by the H3DUtil tests. A test is a program that
+/// returns TestCheck::result() from main, which is non-zero if any check
+/// failed.
+///
+//
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __TESTCHECK_H__
+#define __TESTCHECK_H__
+
+#include <iostream>
+
+namespace TestCheck {
+  /// Returns the number of failed checks.
+  inline int &nrFailed() {
+    static int nr_failed = 0;
+    return nr_failed;
+  }
+
+  /// Report a failed check.
+  inline void check( bool ok, const char *condition,
+                     const char *file, int line ) {
+    if( !ok ) {
+      std::cerr << file << ":" << line << ": check failed: "
+                << condition << std::endl;
+      ++nrFailed();
+    }
+  }
+
+  /// Returns the exit code of the test.
+  inline int result() {
+    if( nrFailed() == 0 ) return 0;
+    std::cerr << nrFailed() << " check(s) failed." << std::endl;
+    return 1;
+  }
+}
+
+/// Check that condition is true, the test fails otherwise.
+#define TEST_CHECK( condition ) \
+  TestCheck::check( ( condition ) ? true : false, #condition, \
+                    __FILE__, __LINE__ )
+
+#endif
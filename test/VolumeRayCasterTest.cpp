@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////////////
+//    Copyright 2004-2014, SenseGraphics AB
+//
+//    This file is part of H3DUtil.
+//
+//    H3DUtil is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    H3DUtil is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with H3DUtil; if not, write to the Free Software
+//    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+//    A commercial license is also available. Please contact us at
+//    www.sensegraphics.com for more information.
+//
+//
+/// \file VolumeRayCasterTest.cpp
+/// \brief Compares renderings of VolumeRayCaster with reference images
+/// computed directly from the volume.
+///
+/// The volumes have 16x16x16 voxels of size 1 and are rendered with an
+/// orthographic camera looking along -z, so that the ray of pixel (x, y)
+/// runs through the centers of the voxels (x, y, z).
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "TestCheck.h"
+
+#include <H3DUtil/VolumeRayCaster.h>
+#include <H3DUtil/PixelImage.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace H3DUtil;
+
+namespace {
+  const unsigned int size = 16;
+
+  // The camera looking at the volume along -z, with the pixel centers at
+  // the voxel centers.
+  Matrix4f camera() {
+    return Matrix4f( 1, 0, 0, ( size - 1 ) * 0.5f,
+                     0, 1, 0, ( size - 1 ) * 0.5f,
+                     0, 0, 1, 2.0f * size,
+                     0, 0, 0, 1 );
+  }
+
+  template< class T >
+  PixelImage *createVolume( const std::vector< T > &values,
+                            unsigned int bits_per_pixel,
+                            Image::PixelComponentType component_type ) {
+    T *data = new T[ values.size() ];
+    for( size_t i = 0; i < values.size(); ++i ) data[i] = values[i];
+    return new PixelImage( size, size, size, bits_per_pixel,
+                           Image::LUMINANCE, component_type,
+                           (unsigned char *) data, false,
+                           Vec3f( 1, 1, 1 ) );
+  }
+
+  // Render the volume with the given mode and transfer function.
+  Image *render( Image *volume, VolumeRayCaster::RenderMode mode,
+                 const std::vector< RGBA > &lut,
+                 H3DFloat lut_min, H3DFloat lut_max,
+                 H3DFloat iso_value = 0 ) {
+    VolumeRayCaster caster( volume, 0, 4, 2 );
+    caster.setRenderMode( mode );
+    caster.setTransferFunction( lut, lut_min, lut_max );
+    caster.setIsoValue( iso_value );
+    caster.setOrthographic( (H3DFloat) size );
+    return caster.render( camera(), size, size, 2 );
+  }
+
+  inline const unsigned char *pixel( Image *image,
+                                     unsigned int x, unsigned int y ) {
+    return (const unsigned char *) image->getImageData() +
+      ( y * image->width() + x ) * 4;
+  }
+
+  inline bool near( int a, int b ) {
+    return std::abs( a - b ) <= 1;
+  }
+
+  // The maximum intensity rendering is the transfer function of the
+  // largest voxel of each column, for stored and floating point values.
+  void testMaximumIntensity() {
+    std::vector< unsigned short > values( size * size * size );
+    srand( 1 );
+    for( size_t i = 0; i < values.size(); ++i ) {
+      // mostly low values so that most blocks can be skipped.
+      values[i] = (unsigned short)( rand() % 100 == 0 ?
+                                    rand() % 1000 : rand() % 50 );
+    }
+    std::vector< float > float_values( values.begin(), values.end() );
+
+    std::vector< RGBA > lut;
+    lut.push_back( RGBA( 0, 0, 0, 1 ) );
+    lut.push_back( RGBA( 1, 1, 1, 1 ) );
+
+    PixelImage *volume = createVolume( values, 16, Image::UNSIGNED );
+    PixelImage *float_volume =
+      createVolume( float_values, 32, Image::RATIONAL );
+    Image *result = render( volume, VolumeRayCaster::MAXIMUM_INTENSITY,
+                            lut, 0, 1000 );
+    Image *float_result = render( float_volume,
+                                  VolumeRayCaster::MAXIMUM_INTENSITY,
+                                  lut, 0, 1000 );
+
+    int nr_wrong = 0, nr_different = 0;
+    for( unsigned int y = 0; y < size; ++y ) {
+      for( unsigned int x = 0; x < size; ++x ) {
+        unsigned short m = 0;
+        for( unsigned int z = 0; z < size; ++z ) {
+          m = std::max( m, values[ ( z * size + y ) * size + x ] );
+        }
+        int expected = (int)( m / 1000.0f * 255 + 0.5f );
+        const unsigned char *p = pixel( result, x, y );
+        if( !near( p[0], expected ) || p[0] != p[1] || p[0] != p[2] ||
+            p[3] != 255 ) ++nr_wrong;
+        for( unsigned int c = 0; c < 4; ++c ) {
+          if( p[c] != pixel( float_result, x, y )[c] ) ++nr_different;
+        }
+      }
+    }
+    TEST_CHECK( nr_wrong == 0 );
+    TEST_CHECK( nr_different == 0 );
+
+    delete result;
+    delete float_result;
+    delete volume;
+    delete float_volume;
+  }
+
+  // Composite rendering of a homogeneous volume is the color of the
+  // transfer function with the opacity of the length of the ray.
+  void testComposite() {
+    std::vector< unsigned char > values( size * size * size, 100 );
+    std::vector< RGBA > lut( 2, RGBA( 1, 0.5f, 0.25f, 0.1f ) );
+    PixelImage *volume = createVolume( values, 8, Image::UNSIGNED );
+    Image *result = render( volume, VolumeRayCaster::COMPOSITE, lut, 0, 255 );
+
+    // each ray has 2 * ( size - 1 ) + 1 samples with the default step
+    // size of 0.5 voxels, each with the opacity of half a voxel.
+    double nr_samples = 2 * ( size - 1 ) + 1;
+    int alpha =
+      (int)( ( 1 - std::pow( 0.9, nr_samples * 0.5 ) ) * 255 + 0.5 );
+    int nr_wrong = 0;
+    for( unsigned int y = 0; y < size; ++y ) {
+      for( unsigned int x = 0; x < size; ++x ) {
+        const unsigned char *p = pixel( result, x, y );
+        if( p[0] != 255 || !near( p[1], 128 ) || !near( p[2], 64 ) ||
+            !near( p[3], alpha ) ) ++nr_wrong;
+      }
+    }
+    TEST_CHECK( nr_wrong == 0 );
+
+    delete result;
+    delete volume;
+  }
+
+  // The iso-surface of a distance field is a sphere, which covers the
+  // pixels inside its outline and faces the camera at its center.
+  void testIsoSurface() {
+    const H3DFloat cx = 7.3f, cy = 7.9f, cz = 8.2f, radius = 4;
+    std::vector< float > values( size * size * size );
+    for( unsigned int z = 0; z < size; ++z ) {
+      for( unsigned int y = 0; y < size; ++y ) {
+        for( unsigned int x = 0; x < size; ++x ) {
+          H3DFloat d = std::sqrt( ( x - cx ) * ( x - cx ) +
+                                  ( y - cy ) * ( y - cy ) +
+                                  ( z - cz ) * ( z - cz ) );
+          values[ ( z * size + y ) * size + x ] = 10 - d;
+        }
+      }
+    }
+    std::vector< RGBA > lut( 2, RGBA( 1, 1, 1, 1 ) );
+    PixelImage *volume = createVolume( values, 32, Image::RATIONAL );
+    Image *result = render( volume, VolumeRayCaster::ISO_SURFACE,
+                            lut, 0, 10, 10 - radius );
+
+    int nr_wrong = 0;
+    for( unsigned int y = 0; y < size; ++y ) {
+      for( unsigned int x = 0; x < size; ++x ) {
+        H3DFloat r = std::sqrt( ( x - cx ) * ( x - cx ) +
+                                ( y - cy ) * ( y - cy ) );
+        const unsigned char *p = pixel( result, x, y );
+        if( r < radius - 0.5f && p[3] != 255 ) ++nr_wrong;
+        if( r > radius + 0.5f && p[3] != 0 ) ++nr_wrong;
+      }
+    }
+    TEST_CHECK( nr_wrong == 0 );
+    // the center faces the light at the camera, the edge is darker.
+    TEST_CHECK( pixel( result, 7, 8 )[0] > 240 );
+    TEST_CHECK( pixel( result, 7, 11 )[0] < pixel( result, 7, 8 )[0] );
+
+    delete result;
+    delete volume;
+  }
+}
+
+int main() {
+  testMaximumIntensity();
+  testComposite();
+  testIsoSurface();
+  return TestCheck::result();
+}